@@ -0,0 +1,39 @@
+/*
+ * avr/eeprom.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  EEPROM variables live in RAM and start zeroed.  sim_eeprom_erase() blanks
+ *  one to 0xFF like a fresh part.
+ */
+
+#ifndef HOSTSIM_AVR_EEPROM_H_
+#define HOSTSIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *addr) { return *addr; }
+static inline void eeprom_update_byte(uint8_t *addr, uint8_t val) { *addr = val; }
+static inline void eeprom_write_byte(uint8_t *addr, uint8_t val) { *addr = val; }
+static inline void eeprom_read_block(void *dst, const void *src, size_t len) { memcpy(dst, src, len); }
+static inline void eeprom_update_block(const void *src, void *dst, size_t len) { memcpy(dst, src, len); }
+static inline void eeprom_write_block(const void *src, void *dst, size_t len) { memcpy(dst, src, len); }
+
+#define sim_eeprom_erase(var)   memset(&(var), 0xFF, sizeof(var))
+
+#endif /* HOSTSIM_AVR_EEPROM_H_ */
@@ -0,0 +1,35 @@
+/*
+ * avr/interrupt.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Interrupt vectors become plain functions the simulator calls when a source
+ *  is pending, enabled and the global flag is set.
+ */
+
+#ifndef HOSTSIM_AVR_INTERRUPT_H_
+#define HOSTSIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+void sim_sei(void);
+void sim_cli(void);
+
+#define sei()   sim_sei()
+#define cli()   sim_cli()
+
+#define ISR(vector, ...)    extern "C" void vector(void); extern "C" void vector(void)
+
+#endif /* HOSTSIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,553 @@
+/*
+ * avr/io.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Host stand-in for the XMEGA device header.  Only what the libraries and the
+ *  testbed touch is declared.  Registers are objects whose reads and writes go
+ *  through sim_read8()/sim_write8(), so the peripheral models in sim.cpp see
+ *  every access and virtual time advances with it.  Peripherals sit at their
+ *  real data space offsets inside sim_io, which is 4K aligned so address tests
+ *  like ((uintptr_t)usart & 0x10) still work.
+ */
+
+#ifndef HOSTSIM_AVR_IO_H_
+#define HOSTSIM_AVR_IO_H_
+
+#ifndef __cplusplus
+#   error "HostSim compiles the AVR sources as C++ so registers can be modelled"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if !defined(__AVR_ATxmega8E5__) && !defined(__AVR_ATxmega32E5__) && !defined(__AVR_ATxmega32A4U__)
+#   define __AVR_ATxmega8E5__
+#endif
+
+extern uint8_t sim_io[0x1000];
+
+uint8_t sim_read8(const uint8_t *reg);
+void sim_write8(uint8_t *reg, uint8_t val);
+uint16_t sim_read16(const uint8_t *reg);
+void sim_write16(uint8_t *reg, uint16_t val);
+uint16_t sim_dma_addr(const volatile void *ptr);
+
+/*! \brief 8-bit I/O register.  Every access is seen by the peripheral models */
+struct sim_reg8 {
+    uint8_t raw;
+    operator uint8_t() const { return sim_read8(&raw); }
+    sim_reg8 &operator=(uint8_t val) { sim_write8(&raw, val); return *this; }
+    sim_reg8 &operator=(const sim_reg8 &reg) { return *this = (uint8_t)reg; }
+    sim_reg8 &operator|=(uint8_t val) { return *this = (uint8_t)((uint8_t)*this | val); }
+    sim_reg8 &operator&=(uint8_t val) { return *this = (uint8_t)((uint8_t)*this & val); }
+    sim_reg8 &operator^=(uint8_t val) { return *this = (uint8_t)((uint8_t)*this ^ val); }
+};
+
+/*! \brief 16-bit I/O register, byte aligned like the real register pairs */
+struct sim_reg16 {
+    uint8_t raw[2];
+    operator uint16_t() const { return sim_read16(raw); }
+    sim_reg16 &operator=(uint16_t val) { sim_write16(raw, val); return *this; }
+    sim_reg16 &operator=(const sim_reg16 &reg) { return *this = (uint16_t)reg; }
+};
+
+typedef sim_reg8 register8_t;
+typedef sim_reg16 register16_t;
+
+#define SIM_IO(type, offset)    (*(type *)(sim_io + (offset)))
+
+#define PIN0_bm 0x01
+#define PIN1_bm 0x02
+#define PIN2_bm 0x04
+#define PIN3_bm 0x08
+#define PIN4_bm 0x10
+#define PIN5_bm 0x20
+#define PIN6_bm 0x40
+#define PIN7_bm 0x80
+
+/* I/O ports */
+typedef struct PORT_struct {
+    register8_t DIR;
+    register8_t DIRSET;
+    register8_t DIRCLR;
+    register8_t DIRTGL;
+    register8_t OUT;
+    register8_t OUTSET;
+    register8_t OUTCLR;
+    register8_t OUTTGL;
+    register8_t IN;
+    register8_t INTCTRL;
+#if defined(__AVR_ATxmega32A4U__)
+    register8_t INT0MASK;
+    register8_t INT1MASK;
+#else
+    register8_t INTMASK;
+    register8_t reserved_0x0B;
+#endif
+    register8_t INTFLAGS;
+    register8_t reserved_0x0D;
+    register8_t REMAP;
+    register8_t reserved_0x0F;
+    register8_t PIN0CTRL;
+    register8_t PIN1CTRL;
+    register8_t PIN2CTRL;
+    register8_t PIN3CTRL;
+    register8_t PIN4CTRL;
+    register8_t PIN5CTRL;
+    register8_t PIN6CTRL;
+    register8_t PIN7CTRL;
+    register8_t reserved_0x18[8];
+} PORT_t;
+
+#define PORT_INVEN_bm           0x40
+#define PORT_ISC_gm             0x07
+#define PORT_ISC_BOTHEDGES_gc   0x00
+#define PORT_ISC_RISING_gc      0x01
+#define PORT_ISC_FALLING_gc     0x02
+#define PORT_ISC_LEVEL_gc       0x03
+#define PORT_ISC_INPUT_DISABLE_gc 0x07
+#define PORT_INTLVL_gm          0x03
+#define PORT_INTLVL_OFF_gc      0x00
+#define PORT_INTLVL_LO_gc       0x01
+#define PORT_INTLVL_MED_gc      0x02
+#define PORT_INTLVL_HI_gc       0x03
+
+/* SPI */
+typedef struct SPI_struct {
+    register8_t CTRL;
+    register8_t INTCTRL;
+    register8_t STATUS;
+    register8_t DATA;
+    register8_t CTRLB;
+    register8_t reserved_0x05[3];
+} SPI_t;
+
+typedef enum SPI_MODE_enum {
+    SPI_MODE_0_gc = (0x00<<2),
+    SPI_MODE_1_gc = (0x01<<2),
+    SPI_MODE_2_gc = (0x02<<2),
+    SPI_MODE_3_gc = (0x03<<2),
+} SPI_MODE_t;
+
+typedef enum SPI_PRESCALER_enum {
+    SPI_PRESCALER_DIV4_gc = (0x00<<0),
+    SPI_PRESCALER_DIV16_gc = (0x01<<0),
+    SPI_PRESCALER_DIV64_gc = (0x02<<0),
+    SPI_PRESCALER_DIV128_gc = (0x03<<0),
+} SPI_PRESCALER_t;
+
+#define SPI_CLK2X_bm            0x80
+#define SPI_ENABLE_bm           0x40
+#define SPI_DORD_bm             0x20
+#define SPI_MASTER_bm           0x10
+#define SPI_MODE_gm             0x0C
+#define SPI_PRESCALER_gm        0x03
+#define SPI_IF_bm               0x80
+#define SPI_WRCOL_bm            0x40
+#define SPI_RXCIF_bm            0x80
+#define SPI_TXCIF_bm            0x40
+#define SPI_DREIF_bm            0x20
+#define SPI_SSIF_bm             0x10
+#define SPI_BUFOVF_bm           0x01
+#define SPI_BUFMODE_gm          0xC0
+#define SPI_BUFMODE_OFF_gc      0x00
+#define SPI_BUFMODE_BUFMODE1_gc 0x80
+#define SPI_BUFMODE_BUFMODE2_gc 0xC0
+#define SPI_SSD_bm              0x04
+
+/* USART */
+typedef struct USART_struct {
+    register8_t DATA;
+    register8_t STATUS;
+    register8_t reserved_0x02;
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t BAUDCTRLA;
+    register8_t BAUDCTRLB;
+    register8_t reserved_0x08[8];
+} USART_t;
+
+#define USART_RXCIF_bm          0x80
+#define USART_TXCIF_bm          0x40
+#define USART_DREIF_bm          0x20
+#define USART_FERR_bm           0x10
+#define USART_BUFOVF_bm         0x08
+#define USART_PERR_bm           0x04
+#define USART_RXEN_bm           0x10
+#define USART_TXEN_bm           0x08
+#define USART_CLK2X_bm          0x04
+#define USART_CHSIZE_gm         0x07
+#define USART_CHSIZE2_bm        0x04
+#define USART_CHSIZE1_bm        0x02
+#define USART_CHSIZE0_bm        0x01
+#define USART_SBMODE_bm         0x08
+#define USART_PMODE_gm          0x30
+#define USART_CMODE_gm          0xC0
+#define USART_RXCINTLVL_gm      0x30
+#define USART_TXCINTLVL_gm      0x0C
+#define USART_DREINTLVL_gm      0x03
+
+typedef enum USART_CMODE_enum {
+    USART_CMODE_ASYNCHRONOUS_gc = (0x00<<6),
+    USART_CMODE_SYNCHRONOUS_gc = (0x01<<6),
+    USART_CMODE_IRDA_gc = (0x02<<6),
+    USART_CMODE_MSPI_gc = (0x03<<6),
+} USART_CMODE_t;
+
+typedef enum USART_CHSIZE_enum {
+    USART_CHSIZE_5BIT_gc = 0x00,
+    USART_CHSIZE_6BIT_gc = 0x01,
+    USART_CHSIZE_7BIT_gc = 0x02,
+    USART_CHSIZE_8BIT_gc = 0x03,
+    USART_CHSIZE_9BIT_gc = 0x07,
+} USART_CHSIZE_t;
+
+typedef enum USART_PMODE_enum {
+    USART_PMODE_DISABLED_gc = (0x00<<4),
+    USART_PMODE_EVEN_gc = (0x02<<4),
+    USART_PMODE_ODD_gc = (0x03<<4),
+} USART_PMODE_t;
+
+typedef enum USART_RXCINTLVL_enum {
+    USART_RXCINTLVL_OFF_gc = (0x00<<4),
+    USART_RXCINTLVL_LO_gc = (0x01<<4),
+    USART_RXCINTLVL_MED_gc = (0x02<<4),
+    USART_RXCINTLVL_HI_gc = (0x03<<4),
+} USART_RXCINTLVL_t;
+
+typedef enum USART_TXCINTLVL_enum {
+    USART_TXCINTLVL_OFF_gc = (0x00<<2),
+    USART_TXCINTLVL_LO_gc = (0x01<<2),
+    USART_TXCINTLVL_MED_gc = (0x02<<2),
+    USART_TXCINTLVL_HI_gc = (0x03<<2),
+} USART_TXCINTLVL_t;
+
+typedef enum USART_DREINTLVL_enum {
+    USART_DREINTLVL_OFF_gc = (0x00<<0),
+    USART_DREINTLVL_LO_gc = (0x01<<0),
+    USART_DREINTLVL_MED_gc = (0x02<<0),
+    USART_DREINTLVL_HI_gc = (0x03<<0),
+} USART_DREINTLVL_t;
+
+/* Clocks */
+typedef struct OSC_struct {
+    register8_t CTRL;
+    register8_t STATUS;
+    register8_t reserved_0x02[14];
+} OSC_t;
+
+#define OSC_RC2MEN_bm           0x01
+#define OSC_RC32MEN_bm          0x02
+#define OSC_RC32KEN_bm          0x04
+#define OSC_RC2MRDY_bm          0x01
+#define OSC_RC32MRDY_bm         0x02
+#define OSC_RC32KRDY_bm         0x04
+
+typedef struct DFLL_struct {
+    register8_t CTRL;
+    register8_t reserved_0x01[7];
+} DFLL_t;
+
+#define DFLL_ENABLE_bm          0x01
+
+typedef struct CLK_struct {
+    register8_t CTRL;
+    register8_t PSCTRL;
+    register8_t LOCK;
+    register8_t RTCCTRL;
+    register8_t reserved_0x04[4];
+} CLK_t;
+
+#define CLK_SCLKSEL_RC2M_gc     0x00
+#define CLK_SCLKSEL_RC32M_gc    0x01
+#define CLK_RTCSRC_gm           0x0E
+#define CLK_RTCSRC_ULP_gc       0x00
+#define CLK_RTCSRC_RCOSC_gc     0x04
+#define CLK_RTCSRC_RCOSC32_gc   0x0C
+#define CLK_RTCEN_bm            0x01
+
+#define CCP_SPM_gc              0x9D
+#define CCP_IOREG_gc            0xD8
+
+typedef struct PMIC_struct {
+    register8_t STATUS;
+    register8_t INTPRI;
+    register8_t CTRL;
+    register8_t reserved_0x03[13];
+} PMIC_t;
+
+#define PMIC_LOLVLEN_bm         0x01
+#define PMIC_MEDLVLEN_bm        0x02
+#define PMIC_HILVLEN_bm         0x04
+
+typedef struct SLEEP_struct {
+    register8_t CTRL;
+    register8_t reserved_0x01[7];
+} SLEEP_t;
+
+/* Real time counter */
+typedef struct RTC_struct {
+    register8_t CTRL;
+    register8_t STATUS;
+    register8_t INTCTRL;
+    register8_t INTFLAGS;
+    register8_t TEMP;
+    register8_t reserved_0x05[3];
+    register16_t CNT;
+    register16_t PER;
+    register16_t COMP;
+    register8_t reserved_0x0E[2];
+} RTC_t;
+
+#define RTC_PRESCALER_gm        0x07
+#define RTC_PRESCALER_OFF_gc    0x00
+#define RTC_PRESCALER_DIV1_gc   0x01
+#define RTC_SYNCBUSY_bm         0x01
+#define RTC_OVFIF_bm            0x01
+#define RTC_COMPIF_bm           0x02
+#define RTC_OVFINTLVL_gm        0x03
+#define RTC_OVFINTLVL_LO_gc     0x01
+#define RTC_COMPINTLVL_gm       0x0C
+#define RTC_COMPINTLVL_LO_gc    0x04
+
+/* Timer/counters.  The E5 TC4/TC5 and the A4U TC0/TC1 share the layout the code uses */
+typedef struct TC_struct {
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t CTRLC;
+    register8_t CTRLD;
+    register8_t CTRLE;
+    register8_t CTRLF;
+    register8_t INTCTRLA;
+    register8_t INTCTRLB;
+    register8_t CTRLGCLR;
+    register8_t CTRLGSET;
+    register8_t CTRLHCLR;
+    register8_t CTRLHSET;
+    register8_t INTFLAGS;
+    register8_t reserved_0x0D[2];
+    register8_t TEMP;
+    register8_t reserved_0x10[16];
+    register16_t CNT;
+    register8_t reserved_0x22[4];
+    register16_t PER;
+    register8_t reserved_0x28[24];
+} TC_t;
+
+#define SIM_TC_CLKSEL_gm        0x0F
+
+/* Data space offsets, as in the device datasheets */
+#define SIM_CCP_OFFSET          0x0034
+#define SIM_CLK_OFFSET          0x0040
+#define SIM_SLEEP_OFFSET        0x0048
+#define SIM_OSC_OFFSET          0x0050
+#define SIM_DFLL_OFFSET         0x0060
+#define SIM_PMIC_OFFSET         0x00A0
+#define SIM_DMA_OFFSET          0x0100
+#define SIM_RTC_OFFSET          0x0400
+#define SIM_PORTA_OFFSET        0x0600
+#define SIM_PORTC_OFFSET        0x0640
+#define SIM_PORTD_OFFSET        0x0660
+#define SIM_PORTE_OFFSET        0x0680
+#define SIM_PORTR_OFFSET        0x07E0
+#define SIM_TCC0_OFFSET         0x0800
+#define SIM_TCC1_OFFSET         0x0840
+#define SIM_USARTC0_OFFSET      0x08A0
+#define SIM_USARTC1_OFFSET      0x08B0
+#define SIM_SPIC_OFFSET         0x08C0
+#define SIM_TCD0_OFFSET         0x0900
+#define SIM_TCD5_OFFSET         0x0940
+#define SIM_USARTD0_OFFSET      0x09A0
+#define SIM_USARTD1_OFFSET      0x09B0
+#define SIM_SPID_OFFSET         0x09C0
+
+#define CCP         SIM_IO(register8_t, SIM_CCP_OFFSET)
+#define CLK         SIM_IO(CLK_t, SIM_CLK_OFFSET)
+#define SLEEP       SIM_IO(SLEEP_t, SIM_SLEEP_OFFSET)
+#define OSC         SIM_IO(OSC_t, SIM_OSC_OFFSET)
+#define DFLLRC32M   SIM_IO(DFLL_t, SIM_DFLL_OFFSET)
+#define PMIC        SIM_IO(PMIC_t, SIM_PMIC_OFFSET)
+#define RTC         SIM_IO(RTC_t, SIM_RTC_OFFSET)
+#define PORTA       SIM_IO(PORT_t, SIM_PORTA_OFFSET)
+#define PORTC       SIM_IO(PORT_t, SIM_PORTC_OFFSET)
+#define PORTD       SIM_IO(PORT_t, SIM_PORTD_OFFSET)
+#define PORTR       SIM_IO(PORT_t, SIM_PORTR_OFFSET)
+#define USARTC0     SIM_IO(USART_t, SIM_USARTC0_OFFSET)
+#define USARTD0     SIM_IO(USART_t, SIM_USARTD0_OFFSET)
+#define SPIC        SIM_IO(SPI_t, SIM_SPIC_OFFSET)
+
+#define PORTA_PIN6CTRL  PORTA.PIN6CTRL
+#define PORTC_PIN3CTRL  PORTC.PIN3CTRL
+
+#if defined(__AVR_ATxmega32A4U__)
+
+typedef TC_t TC0_t;
+typedef TC_t TC1_t;
+
+#define TCC0        SIM_IO(TC0_t, SIM_TCC0_OFFSET)
+#define TCC1        SIM_IO(TC1_t, SIM_TCC1_OFFSET)
+#define TCD0        SIM_IO(TC0_t, SIM_TCD0_OFFSET)
+#define PORTE       SIM_IO(PORT_t, SIM_PORTE_OFFSET)
+#define USARTC1     SIM_IO(USART_t, SIM_USARTC1_OFFSET)
+#define USARTD1     SIM_IO(USART_t, SIM_USARTD1_OFFSET)
+#define SPID        SIM_IO(SPI_t, SIM_SPID_OFFSET)
+
+#define TC_CLKSEL_OFF_gc        0x00
+#define TC_CLKSEL_DIV1_gc       0x01
+#define TC_CLKSEL_DIV2_gc       0x02
+#define TC_CLKSEL_DIV4_gc       0x03
+#define TC_CLKSEL_DIV8_gc       0x04
+#define TC_CLKSEL_DIV64_gc      0x05
+#define TC_CLKSEL_DIV256_gc     0x06
+#define TC_CLKSEL_DIV1024_gc    0x07
+#define TC0_OVFIF_bm            0x01
+#define TC1_OVFIF_bm            0x01
+
+typedef struct DMA_CH_struct {
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t ADDRCTRL;
+    register8_t TRIGSRC;
+    register16_t TRFCNT;
+    register8_t REPCNT;
+    register8_t reserved_0x07;
+    register8_t SRCADDR0;
+    register8_t SRCADDR1;
+    register8_t SRCADDR2;
+    register8_t reserved_0x0B;
+    register8_t DESTADDR0;
+    register8_t DESTADDR1;
+    register8_t DESTADDR2;
+    register8_t reserved_0x0F;
+} DMA_CH_t;
+
+typedef struct DMA_struct {
+    register8_t CTRL;
+    register8_t reserved_0x01[2];
+    register8_t INTFLAGS;
+    register8_t STATUS;
+    register8_t reserved_0x05;
+    register16_t TEMP;
+    register8_t reserved_0x08[8];
+    DMA_CH_t CH0;
+    DMA_CH_t CH1;
+    DMA_CH_t CH2;
+    DMA_CH_t CH3;
+} DMA_t;
+
+#define DMA         SIM_IO(DMA_t, SIM_DMA_OFFSET)
+
+#define DMA_ENABLE_bm               0x80
+#define DMA_RESET_bm                0x40
+#define DMA_PRIMODE_CH0123_gc       0x03
+#define DMA_CH_ENABLE_bm            0x80
+#define DMA_CH_RESET_bm             0x40
+#define DMA_CH_REPEAT_bm            0x20
+#define DMA_CH_TRFREQ_bm            0x10
+#define DMA_CH_SINGLE_bm            0x04
+#define DMA_CH_BURSTLEN_1BYTE_gc    0x00
+#define DMA_CH_CHBUSY_bm            0x80
+#define DMA_CH_CHPEND_bm            0x40
+#define DMA_CH_ERRIF_bm             0x20
+#define DMA_CH_TRNIF_bm             0x10
+#define DMA_CH_TRNINTLVL_gm         0x03
+#define DMA_CH_TRNINTLVL_LO_gc      0x01
+#define DMA_CH_SRCRELOAD_NONE_gc    0x00
+#define DMA_CH_SRCDIR_gm            0x30
+#define DMA_CH_SRCDIR_FIXED_gc      0x00
+#define DMA_CH_SRCDIR_INC_gc        0x10
+#define DMA_CH_DESTRELOAD_NONE_gc   0x00
+#define DMA_CH_DESTDIR_gm           0x03
+#define DMA_CH_DESTDIR_FIXED_gc     0x00
+#define DMA_CH_DESTDIR_INC_gc       0x01
+#define DMA_CH_TRIGSRC_SPIC_gc      0x4A
+#define DMA_CH_TRIGSRC_SPID_gc      0x6A
+
+#else
+
+typedef TC_t TC4_t;
+typedef TC_t TC5_t;
+
+#define TCC4        SIM_IO(TC4_t, SIM_TCC0_OFFSET)
+#define TCC5        SIM_IO(TC5_t, SIM_TCC1_OFFSET)
+#define TCD5        SIM_IO(TC5_t, SIM_TCD5_OFFSET)
+
+#define TC45_CLKSEL_OFF_gc      0x00
+#define TC45_CLKSEL_DIV1_gc     0x01
+#define TC45_CLKSEL_DIV2_gc     0x02
+#define TC45_CLKSEL_DIV4_gc     0x03
+#define TC45_CLKSEL_DIV8_gc     0x04
+#define TC45_CLKSEL_DIV64_gc    0x05
+#define TC45_CLKSEL_DIV256_gc   0x06
+#define TC45_CLKSEL_DIV1024_gc  0x07
+#define TC4_OVFIF_bm            0x01
+#define TC5_OVFIF_bm            0x01
+
+typedef struct EDMA_CH_struct {
+    register8_t CTRLA;
+    register8_t CTRLB;
+    register8_t ADDRCTRL;
+    register8_t DESTADDRCTRL;
+    register8_t TRIGSRC;
+    register8_t reserved_0x05;
+    register16_t TRFCNT;
+    register16_t ADDR;
+    register8_t reserved_0x0A[2];
+    register16_t DESTADDR;
+    register8_t reserved_0x0E[2];
+} EDMA_CH_t;
+
+typedef struct EDMA_struct {
+    register8_t CTRL;
+    register8_t reserved_0x01[2];
+    register8_t INTFLAGS;
+    register8_t STATUS;
+    register8_t reserved_0x05;
+    register8_t TEMP;
+    register8_t reserved_0x07[9];
+    EDMA_CH_t CH0;
+    EDMA_CH_t CH1;
+    EDMA_CH_t CH2;
+    EDMA_CH_t CH3;
+} EDMA_t;
+
+#define EDMA        SIM_IO(EDMA_t, SIM_DMA_OFFSET)
+
+#define EDMA_ENABLE_bm              0x80
+#define EDMA_RESET_bm               0x40
+#define EDMA_CHMODE_PER0123_gc      0x00
+#define EDMA_CH_ENABLE_bm           0x80
+#define EDMA_CH_RESET_bm            0x40
+#define EDMA_CH_REPEAT_bm           0x20
+#define EDMA_CH_SINGLE_bm           0x04
+#define EDMA_CH_BURSTLEN_bm         0x01
+#define EDMA_CH_CHBUSY_bm           0x80
+#define EDMA_CH_CHPEND_bm           0x40
+#define EDMA_CH_ERRIF_bm            0x20
+#define EDMA_CH_TRNIF_bm            0x10
+#define EDMA_CH_TRNINTLVL_gm        0x03
+#define EDMA_CH_TRNINTLVL_LO_gc     0x01
+#define EDMA_CH_RELOAD_NONE_gc      0x00
+#define EDMA_CH_DIR_gm              0x07
+#define EDMA_CH_DIR_FIXED_gc        0x00
+#define EDMA_CH_DIR_INC_gc          0x01
+#define EDMA_CH_TRIGSRC_SPIC_RXC_gc 0x4A
+#define EDMA_CH_TRIGSRC_SPIC_DRE_gc 0x4B
+
+#endif
+
+#endif /* HOSTSIM_AVR_IO_H_ */
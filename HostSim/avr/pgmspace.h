@@ -0,0 +1,34 @@
+/*
+ * avr/pgmspace.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Flash and RAM are the same address space on the host.
+ */
+
+#ifndef HOSTSIM_AVR_PGMSPACE_H_
+#define HOSTSIM_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s)                 (s)
+#define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+#define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+#define memcpy_P(dst, src, len) memcpy((dst), (src), (len))
+#define strlen_P(str)           strlen(str)
+
+#endif /* HOSTSIM_AVR_PGMSPACE_H_ */
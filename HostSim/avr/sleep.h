@@ -0,0 +1,47 @@
+/*
+ * avr/sleep.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  sleep_cpu() lets virtual time run until an enabled interrupt is pending.
+ */
+
+#ifndef HOSTSIM_AVR_SLEEP_H_
+#define HOSTSIM_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+#define SLEEP_SMODE_IDLE_gc     (0x00<<1)
+#define SLEEP_SMODE_PDOWN_gc    (0x02<<1)
+#define SLEEP_SMODE_PSAVE_gc    (0x03<<1)
+#define SLEEP_SMODE_STDBY_gc    (0x06<<1)
+#define SLEEP_SMODE_ESTDBY_gc   (0x07<<1)
+#define SLEEP_SEN_bm            0x01
+
+#define SLEEP_MODE_IDLE         SLEEP_SMODE_IDLE_gc
+#define SLEEP_MODE_PWR_DOWN     SLEEP_SMODE_PDOWN_gc
+#define SLEEP_MODE_PWR_SAVE     SLEEP_SMODE_PSAVE_gc
+#define SLEEP_MODE_STANDBY      SLEEP_SMODE_STDBY_gc
+#define SLEEP_MODE_EXT_STANDBY  SLEEP_SMODE_ESTDBY_gc
+
+void sim_sleep(void);
+
+#define set_sleep_mode(mode)    (SLEEP.CTRL = (uint8_t)((SLEEP.CTRL & SLEEP_SEN_bm) | (mode)))
+#define sleep_enable()          (SLEEP.CTRL |= SLEEP_SEN_bm)
+#define sleep_disable()         (SLEEP.CTRL &= (uint8_t)~SLEEP_SEN_bm)
+#define sleep_cpu()             sim_sleep()
+#define sleep_mode()            do { sleep_enable(); sleep_cpu(); sleep_disable(); } while (0)
+
+#endif /* HOSTSIM_AVR_SLEEP_H_ */
@@ -0,0 +1,259 @@
+/*
+ * bench.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Benchmark scenarios.  Each one runs on a freshly reset machine and prints
+ *  bytes clocked, SPI bus idle time and modelled throughput, then the XSTATS
+ *  table for the calls it made.  Numbers are cycle approximate, see sim.h.
+ *  Built twice, as bench for the SPI interface and as bench_usart with
+ *  NRF_INTERFACE set to XNRF_IF_USART.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <util/delay.h>
+#include "XNRF24L01.h"
+#include "sim.h"
+#include "nrf_model.h"
+
+#define LINK_ADDR   0xE7E7E7E7E7ULL
+#define PACKETS     200
+
+#if NRF_INTERFACE == XNRF_IF_USART
+/* USARTC0 in master SPI mode takes PC1 - PC3 (XCK, MISO, MOSI), so CE and IRQ move to port A */
+#   define BENCH_BUS        USARTC0
+#   define BENCH_CE_PORT    PORTA
+#   define BENCH_CE_PIN     5
+#   define BENCH_IRQ_PORT   PORTA
+#   define BENCH_IRQ_PIN    6
+#   define BENCH_INTERFACE  "USART master SPI"
+#else
+#   define BENCH_BUS        SPIC
+#   define BENCH_CE_PORT    PORTC
+#   define BENCH_CE_PIN     2
+#   define BENCH_IRQ_PORT   PORTC
+#   define BENCH_IRQ_PIN    3
+#   define BENCH_INTERFACE  "SPI"
+#endif
+
+static const char *xstats_names[XSTATS_COUNT] = {
+    "xspi_send_packet", "xspi_get_packet", "xspi_usart_transfer_packet", "xnrf_read_register",
+    "xnrf_write_register", "xnrf_read_payload", "xnrf_write_payload", "xnrf_receive_all",
+    "xnrf_stream_tx", "xnrf_write_batch", "xnrf_configure", "xspi_transfer_byte", "xspi_usart_transfer_byte",
+    "xnrf_select", "xnrf_deselect",
+};
+
+static xnrf_config_t radio = {
+#if NRF_INTERFACE == XNRF_IF_USART
+    .spi = NULL,
+    .usart = &BENCH_BUS,
+#else
+    .spi = &BENCH_BUS,
+    .usart = NULL,
+#endif
+    .spi_port = &PORTC,
+    .ss_port = &PORTC,
+    .ss_pin = 4,
+    .ce_port = &BENCH_CE_PORT,
+    .ce_pin = BENCH_CE_PIN,
+    .addr_width = 5,
+    .payload_width = 32,
+    .confbits = (1 << EN_CRC) | (1 << CRCO),
+};
+
+static sim_nrf_t *peer;
+static uint32_t peer_left;
+
+static void bench_begin(void) {
+    sim_nrf_wiring_t wiring = { &BENCH_BUS, &PORTC, 4, &BENCH_CE_PORT, BENCH_CE_PIN, &BENCH_IRQ_PORT, BENCH_IRQ_PIN };
+
+    sim_reset(1);
+    sim_nrf_attach(&wiring);
+    xnrf_init(&radio);
+}
+
+static void bench_xstats(void) {
+    for (uint8_t i = 0; i < XSTATS_COUNT; i++) {
+        xstats_entry_t *entry = &xstats_table[i];
+        if (entry->calls)
+            printf("    %-28s %6u calls %7lu bytes %8lu cycles  %6.1f cycles/byte\n", xstats_names[i], entry->calls,
+                    (unsigned long)entry->bytes, (unsigned long)entry->cycles,
+                    entry->bytes ? (double)entry->cycles / entry->bytes : 0.0);
+    }
+}
+
+static bool irq_low(void) {
+    return !(BENCH_IRQ_PORT.IN & (1 << BENCH_IRQ_PIN));
+}
+
+/* Peer PTX keeping its TX FIFO topped up until PACKETS have gone out */
+static void peer_feed(sim_nrf_t *nrf, void *ctx) {
+    static bool busy;
+    uint8_t payload[32];
+
+    if (busy)
+        return;
+    busy = true;
+    if (sim_nrf_reg(nrf, NRF_STATUS) & ((1 << TX_DS) | (1 << MAX_RT)))
+        sim_nrf_clear_irq(nrf);
+    while (peer_left && sim_nrf_tx_count(nrf) < 3) {
+        memset(payload, peer_left, sizeof(payload));
+        sim_nrf_send(nrf, payload, sizeof(payload), false);
+        peer_left--;
+    }
+    busy = false;
+}
+
+/* Peer PRX emptying its RX FIFO as packets land */
+static void peer_drain(sim_nrf_t *nrf, void *ctx) {
+    uint8_t payload[32];
+
+    while (sim_nrf_recv(nrf, payload, NULL) >= 0);
+}
+
+static void scenario_configure(void) {
+    sim_mark_t mark;
+
+    bench_begin();
+    xstats_init();
+    sim_mark(&mark, &BENCH_BUS);
+    xnrf_configure(&radio);
+    sim_report("configure", &mark, &BENCH_BUS, 0);
+    bench_xstats();
+}
+
+/* A full profile, the xNRF_Testbed "bridge" one:  5 byte addresses, static 32 byte payloads */
+static void scenario_profile(void) {
+    static const xnrf_profile_t bridge = {
+        .name = "bridge", .crc = (1 << EN_CRC) | (1 << CRCO), .en_aa = 0, .en_rxaddr = (1 << ERX_P1) | (1 << ERX_P0),
+        .setup_retr = 0x03, .rf_ch = 100, .rf_setup = (1 << RF_DR_LOW) | (1 << RF_PWR_HIGH) | (1 << RF_PWR_LOW),
+        .feature = 0, .dynpd = 0, .addr_width = 5, .payload_width = 32,
+        .tx_addr = { 0xE1, 0xF0, 0xF0, 0xF0, 0xF0 }, .rx0_addr = { 0xE1, 0xF0, 0xF0, 0xF0, 0xF0 },
+        .rx1_addr = { 0xD2, 0xF0, 0xF0, 0xF0, 0xF0 }, .rx_lsb = { 0xC3, 0xC4, 0xC5, 0xC6 } };
+    sim_mark_t mark;
+
+    bench_begin();
+    xstats_init();
+    sim_mark(&mark, &BENCH_BUS);
+    xnrf_apply_profile(&radio, &bridge);
+    sim_report("profile", &mark, &BENCH_BUS, 0);
+    bench_xstats();
+}
+
+/* Payloads in and out of the FIFOs with nothing on air, so the interface is all there is to it */
+static void scenario_payloads(void) {
+    uint8_t payload[32];
+    sim_mark_t mark;
+
+    bench_begin();
+    xstats_init();
+    memset(payload, 0x5A, sizeof(payload));
+    sim_mark(&mark, &BENCH_BUS);
+    for (uint16_t i = 0; i < PACKETS; i++) {
+        xnrf_write_payload(&radio, payload, sizeof(payload));
+        xnrf_flush_tx(&radio);
+    }
+    sim_report("write 32B payload + flush", &mark, &BENCH_BUS, PACKETS * 32);
+    bench_xstats();
+
+    xstats_init();
+    sim_mark(&mark, &BENCH_BUS);
+    for (uint16_t i = 0; i < PACKETS; i++)
+        xnrf_read_payload(&radio, payload, sizeof(payload));
+    sim_report("read 32B payload", &mark, &BENCH_BUS, PACKETS * 32);
+    bench_xstats();
+}
+
+static void scenario_register_reads(void) {
+    sim_mark_t mark;
+
+    bench_begin();
+    xstats_init();
+    sim_mark(&mark, &BENCH_BUS);
+    for (uint16_t i = 0; i < PACKETS; i++)
+        xnrf_read_register(&radio, FIFO_STATUS);
+    sim_report("register reads", &mark, &BENCH_BUS, 0);
+    bench_xstats();
+}
+
+/* One payload per CE pulse, waiting out the ack each time */
+static void scenario_tx(const char *name, xnrf_datarate_t rate, uint16_t kbps) {
+    uint8_t payload[32];
+    sim_mark_t mark;
+
+    bench_begin();
+    peer = sim_nrf_peer();
+    sim_nrf_link(peer, 2, kbps, LINK_ADDR, 32, true, true);
+    sim_nrf_on_event(peer, peer_drain, NULL);
+    sim_nrf_ce(peer, true);
+    xnrf_set_datarate(&radio, rate);
+    xnrf_powerup_tx(&radio);
+    _delay_us(XNRF_TPD2STBY_US);
+    xstats_init();
+
+    sim_mark(&mark, &BENCH_BUS);
+    for (uint16_t i = 0; i < PACKETS; i++) {
+        memset(payload, i, sizeof(payload));
+        xnrf_write_payload(&radio, payload, sizeof(payload));
+        xnrf_enable(&radio);
+        _delay_us(10);
+        xnrf_disable(&radio);
+        while (!irq_low());
+        xnrf_write_register(&radio, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+    }
+    sim_report(name, &mark, &BENCH_BUS, PACKETS * 32);
+    bench_xstats();
+}
+
+/* Peer sending back to back, the MCU polling IRQ and draining the FIFO */
+static void scenario_rx(void) {
+    xnrf_packet_t batch[XNRF_RX_FIFO_DEPTH];
+    uint32_t received = 0;
+    sim_mark_t mark;
+
+    bench_begin();
+    peer = sim_nrf_peer();
+    peer_left = PACKETS;
+    sim_nrf_link(peer, 2, 2000, LINK_ADDR, 32, true, false);
+    sim_nrf_on_event(peer, peer_feed, NULL);
+    xnrf_powerup_rx(&radio);
+    _delay_us(XNRF_TPD2STBY_US);
+    xnrf_enable(&radio);
+    _delay_us(XNRF_TSTBY2A_US);
+    xstats_init();
+
+    sim_mark(&mark, &BENCH_BUS);
+    peer_feed(peer, NULL);
+    sim_nrf_ce(peer, true);
+    while (received < PACKETS) {
+        while (!irq_low());
+        received += xnrf_receive_all(&radio, batch, XNRF_RX_FIFO_DEPTH);
+    }
+    sim_report("rx 32B, receive_all", &mark, &BENCH_BUS, received * 32);
+    bench_xstats();
+}
+
+int main(void) {
+    printf("== %s interface\n", BENCH_INTERFACE);
+    scenario_configure();
+    scenario_profile();
+    scenario_register_reads();
+    scenario_payloads();
+    scenario_tx("tx 32B acked, 2Mbps", XNRF_2MBPS, 2000);
+    scenario_tx("tx 32B acked, 250kbps", XNRF_250KBPS, 250);
+    scenario_rx();
+    return sim_stats.errors ? 1 : 0;
+}
@@ -0,0 +1,821 @@
+/*
+ * nrf_model.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Timings and behaviour follow the nRF24L01+ product specification v1.0:
+ *  the state diagram (figure 4), Enhanced ShockBurst (section 7) and the
+ *  register map (section 9).
+ */
+
+#include <string.h>
+#include <vector>
+#include "nRF24L01.h"
+#include "nrf_model.h"
+
+#define CMD_W_TX_PAYLOAD_NOACK  0xB0
+
+enum nrf_state {
+    ST_PD,              /* power down */
+    ST_STARTUP,         /* crystal starting, Tpd2stby */
+    ST_STBY1,           /* standby-I */
+    ST_STBY2,           /* standby-II, PTX with CE high and nothing to send */
+    ST_RX_SETTLE,
+    ST_RX,
+    ST_TX_SETTLE,
+    ST_TX,              /* packet on air */
+    ST_ACK_WAIT,        /* PTX waiting for an ack or the retransmit delay */
+    ST_ACK_TX,          /* PRX turning around and sending an ack */
+};
+
+typedef struct {
+    uint8_t     len;
+    uint8_t     pipe;           /* RX: pipe it came in on.  TX: ack payload pipe, 0xFF for normal payloads */
+    bool        no_ack;
+    uint8_t     data[32];
+} nrf_payload_t;
+
+typedef struct {
+    sim_nrf     *from;
+    uint64_t    start;
+    uint64_t    end;
+    uint8_t     channel;
+    uint16_t    kbps;
+} air_burst_t;
+
+static std::vector<sim_nrf *> radios;
+static std::vector<air_burst_t> air;
+static uint16_t air_loss[SIM_NRF_CHANNELS];
+static uint16_t air_noise[SIM_NRF_CHANNELS];
+
+static const uint8_t reset_regs[0x20] = {
+    [CONFIG] = 0x08, [EN_AA] = 0x3F, [EN_RXADDR] = 0x03, [SETUP_AW] = 0x03, [SETUP_RETR] = 0x03,
+    [RF_CH] = 0x02, [RF_SETUP] = 0x0E, [NRF_STATUS] = 0x0E, [OBSERVE_TX] = 0, [RPD] = 0,
+    [RX_ADDR_P0] = 0, [RX_ADDR_P1] = 0, [RX_ADDR_P2] = 0xC3, [RX_ADDR_P3] = 0xC4, [RX_ADDR_P4] = 0xC5,
+    [RX_ADDR_P5] = 0xC6,
+};
+
+uint64_t sim_nrf_airtime(uint16_t kbps, uint8_t addr_width, uint8_t len, uint8_t crc_bytes) {
+    /* preamble, address, 9 bit packet control field, payload, CRC */
+    uint32_t bits = 8 * (1 + addr_width + len + crc_bytes) + 9;
+    return (uint64_t)bits * F_CPU / (kbps * 1000UL);
+}
+
+static bool air_collided(const air_burst_t *burst) {
+    for (size_t i = 0; i < air.size(); i++) {
+        const air_burst_t *other = &air[i];
+        if (other->from != burst->from && other->channel == burst->channel &&
+                other->start < burst->end && other->end > burst->start)
+            return true;
+    }
+    return false;
+}
+
+static void air_add(sim_nrf *from, uint64_t start, uint64_t end, uint8_t channel, uint16_t kbps) {
+    uint64_t now = sim_now();
+    for (size_t i = 0; i < air.size(); ) {
+        if (air[i].end + SIM_MS(10) < now) {
+            air[i] = air.back();
+            air.pop_back();
+        } else {
+            i++;
+        }
+    }
+    air.push_back(air_burst_t{ from, start, end, channel, kbps });
+}
+
+static bool air_carrier(uint8_t channel) {
+    uint64_t now = sim_now();
+    for (size_t i = 0; i < air.size(); i++)
+        if (air[i].channel == channel && air[i].start <= now && air[i].end + SIM_US(40) > now)
+            return true;
+    return false;
+}
+
+static uint32_t payload_hash(const uint8_t *data, uint8_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint8_t i = 0; i < len; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash ^ len;
+}
+
+struct sim_nrf : sim_device {
+    sim_nrf_wiring_t wiring;
+    bool            wired;
+    sim_spi_slave_t slave;
+    uint64_t        por_at;
+
+    uint8_t         reg[0x20];
+    uint8_t         addr_p0[5], addr_p1[5], tx_addr[5];
+    nrf_payload_t   txq[3], rxq[3];
+    uint8_t         txn, rxn;
+    bool            reuse;
+    uint8_t         plos, arc_cnt, pid;
+    uint8_t         last_pid[6];
+    uint32_t        last_hash[6];
+
+    bool            ce, selected, ignored, read_any;
+    uint8_t         cmd, idx, nbuf, buf[32];
+
+    nrf_state       state;
+    uint64_t        until, since, rx_since;
+
+    /* packet on air or waiting for its ack */
+    nrf_payload_t   cur;
+    uint8_t         cur_pid;
+    bool            ack_ok;
+    nrf_payload_t   ack_in;
+    bool            ack_pop;        /* PRX: ack payload goes out with the ack being sent */
+
+    sim_nrf_stats_t stats;
+    void            (*event_fn)(sim_nrf_t *nrf, void *ctx);
+    void            *event_ctx;
+
+    /* register helpers */
+    uint8_t aw(void) {
+        uint8_t setting = reg[SETUP_AW] & 0x03;
+        return setting ? setting + 2 : 3;
+    }
+    uint16_t kbps(void) {
+        if (reg[RF_SETUP] & (1 << RF_DR_LOW))
+            return 250;
+        return (reg[RF_SETUP] & (1 << RF_DR_HIGH)) ? 2000 : 1000;
+    }
+    uint8_t crc_bytes(void) {
+        if (!(reg[CONFIG] & (1 << EN_CRC)) && !reg[EN_AA])
+            return 0;
+        return (reg[CONFIG] & (1 << CRCO)) ? 2 : 1;
+    }
+    uint8_t channel(void) {
+        return reg[RF_CH] & 0x7F;
+    }
+    bool dpl(uint8_t pipe) {
+        return (reg[FEATURE] & (1 << EN_DPL)) && (reg[DYNPD] & (1 << pipe));
+    }
+    uint64_t ard(void) {
+        return SIM_US(250 * ((reg[SETUP_RETR] >> ARD) + 1));
+    }
+
+    uint8_t status(void) {
+        return (reg[NRF_STATUS] & 0x70) | ((rxn ? rxq[0].pipe : 7) << RX_P_NO) | (txn == 3 ? 1 : 0);
+    }
+    uint8_t fifo_status(void) {
+        return (reuse ? 1 << TX_REUSE : 0) | (txn == 3 ? 1 << FIFO_FULL : 0) | (!txn ? 1 << TX_EMPTY : 0) |
+                (rxn == 3 ? 1 << RX_FULL : 0) | (!rxn ? 1 << RX_EMPTY : 0);
+    }
+
+    void notify(void) {
+        if (wired && wiring.irq_port) {
+            uint8_t flags = reg[NRF_STATUS] & ~reg[CONFIG] & 0x70;
+            sim_port_drive(wiring.irq_port, wiring.irq_pin, !flags);
+        }
+        if (event_fn)
+            event_fn(this, event_ctx);
+    }
+
+    void power_on(void) {
+        memcpy(reg, reset_regs, sizeof(reg));
+        memset(addr_p0, 0xE7, 5);
+        memset(addr_p1, 0xC2, 5);
+        memset(tx_addr, 0xE7, 5);
+        txn = rxn = 0;
+        reuse = false;
+        plos = arc_cnt = pid = 0;
+        memset(last_pid, 0xFF, sizeof(last_pid));
+        memset(last_hash, 0, sizeof(last_hash));
+        account();
+        state = ST_PD;
+        until = SIM_NEVER;
+        rx_since = SIM_NEVER;
+        sim_schedule(this, SIM_NEVER);
+    }
+
+    /* time in each state, for modelled current */
+    void account(void) {
+        uint64_t now = sim_now(), spent = now - since;
+        since = now;
+        switch (state) {
+            case ST_PD: stats.pd_cycles += spent; break;
+            case ST_RX_SETTLE: case ST_RX: stats.rx_cycles += spent; break;
+            case ST_TX_SETTLE: case ST_TX: case ST_ACK_WAIT: case ST_ACK_TX: break;
+            default: stats.standby_cycles += spent; break;
+        }
+    }
+
+    void enter(nrf_state next, uint64_t when = SIM_NEVER) {
+        account();
+        state = next;
+        until = when;
+        if (next == ST_RX)
+            rx_since = sim_now();
+        else
+            rx_since = SIM_NEVER;
+        sim_schedule(this, when);
+    }
+
+    /* Works out where the state machine goes from here */
+    void update(void) {
+        uint64_t now = sim_now();
+        bool prx = reg[CONFIG] & (1 << PRIM_RX);
+
+        if (!(reg[CONFIG] & (1 << PWR_UP))) {
+            if (state != ST_PD)
+                enter(ST_PD);
+            return;
+        }
+        switch (state) {
+            case ST_PD:
+                enter(ST_STARTUP, now + SIM_US(SIM_NRF_TPD2STBY_US));
+                break;
+            case ST_STARTUP:
+                if (now >= until) {
+                    enter(ST_STBY1);
+                    update();
+                }
+                break;
+            case ST_STBY1:
+            case ST_STBY2:
+                if (!ce) {
+                    if (state != ST_STBY1)
+                        enter(ST_STBY1);
+                } else if (prx) {
+                    enter(ST_RX_SETTLE, now + SIM_US(SIM_NRF_TSTBY2A_US));
+                } else if (txn && !(reg[NRF_STATUS] & (1 << MAX_RT))) {
+                    enter(ST_TX_SETTLE, now + SIM_US(SIM_NRF_TSTBY2A_US));
+                } else if (state != ST_STBY2) {
+                    enter(ST_STBY2);
+                }
+                break;
+            case ST_RX_SETTLE:
+                if (!ce || !prx) {
+                    enter(ST_STBY1);
+                    update();
+                } else if (now >= until) {
+                    enter(ST_RX);
+                }
+                break;
+            case ST_RX:
+                if (!ce || !prx) {
+                    enter(ST_STBY1);
+                    update();
+                }
+                break;
+            case ST_TX_SETTLE:
+                /* once settling has started one packet goes out, even if CE was only pulsed */
+                if (now >= until)
+                    start_tx(false);
+                break;
+            case ST_TX:
+                if (now >= until)
+                    end_tx();
+                break;
+            case ST_ACK_WAIT:
+                if (now >= until)
+                    ack_result();
+                break;
+            case ST_ACK_TX:
+                if (now >= until) {
+                    if (ack_pop) {
+                        pop_tx();
+                        reg[NRF_STATUS] |= 1 << TX_DS;
+                        ack_pop = false;
+                    }
+                    enter(ST_RX);
+                    update();
+                }
+                break;
+        }
+    }
+
+    void fire(uint64_t) override {
+        update();
+        notify();
+    }
+
+    /************************************************************************/
+    /* Air                                                                  */
+    /************************************************************************/
+
+    void start_tx(bool retransmit) {
+        if (!txn) {
+            enter(ce ? ST_STBY2 : ST_STBY1);
+            return;
+        }
+        if (!retransmit) {
+            cur = txq[0];
+            cur_pid = pid;
+            arc_cnt = 0;            /* ARC_CNT holds the last packet's count until a new one starts */
+        }
+        uint64_t now = sim_now(), end = now + sim_nrf_airtime(kbps(), aw(), cur.len, crc_bytes());
+        stats.tx_packets++;
+        stats.air_cycles += end - now;
+        air_add(this, now, end, channel(), kbps());
+        enter(ST_TX, end);
+    }
+
+    void end_tx(void) {
+        uint64_t now = sim_now(), start = now - sim_nrf_airtime(kbps(), aw(), cur.len, crc_bytes());
+        air_burst_t burst = { this, start, now, channel(), kbps() };
+        bool want_ack = (reg[EN_AA] & (1 << ENAA_P0)) && !cur.no_ack;
+        sim_nrf *acker = NULL;
+        nrf_payload_t ack_payload;
+
+        ack_payload.len = 0;
+        for (size_t i = 0; i < radios.size(); i++) {
+            sim_nrf *r = radios[i];
+            if (r != this && r->receive(this, &burst, &ack_payload) && !acker)
+                acker = r;
+        }
+        if (!want_ack) {
+            tx_done();
+            return;
+        }
+
+        /* the ack comes back on pipe 0, so RX_ADDR_P0 has to match TX_ADDR */
+        bool listening = (reg[EN_RXADDR] & (1 << ERX_P0)) && !memcmp(addr_p0, tx_addr, aw());
+        if (acker && listening) {
+            uint64_t ack_end = now + SIM_US(SIM_NRF_TSTBY2A_US) +
+                    sim_nrf_airtime(kbps(), aw(), ack_payload.len, crc_bytes());
+            air_add(acker, now + SIM_US(SIM_NRF_TSTBY2A_US), ack_end, channel(), kbps());
+            ack_ok = !sim_chance(air_loss[channel()]);
+            ack_in = ack_payload;
+            if (ack_ok && ack_end <= now + ard()) {
+                enter(ST_ACK_WAIT, ack_end);
+                return;
+            }
+            ack_ok = false;
+        } else {
+            ack_ok = false;
+        }
+        enter(ST_ACK_WAIT, now + ard());
+    }
+
+    void ack_result(void) {
+        if (ack_ok) {
+            if (ack_in.len) {
+                if (rxn < 3) {
+                    ack_in.pipe = 0;
+                    rxq[rxn++] = ack_in;
+                    reg[NRF_STATUS] |= 1 << RX_DR;
+                    stats.rx_packets++;
+                } else {
+                    stats.rx_overflows++;
+                }
+            }
+            tx_done();
+        } else if (arc_cnt < (reg[SETUP_RETR] & 0x0F)) {
+            arc_cnt++;
+            start_tx(true);
+        } else {
+            reg[NRF_STATUS] |= 1 << MAX_RT;
+            stats.max_rt++;
+            if (plos < 15)
+                plos++;
+            enter(ce ? ST_STBY2 : ST_STBY1);
+        }
+    }
+
+    void tx_done(void) {
+        reg[NRF_STATUS] |= 1 << TX_DS;
+        stats.tx_ds++;
+        if (!reuse)
+            pop_tx();
+        pid = (pid + 1) & 0x03;
+        uint64_t now = sim_now();
+        if (ce && txn && !(reg[NRF_STATUS] & (1 << MAX_RT)) && !(reg[CONFIG] & (1 << PRIM_RX)))
+            enter(ST_TX_SETTLE, now + SIM_US(SIM_NRF_TSTBY2A_US));
+        else
+            enter(ce ? ST_STBY2 : ST_STBY1);
+        update();
+    }
+
+    int8_t match_pipe(const uint8_t *addr, uint8_t width) {
+        if (width != aw())
+            return -1;
+        for (uint8_t pipe = 0; pipe < 6; pipe++) {
+            if (!(reg[EN_RXADDR] & (1 << pipe)))
+                continue;
+            if (pipe == 0 && !memcmp(addr, addr_p0, width))
+                return 0;
+            if (pipe >= 1 && !memcmp(addr + 1, addr_p1 + 1, width - 1) &&
+                    addr[0] == (pipe == 1 ? addr_p1[0] : reg[RX_ADDR_P0 + pipe]))
+                return pipe;
+        }
+        return -1;
+    }
+
+    /* A packet from another radio just ended.  true if this radio acks it */
+    bool receive(sim_nrf *from, const air_burst_t *burst, nrf_payload_t *ack_payload) {
+        if (state != ST_RX || rx_since > burst->start || channel() != burst->channel || kbps() != burst->kbps)
+            return false;
+        int8_t pipe = match_pipe(from->tx_addr, from->aw());
+        if (pipe < 0)
+            return false;
+        if (air_collided(burst) || sim_chance(air_loss[burst->channel])) {
+            stats.rx_lost++;
+            return false;
+        }
+        const nrf_payload_t *p = &from->cur;
+        bool dynamic = dpl(pipe);
+        if (dynamic != from->dpl(0) || (!dynamic && reg[RX_PW_P0 + pipe] != p->len))
+            return false;           /* CRC or length mismatch, silently dropped */
+
+        bool ack = (reg[EN_AA] & (1 << pipe)) && !p->no_ack;
+        uint32_t hash = payload_hash(p->data, p->len);
+        if (ack && from->cur_pid == last_pid[pipe] && hash == last_hash[pipe]) {
+            stats.rx_duplicates++;
+        } else {
+            if (rxn == 3) {
+                stats.rx_overflows++;
+                return false;
+            }
+            rxq[rxn] = *p;
+            rxq[rxn++].pipe = pipe;
+            reg[NRF_STATUS] |= 1 << RX_DR;
+            stats.rx_packets++;
+            last_pid[pipe] = from->cur_pid;
+            last_hash[pipe] = hash;
+        }
+        if (!ack) {
+            notify();
+            return false;
+        }
+
+        ack_payload->len = 0;
+        for (uint8_t i = 0; i < txn; i++) {
+            if (txq[i].pipe == pipe) {
+                if (i) {
+                    nrf_payload_t first = txq[i];
+                    memmove(&txq[1], &txq[0], i * sizeof(txq[0]));
+                    txq[0] = first;
+                }
+                *ack_payload = txq[0];
+                ack_pop = true;
+                break;
+            }
+        }
+        enter(ST_ACK_TX, sim_now() + SIM_US(SIM_NRF_TSTBY2A_US) +
+                sim_nrf_airtime(kbps(), aw(), ack_payload->len, crc_bytes()));
+        notify();
+        return true;
+    }
+
+    /************************************************************************/
+    /* SPI                                                                  */
+    /************************************************************************/
+
+    void pop_tx(void) {
+        if (!txn)
+            return;
+        memmove(&txq[0], &txq[1], (txn - 1) * sizeof(txq[0]));
+        txn--;
+    }
+
+    void push_tx(uint8_t pipe, bool no_ack) {
+        if (!nbuf)
+            return;
+        if (txn == 3) {
+            stats.tx_dropped++;
+            return;
+        }
+        txq[txn].len = nbuf;
+        txq[txn].pipe = pipe;
+        txq[txn].no_ack = no_ack;
+        memcpy(txq[txn].data, buf, nbuf);
+        txn++;
+        reuse = false;
+    }
+
+    uint8_t read_reg(uint8_t r, uint8_t k) {
+        switch (r) {
+            case NRF_STATUS: return status();
+            case FIFO_STATUS: return fifo_status();
+            case OBSERVE_TX: return (plos << PLOS_CNT) | arc_cnt;
+            case RPD:
+                return (state == ST_RX && (air_carrier(channel()) || sim_chance(air_noise[channel()]))) ? 1 : 0;
+            case RX_ADDR_P0: return k < 5 ? addr_p0[k] : 0;
+            case RX_ADDR_P1: return k < 5 ? addr_p1[k] : 0;
+            case TX_ADDR: return k < 5 ? tx_addr[k] : 0;
+            default: return reg[r];
+        }
+    }
+
+    void write_reg(uint8_t r, const uint8_t *data, uint8_t len) {
+        switch (r) {
+            case NRF_STATUS:
+                reg[NRF_STATUS] &= ~(data[0] & 0x70);
+                break;
+            case RF_CH:
+                reg[RF_CH] = data[0] & 0x7F;
+                plos = 0;
+                break;
+            case SETUP_AW:
+                reg[SETUP_AW] = data[0] & 0x03;
+                break;
+            case OBSERVE_TX: case RPD: case FIFO_STATUS:
+                break;
+            case RX_ADDR_P0: memcpy(addr_p0, data, len < 5 ? len : 5); break;
+            case RX_ADDR_P1: memcpy(addr_p1, data, len < 5 ? len : 5); break;
+            case TX_ADDR: memcpy(tx_addr, data, len < 5 ? len : 5); break;
+            default:
+                if (r < 0x1E)
+                    reg[r] = data[0];
+                break;
+        }
+    }
+
+    void select(void) {
+        selected = true;
+        idx = nbuf = 0;
+        read_any = false;
+        ignored = sim_now() < por_at;
+        stats.transactions++;
+    }
+
+    uint8_t spi_byte(uint8_t mosi) {
+        stats.spi_bytes++;
+        if (ignored || sim_now() < por_at) {
+            ignored = true;
+            stats.early_bytes++;
+            return 0x00;
+        }
+        if (!idx++) {
+            cmd = mosi;
+            return status();
+        }
+        uint8_t k = idx - 2;
+        if (cmd < W_REGISTER)
+            return read_reg(cmd & REGISTER_MASK, k);
+        if (cmd < 0x40 || cmd == W_TX_PAYLOAD || cmd == CMD_W_TX_PAYLOAD_NOACK || (cmd & 0xF8) == W_ACK_PAYLOAD) {
+            if (nbuf < 32)
+                buf[nbuf++] = mosi;
+            return 0;
+        }
+        if (cmd == R_RX_PL_WID)
+            return rxn ? rxq[0].len : 0;
+        if (cmd == R_RX_PAYLOAD) {
+            read_any = true;
+            return (rxn && k < rxq[0].len && k < sizeof(rxq[0].data)) ? rxq[0].data[k] : 0;
+        }
+        return 0;
+    }
+
+    void deselect(void) {
+        selected = false;
+        if (ignored || !idx)
+            return;
+        if (cmd >= W_REGISTER && cmd < 0x40) {
+            if (nbuf)
+                write_reg(cmd & REGISTER_MASK, buf, nbuf);
+        } else if (cmd == W_TX_PAYLOAD) {
+            push_tx(0xFF, false);
+        } else if (cmd == CMD_W_TX_PAYLOAD_NOACK) {
+            if (reg[FEATURE] & (1 << EN_DYN_ACK))
+                push_tx(0xFF, true);
+        } else if ((cmd & 0xF8) == W_ACK_PAYLOAD && (cmd & 0x07) < 6) {
+            if (reg[FEATURE] & (1 << EN_ACK_PAY))
+                push_tx(cmd & 0x07, false);
+        } else if (cmd == R_RX_PAYLOAD) {
+            if (read_any && rxn) {
+                memmove(&rxq[0], &rxq[1], (rxn - 1) * sizeof(rxq[0]));
+                rxn--;
+            }
+        } else if (cmd == FLUSH_TX) {
+            txn = 0;
+            reuse = false;
+        } else if (cmd == FLUSH_RX) {
+            rxn = 0;
+        } else if (cmd == REUSE_TX_PL) {
+            reuse = true;
+        }
+        update();
+        notify();
+    }
+};
+
+/************************************************************************/
+/* Wiring                                                               */
+/************************************************************************/
+
+static uint8_t nrf_exchange(void *ctx, uint8_t mosi) {
+    return ((sim_nrf *)ctx)->spi_byte(mosi);
+}
+
+static void nrf_csn_edge(void *ctx, bool level) {
+    sim_nrf *nrf = (sim_nrf *)ctx;
+    if (!level) {
+        nrf->select();
+    } else if (nrf->selected) {
+        if (sim_spi_busy(nrf->wiring.bus))
+            sim_error("CSN raised with a byte still being clocked");
+        nrf->deselect();
+    }
+}
+
+static void nrf_ce_edge(void *ctx, bool level) {
+    sim_nrf *nrf = (sim_nrf *)ctx;
+    nrf->ce = level;
+    nrf->update();
+    nrf->notify();
+}
+
+static sim_nrf *nrf_new(void) {
+    sim_nrf *nrf = new sim_nrf();
+    nrf->next = SIM_NEVER;
+    nrf->since = sim_now();
+    nrf->state = ST_PD;
+    memset(&nrf->stats, 0, sizeof(nrf->stats));
+    nrf->power_on();
+    radios.push_back(nrf);
+    sim_device_add(nrf);
+    return nrf;
+}
+
+void sim_nrf_reset(void) {
+    for (size_t i = 0; i < radios.size(); i++)
+        delete radios[i];
+    radios.clear();
+    air.clear();
+    memset(air_loss, 0, sizeof(air_loss));
+    memset(air_noise, 0, sizeof(air_noise));
+}
+
+sim_nrf_t *sim_nrf_attach(const sim_nrf_wiring_t *wiring) {
+    sim_nrf *nrf = nrf_new();
+    nrf->wiring = *wiring;
+    nrf->wired = true;
+    nrf->por_at = sim_now() + SIM_US(SIM_NRF_TPOR_US);
+    nrf->slave.ss_port = wiring->ss_port;
+    nrf->slave.ss_pin = wiring->ss_pin;
+    nrf->slave.exchange = nrf_exchange;
+    nrf->slave.ctx = nrf;
+    sim_spi_attach(wiring->bus, &nrf->slave);
+    sim_port_watch(wiring->ss_port, wiring->ss_pin, nrf_csn_edge, nrf);
+    sim_port_watch(wiring->ce_port, wiring->ce_pin, nrf_ce_edge, nrf);
+    nrf->ce = sim_port_level(wiring->ce_port, wiring->ce_pin);
+    nrf->notify();
+    return nrf;
+}
+
+sim_nrf_t *sim_nrf_peer(void) {
+    sim_nrf *nrf = nrf_new();
+    nrf->wired = false;
+    nrf->por_at = 0;
+    return nrf;
+}
+
+void sim_air_loss(uint8_t channel, uint16_t permille) {
+    if (channel < SIM_NRF_CHANNELS)
+        air_loss[channel] = permille;
+}
+
+void sim_air_noise(uint8_t channel, uint16_t permille) {
+    if (channel < SIM_NRF_CHANNELS)
+        air_noise[channel] = permille;
+}
+
+/************************************************************************/
+/* Peer access                                                          */
+/************************************************************************/
+
+uint8_t sim_nrf_command(sim_nrf_t *nrf, uint8_t cmd, const uint8_t *in, uint8_t *out, uint8_t len) {
+    nrf->select();
+    uint8_t status = nrf->spi_byte(cmd);
+    for (uint8_t i = 0; i < len; i++) {
+        uint8_t val = nrf->spi_byte(in ? in[i] : NRF_NOP);
+        if (out)
+            out[i] = val;
+    }
+    nrf->deselect();
+    return status;
+}
+
+void sim_nrf_write(sim_nrf_t *nrf, uint8_t reg, uint8_t val) {
+    sim_nrf_command(nrf, W_REGISTER | reg, &val, NULL, 1);
+}
+
+void sim_nrf_write_addr(sim_nrf_t *nrf, uint8_t reg, uint64_t addr, uint8_t width) {
+    uint8_t bytes[5];
+    for (uint8_t i = 0; i < width && i < 5; i++)
+        bytes[i] = addr >> (8 * i);
+    sim_nrf_command(nrf, W_REGISTER | reg, bytes, NULL, width);
+}
+
+uint8_t sim_nrf_read(sim_nrf_t *nrf, uint8_t reg) {
+    uint8_t val;
+    sim_nrf_command(nrf, R_REGISTER | reg, NULL, &val, 1);
+    return val;
+}
+
+void sim_nrf_ce(sim_nrf_t *nrf, bool level) {
+    nrf->ce = level;
+    nrf->update();
+    nrf->notify();
+}
+
+bool sim_nrf_send(sim_nrf_t *nrf, const uint8_t *data, uint8_t len, bool no_ack) {
+    if (nrf->txn == 3)
+        return false;
+    sim_nrf_command(nrf, no_ack ? CMD_W_TX_PAYLOAD_NOACK : W_TX_PAYLOAD, data, NULL, len);
+    return true;
+}
+
+int sim_nrf_recv(sim_nrf_t *nrf, uint8_t *data, uint8_t *pipe) {
+    if (!nrf->rxn)
+        return -1;
+    uint8_t len = nrf->rxq[0].len;
+    if (pipe)
+        *pipe = nrf->rxq[0].pipe;
+    sim_nrf_command(nrf, R_RX_PAYLOAD, NULL, data, len);
+    return len;
+}
+
+bool sim_nrf_inject(sim_nrf_t *nrf, uint8_t pipe, const uint8_t *data, uint8_t len) {
+    if (nrf->rxn == 3)
+        return false;
+    nrf_payload_t *p = &nrf->rxq[nrf->rxn++];
+    p->len = len;
+    p->pipe = pipe;
+    p->no_ack = false;
+    memcpy(p->data, data, len < sizeof(p->data) ? len : sizeof(p->data));
+    nrf->reg[NRF_STATUS] |= 1 << RX_DR;
+    nrf->stats.rx_packets++;
+    nrf->notify();
+    return true;
+}
+
+void sim_nrf_clear_irq(sim_nrf_t *nrf) {
+    sim_nrf_write(nrf, NRF_STATUS, (1 << RX_DR) | (1 << TX_DS) | (1 << MAX_RT));
+}
+
+void sim_nrf_link(sim_nrf_t *nrf, uint8_t channel, uint16_t kbps, uint64_t addr, uint8_t width, bool auto_ack, bool prx) {
+    uint8_t rf_setup = (1 << RF_PWR_HIGH) | (1 << RF_PWR_LOW);
+    if (kbps == 250)
+        rf_setup |= 1 << RF_DR_LOW;
+    else if (kbps == 2000)
+        rf_setup |= 1 << RF_DR_HIGH;
+
+    sim_nrf_write(nrf, CONFIG, (1 << EN_CRC) | (1 << CRCO));
+    sim_nrf_write(nrf, EN_AA, auto_ack ? (1 << ENAA_P0) : 0);
+    sim_nrf_write(nrf, EN_RXADDR, 1 << ERX_P0);
+    sim_nrf_write(nrf, SETUP_AW, 3);
+    sim_nrf_write(nrf, SETUP_RETR, auto_ack ? 0x1F : 0);
+    sim_nrf_write(nrf, RF_CH, channel);
+    sim_nrf_write(nrf, RF_SETUP, rf_setup);
+    sim_nrf_write_addr(nrf, RX_ADDR_P0, addr, 5);
+    sim_nrf_write_addr(nrf, TX_ADDR, addr, 5);
+    sim_nrf_write(nrf, RX_PW_P0, width);
+    sim_nrf_write(nrf, FEATURE, width ? 0 : (1 << EN_DPL) | (1 << EN_ACK_PAY) | (1 << EN_DYN_ACK));
+    sim_nrf_write(nrf, DYNPD, width ? 0 : 1 << DPL_P0);
+    sim_nrf_command(nrf, FLUSH_TX, NULL, NULL, 0);
+    sim_nrf_command(nrf, FLUSH_RX, NULL, NULL, 0);
+    sim_nrf_clear_irq(nrf);
+    sim_nrf_write(nrf, CONFIG, (1 << EN_CRC) | (1 << CRCO) | (1 << PWR_UP) | (prx ? 1 << PRIM_RX : 0));
+}
+
+void sim_nrf_on_event(sim_nrf_t *nrf, void (*fn)(sim_nrf_t *nrf, void *ctx), void *ctx) {
+    nrf->event_fn = fn;
+    nrf->event_ctx = ctx;
+}
+
+uint8_t sim_nrf_reg(sim_nrf_t *nrf, uint8_t reg) {
+    return nrf->read_reg(reg, 0);
+}
+
+uint8_t sim_nrf_rx_count(sim_nrf_t *nrf) {
+    return nrf->rxn;
+}
+
+uint8_t sim_nrf_tx_count(sim_nrf_t *nrf) {
+    return nrf->txn;
+}
+
+bool sim_nrf_selected(sim_nrf_t *nrf) {
+    return nrf->selected;
+}
+
+bool sim_nrf_listening(sim_nrf_t *nrf) {
+    return nrf->state == ST_RX;
+}
+
+sim_nrf_stats_t *sim_nrf_stats(sim_nrf_t *nrf) {
+    nrf->account();
+    return &nrf->stats;
+}
+
+void sim_nrf_brownout(sim_nrf_t *nrf) {
+    nrf->power_on();
+    nrf->notify();
+}
@@ -0,0 +1,124 @@
+/*
+ * nrf_model.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  nRF24L01+ model and the air between radios.  Registers, the SPI command set,
+ *  3 deep FIFOs, the state machine timings (Tpor, Tpd2stby, Tstby2a), air time,
+ *  Enhanced ShockBurst auto-ack with retransmits and ack payloads, and a
+ *  per-channel loss rate.  Radios are either wired to the simulated MCU or
+ *  driven straight from a test as a peer.
+ */
+
+#ifndef HOSTSIM_NRF_MODEL_H_
+#define HOSTSIM_NRF_MODEL_H_
+
+#include "sim.h"
+
+#define SIM_NRF_TPOR_US         100000  /* power on reset, SPI ignored until then */
+#define SIM_NRF_TPD2STBY_US     1500    /* power down to standby, worst case crystal */
+#define SIM_NRF_TSTBY2A_US      130     /* standby to TX or RX settling */
+#define SIM_NRF_CHANNELS        126
+
+typedef struct sim_nrf sim_nrf_t;
+
+/*! \brief How a radio is wired to the MCU.  irq_port may be NULL if IRQ isn't connected */
+typedef struct {
+    const volatile void *bus;   /* SPI_t or USART_t in master SPI mode */
+    PORT_t      *ss_port;
+    uint8_t     ss_pin;
+    PORT_t      *ce_port;
+    uint8_t     ce_pin;
+    PORT_t      *irq_port;
+    uint8_t     irq_pin;
+} sim_nrf_wiring_t;
+
+typedef struct {
+    uint32_t    transactions;   /* CSN low periods */
+    uint32_t    spi_bytes;
+    uint32_t    early_bytes;    /* bytes clocked before Tpor was up, ignored by the chip */
+    uint32_t    tx_packets;     /* transmissions put on air, retransmits included */
+    uint32_t    tx_ds;          /* packets sent and acked or sent without ack */
+    uint32_t    max_rt;
+    uint32_t    rx_packets;     /* packets stored in the RX FIFO */
+    uint32_t    rx_duplicates;  /* acked again but not stored */
+    uint32_t    rx_overflows;   /* dropped because the RX FIFO was full */
+    uint32_t    rx_lost;        /* addressed to this radio but lost on air */
+    uint32_t    tx_dropped;     /* W_TX_PAYLOAD with the TX FIFO full */
+    uint64_t    air_cycles;     /* time spent transmitting */
+    uint64_t    rx_cycles;      /* time spent in RX mode, settling included */
+    uint64_t    standby_cycles;
+    uint64_t    pd_cycles;
+} sim_nrf_stats_t;
+
+/*! \brief Drops every radio and clears the air.  Called by sim_reset() */
+void sim_nrf_reset(void);
+
+/*! \brief Puts a radio on the simulated MCU's pins and bus */
+sim_nrf_t *sim_nrf_attach(const sim_nrf_wiring_t *wiring);
+
+/*! \brief A radio driven by the test itself, already past Tpor */
+sim_nrf_t *sim_nrf_peer(void);
+
+/*! \brief Per-channel loss rate in permille, for data packets and acks alike */
+void sim_air_loss(uint8_t channel, uint16_t permille);
+
+/*! \brief Chance of RPD reading set on a channel when nothing is transmitting on it */
+void sim_air_noise(uint8_t channel, uint16_t permille);
+
+/* Peer access, the same command set an MCU sees over SPI */
+uint8_t sim_nrf_command(sim_nrf_t *nrf, uint8_t cmd, const uint8_t *in, uint8_t *out, uint8_t len);
+void sim_nrf_write(sim_nrf_t *nrf, uint8_t reg, uint8_t val);
+void sim_nrf_write_addr(sim_nrf_t *nrf, uint8_t reg, uint64_t addr, uint8_t width);
+uint8_t sim_nrf_read(sim_nrf_t *nrf, uint8_t reg);
+void sim_nrf_ce(sim_nrf_t *nrf, bool level);
+
+/*! \brief Queues a payload, W_TX_PAYLOAD or W_TX_PAYLOAD_NO_ACK.  false if the TX FIFO is full */
+bool sim_nrf_send(sim_nrf_t *nrf, const uint8_t *data, uint8_t len, bool no_ack);
+
+/*! \brief Pops a received payload.  \return its length, -1 if the RX FIFO is empty */
+int sim_nrf_recv(sim_nrf_t *nrf, uint8_t *data, uint8_t *pipe);
+
+/*! \brief Puts a payload straight into the RX FIFO as if it came in on pipe, for what the air can't produce.  A len
+ *  over 32 reads back from R_RX_PL_WID as a corrupt width, pipe 6 is the "not used" RX_P_NO.  false if the FIFO is full
+ */
+bool sim_nrf_inject(sim_nrf_t *nrf, uint8_t pipe, const uint8_t *data, uint8_t len);
+
+/*! \brief Clears RX_DR, TX_DS and MAX_RT */
+void sim_nrf_clear_irq(sim_nrf_t *nrf);
+
+/*! \brief Sets a peer up for a link on pipe 0 and powers it up, CE low.
+ *  kbps is 250, 1000 or 2000.  width 0 turns on dynamic payloads.
+ */
+void sim_nrf_link(sim_nrf_t *nrf, uint8_t channel, uint16_t kbps, uint64_t addr, uint8_t width, bool auto_ack, bool prx);
+
+/*! \brief Called from the event loop after anything on the radio changed */
+void sim_nrf_on_event(sim_nrf_t *nrf, void (*fn)(sim_nrf_t *nrf, void *ctx), void *ctx);
+
+/* State for checks */
+uint8_t sim_nrf_reg(sim_nrf_t *nrf, uint8_t reg);       /* register value without touching SPI */
+uint8_t sim_nrf_rx_count(sim_nrf_t *nrf);
+uint8_t sim_nrf_tx_count(sim_nrf_t *nrf);
+bool sim_nrf_selected(sim_nrf_t *nrf);
+bool sim_nrf_listening(sim_nrf_t *nrf);
+sim_nrf_stats_t *sim_nrf_stats(sim_nrf_t *nrf);
+
+/*! \brief Air time of one packet in CPU cycles */
+uint64_t sim_nrf_airtime(uint16_t kbps, uint8_t addr_width, uint8_t len, uint8_t crc_bytes);
+
+/*! \brief Puts all registers back to reset values, as a brown-out would */
+void sim_nrf_brownout(sim_nrf_t *nrf);
+
+#endif /* HOSTSIM_NRF_MODEL_H_ */
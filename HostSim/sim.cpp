@@ -0,0 +1,1736 @@
+/*
+ * sim.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Peripheral models: ports, SPI, USART (asynchronous and master SPI), DMA or
+ *  EDMA, TC, RTC and the interrupt controller.  Only the behaviour the
+ *  libraries lean on is modelled, and it is modelled per the datasheets.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
+#include "sim.h"
+
+#define SIM_SPIN_MAX        SIM_MS(1)   /* longest jump over a polling loop */
+
+alignas(4096) uint8_t sim_io[0x1000];
+sim_stats_t sim_stats;
+
+static uint64_t sim_time;
+static uint64_t sim_deadline = SIM_NEVER;
+static jmp_buf sim_run_exit;
+static bool sim_sreg_i;
+static bool sim_in_isr;
+static uint32_t sim_rng = 1;
+static bool sim_ready;
+
+static sim_device *sim_devices;
+static uint64_t sim_next = SIM_NEVER;
+static bool sim_next_dirty;
+
+/* polling loop detection */
+static uint16_t spin_off = 0xFFFF;
+static uint8_t spin_val;
+static uint8_t spin_count;
+
+static void sim_run_until(uint64_t when);
+static void sim_irq_poll(void);
+static void sim_init(void);
+
+void sim_nrf_reset(void) __attribute__((weak));
+
+/************************************************************************/
+/* Event loop                                                           */
+/************************************************************************/
+
+void sim_device_add(sim_device *dev) {
+    dev->link = sim_devices;
+    sim_devices = dev;
+    sim_next_dirty = true;
+}
+
+void sim_device_remove(sim_device *dev) {
+    for (sim_device **p = &sim_devices; *p; p = &(*p)->link) {
+        if (*p == dev) {
+            *p = dev->link;
+            break;
+        }
+    }
+    sim_next_dirty = true;
+}
+
+void sim_schedule(sim_device *dev, uint64_t when) {
+    dev->next = when;
+    if (when < sim_next)
+        sim_next = when;
+    else
+        sim_next_dirty = true;
+}
+
+static uint64_t sim_next_event(void) {
+    if (sim_next_dirty) {
+        sim_next = SIM_NEVER;
+        for (sim_device *dev = sim_devices; dev; dev = dev->link)
+            if (dev->next < sim_next)
+                sim_next = dev->next;
+        sim_next_dirty = false;
+    }
+    return sim_next;
+}
+
+static void sim_check_deadline(void) {
+    if (sim_time >= sim_deadline) {
+        sim_deadline = SIM_NEVER;
+        sim_in_isr = false;
+        spin_off = 0xFFFF;
+        longjmp(sim_run_exit, 1);
+    }
+}
+
+static void sim_fire_due(void) {
+    for (sim_device *dev = sim_devices; dev; dev = dev->link) {
+        if (dev->next <= sim_time) {
+            dev->next = SIM_NEVER;
+            dev->fire(sim_time);
+        }
+    }
+    sim_next_dirty = true;
+}
+
+static void sim_run_until(uint64_t when) {
+    for (;;) {
+        uint64_t next = sim_next_event();
+        if (next > when || next > sim_deadline)
+            break;
+        if (next > sim_time)
+            sim_time = next;
+        sim_fire_due();
+        sim_irq_poll();
+    }
+    if (when > sim_time)
+        sim_time = when;
+    sim_check_deadline();
+    sim_irq_poll();
+}
+
+uint64_t sim_now(void) {
+    return sim_time;
+}
+
+double sim_now_us(void) {
+    return (double)sim_time / SIM_CYCLES_PER_US;
+}
+
+void sim_advance(uint64_t cycles) {
+    if (!sim_ready)
+        sim_init();
+    spin_off = 0xFFFF;
+    sim_run_until(sim_time + cycles);
+}
+
+void sim_delay_cycles(uint64_t cycles) {
+    sim_advance(cycles);
+}
+
+bool sim_run(void (*fn)(void), uint64_t cycles) {
+    uint64_t saved = sim_deadline;
+
+    if (!sim_ready)
+        sim_init();
+    sim_deadline = sim_time + cycles;
+    if (setjmp(sim_run_exit)) {
+        sim_deadline = saved;
+        return false;
+    }
+    fn();
+    sim_deadline = saved;
+    return true;
+}
+
+uint32_t sim_rand(void) {
+    /* xorshift32 */
+    sim_rng ^= sim_rng << 13;
+    sim_rng ^= sim_rng >> 17;
+    sim_rng ^= sim_rng << 5;
+    return sim_rng;
+}
+
+bool sim_chance(uint16_t permille) {
+    return permille && (sim_rand() % 1000) < permille;
+}
+
+void sim_error(const char *fmt, ...) {
+    va_list args;
+
+    sim_stats.errors++;
+    if (sim_stats.errors > 20)
+        return;
+    fprintf(stderr, "sim error @%.1fus: ", sim_now_us());
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+/* Test timers */
+struct sim_timer_device : sim_device {
+    struct entry { void (*fn)(void *ctx); void *ctx; };
+    std::multimap<uint64_t, entry> queue;
+
+    void fire(uint64_t now) override {
+        while (!queue.empty() && queue.begin()->first <= now) {
+            entry e = queue.begin()->second;
+            queue.erase(queue.begin());
+            e.fn(e.ctx);
+        }
+        if (!queue.empty())
+            sim_schedule(this, queue.begin()->first);
+    }
+    void reset(void) override {
+        next = SIM_NEVER;
+        queue.clear();
+    }
+};
+
+static sim_timer_device sim_timers;
+
+void sim_at(uint64_t when, void (*fn)(void *ctx), void *ctx) {
+    if (!sim_ready)
+        sim_init();
+    sim_timers.queue.insert(std::make_pair(when, sim_timer_device::entry{ fn, ctx }));
+    sim_schedule(&sim_timers, sim_timers.queue.begin()->first);
+}
+
+/************************************************************************/
+/* Register plumbing                                                    */
+/************************************************************************/
+
+enum periph_kind { KIND_RAW, KIND_PORT, KIND_SPI, KIND_USART, KIND_TC, KIND_RTC, KIND_DMA, KIND_OSC };
+
+struct periph : sim_device {
+    uint16_t    base;
+    uint16_t    size;
+    periph_kind kind;
+
+    periph(uint16_t base_, uint16_t size_, periph_kind kind_) : base(base_), size(size_), kind(kind_) {}
+    virtual uint8_t read(uint16_t off) { return sim_io[base + off]; }
+    virtual void write(uint16_t off, uint8_t val) { sim_io[base + off] = val; }
+    void fire(uint64_t now) override {}
+    void reset(void) override {
+        next = SIM_NEVER;
+        memset(&sim_io[base], 0, size);
+    }
+};
+
+static periph *io_map[0x1000 >> 4];
+static std::vector<periph *> io_periphs;
+
+static void io_add(periph *p, bool timed) {
+    /* plain storage needs no mapping, which matters where two share a 16 byte block */
+    for (uint16_t block = p->base >> 4; p->kind != KIND_RAW && block <= (p->base + p->size - 1) >> 4; block++)
+        io_map[block] = p;
+    io_periphs.push_back(p);
+    if (timed)
+        sim_device_add(p);
+}
+
+static uint16_t io_offset(const volatile void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    if (addr < (uintptr_t)sim_io || addr >= (uintptr_t)sim_io + sizeof(sim_io))
+        return 0xFFFF;
+    return (uint16_t)(addr - (uintptr_t)sim_io);
+}
+
+static periph *io_periph(const volatile void *ptr, periph_kind kind) {
+    uint16_t off = io_offset(ptr);
+    periph *p = (off == 0xFFFF) ? NULL : io_map[off >> 4];
+    return (p && p->kind == kind && p->base == off) ? p : NULL;
+}
+
+/* register access without any time passing, used by the models and the DMA */
+static uint8_t io_read(uint16_t off) {
+    periph *p = io_map[off >> 4];
+    return p ? p->read(off - p->base) : sim_io[off];
+}
+
+static void io_write(uint16_t off, uint8_t val) {
+    periph *p = io_map[off >> 4];
+    if (p)
+        p->write(off - p->base, val);
+    else
+        sim_io[off] = val;
+}
+
+static void io_tick(void) {
+    if (!sim_ready)
+        sim_init();
+    sim_stats.accesses++;
+    sim_run_until(sim_time + SIM_IO_CYCLES);
+}
+
+/* A third identical read of the same register in a row is a polling loop.  Nothing it can see changes
+ * before the next event, so skip straight there instead of spinning through every cycle. */
+static void io_spin(uint16_t off, uint8_t val) {
+    if (off == spin_off && val == spin_val) {
+        if (++spin_count >= 2) {
+            uint64_t next = sim_next_event();
+            uint64_t limit = sim_time + SIM_SPIN_MAX;
+            spin_count = 0;
+            sim_run_until(next < limit ? next : limit);
+        }
+    } else {
+        spin_off = off;
+        spin_val = val;
+        spin_count = 0;
+    }
+}
+
+uint8_t sim_read8(const uint8_t *reg) {
+    uint16_t off = io_offset(reg);
+    if (off == 0xFFFF)
+        return *reg;
+    io_tick();
+    uint8_t val = io_read(off);
+    io_spin(off, val);
+    sim_irq_poll();
+    return val;
+}
+
+void sim_write8(uint8_t *reg, uint8_t val) {
+    uint16_t off = io_offset(reg);
+    if (off == 0xFFFF) {
+        *reg = val;
+        return;
+    }
+    io_tick();
+    spin_off = 0xFFFF;
+    io_write(off, val);
+    sim_irq_poll();
+}
+
+uint16_t sim_read16(const uint8_t *reg) {
+    uint16_t off = io_offset(reg);
+    if (off == 0xFFFF)
+        return reg[0] | (reg[1] << 8);
+    io_tick();
+    uint8_t lo = io_read(off);
+    io_tick();
+    uint8_t hi = io_read(off + 1);
+    io_spin(off, lo ^ hi);
+    sim_irq_poll();
+    return lo | (hi << 8);
+}
+
+void sim_write16(uint8_t *reg, uint16_t val) {
+    uint16_t off = io_offset(reg);
+    if (off == 0xFFFF) {
+        reg[0] = val;
+        reg[1] = val >> 8;
+        return;
+    }
+    io_tick();
+    spin_off = 0xFFFF;
+    io_write(off, val & 0xFF);
+    io_tick();
+    io_write(off + 1, val >> 8);
+    sim_irq_poll();
+}
+
+/************************************************************************/
+/* DMA address space                                                    */
+/************************************************************************/
+
+/* The DMA controllers only see 16-bit data space addresses.  I/O registers keep their real
+ * offsets, RAM buffers get a window each from 0x2000 up, handed out round robin. */
+#define DMA_WINDOWS         16
+#define DMA_WINDOW_BASE     0x2000
+#define DMA_WINDOW_SIZE     0x200
+
+static uint8_t *dma_window[DMA_WINDOWS];
+static uint8_t dma_window_next;
+
+uint16_t sim_dma_addr(const volatile void *ptr) {
+    uint16_t off = io_offset(ptr);
+    uint8_t *p = (uint8_t *)ptr;
+
+    if (off != 0xFFFF)
+        return off;
+    for (uint8_t i = 0; i < DMA_WINDOWS; i++)
+        if (dma_window[i] && p >= dma_window[i] && p - dma_window[i] <= DMA_WINDOW_SIZE - 0x100)
+            return DMA_WINDOW_BASE + i * DMA_WINDOW_SIZE + (p - dma_window[i]);
+    uint8_t i = dma_window_next++ % DMA_WINDOWS;
+    dma_window[i] = p;
+    return DMA_WINDOW_BASE + i * DMA_WINDOW_SIZE;
+}
+
+static uint8_t *dma_ram(uint32_t addr) {
+    if (addr < DMA_WINDOW_BASE || addr >= DMA_WINDOW_BASE + DMA_WINDOWS * DMA_WINDOW_SIZE)
+        return NULL;
+    uint8_t *base = dma_window[(addr - DMA_WINDOW_BASE) / DMA_WINDOW_SIZE];
+    return base ? base + (addr - DMA_WINDOW_BASE) % DMA_WINDOW_SIZE : NULL;
+}
+
+static uint8_t dma_read(uint32_t addr) {
+    if (addr < sizeof(sim_io))
+        return io_read(addr);
+    uint8_t *p = dma_ram(addr);
+    if (!p) {
+        sim_error("DMA read from unmapped address 0x%04X", (unsigned)addr);
+        return 0;
+    }
+    return *p;
+}
+
+static void dma_write(uint32_t addr, uint8_t val) {
+    if (addr < sizeof(sim_io)) {
+        io_write(addr, val);
+        return;
+    }
+    uint8_t *p = dma_ram(addr);
+    if (!p) {
+        sim_error("DMA write to unmapped address 0x%04X", (unsigned)addr);
+        return;
+    }
+    *p = val;
+}
+
+/************************************************************************/
+/* Ports                                                                */
+/************************************************************************/
+
+struct pin_watcher {
+    uint8_t     pin;
+    sim_pin_fn  fn;
+    void        *ctx;
+};
+
+struct port_model : periph {
+    uint8_t dir, out, ext, intctrl, mask0, mask1, flags, remap, pinctrl[8], last;
+    std::vector<pin_watcher> watchers;
+
+    port_model(uint16_t base_) : periph(base_, 0x20, KIND_PORT) {}
+
+    void reset(void) override {
+        periph::reset();
+        dir = out = intctrl = mask0 = mask1 = flags = remap = 0;
+        memset(pinctrl, 0, sizeof(pinctrl));
+        ext = 0xFF;
+        last = level();
+        watchers.clear();
+    }
+
+    uint8_t level(void) {
+        return (out & dir) | (ext & ~dir);
+    }
+
+    /* pins sensing low level keep their flag up for as long as they're low */
+    uint8_t level_flags(void) {
+        uint8_t lv = level(), held = 0;
+        for (uint8_t pin = 0; pin < 8; pin++)
+            if ((pinctrl[pin] & PORT_ISC_gm) == PORT_ISC_LEVEL_gc && !(lv & (1 << pin)))
+                held |= 1 << pin;
+        return held;
+    }
+
+    void update(void) {
+        uint8_t lv = level(), changed = lv ^ last;
+        last = lv;
+        if (!changed)
+            return;
+        for (uint8_t pin = 0; pin < 8; pin++) {
+            uint8_t bit = 1 << pin;
+            if (!(changed & bit))
+                continue;
+            bool high = lv & bit, sensed;
+            switch (pinctrl[pin] & PORT_ISC_gm) {
+                case PORT_ISC_BOTHEDGES_gc: sensed = true; break;
+                case PORT_ISC_RISING_gc:    sensed = high; break;
+                case PORT_ISC_FALLING_gc:   sensed = !high; break;
+                default:                    sensed = false; break;
+            }
+            if (sensed && ((mask0 | mask1) & bit))
+                flags |= bit;
+        }
+        for (size_t i = 0; i < watchers.size(); i++)
+            if (changed & (1 << watchers[i].pin))
+                watchers[i].fn(watchers[i].ctx, lv & (1 << watchers[i].pin));
+    }
+
+    uint8_t read(uint16_t off) override {
+        switch (off) {
+            case 0x00: case 0x01: case 0x02: case 0x03: return dir;
+            case 0x04: case 0x05: case 0x06: case 0x07: return out;
+            case 0x08: return level();
+            case 0x09: return intctrl;
+            case 0x0A: return mask0;
+            case 0x0B: return mask1;
+            case 0x0C: return flags | level_flags();
+            case 0x0E: return remap;
+            default:
+                if (off >= 0x10 && off < 0x18)
+                    return pinctrl[off - 0x10];
+                return 0;
+        }
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        switch (off) {
+            case 0x00: dir = val; break;
+            case 0x01: dir |= val; break;
+            case 0x02: dir &= ~val; break;
+            case 0x03: dir ^= val; break;
+            case 0x04: out = val; break;
+            case 0x05: out |= val; break;
+            case 0x06: out &= ~val; break;
+            case 0x07: out ^= val; break;
+            case 0x09: intctrl = val; return;
+            case 0x0A: mask0 = val; return;
+            case 0x0B: mask1 = val; return;
+            case 0x0C: flags &= ~val; return;
+            case 0x0E: remap = val; return;
+            default:
+                if (off >= 0x10 && off < 0x18)
+                    pinctrl[off - 0x10] = val;
+                return;
+        }
+        update();
+    }
+
+    uint8_t irq_level(uint8_t mask, uint8_t shift) {
+        return ((flags | level_flags()) & mask) ? (intctrl >> shift) & 0x03 : 0;
+    }
+};
+
+static port_model port_a(SIM_PORTA_OFFSET), port_c(SIM_PORTC_OFFSET), port_d(SIM_PORTD_OFFSET),
+        port_e(SIM_PORTE_OFFSET), port_r(SIM_PORTR_OFFSET);
+
+static port_model *port_of(PORT_t *port) {
+    port_model *p = (port_model *)io_periph(port, KIND_PORT);
+    if (!p)
+        sim_error("not a port: %p", (void *)port);
+    return p;
+}
+
+void sim_port_watch(PORT_t *port, uint8_t pin, sim_pin_fn fn, void *ctx) {
+    if (!sim_ready)
+        sim_init();
+    port_model *p = port_of(port);
+    if (p)
+        p->watchers.push_back(pin_watcher{ pin, fn, ctx });
+}
+
+bool sim_port_level(PORT_t *port, uint8_t pin) {
+    port_model *p = port_of(port);
+    return p ? p->level() & (1 << pin) : true;
+}
+
+void sim_port_drive(PORT_t *port, uint8_t pin, bool level) {
+    port_model *p = port_of(port);
+    if (!p)
+        return;
+    if (level)
+        p->ext |= 1 << pin;
+    else
+        p->ext &= ~(1 << pin);
+    p->update();
+}
+
+/************************************************************************/
+/* SPI buses                                                            */
+/************************************************************************/
+
+struct spi_bus {
+    sim_spi_slave_t *slaves;
+    sim_bus_stats_t stats;
+
+    void reset(void) {
+        slaves = NULL;
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    uint8_t exchange(uint8_t mosi) {
+        uint8_t selected = 0, miso = 0xFF;
+        stats.bytes++;
+        for (sim_spi_slave_t *s = slaves; s; s = s->next) {
+            if (!sim_port_level(s->ss_port, s->ss_pin)) {
+                selected++;
+                miso &= s->exchange(s->ctx, mosi);
+            }
+        }
+        if (selected > 1) {
+            stats.conflicts++;
+            sim_error("%u slaves selected at once", selected);
+        } else if (!selected) {
+            stats.unselected++;
+        }
+        return miso;
+    }
+};
+
+static void dma_spi_event(uint16_t spi_base, bool completed);
+
+struct spi_model : periph {
+    spi_bus bus;
+    uint8_t ctrl, intctrl, ctrlb, rxdata, miso, txbuf, rx[2], rxn;
+    bool busy, flag_if, wrcol, txfull, txcif, bufovf;
+    uint64_t started;
+
+    spi_model(uint16_t base_) : periph(base_, 0x08, KIND_SPI) {}
+
+    void reset(void) override {
+        periph::reset();
+        bus.reset();
+        ctrl = intctrl = ctrlb = rxdata = miso = txbuf = rxn = 0;
+        busy = flag_if = wrcol = txfull = txcif = bufovf = false;
+    }
+
+    bool buffered(void) {
+        return ctrlb & SPI_BUFMODE_gm;
+    }
+
+    bool dre(void) {
+        return buffered() && !txfull;
+    }
+
+    uint64_t byte_cycles(void) {
+        static const uint8_t div[] = { 4, 16, 64, 128 };
+        return 8 * (div[ctrl & SPI_PRESCALER_gm] >> ((ctrl & SPI_CLK2X_bm) ? 1 : 0));
+    }
+
+    void start(uint8_t val) {
+        miso = bus.exchange(val);
+        busy = true;
+        started = sim_time;
+        sim_schedule(this, sim_time + byte_cycles());
+    }
+
+    void fire(uint64_t now) override {
+        busy = false;
+        bus.stats.busy += now - started;
+        if (buffered()) {
+            if (rxn < 2)
+                rx[rxn++] = miso;
+            else
+                bufovf = true;
+            if (txfull) {
+                txfull = false;
+                start(txbuf);
+            } else {
+                txcif = true;
+            }
+        } else {
+            rxdata = miso;
+            flag_if = true;
+        }
+        dma_spi_event(base, true);
+    }
+
+    uint8_t read(uint16_t off) override {
+        switch (off) {
+            case 0: return ctrl;
+            case 1: return intctrl;
+            case 2:
+                if (buffered())
+                    return (rxn ? SPI_RXCIF_bm : 0) | (txcif ? SPI_TXCIF_bm : 0) |
+                            (!txfull ? SPI_DREIF_bm : 0) | (bufovf ? SPI_BUFOVF_bm : 0);
+                return (flag_if ? SPI_IF_bm : 0) | (wrcol ? SPI_WRCOL_bm : 0);
+            case 3:
+                if (buffered()) {
+                    uint8_t val = rx[0];
+                    if (rxn) {
+                        rx[0] = rx[1];
+                        rxn--;
+                    }
+                    return val;
+                }
+                flag_if = wrcol = false;
+                return rxdata;
+            case 4: return ctrlb;
+            default: return 0;
+        }
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        switch (off) {
+            case 0: ctrl = val; break;
+            case 1: intctrl = val; break;
+            case 2:
+                if (val & SPI_TXCIF_bm)
+                    txcif = false;
+                if (val & SPI_BUFOVF_bm)
+                    bufovf = false;
+                break;
+            case 3:
+                if (!(ctrl & SPI_ENABLE_bm) || !(ctrl & SPI_MASTER_bm))
+                    break;
+                if (buffered()) {
+                    if (txfull) {
+                        bus.stats.collisions++;
+                    } else if (!busy) {
+                        txcif = false;
+                        start(val);
+                    } else {
+                        txbuf = val;
+                        txfull = true;
+                    }
+                } else if (busy) {
+                    wrcol = true;
+                    bus.stats.collisions++;
+                } else {
+                    flag_if = false;
+                    start(val);
+                }
+                break;
+            case 4:
+                if ((val ^ ctrlb) & SPI_BUFMODE_gm) {
+                    rxn = 0;
+                    txfull = txcif = bufovf = flag_if = false;
+                }
+                ctrlb = val;
+                break;
+        }
+        dma_spi_event(base, false);
+    }
+};
+
+static spi_model spi_c(SIM_SPIC_OFFSET), spi_d(SIM_SPID_OFFSET);
+
+/************************************************************************/
+/* USARTs                                                               */
+/************************************************************************/
+
+static uint8_t bit_reverse(uint8_t val) {
+    val = (val >> 4) | (val << 4);
+    val = ((val >> 2) & 0x33) | ((val & 0x33) << 2);
+    return ((val >> 1) & 0x55) | ((val & 0x55) << 1);
+}
+
+struct usart_model : periph {
+    spi_bus bus;                /* slaves when in master SPI mode */
+    port_model *port;           /* and the XCK pin, inverted for CPOL */
+    uint8_t xck;
+    uint8_t ctrla, ctrlb, ctrlc, baudctrla, baudctrlb;
+    uint8_t txbuf, shift_tx, shift_rx, rx[3], rxn, rx_byte;
+    bool txfull, shifting, txcif, bufovf, receiving;
+    uint64_t shift_end, shift_start, rx_end;
+    std::deque<uint8_t> feed;
+    std::deque<uint8_t> out;
+    PORT_t *de_port;
+    uint8_t de_pin;
+    uint64_t de_rise;
+    sim_uart_stats_t stats;
+
+    usart_model(uint16_t base_, port_model *port_, uint8_t xck_) : periph(base_, 0x10, KIND_USART), port(port_), xck(xck_) {}
+
+    void reset(void) override {
+        periph::reset();
+        bus.reset();
+        ctrla = ctrlb = ctrlc = baudctrla = baudctrlb = txbuf = rxn = 0;
+        txfull = shifting = txcif = bufovf = receiving = false;
+        feed.clear();
+        out.clear();
+        de_port = NULL;
+        memset(&stats, 0, sizeof(stats));
+        ctrlc = USART_CHSIZE_8BIT_gc;
+    }
+
+    bool mspi(void) {
+        return (ctrlc & USART_CMODE_gm) == USART_CMODE_MSPI_gc;
+    }
+
+    /* UDORD shares the CHSIZE2 bit in master SPI mode */
+    bool lsb_first(void) {
+        return mspi() && (ctrlc & USART_CHSIZE2_bm);
+    }
+
+    uint8_t spi_mode(void) {
+        return ((port->pinctrl[xck] & PORT_INVEN_bm) ? SPI_MODE_2_gc : 0) |
+                ((ctrlc & USART_CHSIZE1_bm) ? SPI_MODE_1_gc : 0);
+    }
+
+    uint64_t char_cycles(void) {
+        uint16_t bsel = ((baudctrlb & 0x0F) << 8) | baudctrla;
+        int8_t bscale = (int8_t)(baudctrlb & 0xF0) >> 4;
+        double bit;
+
+        if (mspi())
+            return 8 * 2 * (bsel + 1);
+        uint8_t samples = (ctrlb & USART_CLK2X_bm) ? 8 : 16;
+        if (bscale >= 0)
+            bit = (double)samples * (1 << bscale) * (bsel + 1);
+        else
+            bit = (double)samples * ((double)bsel / (1 << -bscale) + 1);
+        uint8_t chsize = ctrlc & USART_CHSIZE_gm;
+        uint8_t bits = 1 + (chsize == USART_CHSIZE_9BIT_gc ? 9 : 5 + chsize) +
+                ((ctrlc & USART_PMODE_gm) ? 1 : 0) + ((ctrlc & USART_SBMODE_bm) ? 2 : 1);
+        return (uint64_t)(bit * bits + 0.5);
+    }
+
+    void reschedule(void) {
+        uint64_t when = SIM_NEVER;
+        if (shifting)
+            when = shift_end;
+        if (receiving && rx_end < when)
+            when = rx_end;
+        sim_schedule(this, when);
+    }
+
+    void check_de(void) {
+        if (de_port && !sim_port_level(de_port, de_pin)) {
+            if (!stats.de_errors)
+                sim_error("USART at 0x%03X sending with RS485 DE low", base);
+            stats.de_errors++;
+        }
+    }
+
+    void start_tx(uint8_t val) {
+        shifting = true;
+        shift_tx = val;
+        shift_start = sim_time;
+        if (lsb_first())
+            shift_rx = bit_reverse(bus.exchange(bit_reverse(val)));
+        else if (mspi())
+            shift_rx = bus.exchange(val);
+        else
+            check_de();
+        shift_end = sim_time + char_cycles();
+        reschedule();
+    }
+
+    void start_rx(void) {
+        if (receiving || feed.empty() || mspi())
+            return;
+        rx_byte = feed.front();
+        feed.pop_front();
+        receiving = true;
+        rx_end = sim_time + char_cycles();
+        reschedule();
+    }
+
+    void push_rx(uint8_t val) {
+        /* two level FIFO, plus the shift register holding one more in async mode */
+        if (rxn < (mspi() ? 2 : 3)) {
+            rx[rxn++] = val;
+        } else {
+            bufovf = true;
+            stats.rx_overruns++;
+        }
+    }
+
+    void fire(uint64_t now) override {
+        if (shifting && shift_end <= now) {
+            shifting = false;
+            if (mspi()) {
+                bus.stats.busy += now - shift_start;
+                if (ctrlb & USART_RXEN_bm)
+                    push_rx(shift_rx);
+            } else {
+                check_de();
+                out.push_back(shift_tx);
+                stats.tx_bytes++;
+            }
+            if (txfull) {
+                txfull = false;
+                start_tx(txbuf);
+            } else {
+                txcif = true;
+            }
+        }
+        if (receiving && rx_end <= now) {
+            receiving = false;
+            if (ctrlb & USART_RXEN_bm) {
+                stats.rx_bytes++;
+                push_rx(rx_byte);
+            }
+            start_rx();
+        }
+        reschedule();
+    }
+
+    uint8_t read(uint16_t off) override {
+        switch (off) {
+            case 0: {
+                uint8_t val = rx[0];
+                if (rxn) {
+                    rx[0] = rx[1];
+                    rx[1] = rx[2];
+                    rxn--;
+                    bufovf = false;
+                }
+                return val;
+            }
+            case 1:
+                return (rxn ? USART_RXCIF_bm : 0) | (txcif ? USART_TXCIF_bm : 0) |
+                        (!txfull ? USART_DREIF_bm : 0) | (bufovf ? USART_BUFOVF_bm : 0);
+            case 3: return ctrla;
+            case 4: return ctrlb;
+            case 5: return ctrlc;
+            case 6: return baudctrla;
+            case 7: return baudctrlb;
+            default: return 0;
+        }
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        switch (off) {
+            case 0:
+                if (!(ctrlb & USART_TXEN_bm) || txfull)
+                    break;
+                if (!shifting) {
+                    start_tx(val);
+                } else {
+                    txbuf = val;
+                    txfull = true;
+                }
+                if (mspi() && (ctrlb & USART_RXEN_bm)) {
+                    uint8_t pending = rxn + (shifting ? 1 : 0) + (txfull ? 1 : 0);
+                    if (pending > bus.stats.in_flight)
+                        bus.stats.in_flight = pending;
+                }
+                break;
+            case 1:
+                if (val & USART_TXCIF_bm)
+                    txcif = false;
+                break;
+            case 3: ctrla = val; break;
+            case 4:
+                ctrlb = val;
+                start_rx();
+                break;
+            case 5: ctrlc = val; break;
+            case 6: baudctrla = val; break;
+            case 7: baudctrlb = val; break;
+        }
+    }
+};
+
+static usart_model usart_c0(SIM_USARTC0_OFFSET, &port_c, 1), usart_c1(SIM_USARTC1_OFFSET, &port_c, 5),
+        usart_d0(SIM_USARTD0_OFFSET, &port_d, 1), usart_d1(SIM_USARTD1_OFFSET, &port_d, 5);
+
+static usart_model *usart_of(USART_t *usart) {
+    usart_model *u = (usart_model *)io_periph(usart, KIND_USART);
+    if (!u)
+        sim_error("not a USART: %p", (void *)usart);
+    return u;
+}
+
+void sim_uart_feed(USART_t *usart, const uint8_t *data, size_t len) {
+    usart_model *u = usart_of(usart);
+    if (!u)
+        return;
+    u->feed.insert(u->feed.end(), data, data + len);
+    u->start_rx();
+}
+
+size_t sim_uart_feed_pending(USART_t *usart) {
+    usart_model *u = usart_of(usart);
+    return u ? u->feed.size() + (u->receiving ? 1 : 0) : 0;
+}
+
+size_t sim_uart_take(USART_t *usart, uint8_t *buf, size_t max) {
+    usart_model *u = usart_of(usart);
+    size_t n = 0;
+    while (u && n < max && !u->out.empty()) {
+        buf[n++] = u->out.front();
+        u->out.pop_front();
+    }
+    return n;
+}
+
+static void sim_uart_de_edge(void *ctx, bool level) {
+    usart_model *u = (usart_model *)ctx;
+    if (level)
+        u->de_rise = sim_time;
+    else
+        u->stats.de_high += sim_time - u->de_rise;
+}
+
+void sim_uart_de(USART_t *usart, PORT_t *port, uint8_t pin) {
+    usart_model *u = usart_of(usart);
+    if (!u)
+        return;
+    u->de_port = port;
+    u->de_pin = pin;
+    u->de_rise = sim_time;
+    sim_port_watch(port, pin, sim_uart_de_edge, u);
+}
+
+uint64_t sim_uart_char_cycles(USART_t *usart) {
+    usart_model *u = usart_of(usart);
+    return u ? u->char_cycles() : 0;
+}
+
+sim_uart_stats_t *sim_uart_stats(USART_t *usart) {
+    usart_model *u = usart_of(usart);
+    return u ? &u->stats : NULL;
+}
+
+void sim_spi_attach(const volatile void *bus, sim_spi_slave_t *slave) {
+    spi_bus *b = NULL;
+    periph *p;
+
+    if (!sim_ready)
+        sim_init();
+    if ((p = io_periph(bus, KIND_SPI)))
+        b = &((spi_model *)p)->bus;
+    else if ((p = io_periph(bus, KIND_USART)))
+        b = &((usart_model *)p)->bus;
+    if (!b) {
+        sim_error("not a SPI bus: %p", (void *)bus);
+        return;
+    }
+    slave->next = b->slaves;
+    b->slaves = slave;
+}
+
+bool sim_spi_busy(const volatile void *bus) {
+    periph *p;
+    if ((p = io_periph(bus, KIND_SPI)))
+        return ((spi_model *)p)->busy;
+    if ((p = io_periph(bus, KIND_USART)))
+        return ((usart_model *)p)->shifting;
+    return false;
+}
+
+sim_bus_stats_t *sim_bus_stats(const volatile void *bus) {
+    periph *p;
+    if ((p = io_periph(bus, KIND_SPI)))
+        return &((spi_model *)p)->bus.stats;
+    if ((p = io_periph(bus, KIND_USART)))
+        return &((usart_model *)p)->bus.stats;
+    return NULL;
+}
+
+uint8_t sim_spi_mode(const volatile void *bus) {
+    periph *p;
+    if ((p = io_periph(bus, KIND_SPI)))
+        return ((spi_model *)p)->ctrl & SPI_MODE_gm;
+    if ((p = io_periph(bus, KIND_USART)))
+        return ((usart_model *)p)->spi_mode();
+    return 0;
+}
+
+void sim_mark(sim_mark_t *mark, const volatile void *bus) {
+    sim_bus_stats_t *stats = sim_bus_stats(bus);
+
+    mark->at = sim_time;
+    if (stats)
+        mark->bus = *stats;
+    else
+        memset(&mark->bus, 0, sizeof(mark->bus));
+}
+
+void sim_report(const char *scenario, const sim_mark_t *since, const volatile void *bus, uint32_t payload_bytes) {
+    sim_mark_t now;
+    sim_mark(&now, bus);
+    uint64_t elapsed = now.at - since->at;
+    uint32_t bytes = now.bus.bytes - since->bus.bytes;
+    uint64_t busy = now.bus.busy - since->bus.busy;
+    double us = (double)elapsed / SIM_CYCLES_PER_US;
+
+    if (!elapsed)
+        elapsed = 1;
+    printf("%-32s %9.0fus %7u bytes clocked  bus idle %5.1f%% %8.1fus  %7.1f kbit/s bus  %7.1f kbit/s payload\n",
+            scenario, us, (unsigned)bytes, 100.0 * (elapsed - busy) / elapsed, (double)(elapsed - busy) / SIM_CYCLES_PER_US,
+            bytes * 8000.0 / (us ? us : 1), payload_bytes * 8000.0 / (us ? us : 1));
+}
+
+/************************************************************************/
+/* DMA controllers                                                      */
+/************************************************************************/
+
+#if defined(__AVR_ATxmega32A4U__)
+/* A series DMA - SPI transfer complete is an event, every enabled channel on that trigger
+ * moves one byte per event in fixed priority order. */
+struct dma_model : periph {
+    struct channel {
+        uint32_t src, dest;
+        uint32_t left;
+    } ch[4];
+
+    dma_model() : periph(SIM_DMA_OFFSET, 0x50, KIND_DMA) {}
+
+    void reset(void) override {
+        periph::reset();
+        memset(ch, 0, sizeof(ch));
+    }
+
+    uint8_t *reg(uint8_t n, uint8_t off) {
+        return &sim_io[base + 0x10 + n * 0x10 + off];
+    }
+
+    uint8_t read(uint16_t off) override {
+        if (off >= 0x10 && (off & 0x0F) == 1) {
+            uint8_t n = (off - 0x10) >> 4;
+            return sim_io[base + off] | ((*reg(n, 0) & DMA_CH_ENABLE_bm) ? DMA_CH_CHBUSY_bm : 0);
+        }
+        return periph::read(off);
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        if (off < 0x10) {
+            periph::write(off, val);
+            return;
+        }
+        uint8_t n = (off - 0x10) >> 4;
+        switch (off & 0x0F) {
+            case 0x00: {
+                bool was = *reg(n, 0) & DMA_CH_ENABLE_bm;
+                if (val & DMA_CH_RESET_bm) {
+                    memset(reg(n, 0), 0, 0x10);
+                    return;
+                }
+                *reg(n, 0) = val;
+                if ((val & DMA_CH_ENABLE_bm) && !was) {
+                    uint16_t cnt = reg(n, 4)[0] | (reg(n, 4)[1] << 8);
+                    ch[n].left = cnt ? cnt : 0x10000;
+                    ch[n].src = reg(n, 8)[0] | (reg(n, 8)[1] << 8) | ((uint32_t)reg(n, 8)[2] << 16);
+                    ch[n].dest = reg(n, 12)[0] | (reg(n, 12)[1] << 8) | ((uint32_t)reg(n, 12)[2] << 16);
+                }
+                return;
+            }
+            case 0x01:
+                /* flags are cleared by writing one, the rest is stored */
+                *reg(n, 1) = (*reg(n, 1) & (DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm) & ~val) |
+                        (val & ~(DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm | DMA_CH_CHBUSY_bm | DMA_CH_CHPEND_bm));
+                return;
+            default:
+                periph::write(off, val);
+        }
+    }
+
+    void transfer(uint8_t n) {
+        uint8_t addrctrl = *reg(n, 2);
+        dma_write(ch[n].dest, dma_read(ch[n].src));
+        if ((addrctrl & DMA_CH_SRCDIR_gm) == DMA_CH_SRCDIR_INC_gc)
+            ch[n].src++;
+        if ((addrctrl & DMA_CH_DESTDIR_gm) == DMA_CH_DESTDIR_INC_gc)
+            ch[n].dest++;
+        if (!--ch[n].left) {
+            *reg(n, 0) &= ~DMA_CH_ENABLE_bm;
+            *reg(n, 1) |= DMA_CH_TRNIF_bm;
+        }
+    }
+
+    void trigger(uint8_t trigsrc) {
+        if (!(sim_io[base] & DMA_ENABLE_bm))
+            return;
+        bool pending[4];
+        for (uint8_t n = 0; n < 4; n++)
+            pending[n] = (*reg(n, 0) & DMA_CH_ENABLE_bm) && *reg(n, 3) == trigsrc;
+        for (uint8_t n = 0; n < 4; n++)
+            if (pending[n])
+                transfer(n);
+    }
+
+    uint8_t irq_level(uint8_t n) {
+        return (*reg(n, 1) & DMA_CH_TRNIF_bm) ? *reg(n, 1) & DMA_CH_TRNINTLVL_gm : 0;
+    }
+};
+
+static dma_model dma;
+
+/* only the transfer complete edge triggers, so writes don't count */
+static void dma_spi_event(uint16_t spi_base, bool completed) {
+    if (completed)
+        dma.trigger(spi_base == SIM_SPIC_OFFSET ? DMA_CH_TRIGSRC_SPIC_gc : DMA_CH_TRIGSRC_SPID_gc);
+}
+
+#else
+/* E series EDMA - peripheral channels with level triggers on the buffered SPI flags. */
+struct dma_model : periph {
+    struct channel {
+        uint16_t addr;
+        uint16_t left;
+    } ch[4];
+    bool servicing;
+
+    dma_model() : periph(SIM_DMA_OFFSET, 0x50, KIND_DMA) {}
+
+    void reset(void) override {
+        periph::reset();
+        memset(ch, 0, sizeof(ch));
+        servicing = false;
+    }
+
+    uint8_t *reg(uint8_t n, uint8_t off) {
+        return &sim_io[base + 0x10 + n * 0x10 + off];
+    }
+
+    uint8_t read(uint16_t off) override {
+        if (off >= 0x10 && (off & 0x0F) == 1) {
+            uint8_t n = (off - 0x10) >> 4;
+            return sim_io[base + off] | ((*reg(n, 0) & EDMA_CH_ENABLE_bm) ? EDMA_CH_CHBUSY_bm : 0);
+        }
+        return periph::read(off);
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        if (off < 0x10) {
+            periph::write(off, val);
+            service();
+            return;
+        }
+        uint8_t n = (off - 0x10) >> 4;
+        switch (off & 0x0F) {
+            case 0x00: {
+                bool was = *reg(n, 0) & EDMA_CH_ENABLE_bm;
+                if (val & EDMA_CH_RESET_bm) {
+                    memset(reg(n, 0), 0, 0x10);
+                    return;
+                }
+                *reg(n, 0) = val;
+                if ((val & EDMA_CH_ENABLE_bm) && !was) {
+                    uint16_t cnt = reg(n, 6)[0] | (reg(n, 6)[1] << 8);
+                    ch[n].left = cnt ? cnt : 256;
+                    ch[n].addr = reg(n, 8)[0] | (reg(n, 8)[1] << 8);
+                }
+                service();
+                return;
+            }
+            case 0x01:
+                *reg(n, 1) = (*reg(n, 1) & (EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm) & ~val) |
+                        (val & ~(EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm | EDMA_CH_CHBUSY_bm | EDMA_CH_CHPEND_bm));
+                return;
+            default:
+                periph::write(off, val);
+        }
+    }
+
+    void done(uint8_t n) {
+        if (!--ch[n].left) {
+            *reg(n, 0) &= ~EDMA_CH_ENABLE_bm;
+            *reg(n, 1) |= EDMA_CH_TRNIF_bm;
+        }
+    }
+
+    void step_addr(uint8_t n) {
+        if ((*reg(n, 2) & EDMA_CH_DIR_gm) == EDMA_CH_DIR_INC_gc)
+            ch[n].addr++;
+    }
+
+    void service(void) {
+        bool progress = true;
+        if (servicing || !(sim_io[base] & EDMA_ENABLE_bm))
+            return;
+        servicing = true;
+        while (progress) {
+            progress = false;
+            for (uint8_t n = 0; n < 4; n++) {
+                if (!(*reg(n, 0) & EDMA_CH_ENABLE_bm))
+                    continue;
+                uint8_t trig = *reg(n, 4);
+                if (trig == EDMA_CH_TRIGSRC_SPIC_RXC_gc && spi_c.rxn) {
+                    dma_write(ch[n].addr, io_read(SIM_SPIC_OFFSET + 3));
+                    step_addr(n);
+                    done(n);
+                    progress = true;
+                } else if (trig == EDMA_CH_TRIGSRC_SPIC_DRE_gc && spi_c.dre()) {
+                    io_write(SIM_SPIC_OFFSET + 3, dma_read(ch[n].addr));
+                    step_addr(n);
+                    done(n);
+                    progress = true;
+                }
+            }
+        }
+        servicing = false;
+    }
+
+    uint8_t irq_level(uint8_t n) {
+        return (*reg(n, 1) & EDMA_CH_TRNIF_bm) ? *reg(n, 1) & EDMA_CH_TRNINTLVL_gm : 0;
+    }
+};
+
+static dma_model dma;
+
+static void dma_spi_event(uint16_t spi_base, bool completed) {
+    if (spi_base == SIM_SPIC_OFFSET)
+        dma.service();
+}
+#endif
+
+/************************************************************************/
+/* Timers                                                               */
+/************************************************************************/
+
+struct tc_model : periph {
+    uint8_t ctrla, temp;
+    uint16_t per, cnt0;
+    uint64_t t0, ovf_base, ovf_seen;
+
+    tc_model(uint16_t base_) : periph(base_, 0x40, KIND_TC) {}
+
+    void reset(void) override {
+        periph::reset();
+        ctrla = temp = 0;
+        per = 0xFFFF;
+        cnt0 = 0;
+        t0 = sim_time;
+        ovf_base = ovf_seen = 0;
+    }
+
+    uint32_t div(void) {
+        static const uint16_t divs[] = { 0, 1, 2, 4, 8, 64, 256, 1024 };
+        return (ctrla & SIM_TC_CLKSEL_gm) < 8 ? divs[ctrla & SIM_TC_CLKSEL_gm] : 0;
+    }
+
+    uint64_t counted(void) {
+        return div() ? cnt0 + (sim_time - t0) / div() : cnt0;
+    }
+
+    uint16_t cnt(void) {
+        return counted() % ((uint32_t)per + 1);
+    }
+
+    uint64_t overflows(void) {
+        return ovf_base + counted() / ((uint32_t)per + 1);
+    }
+
+    /* restart counting from here, keeping the overflow tally */
+    void freeze(void) {
+        ovf_base = overflows();
+        cnt0 = cnt();
+        t0 = sim_time;
+    }
+
+    uint8_t read(uint16_t off) override {
+        switch (off) {
+            case 0x00: return ctrla;
+            case 0x0C: return overflows() > ovf_seen ? 0x01 : 0;
+            case 0x20: {
+                uint16_t val = cnt();
+                temp = val >> 8;
+                return val & 0xFF;
+            }
+            case 0x21: return temp;
+            case 0x26: return per & 0xFF;
+            case 0x27: return per >> 8;
+            default: return periph::read(off);
+        }
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        switch (off) {
+            case 0x00:
+                freeze();
+                ctrla = val;
+                break;
+            case 0x0C:
+                if (val & 0x01)
+                    ovf_seen = overflows();
+                break;
+            case 0x20: temp = val; break;
+            case 0x21:
+                freeze();
+                cnt0 = temp | (val << 8);
+                break;
+            case 0x26: temp = val; break;
+            case 0x27:
+                freeze();
+                per = temp | (val << 8);
+                break;
+            default: periph::write(off, val);
+        }
+    }
+};
+
+static tc_model tc_c0(SIM_TCC0_OFFSET), tc_c1(SIM_TCC1_OFFSET), tc_d0(SIM_TCD0_OFFSET), tc_d5(SIM_TCD5_OFFSET);
+
+/* RTC - counts from the clock CLK.RTCCTRL selects when RTC.CTRL starts it, with overflow
+ * and compare flags and interrupts.  Never reports SYNCBUSY. */
+struct rtc_model : periph {
+    uint8_t ctrl, intctrl, flags, temp;
+    uint16_t per, comp;
+    uint64_t t0, abs0;          /* absolute tick count abs0 at time t0 */
+    uint64_t next_ovf, next_comp;
+
+    rtc_model() : periph(SIM_RTC_OFFSET, 0x10, KIND_RTC) {}
+
+    void reset(void) override {
+        periph::reset();
+        ctrl = intctrl = flags = temp = 0;
+        per = 0xFFFF;
+        comp = 0;
+        t0 = sim_time;
+        abs0 = 0;
+        next_ovf = next_comp = SIM_NEVER;
+    }
+
+    uint32_t rate(void) {
+        uint8_t rtcctrl = sim_io[SIM_CLK_OFFSET + 3];
+        if (!(rtcctrl & CLK_RTCEN_bm))
+            return 0;
+        return ((rtcctrl & CLK_RTCSRC_gm) == CLK_RTCSRC_RCOSC32_gc) ? 32768 : 1024;
+    }
+
+    uint32_t div(void) {
+        static const uint16_t divs[] = { 0, 1, 2, 8, 16, 64, 256, 1024 };
+        return divs[ctrl & RTC_PRESCALER_gm];
+    }
+
+    bool running(void) {
+        return rate() && div();
+    }
+
+    uint64_t ticks(void) {
+        if (!running())
+            return abs0;
+        return abs0 + (uint64_t)((unsigned __int128)(sim_time - t0) * rate() / ((uint64_t)F_CPU * div()));
+    }
+
+    uint64_t time_of(uint64_t tick) {
+        unsigned __int128 num = (unsigned __int128)(tick - abs0) * F_CPU * div();
+        return t0 + (uint64_t)((num + rate() - 1) / rate());
+    }
+
+    uint16_t cnt(void) {
+        return ticks() % ((uint32_t)per + 1);
+    }
+
+    void rebase(uint16_t val) {
+        abs0 = val;
+        t0 = sim_time;
+    }
+
+    void plan(void) {
+        next_ovf = next_comp = SIM_NEVER;
+        if (!running()) {
+            sim_schedule(this, SIM_NEVER);
+            return;
+        }
+        uint64_t now = ticks(), span = (uint32_t)per + 1, c = now % span;
+        next_ovf = (now / span + 1) * span;
+        if (comp <= per)
+            next_comp = now + (comp > c ? comp - c : comp + span - c);
+        uint64_t tick = next_ovf < next_comp ? next_ovf : next_comp;
+        sim_schedule(this, time_of(tick));
+    }
+
+    void fire(uint64_t now) override {
+        uint64_t t = ticks();
+        if (t >= next_ovf)
+            flags |= RTC_OVFIF_bm;
+        if (t >= next_comp)
+            flags |= RTC_COMPIF_bm;
+        plan();
+    }
+
+    uint8_t read(uint16_t off) override {
+        switch (off) {
+            case 0x00: return ctrl;
+            case 0x01: return 0;
+            case 0x02: return intctrl;
+            case 0x03: return flags;
+            case 0x08: {
+                uint16_t val = cnt();
+                temp = val >> 8;
+                return val & 0xFF;
+            }
+            case 0x09: return temp;
+            case 0x0A: return per & 0xFF;
+            case 0x0B: return per >> 8;
+            case 0x0C: return comp & 0xFF;
+            case 0x0D: return comp >> 8;
+            default: return periph::read(off);
+        }
+    }
+
+    void write(uint16_t off, uint8_t val) override {
+        switch (off) {
+            case 0x00:
+                rebase(cnt());
+                ctrl = val;
+                break;
+            case 0x02: intctrl = val; return;
+            case 0x03: flags &= ~val; return;
+            case 0x08: case 0x0A: case 0x0C: temp = val; return;
+            case 0x09: rebase(temp | (val << 8)); break;
+            case 0x0B:
+                rebase(cnt());
+                per = temp | (val << 8);
+                break;
+            case 0x0D: comp = temp | (val << 8); break;
+            default: periph::write(off, val); return;
+        }
+        plan();
+    }
+};
+
+static rtc_model rtc;
+
+/* Oscillators are ready the moment they're enabled */
+struct osc_model : periph {
+    osc_model() : periph(SIM_OSC_OFFSET, 0x10, KIND_OSC) {}
+    uint8_t read(uint16_t off) override {
+        return off == 1 ? 0xFF : periph::read(off);
+    }
+};
+
+static osc_model osc;
+
+/************************************************************************/
+/* Interrupts                                                           */
+/************************************************************************/
+
+#define SIM_VECTORS(X) \
+    X(RTC_OVF_vect) X(RTC_COMP_vect) \
+    X(PORTC_INT_vect) X(PORTR_INT_vect) X(PORTC_INT0_vect) X(PORTC_INT1_vect) \
+    X(EDMA_CH0_vect) X(DMA_CH0_vect) \
+    X(USARTC0_RXC_vect) X(USARTC0_DRE_vect) X(USARTC0_TXC_vect) \
+    X(USARTC1_RXC_vect) X(USARTC1_DRE_vect) X(USARTC1_TXC_vect) \
+    X(PORTA_INT_vect) X(PORTA_INT0_vect) X(PORTA_INT1_vect) \
+    X(PORTD_INT_vect) X(PORTD_INT0_vect) X(PORTD_INT1_vect) \
+    X(USARTD0_RXC_vect) X(USARTD0_DRE_vect) X(USARTD0_TXC_vect) \
+    X(USARTD1_RXC_vect) X(USARTD1_DRE_vect) X(USARTD1_TXC_vect)
+
+#define SIM_DECLARE_VECTOR(name) extern "C" void name(void) __attribute__((weak));
+SIM_VECTORS(SIM_DECLARE_VECTOR)
+
+struct irq_source {
+    const char  *name;
+    void        (*handler)(void);
+    uint8_t     (*level)(void);
+    void        (*ack)(void);
+    bool        dead;
+};
+
+static uint8_t lvl_rtc_ovf(void) { return (rtc.flags & RTC_OVFIF_bm) ? rtc.intctrl & RTC_OVFINTLVL_gm : 0; }
+static uint8_t lvl_rtc_comp(void) { return (rtc.flags & RTC_COMPIF_bm) ? (rtc.intctrl & RTC_COMPINTLVL_gm) >> 2 : 0; }
+static void ack_rtc_ovf(void) { rtc.flags &= ~RTC_OVFIF_bm; }
+static void ack_rtc_comp(void) { rtc.flags &= ~RTC_COMPIF_bm; }
+static uint8_t lvl_dma0(void) { return dma.irq_level(0); }
+static void ack_none(void) {}
+
+#define PORT_IRQ(p) \
+    static inline uint8_t lvl_##p##_int0(void) { return p.irq_level(p.mask0, 0); } \
+    static inline uint8_t lvl_##p##_int1(void) { return p.irq_level(p.mask1, 2); }
+PORT_IRQ(port_a)
+PORT_IRQ(port_c)
+PORT_IRQ(port_d)
+PORT_IRQ(port_r)
+
+#define USART_IRQ(u) \
+    static inline uint8_t lvl_##u##_rxc(void) { return u.rxn ? (u.ctrla & USART_RXCINTLVL_gm) >> 4 : 0; } \
+    static inline uint8_t lvl_##u##_dre(void) { return !u.txfull ? u.ctrla & USART_DREINTLVL_gm : 0; } \
+    static inline uint8_t lvl_##u##_txc(void) { return u.txcif ? (u.ctrla & USART_TXCINTLVL_gm) >> 2 : 0; } \
+    static inline void ack_##u##_txc(void) { u.txcif = false; }
+USART_IRQ(usart_c0)
+USART_IRQ(usart_c1)
+USART_IRQ(usart_d0)
+USART_IRQ(usart_d1)
+
+#define USART_SOURCES(u, U) \
+    { #U "_RXC_vect", U##_RXC_vect, lvl_##u##_rxc, ack_none, false }, \
+    { #U "_DRE_vect", U##_DRE_vect, lvl_##u##_dre, ack_none, false }, \
+    { #U "_TXC_vect", U##_TXC_vect, lvl_##u##_txc, ack_##u##_txc, false },
+
+/* in vector table order, which is the priority order within a level */
+static irq_source irq_sources[] = {
+    { "RTC_OVF_vect", RTC_OVF_vect, lvl_rtc_ovf, ack_rtc_ovf, false },
+    { "RTC_COMP_vect", RTC_COMP_vect, lvl_rtc_comp, ack_rtc_comp, false },
+#if defined(__AVR_ATxmega32A4U__)
+    { "PORTC_INT0_vect", PORTC_INT0_vect, lvl_port_c_int0, ack_none, false },
+    { "PORTC_INT1_vect", PORTC_INT1_vect, lvl_port_c_int1, ack_none, false },
+    { "PORTR_INT0_vect", NULL, lvl_port_r_int0, ack_none, false },
+    { "DMA_CH0_vect", DMA_CH0_vect, lvl_dma0, ack_none, false },
+#else
+    { "PORTC_INT_vect", PORTC_INT_vect, lvl_port_c_int0, ack_none, false },
+    { "PORTR_INT_vect", PORTR_INT_vect, lvl_port_r_int0, ack_none, false },
+    { "EDMA_CH0_vect", EDMA_CH0_vect, lvl_dma0, ack_none, false },
+#endif
+    USART_SOURCES(usart_c0, USARTC0)
+#if defined(__AVR_ATxmega32A4U__)
+    USART_SOURCES(usart_c1, USARTC1)
+    { "PORTA_INT0_vect", PORTA_INT0_vect, lvl_port_a_int0, ack_none, false },
+    { "PORTA_INT1_vect", PORTA_INT1_vect, lvl_port_a_int1, ack_none, false },
+    { "PORTD_INT0_vect", PORTD_INT0_vect, lvl_port_d_int0, ack_none, false },
+    { "PORTD_INT1_vect", PORTD_INT1_vect, lvl_port_d_int1, ack_none, false },
+#else
+    { "PORTA_INT_vect", PORTA_INT_vect, lvl_port_a_int0, ack_none, false },
+    { "PORTD_INT_vect", PORTD_INT_vect, lvl_port_d_int0, ack_none, false },
+#endif
+    USART_SOURCES(usart_d0, USARTD0)
+#if defined(__AVR_ATxmega32A4U__)
+    USART_SOURCES(usart_d1, USARTD1)
+#endif
+};
+
+static irq_source *sim_irq_pending(void) {
+    uint8_t enabled = sim_io[SIM_PMIC_OFFSET + 2];
+    irq_source *best = NULL;
+    uint8_t best_level = 0;
+
+    for (size_t i = 0; i < sizeof(irq_sources) / sizeof(irq_sources[0]); i++) {
+        irq_source *src = &irq_sources[i];
+        uint8_t level = src->dead ? 0 : src->level();
+        if (level > best_level && (enabled & (1 << (level - 1)))) {
+            best = src;
+            best_level = level;
+        }
+    }
+    return best;
+}
+
+static void sim_irq_poll(void) {
+    if (!sim_sreg_i || sim_in_isr)
+        return;
+    for (;;) {
+        irq_source *src = sim_irq_pending();
+        if (!src)
+            return;
+        if (!src->handler) {
+            sim_error("%s is enabled and pending but has no handler", src->name);
+            src->dead = true;
+            continue;
+        }
+
+        uint64_t start = sim_time;
+        sim_in_isr = true;
+        sim_stats.isrs++;
+        spin_off = 0xFFFF;
+        sim_run_until(sim_time + SIM_ISR_CYCLES / 2);
+        src->ack();
+        src->handler();
+        sim_run_until(sim_time + SIM_ISR_CYCLES / 2);
+        spin_off = 0xFFFF;
+        sim_in_isr = false;
+        sim_stats.isr_cycles += sim_time - start;
+    }
+}
+
+void sim_sei(void) {
+    /* like SEI, the next instruction runs before anything pending does */
+    sim_sreg_i = true;
+}
+
+void sim_cli(void) {
+    sim_sreg_i = false;
+}
+
+uint8_t sim_atomic_enter(void) {
+    uint8_t sreg = sim_sreg_i;
+    sim_sreg_i = false;
+    return sreg;
+}
+
+void sim_atomic_exit(uint8_t sreg) {
+    sim_sreg_i = (sreg & ((1 << ATOMIC_FORCEON) | 1)) != 0;
+}
+
+void sim_sleep(void) {
+    uint64_t start = sim_time;
+    uint32_t isrs = sim_stats.isrs;
+
+    if (!(sim_io[SIM_SLEEP_OFFSET] & SLEEP_SEN_bm))
+        return;
+    spin_off = 0xFFFF;
+    sim_irq_poll();
+    while (sim_stats.isrs == isrs) {
+        uint64_t next = sim_next_event();
+        if (!sim_sreg_i || next == SIM_NEVER) {
+            if (sim_deadline != SIM_NEVER) {
+                sim_stats.sleep_cycles += sim_deadline - sim_time;
+                sim_run_until(sim_deadline);
+            }
+            sim_error("sleeping with nothing left to wake the CPU");
+            return;
+        }
+        sim_run_until(next);
+    }
+    sim_stats.sleep_cycles += sim_time - start;
+}
+
+/************************************************************************/
+/* Reset                                                                */
+/************************************************************************/
+
+static void sim_init(void) {
+    static periph ccp(SIM_CCP_OFFSET, 0x01, KIND_RAW), clk(SIM_CLK_OFFSET, 0x08, KIND_RAW),
+            sleep(SIM_SLEEP_OFFSET, 0x08, KIND_RAW), dfll(SIM_DFLL_OFFSET, 0x08, KIND_RAW),
+            pmic(SIM_PMIC_OFFSET, 0x10, KIND_RAW);
+
+    sim_ready = true;
+    io_add(&ccp, false);
+    io_add(&clk, false);
+    io_add(&sleep, false);
+    io_add(&osc, false);
+    io_add(&dfll, false);
+    io_add(&pmic, false);
+    io_add(&dma, false);
+    io_add(&rtc, true);
+    io_add(&port_a, false);
+    io_add(&port_c, false);
+    io_add(&port_d, false);
+    io_add(&port_e, false);
+    io_add(&port_r, false);
+    io_add(&tc_c0, false);
+    io_add(&tc_c1, false);
+    io_add(&tc_d0, false);
+    io_add(&tc_d5, false);
+    io_add(&usart_c0, true);
+    io_add(&usart_c1, true);
+    io_add(&usart_d0, true);
+    io_add(&usart_d1, true);
+    io_add(&spi_c, true);
+    io_add(&spi_d, true);
+    sim_device_add(&sim_timers);
+    for (size_t i = 0; i < io_periphs.size(); i++)
+        io_periphs[i]->reset();
+}
+
+void sim_reset(uint32_t seed) {
+    if (!sim_ready)
+        sim_init();
+
+    /* drop everything that isn't part of the MCU */
+    sim_device **p = &sim_devices;
+    while (*p) {
+        bool builtin = (*p == &sim_timers);
+        for (size_t i = 0; i < io_periphs.size() && !builtin; i++)
+            builtin = (*p == io_periphs[i]);
+        if (builtin)
+            p = &(*p)->link;
+        else
+            *p = (*p)->link;
+    }
+    if (sim_nrf_reset)
+        sim_nrf_reset();
+
+    sim_time = 0;
+    sim_deadline = SIM_NEVER;
+    sim_sreg_i = sim_in_isr = false;
+    sim_rng = seed ? seed : 1;
+    spin_off = 0xFFFF;
+    memset(&sim_stats, 0, sizeof(sim_stats));
+    memset(dma_window, 0, sizeof(dma_window));
+    dma_window_next = 0;
+    for (size_t i = 0; i < io_periphs.size(); i++)
+        io_periphs[i]->reset();
+    sim_timers.reset();
+    for (size_t i = 0; i < sizeof(irq_sources) / sizeof(irq_sources[0]); i++)
+        irq_sources[i].dead = false;
+    sim_next_dirty = true;
+}
@@ -0,0 +1,198 @@
+/*
+ * sim.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Cycle approximate XMEGA model for running the libraries on a PC.  Time only
+ *  moves at I/O register accesses, delays and sleep, so it is I/O accurate
+ *  rather than instruction accurate - plain C between two accesses is free.
+ */
+
+#ifndef HOSTSIM_SIM_H_
+#define HOSTSIM_SIM_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef F_CPU
+#   define F_CPU 32000000UL
+#endif
+
+#define SIM_CYCLES_PER_US   (F_CPU / 1000000UL)
+#define SIM_US(us)          ((uint64_t)((us) * (double)SIM_CYCLES_PER_US))
+#define SIM_MS(ms)          SIM_US((ms) * 1000.0)
+#define SIM_NEVER           UINT64_MAX
+
+#define SIM_IO_CYCLES       2       /* cost of one register access, LDS/STS plus a little code around it */
+#define SIM_ISR_CYCLES      10      /* vector entry and RETI */
+
+/************************************************************************/
+/* Machine                                                              */
+/************************************************************************/
+
+/*! \brief Puts every model back to power on state and seeds the noise generator.
+ *  Radios and host attachments are dropped too, so set them up again afterwards.
+ */
+void sim_reset(uint32_t seed);
+
+/*! \brief Virtual CPU cycles since sim_reset() */
+uint64_t sim_now(void);
+
+/*! \brief Virtual time in microseconds */
+double sim_now_us(void);
+
+/*! \brief Lets virtual time pass, running peripherals, test timers and interrupts */
+void sim_advance(uint64_t cycles);
+
+/*! \brief Calls fn() until it returns or cycles have passed, for code that never returns.
+ *  \return true if fn() returned on its own.
+ */
+bool sim_run(void (*fn)(void), uint64_t cycles);
+
+/*! \brief Calls fn(ctx) from the event loop at a virtual time.  It stands in for the
+ *  world outside the MCU, so it must not call into code under test.
+ */
+void sim_at(uint64_t when, void (*fn)(void *ctx), void *ctx);
+
+/*! \brief Deterministic noise source, reseeded by sim_reset() */
+uint32_t sim_rand(void);
+
+/*! \brief true with a probability of permille/1000 */
+bool sim_chance(uint16_t permille);
+
+/*! \brief Counts and prints a model detected problem, like a byte cut short by SS */
+void sim_error(const char *fmt, ...);
+
+typedef struct {
+    uint32_t    accesses;       /* I/O register reads and writes */
+    uint32_t    isrs;           /* interrupt handlers run */
+    uint64_t    isr_cycles;     /* time spent inside them */
+    uint64_t    sleep_cycles;   /* time spent in sleep_cpu() */
+    uint32_t    errors;         /* sim_error() calls */
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+/************************************************************************/
+/* Models attached to the machine                                       */
+/************************************************************************/
+
+/*! \brief Anything with timed behaviour - peripherals, radios, test timers */
+struct sim_device {
+    uint64_t    next;                   /* next time fire() wants to run, SIM_NEVER if idle */
+    sim_device  *link;
+    virtual void fire(uint64_t now) = 0;
+    virtual void reset(void) { next = SIM_NEVER; }
+    virtual ~sim_device() {}
+};
+
+void sim_device_add(sim_device *dev);
+void sim_device_remove(sim_device *dev);
+void sim_schedule(sim_device *dev, uint64_t when);
+
+/************************************************************************/
+/* Ports                                                                */
+/************************************************************************/
+
+typedef void (*sim_pin_fn)(void *ctx, bool level);
+
+/*! \brief Calls fn whenever the level of a pin changes */
+void sim_port_watch(PORT_t *port, uint8_t pin, sim_pin_fn fn, void *ctx);
+
+/*! \brief Level of a pin, driven by the MCU if it's an output */
+bool sim_port_level(PORT_t *port, uint8_t pin);
+
+/*! \brief Drives an input pin from outside.  Undriven pins read high */
+void sim_port_drive(PORT_t *port, uint8_t pin, bool level);
+
+/************************************************************************/
+/* SPI buses - SPI modules and USARTs in master SPI mode                */
+/************************************************************************/
+
+typedef struct sim_spi_slave {
+    PORT_t      *ss_port;               /* selected while this pin is low */
+    uint8_t     ss_pin;
+    uint8_t     (*exchange)(void *ctx, uint8_t mosi);  /* called as a byte starts, returns MISO.  Both as on the
+                                                         * wire, first bit clocked in bit 7 whatever the data order */
+    void        *ctx;
+    struct sim_spi_slave *next;
+} sim_spi_slave_t;
+
+typedef struct {
+    uint32_t    bytes;          /* bytes clocked */
+    uint64_t    busy;           /* cycles the clock was running */
+    uint32_t    conflicts;      /* bytes clocked with more than one slave selected */
+    uint32_t    unselected;     /* bytes clocked with nobody selected */
+    uint32_t    collisions;     /* DATA written while a byte was in flight */
+    uint8_t     in_flight;      /* most bytes written to a master SPI USART's DATA and not yet read back */
+} sim_bus_stats_t;
+
+/*! \brief Puts a slave on a SPI_t or USART_t bus */
+void sim_spi_attach(const volatile void *bus, sim_spi_slave_t *slave);
+
+/*! \brief true while a byte is being clocked out on a bus */
+bool sim_spi_busy(const volatile void *bus);
+
+sim_bus_stats_t *sim_bus_stats(const volatile void *bus);
+
+/*! \brief SPI mode seen on a bus's clock line, as SPI_MODE_x_gc.  For a USART that's UCPHA plus the XCK pin's INVEN */
+uint8_t sim_spi_mode(const volatile void *bus);
+
+/*! \brief Start of a measured stretch, for sim_report() */
+typedef struct {
+    uint64_t        at;
+    sim_bus_stats_t bus;
+} sim_mark_t;
+
+void sim_mark(sim_mark_t *mark, const volatile void *bus);
+
+/*! \brief Prints bytes clocked, bus idle time and throughput on a bus since a mark.
+ *  payload_bytes is whatever the scenario moved end to end, radio payloads for instance.
+ */
+void sim_report(const char *scenario, const sim_mark_t *since, const volatile void *bus, uint32_t payload_bytes);
+
+/************************************************************************/
+/* Host side of the asynchronous USARTs                                 */
+/************************************************************************/
+
+typedef struct {
+    uint32_t    tx_bytes;       /* bytes the MCU sent */
+    uint32_t    rx_bytes;       /* bytes the MCU's receiver took in */
+    uint32_t    rx_overruns;    /* bytes lost because the RX buffer was full */
+    uint32_t    de_errors;      /* bytes sent with the RS485 driver disabled */
+    uint64_t    de_high;        /* cycles the driver was enabled */
+} sim_uart_stats_t;
+
+/*! \brief Queues bytes for the MCU to receive, back to back at its baud rate */
+void sim_uart_feed(USART_t *usart, const uint8_t *data, size_t len);
+
+/*! \brief Bytes fed but not clocked in yet */
+size_t sim_uart_feed_pending(USART_t *usart);
+
+/*! \brief Takes what the MCU has sent so far */
+size_t sim_uart_take(USART_t *usart, uint8_t *buf, size_t max);
+
+/*! \brief Checks every byte goes out with this RS485 driver enable pin high */
+void sim_uart_de(USART_t *usart, PORT_t *port, uint8_t pin);
+
+/*! \brief Cycles one character takes at the current settings */
+uint64_t sim_uart_char_cycles(USART_t *usart);
+
+sim_uart_stats_t *sim_uart_stats(USART_t *usart);
+
+#endif /* HOSTSIM_SIM_H_ */
@@ -0,0 +1,67 @@
+/*
+ * test.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Checks shared by the tests.  Each test is its own program, main() runs the
+ *  cases with TEST_RUN() and returns test_done().
+ */
+
+#ifndef HOSTSIM_TEST_H_
+#define HOSTSIM_TEST_H_
+
+#include <stdio.h>
+#include "sim.h"
+#include "nrf_model.h"
+
+static int test_failures;
+static const char *test_current;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        test_failures++; \
+        fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, test_current, #cond); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _a = (long long)(a), _b = (long long)(b); \
+    if (_a != _b) { \
+        test_failures++; \
+        fprintf(stderr, "%s:%d: %s: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, \
+                test_current, #a, #b, _a, _b); \
+    } \
+} while (0)
+
+/* Runs one case on a freshly reset machine and fails it on any model detected error */
+#define TEST_RUN(fn) do { \
+    int _before = test_failures; \
+    test_current = #fn; \
+    sim_reset(1); \
+    fn(); \
+    if (sim_stats.errors) { \
+        test_failures++; \
+        fprintf(stderr, "%s: %u simulator errors\n", #fn, (unsigned)sim_stats.errors); \
+    } \
+    printf("%-40s %s\n", #fn, test_failures == _before ? "ok" : "FAILED"); \
+} while (0)
+
+static inline int test_done(void) {
+    if (test_failures)
+        printf("%d check(s) failed\n", test_failures);
+    return test_failures ? 1 : 0;
+}
+
+#endif /* HOSTSIM_TEST_H_ */
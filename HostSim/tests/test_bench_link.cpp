@@ -0,0 +1,191 @@
+/*
+ * test_bench_link.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  bench_rx_loop() over a simulated link.  A peer PTX plays bench_tx_loop(),
+ *  stamping bench_frame_t payloads with the simulated clock in BENCH_TC
+ *  ticks, and the test reads back the summary lines from USARTD0.  Also the
+ *  auto-ack link counters over a lossy channel.
+ */
+
+#include <stdio.h>
+#include "testbed.h"
+
+#define SKIP_EVERY  50      /* the peer leaves out every 50th sequence number */
+#define LINK_PACKETS 200
+
+static uint32_t peer_seq;
+static uint8_t peer_rate;
+static char text[1024];     /* USARTD0 output not yet parsed */
+static size_t text_len;
+
+/* Peer PTX keeping its TX FIFO topped up with bench frames */
+static void peer_bench(sim_nrf_t *nrf, void *ctx) {
+    static bool busy;
+    bench_frame_t frame = {0};
+
+    if (busy)
+        return;
+    busy = true;
+    if (sim_nrf_reg(nrf, NRF_STATUS) & ((1 << TX_DS) | (1 << MAX_RT)))
+        sim_nrf_clear_irq(nrf);
+    while (sim_nrf_tx_count(nrf) < 3) {
+        if (++peer_seq % SKIP_EVERY == 0)
+            peer_seq++;
+        frame.seq = peer_seq;
+        frame.stamp = (uint32_t)(sim_now() / 64);   /* BENCH_TC runs at F_CPU / 64 */
+        frame.rate = peer_rate;
+        sim_nrf_send(nrf, (uint8_t *)&frame, sizeof(frame), false);
+    }
+    busy = false;
+}
+
+static sim_nrf_t *peer_start(xnrf_datarate_t rate, uint16_t kbps) {
+    const xnrf_profile_t *bridge = &ee_profiles[0];
+
+    testbed_radio_a();
+    testbed_boot(0);
+    sim_nrf_t *peer = sim_nrf_peer();
+    peer_seq = 0;
+    peer_rate = rate;
+    text_len = 0;
+    sim_nrf_link(peer, bridge->rf_ch, kbps, testbed_addr(bridge->rx0_addr), 32, false, false);
+    sim_nrf_on_event(peer, peer_bench, NULL);
+    peer_bench(peer, NULL);
+    sim_nrf_ce(peer, true);
+    return peer;
+}
+
+typedef struct {
+    unsigned long kbps, pkts, lost, reord, bps;
+    unsigned long pdv[BENCH_PDV_BUCKETS];
+} summary_t;
+
+/* Reads the next "RX kbps ..." line off USARTD0 */
+static bool next_summary(summary_t *sum) {
+    char *end;
+
+    text_len += sim_uart_take(&USARTD0, (uint8_t *)text + text_len, sizeof(text) - 1 - text_len);
+    text[text_len] = 0;
+    if (!(end = strstr(text, "\r\n")))
+        return false;
+    int fields = sscanf(text, "RX kbps %lu pkts %lu lost %lu reord %lu Bps %lu pdv %lu %lu %lu %lu %lu %lu %lu %lu",
+            &sum->kbps, &sum->pkts, &sum->lost, &sum->reord, &sum->bps, &sum->pdv[0], &sum->pdv[1], &sum->pdv[2],
+            &sum->pdv[3], &sum->pdv[4], &sum->pdv[5], &sum->pdv[6], &sum->pdv[7]);
+    end += 2;
+    text_len -= end - text;
+    memmove(text, end, text_len);
+    return fields == 5 + BENCH_PDV_BUCKETS;
+}
+
+/* 250kbps, the rate bench_rx_loop() starts at:  loss counted from the sequence gaps, and the delay barely varies */
+static void link_250k(void) {
+    summary_t sum;
+
+    peer_start(XNRF_250KBPS, 250);
+    sim_run(bench_rx_loop, SIM_MS(2100));
+
+    for (uint8_t line = 0; line < 2; line++) {
+        CHECK(next_summary(&sum));
+        CHECK_EQ(sum.kbps, 250);
+        CHECK(sum.pkts > 500);
+        CHECK_EQ(sum.reord, 0);
+        CHECK(sum.lost >= sum.pkts / SKIP_EVERY && sum.lost <= sum.pkts / SKIP_EVERY + 1);
+        // over the interval actually measured, a little longer than the nominal second
+        CHECK(sum.bps <= sum.pkts * 32 && sum.bps >= sum.pkts * 32 * 99 / 100);
+        // the peer's FIFO is always 3 deep, so every packet queues about as long and the delay barely varies
+        CHECK_EQ(sum.pdv[0], sum.pkts);
+    }
+}
+
+/* A 2Mbps transmitter is found by stepping through the rates on silence */
+static void follows_rate(void) {
+    summary_t sum;
+    bool found = false;
+
+    peer_start(XNRF_2MBPS, 2000);
+    sim_run(bench_rx_loop, SIM_MS(3100));
+
+    while (next_summary(&sum)) {
+        if (sum.kbps == 2000 && sum.pkts > 2000)
+            found = true;
+    }
+    CHECK(found);
+}
+
+/* Peer PRX, keeps its RX FIFO empty so it always acks */
+static void drain(sim_nrf_t *nrf, void *ctx) {
+    uint8_t payload[32];
+
+    while (sim_nrf_recv(nrf, payload, NULL) >= 0)
+        ;
+}
+
+/* One payload per CE pulse, accounted once it's acked or given up on */
+static void link_send(void) {
+    uint8_t payload[8] = { 0 };
+
+    xnrf_write_payload(&xnrf_config, payload, sizeof(payload));
+    xnrf_enable(&xnrf_config);
+    _delay_us(15);
+    xnrf_disable(&xnrf_config);
+    // the testbed masks TX_DS and MAX_RT off IRQ, so poll STATUS the way hop_tx_loop() does
+    while (!(xnrf_update_link_stats(&xnrf_config) & ((1 << TX_DS) | (1 << MAX_RT))))
+        ;
+}
+
+/* xnrf_update_link_stats() on the "ackpay" profile:  every transmission the radio made is a first try, or a retry
+ * summed from ARC_CNT, and MAX_RT counts as lost after all 15 retries
+ */
+static void link_counters(void) {
+    const xnrf_profile_t *ackpay = &ee_profiles[2];
+    xnrf_link_stats_t *link = &xnrf_config.link;
+
+    sim_nrf_t *nrf = testbed_radio_a();
+    testbed_boot(2);
+    sim_nrf_t *peer = sim_nrf_peer();
+    sim_nrf_link(peer, ackpay->rf_ch, 1000, testbed_addr(ackpay->tx_addr), 0, true, true);
+    sim_nrf_on_event(peer, drain, NULL);
+    sim_nrf_ce(peer, true);
+    sim_air_loss(ackpay->rf_ch, 300);
+    *link = (xnrf_link_stats_t){0};
+    xnrf_powerup_tx(&xnrf_config);
+    _delay_us(XNRF_TPD2STBY_US);
+
+    for (uint16_t i = 0; i < LINK_PACKETS; i++)
+        link_send();
+    printf("    sent %lu  retries %lu  lost %u\n", (unsigned long)link->sent, (unsigned long)link->retries, link->lost);
+    CHECK_EQ(link->sent + link->lost, LINK_PACKETS);
+    CHECK_EQ(sim_nrf_stats(nrf)->tx_packets, link->sent + link->lost + link->retries);
+    CHECK(link->retries > LINK_PACKETS / 2);
+
+    // nobody listening
+    uint32_t sent = link->sent, retries = link->retries;
+    uint16_t lost = link->lost;
+    sim_nrf_ce(peer, false);
+    link_send();
+    CHECK_EQ(link->sent, sent);
+    CHECK_EQ(link->lost, lost + 1);
+    CHECK_EQ(link->retries, retries + 15);
+    sim_air_loss(ackpay->rf_ch, 0);
+}
+
+int main(void) {
+    TEST_RUN(link_250k);
+    TEST_RUN(follows_rate);
+    TEST_RUN(link_counters);
+    return test_done();
+}
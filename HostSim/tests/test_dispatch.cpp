@@ -0,0 +1,181 @@
+/*
+ * test_dispatch.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Per pipe routing with xnrf_dispatch():  handlers, bounded queues read
+ *  through xnrf_pipe_peek() / xnrf_pipe_pop(), the per pipe counts, and the
+ *  payloads the FIFO can hand back that belong to no pipe.  Payloads are put
+ *  straight into radio A's RX FIFO with sim_nrf_inject().
+ */
+
+#include "testbed.h"
+
+static xnrf_dispatch_t dispatch;
+static xnrf_packet_t queue1[2];
+static uint8_t handled, handled_pipe, handled_len, handled_first;
+
+static void on_pipe0(xnrf_packet_t *packet) {
+    handled++;
+    handled_pipe = packet->pipe;
+    handled_len = packet->len;
+    handled_first = packet->data[0];
+}
+
+/* Radio A on a profile, pipe 0 to on_pipe0() and pipe 1 to a 2 deep queue */
+static sim_nrf_t *dispatch_setup(uint8_t profile) {
+    sim_nrf_t *nrf = testbed_radio_a();
+
+    testbed_boot(profile);
+    handled = 0;
+    xnrf_dispatch_init(&dispatch);
+    xnrf_dispatch_handler(&dispatch, 0, on_pipe0);
+    xnrf_dispatch_queue(&dispatch, 1, queue1, sizeof(queue1) / sizeof(queue1[0]));
+    return nrf;
+}
+
+/* Each payload goes where its pipe says, and the FIFO is left empty with SS up and RX_DR clear */
+static void routes_by_pipe(void) {
+    uint8_t a[32] = { 0xA0 }, b[32] = { 0xB0 }, c[32] = { 0xC0 };
+    sim_nrf_t *nrf = dispatch_setup(0);
+
+    sim_nrf_inject(nrf, 0, a, sizeof(a));
+    sim_nrf_inject(nrf, 1, b, sizeof(b));
+    sim_nrf_inject(nrf, 2, c, sizeof(c));
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 3);
+
+    CHECK_EQ(handled, 1);
+    CHECK_EQ(handled_pipe, 0);
+    CHECK_EQ(handled_len, 32);
+    CHECK_EQ(handled_first, 0xA0);
+
+    xnrf_packet_t *packet = xnrf_pipe_peek(&dispatch, 1);
+    CHECK(packet != NULL);
+    CHECK_EQ(packet->pipe, 1);
+    CHECK(!memcmp(packet->data, b, sizeof(b)));
+
+    // nowhere to go on pipe 2, so it's read out and dropped
+    CHECK_EQ(dispatch.pipes[0].received, 1);
+    CHECK_EQ(dispatch.pipes[1].received, 1);
+    CHECK_EQ(dispatch.pipes[2].received, 1);
+    CHECK_EQ(dispatch.pipes[2].dropped, 1);
+    CHECK_EQ(dispatch.pipes[0].dropped + dispatch.pipes[1].dropped, 0);
+
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(!sim_nrf_selected(nrf));
+    CHECK(!(sim_nrf_reg(nrf, NRF_STATUS) & (1 << RX_DR)));
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 0);
+}
+
+/* A handler wins over a queue on the same pipe */
+static void handler_over_queue(void) {
+    uint8_t a[32] = { 0xA1 };
+    sim_nrf_t *nrf = dispatch_setup(0);
+
+    xnrf_dispatch_queue(&dispatch, 0, queue1, sizeof(queue1) / sizeof(queue1[0]));
+    sim_nrf_inject(nrf, 0, a, sizeof(a));
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 1);
+    CHECK_EQ(handled, 1);
+    CHECK_EQ(handled_first, 0xA1);
+    CHECK(xnrf_pipe_peek(&dispatch, 0) == NULL);
+
+    // and taking the handler away leaves the queue
+    xnrf_dispatch_handler(&dispatch, 0, NULL);
+    sim_nrf_inject(nrf, 0, a, sizeof(a));
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 1);
+    CHECK_EQ(handled, 1);
+    CHECK(xnrf_pipe_peek(&dispatch, 0) != NULL);
+}
+
+/* A full queue drops what doesn't fit and keeps the oldest, in order, through many trips round the indexes */
+static void queue_overflow(void) {
+    uint8_t data[32] = { 0 };
+    uint16_t dropped = 0;
+    sim_nrf_t *nrf = dispatch_setup(0);
+
+    for (uint16_t round = 0; round < 200; round++) {
+        for (uint8_t i = 0; i < XNRF_RX_FIFO_DEPTH; i++) {
+            data[0] = (uint8_t)round;
+            data[1] = i;
+            sim_nrf_inject(nrf, 1, data, sizeof(data));
+        }
+        CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), XNRF_RX_FIFO_DEPTH);
+        dropped++;
+
+        for (uint8_t i = 0; i < 2; i++) {
+            xnrf_packet_t *packet = xnrf_pipe_peek(&dispatch, 1);
+            CHECK(packet != NULL);
+            if (!packet)
+                return;
+            CHECK_EQ(packet->data[0], (uint8_t)round);
+            CHECK_EQ(packet->data[1], i);
+            // peek doesn't consume
+            CHECK(xnrf_pipe_peek(&dispatch, 1) == packet);
+            xnrf_pipe_pop(&dispatch, 1);
+        }
+        CHECK(xnrf_pipe_peek(&dispatch, 1) == NULL);
+    }
+    CHECK_EQ(dispatch.pipes[1].received, 200 * XNRF_RX_FIFO_DEPTH);
+    CHECK_EQ(dispatch.pipes[1].dropped, dropped);
+}
+
+/* RX_P_NO 6 ("not used") isn't a pipe.  The payload is read out so the FIFO and bus move on, and counts nowhere */
+static void out_of_range_pipe(void) {
+    uint8_t junk[32] = { 0xEE }, a[32] = { 0xA2 };
+    sim_nrf_t *nrf = dispatch_setup(0);
+
+    sim_nrf_inject(nrf, 6, junk, sizeof(junk));
+    sim_nrf_inject(nrf, 0, a, sizeof(a));
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 1);
+    CHECK_EQ(handled, 1);
+    CHECK_EQ(handled_first, 0xA2);
+    for (uint8_t pipe = 1; pipe < XNRF_PIPES; pipe++)
+        CHECK_EQ(dispatch.pipes[pipe].received + dispatch.pipes[pipe].dropped, 0);
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(!sim_nrf_selected(nrf));
+}
+
+/* A dynamic width of 0 is as corrupt as one over 32:  flushed, with SS raised rather than left on an open read */
+static void zero_width(void) {
+    uint8_t good[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    sim_nrf_t *nrf = dispatch_setup(2);     /* "ackpay", dynamic payloads on pipes 0 & 1 */
+
+    sim_nrf_inject(nrf, 1, good, 0);
+    sim_nrf_inject(nrf, 1, good, 7);
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 0);
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(!sim_nrf_selected(nrf));
+    CHECK(xnrf_pipe_peek(&dispatch, 1) == NULL);
+
+    sim_nrf_inject(nrf, 0, good, 0);
+    CHECK_EQ(xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH), 0);
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(!sim_nrf_selected(nrf));
+
+    // and the next good one comes through
+    sim_nrf_inject(nrf, 1, good, 7);
+    CHECK_EQ(xnrf_dispatch(&xnrf_config, &dispatch), 1);
+    xnrf_packet_t *packet = xnrf_pipe_peek(&dispatch, 1);
+    CHECK(packet != NULL && packet->len == 7 && !memcmp(packet->data, good, 7));
+}
+
+int main(void) {
+    TEST_RUN(routes_by_pipe);
+    TEST_RUN(handler_over_queue);
+    TEST_RUN(queue_overflow);
+    TEST_RUN(out_of_range_pipe);
+    TEST_RUN(zero_width);
+    return test_done();
+}
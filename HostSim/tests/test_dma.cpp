@@ -0,0 +1,136 @@
+/*
+ * test_dma.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  DMA (A4U) / EDMA (E5) backed async transfers against a slave that logs
+ *  MOSI and answers with a counting pattern.  Built with XSPI_DMA_ENABLED.
+ */
+
+#include <string.h>
+#include <util/delay.h>
+#include "XSPI.h"
+#include "test.h"
+
+static uint8_t mosi_log[64];
+static uint8_t mosi_count;
+static uint8_t miso_next;
+static uint8_t callbacks;
+
+static uint8_t slave_exchange(void *ctx, uint8_t mosi) {
+    if (mosi_count < sizeof(mosi_log))
+        mosi_log[mosi_count] = mosi;
+    mosi_count++;
+    return miso_next++;
+}
+
+static sim_spi_slave_t slave = { &PORTC, 4, slave_exchange, NULL, NULL };
+
+static void done(void) {
+    callbacks++;
+}
+
+static void setup(void) {
+    mosi_count = 0;
+    miso_next = 0x40;
+    callbacks = 0;
+    sim_spi_attach(&SPIC, &slave);
+    PORTC.OUTSET = XSPI_SS;
+    xspi_master_init(&PORTC, &SPIC, SPI_MODE_0_gc, false, SPI_PRESCALER_DIV16_gc, true);
+    PMIC.CTRL = PMIC_LOLVLEN_bm;
+    sei();
+}
+
+static void wait_done(void) {
+    for (uint16_t i = 0; xspi_dma_busy() && i < 1000; i++)
+        _delay_us(1);
+    CHECK(!xspi_dma_busy());
+    PORTC.OUTSET = XSPI_SS;
+}
+
+/* send with a guard byte in front of the buffer, the first byte must never come from data[-1] */
+static void send_len(uint8_t len) {
+    uint8_t buffer[1 + 32];
+    uint8_t *data = buffer + 1;
+
+    buffer[0] = 0xEE;
+    for (uint8_t i = 0; i < len; i++)
+        data[i] = i + 1;
+    setup();
+    PORTC.OUTCLR = XSPI_SS;
+    CHECK(xspi_send_packet_async(&SPIC, data, len, done));
+    CHECK(xspi_dma_busy());
+    wait_done();
+    CHECK_EQ(callbacks, 1);
+    CHECK_EQ(mosi_count, len);
+    CHECK(!memcmp(mosi_log, data, len));
+    CHECK_EQ(sim_bus_stats(&SPIC)->collisions, 0);
+    CHECK_EQ(sim_bus_stats(&SPIC)->unselected, 0);
+
+    // blocking calls still work after an async one
+    uint8_t byte = 0x5A;
+    PORTC.OUTCLR = XSPI_SS;
+    xspi_send_packet(&SPIC, &byte, 1);
+    PORTC.OUTSET = XSPI_SS;
+    CHECK_EQ(mosi_log[len], 0x5A);
+}
+
+static void get_len(uint8_t len) {
+    uint8_t buffer[32 + 1];
+
+    memset(buffer, 0, sizeof(buffer));
+    setup();
+    PORTC.OUTCLR = XSPI_SS;
+    CHECK(xspi_get_packet_async(&SPIC, buffer, len, done));
+    wait_done();
+    CHECK_EQ(callbacks, 1);
+    CHECK_EQ(mosi_count, len);
+    for (uint8_t i = 0; i < len; i++) {
+        CHECK_EQ(mosi_log[i], 0xFF);
+        CHECK_EQ(buffer[i], 0x40 + i);
+    }
+    CHECK_EQ(buffer[len], 0);
+}
+
+static void send_1(void) { send_len(1); }
+static void send_2(void) { send_len(2); }
+static void send_32(void) { send_len(32); }
+static void get_1(void) { get_len(1); }
+static void get_2(void) { get_len(2); }
+static void get_32(void) { get_len(32); }
+
+/* One transfer at a time, and nothing for zero lengths */
+static void busy_rejects(void) {
+    uint8_t data[8] = { 0 };
+
+    setup();
+    CHECK(!xspi_send_packet_async(&SPIC, data, 0, done));
+    PORTC.OUTCLR = XSPI_SS;
+    CHECK(xspi_send_packet_async(&SPIC, data, sizeof(data), done));
+    CHECK(!xspi_get_packet_async(&SPIC, data, sizeof(data), done));
+    wait_done();
+    CHECK_EQ(callbacks, 1);
+}
+
+int main(void) {
+    TEST_RUN(send_1);
+    TEST_RUN(send_2);
+    TEST_RUN(send_32);
+    TEST_RUN(get_1);
+    TEST_RUN(get_2);
+    TEST_RUN(get_32);
+    TEST_RUN(busy_rejects);
+    return test_done();
+}
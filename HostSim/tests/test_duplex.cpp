@@ -0,0 +1,285 @@
+/*
+ * test_duplex.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  bridge_duplex_loop() on the "fast" profile with both directions loaded at
+ *  once:  the host feeds SLIP frames into USARTD0 while one peer transmits to
+ *  the bridge and another listens for what it sends.  Reports sustained
+ *  duplex throughput, paced and with the host writing back to back.  Also
+ *  the dynamic payload reads and rx_ack_payload_loop() on the "ackpay"
+ *  profile.
+ */
+
+#include <stdio.h>
+#include "testbed.h"
+
+#define RUN_MS      1000
+
+typedef struct {
+    const char *name;
+    uint8_t host_len;           /* payload bytes in each host frame */
+    uint16_t host_period_us;    /* 0 keeps the host's line busy */
+    uint16_t radio_period_us;
+} duplex_load_t;
+
+static const duplex_load_t *load;
+static uint32_t host_sent, host_got;            /* frames the host fed, and their payloads the listening peer saw */
+static uint32_t radio_sent, radio_got;          /* payloads the transmitting peer sent, and frames the host got back */
+static uint32_t host_bad;                       /* frames from the bridge with a bad CRC */
+static uint8_t host_frame_buf[64];              /* host side SLIP decoder */
+static uint8_t host_frame_len;
+static bool host_esc;
+
+/* SLIP encodes a bridge frame for the host to send */
+static size_t host_frame(uint8_t *wire, uint32_t n, uint8_t payload_len) {
+    uint8_t frame[3 + XNRF_MAX_PAYLOAD + 2] = { 0, payload_len, (uint8_t)n };
+    uint8_t len = 3 + payload_len;
+    uint16_t crc = 0xFFFF;
+    size_t out = 0;
+
+    frame[3] = 'H';
+    memcpy(&frame[4], &n, sizeof(n));
+    for (uint8_t i = 0; i < len; i++)
+        crc = _crc_ccitt_update(crc, frame[i]);
+    frame[len++] = (uint8_t)crc;
+    frame[len++] = (uint8_t)(crc >> 8);
+
+    wire[out++] = XUSART_SLIP_END;
+    for (uint8_t i = 0; i < len; i++) {
+        if (frame[i] == XUSART_SLIP_END) {
+            wire[out++] = XUSART_SLIP_ESC;
+            wire[out++] = XUSART_SLIP_ESC_END;
+        } else if (frame[i] == XUSART_SLIP_ESC) {
+            wire[out++] = XUSART_SLIP_ESC;
+            wire[out++] = XUSART_SLIP_ESC_ESC;
+        } else {
+            wire[out++] = frame[i];
+        }
+    }
+    wire[out++] = XUSART_SLIP_END;
+    return out;
+}
+
+/* Decodes what the bridge sent up, counting the peer's payloads */
+static void host_collect(void) {
+    uint8_t wire[256];
+    size_t got = sim_uart_take(&USARTD0, wire, sizeof(wire));
+
+    for (size_t i = 0; i < got; i++) {
+        uint8_t c = wire[i];
+        if (c == XUSART_SLIP_END) {
+            if (host_frame_len) {
+                uint16_t crc = 0xFFFF;
+                for (uint8_t j = 0; j < host_frame_len; j++)
+                    crc = _crc_ccitt_update(crc, host_frame_buf[j]);
+                if (crc || host_frame_len < 5)
+                    host_bad++;
+                else if (host_frame_buf[3] == 'R')
+                    radio_got++;
+            }
+            host_frame_len = 0;
+        } else if (c == XUSART_SLIP_ESC) {
+            host_esc = true;
+        } else if (host_frame_len < sizeof(host_frame_buf)) {
+            host_frame_buf[host_frame_len++] = host_esc ? (c == XUSART_SLIP_ESC_END ? XUSART_SLIP_END : XUSART_SLIP_ESC) : c;
+            host_esc = false;
+        }
+    }
+}
+
+/* Host writing frames to the bridge, and reading what came back */
+static void host_tick(void *ctx) {
+    uint8_t wire[2 * (3 + XNRF_MAX_PAYLOAD + 2) + 2];
+
+    host_collect();
+    if (load->host_period_us) {
+        sim_uart_feed(&USARTD0, wire, host_frame(wire, host_sent++, load->host_len));
+        sim_at(sim_now() + SIM_US(load->host_period_us), host_tick, NULL);
+    } else {
+        // top the line up a frame ahead
+        if (sim_uart_feed_pending(&USARTD0) < 2 * (3 + XNRF_MAX_PAYLOAD + 2))
+            sim_uart_feed(&USARTD0, wire, host_frame(wire, host_sent++, load->host_len));
+        sim_at(sim_now() + SIM_US(200), host_tick, NULL);
+    }
+}
+
+/* Transmitting peer, one payload every radio_period_us */
+static void radio_tick(void *ctx) {
+    sim_nrf_t *nrf = (sim_nrf_t *)ctx;
+    uint8_t payload[32] = { 'R' };
+
+    sim_nrf_clear_irq(nrf);
+    memcpy(&payload[1], &radio_sent, sizeof(radio_sent));
+    if (sim_nrf_send(nrf, payload, sizeof(payload), false))
+        radio_sent++;
+    sim_at(sim_now() + SIM_US(load->radio_period_us), radio_tick, nrf);
+}
+
+/* Listening peer, counting what came from the host */
+static void listener(sim_nrf_t *nrf, void *ctx) {
+    uint8_t payload[32];
+
+    while (sim_nrf_recv(nrf, payload, NULL) >= 0) {
+        if (payload[0] == 'H')
+            host_got++;
+    }
+}
+
+/* Runs the bridge on the "fast" profile under a load, and reports */
+static void duplex_run(const duplex_load_t *with) {
+    const xnrf_profile_t *fast = &ee_profiles[1];
+    sim_mark_t mark;
+
+    load = with;
+    host_sent = host_got = radio_sent = radio_got = host_bad = 0;
+    host_frame_len = 0;
+    host_esc = false;
+    bridge_stats = (bridge_stats_t){0};
+    bridge_txq_head = bridge_txq_tail = 0;
+
+    testbed_radio_a();
+    testbed_boot(1);
+    sim_nrf_t *talker = sim_nrf_peer();
+    sim_nrf_t *listen = sim_nrf_peer();
+    sim_nrf_link(talker, fast->rf_ch, 2000, testbed_addr(fast->rx0_addr), 32, false, false);
+    sim_nrf_link(listen, fast->rf_ch, 2000, testbed_addr(fast->tx_addr), 32, false, true);
+    sim_nrf_on_event(listen, listener, NULL);
+    sim_nrf_ce(talker, true);
+    sim_nrf_ce(listen, true);
+
+    // offset the two sides so they don't always meet on air
+    sim_at(sim_now() + SIM_MS(10), host_tick, NULL);
+    sim_at(sim_now() + SIM_MS(10) + SIM_US(load->radio_period_us / 2), radio_tick, talker);
+
+    sim_mark(&mark, &SPIC);
+    sim_run(bridge_duplex_loop, SIM_MS(RUN_MS));
+    host_collect();
+    sim_report(load->name, &mark, &SPIC, host_got * load->host_len + radio_got * 32);
+    printf("    host -> radio %u/%u  radio -> host %u/%u  flips %u  crc errors %u\n", host_got, host_sent, radio_got,
+            radio_sent, bridge_stats.flips, bridge_stats.crc_errors);
+
+    CHECK(radio_sent + 5 > RUN_MS * 1000UL / load->radio_period_us);
+    CHECK_EQ(bridge_stats.crc_errors, 0);
+    CHECK_EQ(host_bad, 0);
+    CHECK(bridge_stats.flips > 0 && bridge_stats.flips <= host_got);
+}
+
+/* 32 byte frames both ways every 5ms, about 6.4kB/s each way */
+static void paced(void) {
+    static const duplex_load_t paced_load = { "bridge duplex, paced", 32, 5000, 5000 };
+
+    duplex_run(&paced_load);
+    CHECK(host_sent + 5 > RUN_MS * 1000UL / paced_load.host_period_us);
+    // the last frame or two can still be on the line when the run stops, and the talker can catch the bridge in TX
+    CHECK(host_got + 3 >= host_sent);
+    CHECK(radio_got >= radio_sent * 9 / 10);
+}
+
+/* Host line saturated with short frames, so TX batches fill and turnarounds are shared */
+static void host_saturated(void) {
+    static const duplex_load_t saturated_load = { "bridge duplex, host saturated", 8, 0, 4000 };
+
+    duplex_run(&saturated_load);
+    CHECK(host_sent > 500);
+    CHECK(bridge_stats.flips * 3 < host_got * 2);   /* more than 1.5 frames a turnaround */
+    // There's no auto-ack on this profile.  The bridge is deaf while it transmits, and its packets collide with the
+    // talker's on air, so both directions lose more as the host keeps the radio in TX more of the time.
+    CHECK(host_got >= host_sent * 8 / 10);
+    CHECK(radio_got >= radio_sent / 2);
+}
+
+/* A dynamic width over 32 flushes the RX FIFO, whatever is behind it included, and the next read is fine */
+static void corrupt_width(void) {
+    uint8_t good[7] = { 1, 2, 3, 4, 5, 6, 7 }, junk[32] = { 0 };
+    sim_nrf_t *nrf = testbed_radio_a();
+
+    testbed_boot(2);                    /* "ackpay", dynamic payloads on pipes 0 & 1 */
+    sim_nrf_inject(nrf, 1, good, 5);
+    sim_nrf_inject(nrf, 0, junk, 40);
+    sim_nrf_inject(nrf, 1, good, 7);
+    CHECK_EQ(xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH), 1);
+    CHECK_EQ(rxbatch[0].pipe, 1);
+    CHECK_EQ(rxbatch[0].len, 5);
+    CHECK(!memcmp(rxbatch[0].data, good, 5));
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(!sim_nrf_selected(nrf));
+    CHECK(!(sim_nrf_reg(nrf, NRF_STATUS) & (1 << RX_DR)));
+
+    // the single payload read too
+    sim_nrf_inject(nrf, 0, junk, 33);
+    CHECK_EQ(xnrf_read_dynamic_payload(&xnrf_config, junk), 0);
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+
+    sim_nrf_inject(nrf, 0, good, 7);
+    CHECK_EQ(xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH), 1);
+    CHECK_EQ(rxbatch[0].pipe, 0);
+    CHECK_EQ(rxbatch[0].len, 7);
+    CHECK(!memcmp(rxbatch[0].data, good, 7));
+}
+
+typedef struct {
+    sim_nrf_t *nrf;
+    uint8_t next;               /* id of the next packet, each peer has its own range */
+    uint32_t acked, wrong;      /* ack payloads with the id sent before the last one, and any others */
+} ack_peer_t;
+
+/* Peer PTX sending a packet every 2ms, checking what came back on the ack of the last one */
+static void ack_peer_tick(void *ctx) {
+    ack_peer_t *peer = (ack_peer_t *)ctx;
+    uint8_t payload[2] = { peer->next, 0 }, ack[32];
+
+    // rx_ack_payload_loop() queues each packet's id once it has read it, so it goes out with the next one's ack
+    while (sim_nrf_recv(peer->nrf, ack, NULL) >= 0) {
+        if (ack[0] == (uint8_t)(peer->next - 2))
+            peer->acked++;
+        else
+            peer->wrong++;
+    }
+    sim_nrf_clear_irq(peer->nrf);
+    if (sim_nrf_send(peer->nrf, payload, sizeof(payload), false))
+        peer->next++;
+    sim_at(sim_now() + SIM_MS(2), ack_peer_tick, peer);
+}
+
+/* Ack payloads go back in order on the pipe each packet came in on, one packet behind */
+static void ack_payload_order(void) {
+    const xnrf_profile_t *ackpay = &ee_profiles[2];
+    ack_peer_t peers[2] = { { NULL, 0x01 }, { NULL, 0x81 } };
+    const uint8_t *addr[2] = { ackpay->rx0_addr, ackpay->rx1_addr };
+
+    testbed_radio_a();
+    testbed_boot(2);
+    for (uint8_t i = 0; i < 2; i++) {
+        peers[i].nrf = sim_nrf_peer();
+        sim_nrf_link(peers[i].nrf, ackpay->rf_ch, 1000, testbed_addr(addr[i]), 0, true, false);
+        sim_nrf_ce(peers[i].nrf, true);
+        sim_at(sim_now() + SIM_MS(10) + SIM_US(1000 * i), ack_peer_tick, &peers[i]);
+    }
+
+    sim_run(rx_ack_payload_loop, SIM_MS(210));
+    for (uint8_t i = 0; i < 2; i++) {
+        CHECK_EQ(peers[i].wrong, 0);
+        CHECK(peers[i].acked >= 95);
+    }
+}
+
+int main(void) {
+    TEST_RUN(paced);
+    TEST_RUN(host_saturated);
+    TEST_RUN(corrupt_width);
+    TEST_RUN(ack_payload_order);
+    return test_done();
+}
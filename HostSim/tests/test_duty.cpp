@@ -0,0 +1,87 @@
+/*
+ * test_duty.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  duty_rx_loop() on the RTC with the clock started just short of both its
+ *  wraps:  the microsecond count wraps 2s in and the 32 bit tick count 4s in.
+ *  A peer sends every 4.1ms, so windows keep catching something and the
+ *  wake schedule has to carry on through both wraps without a miss.
+ */
+
+#include "testbed.h"
+
+#define US_WRAP_MS      2000
+#define RUN_MS          7500        /* past the first report at 64 wakes */
+#define PEER_GAP_US     4100        /* past DUTY_HOLD_US so windows close, and off the period's grid so hits vary */
+
+/* Peer PTX sending one payload every PEER_GAP_US, the message id going up once a second */
+static void peer_tick(void *ctx) {
+    sim_nrf_t *nrf = (sim_nrf_t *)ctx;
+    uint8_t payload[32] = { 0 };
+
+    sim_nrf_clear_irq(nrf);
+    payload[0] = 1 + sim_now() / SIM_MS(1000);
+    sim_nrf_send(nrf, payload, sizeof(payload), false);
+    sim_at(sim_now() + SIM_US(PEER_GAP_US), peer_tick, nrf);
+}
+
+/* Wakes every DUTY_PERIOD_US with no misses, and still hears the peer, across the microsecond and tick wraps */
+static void schedule_across_wraps(void) {
+    const xnrf_profile_t *bridge = &ee_profiles[0];
+    char out[4096];
+    unsigned wakes = 0, hits = 0, missed = 1;
+
+    testbed_radio_a();
+    eeprom_update_byte(&ee_profile_boot, 0);
+    init();
+
+    // the RTC overflows every 2s, so the ticks wrap 4s in.  The us clock is set to wrap 2s in
+    rtc_ovf = 0xFFFE;
+    rtc_us_ticks = (uint32_t)rtc_ovf << 16;
+    rtc_us_total = 0xFFFFFFFFUL - US_WRAP_MS * 1000UL;
+
+    sim_nrf_t *peer = sim_nrf_peer();
+    sim_nrf_link(peer, bridge->rf_ch, 250, testbed_addr(bridge->rx0_addr), 32, false, false);
+    sim_nrf_ce(peer, true);
+    sim_at(sim_now() + SIM_US(PEER_GAP_US), peer_tick, peer);
+
+    sim_run(duty_rx_loop, SIM_MS(RUN_MS));
+    CHECK(rtc_now() < 0x20000UL);       /* the ticks did wrap */
+    CHECK(rtc_us_total < 0x80000000UL); /* and so did the us */
+
+    size_t len = sim_uart_take(&USARTD0, (uint8_t *)out, sizeof(out) - 1);
+    out[len] = 0;
+    const char *report = NULL;
+    for (size_t i = 0; i + 6 < len; i++) {
+        if (!memcmp(&out[i], "wakes ", 6)) {
+            report = &out[i];
+            break;
+        }
+    }
+    CHECK(report);
+    if (report) {
+        printf("    %.*s\n", (int)strcspn(report, "\r\n"), report);
+        CHECK_EQ(sscanf(report, "wakes %u hits %u missed %u", &wakes, &hits, &missed), 3);
+    }
+    CHECK_EQ(wakes, DUTY_REPORT_WAKES);
+    CHECK_EQ(missed, 0);
+    CHECK(hits > wakes / 4 && hits <= wakes);
+}
+
+int main(void) {
+    TEST_RUN(schedule_across_wraps);
+    return test_done();
+}
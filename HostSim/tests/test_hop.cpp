@@ -0,0 +1,199 @@
+/*
+ * test_hop.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Frequency hopping:  hop_tx_loop() on the "fast" profile, acked by a peer
+ *  PRX parked on each hop channel, with one channel losing every packet for
+ *  a while.  It has to be blacklisted, and come back once the loss is gone
+ *  and its parole is up.  Hopping against a fixed channel link with one
+ *  channel jammed, and xnrf_hop_init() / xnrf_hop_sync() turning down bad
+ *  lists and headers.
+ */
+
+#include "testbed.h"
+
+#define LOSSY_INDEX     8           /* hop_channels[8], channel 66 */
+#define CLEAR_MS        6000        /* loss on the lossy channel ends */
+#define RUN_MS          12000
+#define JAMMED_PERMILLE 900         /* jammed channel loss, packets and ACKs alike, so 1 try in 100 gets through */
+#define COMPARE_MS      3000
+
+static uint16_t blacklist_at_clear;
+static uint32_t lossy_at_clear;
+static sim_nrf_t *peers[sizeof(hop_channels)];
+
+/* Peer PRX, keeps its RX FIFO empty so it always acks */
+static void drain(sim_nrf_t *nrf, void *ctx) {
+    uint8_t payload[32];
+
+    while (sim_nrf_recv(nrf, payload, NULL) >= 0)
+        ;
+}
+
+static void clear_loss(void *ctx) {
+    blacklist_at_clear = loop_ram.hop.blacklist;
+    lossy_at_clear = sim_nrf_stats(peers[LOSSY_INDEX])->rx_packets;
+    sim_air_loss(hop_channels[LOSSY_INDEX], 0);
+}
+
+/* Radio A on the "fast" profile, and an acking peer parked on every hop channel */
+static void hop_peers(void) {
+    const xnrf_profile_t *fast = &ee_profiles[1];
+
+    testbed_radio_a();
+    testbed_boot(1);
+    for (uint8_t i = 0; i < sizeof(hop_channels); i++) {
+        peers[i] = sim_nrf_peer();
+        sim_nrf_link(peers[i], hop_channels[i], 2000, testbed_addr(fast->tx_addr), 32, true, true);
+        sim_nrf_on_event(peers[i], drain, NULL);
+        sim_nrf_ce(peers[i], true);
+    }
+}
+
+static uint32_t hop_delivered(void) {
+    uint32_t total = 0;
+
+    for (uint8_t i = 0; i < sizeof(hop_channels); i++)
+        total += sim_nrf_stats(peers[i])->rx_packets;
+    return total;
+}
+
+/* hop_tx_loop() without the hopping:  the same packet per slot and retry settings, parked on the lossy channel */
+static void fixed_tx_loop(void) {
+    uint8_t payload[32] = {0};
+
+    xnrf_set_autoack(&xnrf_config, (1 << ENAA_P0));
+    xnrf_set_retries(&xnrf_config, 1, 3);
+    xnrf_set_channel(&xnrf_config, hop_channels[LOSSY_INDEX]);
+    xnrf_powerup_tx(&xnrf_config);
+    _delay_ms(5);
+
+    while (1) {
+        xnrf_flush_tx(&xnrf_config);
+        xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+        xnrf_write_payload(&xnrf_config, payload, xnrf_config.payload_width);
+        xnrf_enable(&xnrf_config);
+        _delay_us(15);
+        xnrf_disable(&xnrf_config);
+        _delay_us(HOP_SLOT_US);
+    }
+}
+
+/* A link stuck on a jammed channel loses most of its packets, hopping loses only the jammed channel's share */
+static void jammed_hopping_vs_fixed(void) {
+    hop_peers();
+    sim_air_loss(hop_channels[LOSSY_INDEX], JAMMED_PERMILLE);
+    sim_run(fixed_tx_loop, SIM_MS(COMPARE_MS));
+    uint32_t fixed = hop_delivered();
+
+    sim_reset(1);
+    hop_peers();
+    sim_air_loss(hop_channels[LOSSY_INDEX], JAMMED_PERMILLE);
+    sim_run(hop_tx_loop, SIM_MS(COMPARE_MS));
+    uint32_t hopping = hop_delivered();
+    printf("    delivered in %ums, fixed %lu  hopping %lu\n", COMPARE_MS, (unsigned long)fixed, (unsigned long)hopping);
+
+    // about a slot's worth of packets each way
+    uint32_t slots = COMPARE_MS * 1000UL / HOP_SLOT_US;
+    CHECK(fixed < slots / 2);
+    CHECK(hopping > slots * 9 / 10);
+    CHECK(hopping > fixed * 2);
+    sim_air_loss(hop_channels[LOSSY_INDEX], 0);
+}
+
+/* A channel losing everything is blacklisted, sits out its parole, and is back in the hop sequence after */
+static void blacklist_and_parole(void) {
+    hop_peers();
+    sim_air_loss(hop_channels[LOSSY_INDEX], 1000);
+    sim_at(sim_now() + SIM_MS(CLEAR_MS), clear_loss, NULL);
+
+    sim_run(hop_tx_loop, SIM_MS(RUN_MS));
+
+    // only the lossy channel went, and nothing reached it while it was out
+    CHECK_EQ(blacklist_at_clear, 1U << LOSSY_INDEX);
+    CHECK_EQ(lossy_at_clear, 0);
+    // parole is XNRF_HOP_PAROLE windows of XNRF_HOP_WINDOW slots, about 4s at 8ms slots, then it carries traffic again
+    CHECK_EQ(loop_ram.hop.blacklist, 0);
+    CHECK(sim_nrf_stats(peers[LOSSY_INDEX])->rx_packets > 0);
+    for (uint8_t i = 0; i < sizeof(hop_channels); i++) {
+        if (i != LOSSY_INDEX)
+            CHECK(sim_nrf_stats(peers[i])->rx_packets * sizeof(hop_channels) * HOP_SLOT_US > RUN_MS * 1000UL / 2);
+    }
+    sim_air_loss(hop_channels[LOSSY_INDEX], 0);
+}
+
+/* Receiver only adopts headers with the magic byte and a blacklist the transmitter could have sent */
+static void sync_rejects_bad_headers(void) {
+    const uint8_t stray[XNRF_HOP_HEADER_SIZE] = { 0x00, 5, 0x00, 0x00 };
+    const uint8_t all_out[XNRF_HOP_HEADER_SIZE] = { XNRF_HOP_MAGIC, 5, 0xFF, 0xFF };
+    const uint8_t one_left[XNRF_HOP_HEADER_SIZE] = { XNRF_HOP_MAGIC, 5, 0xFE, 0xFF };
+    const uint8_t past_list[XNRF_HOP_HEADER_SIZE] = { XNRF_HOP_MAGIC, 5, 0x00, 0x80 };
+    const uint8_t good[XNRF_HOP_HEADER_SIZE] = { XNRF_HOP_MAGIC, 5, 0x00, 0x01 };
+    xnrf_hop_t *hop = &loop_ram.hop;
+    sim_nrf_t *nrf = testbed_radio_a();
+
+    testbed_boot(1);
+    xnrf_hop_init(&xnrf_config, hop, hop_channels, sizeof(hop_channels), HOP_SEED, HOP_SLOT_US, HOP_LOSS_PCT, false, 0);
+    CHECK(!xnrf_hop_sync(&xnrf_config, hop, stray, 0));
+    CHECK(!xnrf_hop_sync(&xnrf_config, hop, all_out, 0));
+    CHECK(!xnrf_hop_sync(&xnrf_config, hop, one_left, 0));
+    CHECK(!hop->synced);
+
+    // a 15 channel list can't have bit 15 set
+    xnrf_hop_init(&xnrf_config, hop, hop_channels, sizeof(hop_channels) - 1, HOP_SEED, HOP_SLOT_US, HOP_LOSS_PCT,
+                  false, 0);
+    CHECK(!xnrf_hop_sync(&xnrf_config, hop, past_list, 0));
+    CHECK(!hop->synced);
+
+    xnrf_hop_init(&xnrf_config, hop, hop_channels, sizeof(hop_channels), HOP_SEED, HOP_SLOT_US, HOP_LOSS_PCT, false, 0);
+    CHECK(xnrf_hop_sync(&xnrf_config, hop, good, 0));
+    CHECK(hop->synced);
+    CHECK_EQ(hop->slot, 5);
+    CHECK_EQ(hop->blacklist, 0x0100);
+    CHECK(sim_nrf_reg(nrf, RF_CH) != hop_channels[8]);
+
+    // a full 16 channel list can have any bit set
+    hop->synced = false;
+    CHECK(xnrf_hop_sync(&xnrf_config, hop, past_list, 0));
+    CHECK_EQ(hop->blacklist, 0x8000);
+}
+
+/* Lists too short to hop over are turned down, leaving hop and the radio alone */
+static void init_rejects_short_lists(void) {
+    xnrf_hop_t *hop = &loop_ram.hop;
+    sim_nrf_t *nrf = testbed_radio_a();
+
+    testbed_boot(1);
+    memset(hop, 0x55, sizeof(*hop));
+    uint8_t channel = sim_nrf_reg(nrf, RF_CH);
+    CHECK(!xnrf_hop_init(&xnrf_config, hop, hop_channels, 0, HOP_SEED, HOP_SLOT_US, HOP_LOSS_PCT, true, 0));
+    CHECK(!xnrf_hop_init(&xnrf_config, hop, hop_channels + 3, 1, HOP_SEED, HOP_SLOT_US, HOP_LOSS_PCT, true, 0));
+    CHECK_EQ(hop->count, 0x55);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_CH), channel);
+
+    CHECK(xnrf_hop_init(&xnrf_config, hop, hop_channels + 3, XNRF_HOP_MIN_CHANNELS, HOP_SEED, HOP_SLOT_US,
+                        HOP_LOSS_PCT, true, 0));
+    CHECK_EQ(hop->count, XNRF_HOP_MIN_CHANNELS);
+    CHECK(sim_nrf_reg(nrf, RF_CH) == hop_channels[3] || sim_nrf_reg(nrf, RF_CH) == hop_channels[4]);
+}
+
+int main(void) {
+    TEST_RUN(jammed_hopping_vs_fixed);
+    TEST_RUN(blacklist_and_parole);
+    TEST_RUN(sync_rejects_bad_headers);
+    TEST_RUN(init_rejects_short_lists);
+    return test_done();
+}
@@ -0,0 +1,150 @@
+/*
+ * test_multi_rx.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Two radios on SPIC behind the bus arbiter:  multi_rx_loop() with a peer
+ *  streaming back to back into each, radio A at 2Mbps and radio B at
+ *  250kbps.  Then the same with interrupts held off in bursts, so radio A's
+ *  FIFO is full when it's serviced and refills while it's drained.
+ */
+
+#include "testbed.h"
+
+#define SETUP_MS    150     /* multi_rx_loop() setup, radio B's Tpor included */
+#define STOP_MS     600     /* peers go quiet */
+#define RUN_MS      650
+
+static bool streaming;
+static uint32_t early_a, early_b;
+
+/* Peer PTX keeping its TX FIFO topped up while streaming */
+static void feed(sim_nrf_t *nrf, void *ctx) {
+    uint8_t *seq = (uint8_t *)ctx;
+    uint8_t payload[32];
+
+    if (sim_nrf_reg(nrf, NRF_STATUS) & ((1 << TX_DS) | (1 << MAX_RT)))
+        sim_nrf_clear_irq(nrf);
+    while (streaming && sim_nrf_tx_count(nrf) < 3) {
+        memset(payload, (*seq)++, sizeof(payload));
+        sim_nrf_send(nrf, payload, sizeof(payload), false);
+    }
+}
+
+static void snapshot(void *ctx) {
+    early_a = loop_ram.bus.stats[0].packets;
+    early_b = loop_ram.bus.stats[1].packets;
+}
+
+static void stop(void *ctx) {
+    streaming = false;
+}
+
+static sim_nrf_t *nrf_a, *nrf_b;
+
+/* Boots the testbed with a peer streaming into each radio until STOP_MS */
+static void start(void) {
+    static uint8_t seq_a, seq_b;
+    xnrf_profile_t fast100;
+
+    // the fast profile moved to radio A's channel, radio B sits on channel 110 at 250kbps
+    eeprom_read_block(&fast100, &ee_profiles[1], sizeof(fast100));
+    fast100.rf_ch = 100;
+    eeprom_update_block(&fast100, &ee_profiles[3], sizeof(fast100));
+
+    nrf_a = testbed_radio_a();
+    nrf_b = testbed_radio_b();
+    testbed_boot(3);
+
+    sim_nrf_t *peer_a = sim_nrf_peer();
+    sim_nrf_t *peer_b = sim_nrf_peer();
+    sim_nrf_link(peer_a, 100, 2000, testbed_addr(fast100.rx0_addr), 32, false, false);
+    sim_nrf_link(peer_b, 110, 250, 0xF0F0F0F0E1ULL, 32, false, false);
+    sim_nrf_on_event(peer_a, feed, &seq_a);
+    sim_nrf_on_event(peer_b, feed, &seq_b);
+    streaming = true;
+    feed(peer_a, &seq_a);
+    feed(peer_b, &seq_b);
+    sim_nrf_ce(peer_a, true);
+    sim_nrf_ce(peer_b, true);
+
+    sim_at(sim_now() + SIM_MS(STOP_MS / 2), snapshot, NULL);
+    sim_at(sim_now() + SIM_MS(STOP_MS), stop, NULL);
+}
+
+/* Both radios still serviced in the second half at about the rate of the first, and empty with IRQ high at the end */
+static void check_both(void) {
+    uint32_t late_a = loop_ram.bus.stats[0].packets - early_a;
+    uint32_t late_b = loop_ram.bus.stats[1].packets - early_b;
+
+    CHECK(early_a > 200 && late_a > early_a / 2);
+    CHECK(early_b > 50 && late_b > early_b / 2);
+    CHECK_EQ(sim_nrf_rx_count(nrf_a), 0);
+    CHECK_EQ(sim_nrf_rx_count(nrf_b), 0);
+    CHECK(PORTC.IN & PIN3_bm);
+    CHECK(PORTA.IN & PIN6_bm);
+    // every payload the radios stored was read, short of a batch cut off where one run handed over to the next
+    CHECK(loop_ram.bus.stats[0].packets + XNRF_RX_FIFO_DEPTH >= sim_nrf_stats(nrf_a)->rx_packets);
+    CHECK(loop_ram.bus.stats[1].packets + XNRF_RX_FIFO_DEPTH >= sim_nrf_stats(nrf_b)->rx_packets);
+}
+
+/* multi_rx_loop() as it is */
+static void both_radios_keep_going(void) {
+    start();
+    sim_run(multi_rx_loop, SIM_MS(RUN_MS));
+    check_both();
+}
+
+/* multi_rx_loop()'s service loop with interrupts held off for 2ms every 5ms */
+static void service_with_cli(void) {
+    xnrf_packet_t batch[XNRF_RX_FIFO_DEPTH];
+    uint64_t next = sim_now();
+
+    // multi_rx_loop() was cut off wherever its run ended, maybe mid drain.  Deselect both and queue both to pick up
+    xnrf_deselect(&xnrf_config);
+    xnrf_deselect(&xnrf_config_b);
+    cli();
+    xnrf_bus_irq(&loop_ram.bus, 0);
+    xnrf_bus_irq(&loop_ram.bus, 1);
+    sei();
+
+    while (1) {
+        uint8_t radio;
+        xnrf_bus_service(&loop_ram.bus, batch, XNRF_RX_FIFO_DEPTH, &radio);
+        if (radio == XNRF_BUS_IDLE)
+            _delay_us(20);
+        if (sim_now() >= next) {
+            cli();
+            _delay_us(2000);
+            sei();
+            next = sim_now() + SIM_US(3000);
+        }
+    }
+}
+
+/* A full batch with more landing behind it puts the radio back in the queue, or its IRQ stays low for good */
+static void requeue_after_full_batch(void) {
+    start();
+    sim_run(multi_rx_loop, SIM_MS(SETUP_MS));
+    sim_run(service_with_cli, SIM_MS(RUN_MS - SETUP_MS));
+    CHECK(sim_nrf_stats(nrf_a)->rx_overflows > 0);     /* the bursts did fill radio A's FIFO */
+    check_both();
+}
+
+int main(void) {
+    TEST_RUN(both_radios_keep_going);
+    TEST_RUN(requeue_after_full_batch);
+    return test_done();
+}
@@ -0,0 +1,195 @@
+/*
+ * test_pool.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  xnrf_pool_t:  first with its three ends on three host threads, the way the
+ *  IRQ, main loop and DRE interrupt share it, so the barriers see real
+ *  reordering.  Then pool_bridge_loop() with a peer transmitting at random
+ *  intervals, checking every payload that reaches the host is whole and
+ *  everything else shows up in loop_ram.pool.drops.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include "testbed.h"
+
+#define THREAD_PACKETS  1000000UL
+#define RUN_MS          2000
+
+/* Handoff from the consumer to the freer, the USART's part in the real thing */
+static xnrf_packet_t *volatile handoff[XNRF_POOL_SIZE];
+static std::atomic<uint32_t> handoff_head, handoff_tail;
+static std::atomic<uint32_t> bad_payloads;
+static xnrf_pool_t thread_pool;
+
+/* Radio side:  alloc, fill with the packet number, post */
+static void *producer(void *arg) {
+    for (uint32_t n = 0; n < THREAD_PACKETS; n++) {
+        xnrf_packet_t *packet;
+        while (!(packet = xnrf_pool_alloc(&thread_pool)))
+            sched_yield();      /* a spin would burn the whole timeslice on a single core host */
+        for (uint8_t i = 0; i < XNRF_MAX_PAYLOAD; i += sizeof(n))
+            memcpy(&packet->data[i], &n, sizeof(n));
+        packet->len = XNRF_MAX_PAYLOAD;
+        xnrf_pool_post(&thread_pool, packet);
+    }
+    return NULL;
+}
+
+/* Main loop side:  peek, check it's the next packet and whole, pop and hand it on */
+static void *consumer(void *arg) {
+    for (uint32_t n = 0; n < THREAD_PACKETS; n++) {
+        xnrf_packet_t *packet;
+        while (!(packet = xnrf_pool_peek(&thread_pool)))
+            sched_yield();
+        for (uint8_t i = 0; i < XNRF_MAX_PAYLOAD; i += sizeof(n)) {
+            if (memcmp(&packet->data[i], &n, sizeof(n))) {
+                bad_payloads++;
+                break;
+            }
+        }
+        xnrf_pool_pop(&thread_pool);
+        while (handoff_head - handoff_tail == XNRF_POOL_SIZE)
+            sched_yield();
+        handoff[handoff_head % XNRF_POOL_SIZE] = packet;
+        handoff_head++;
+    }
+    return NULL;
+}
+
+/* USART side:  scribbles over the buffer, as a late read would see the next payload, and frees it */
+static void *freer(void *arg) {
+    for (uint32_t n = 0; n < THREAD_PACKETS; n++) {
+        while (handoff_head == handoff_tail)
+            sched_yield();
+        xnrf_packet_t *packet = handoff[handoff_tail % XNRF_POOL_SIZE];
+        handoff_tail++;
+        memset(packet->data, 0xEE, sizeof(packet->data));
+        xnrf_pool_free(&thread_pool, packet);
+    }
+    return NULL;
+}
+
+/* Producer, consumer and freer each on their own thread, every payload arrives whole and in order */
+static void three_threads(void) {
+    pthread_t threads[3];
+
+    xnrf_pool_init(&thread_pool);
+    handoff_head = handoff_tail = 0;
+    bad_payloads = 0;
+    pthread_create(&threads[0], NULL, freer, NULL);
+    pthread_create(&threads[1], NULL, consumer, NULL);
+    pthread_create(&threads[2], NULL, producer, NULL);
+    for (uint8_t i = 0; i < 3; i++)
+        pthread_join(threads[i], NULL);
+
+    CHECK_EQ(bad_payloads, 0);
+    CHECK_EQ((uint8_t)(thread_pool.free_head - thread_pool.free_tail), XNRF_POOL_SIZE);
+    CHECK_EQ(thread_pool.ready_head, thread_pool.ready_tail);
+}
+
+static uint32_t peer_sent;
+static uint64_t peer_until;                        /* peer goes quiet so the line can catch up */
+static uint32_t host_frames, host_bad, host_gaps;   /* frames seen, corrupt ones, and payloads missing between them */
+static uint32_t host_next;                          /* peer packet number the next frame should carry */
+static uint8_t host_frame_buf[64];
+static uint8_t host_frame_len;
+static bool host_esc;
+
+/* Peer sending one numbered payload after a random 0 - 8ms gap, about 250 a second, against a USART that can take
+ * about 280 frames a second.  Bursts have to queue in the pool, and spill when they outrun it.
+ */
+static void peer_tick(void *ctx) {
+    sim_nrf_t *nrf = (sim_nrf_t *)ctx;
+    uint8_t payload[32];
+
+    sim_nrf_clear_irq(nrf);
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, &peer_sent, sizeof(peer_sent));
+    if (sim_nrf_send(nrf, payload, sizeof(payload), false))
+        peer_sent++;
+    if (sim_now() < peer_until)
+        sim_at(sim_now() + SIM_US(sim_rand() % 8000), peer_tick, nrf);
+}
+
+/* Checks the frames the bridge sent up, each payload has to be a whole numbered one past the last */
+static void host_collect(void *ctx) {
+    uint8_t wire[256];
+    size_t got = sim_uart_take(&USARTD0, wire, sizeof(wire));
+
+    for (size_t i = 0; i < got; i++) {
+        uint8_t c = wire[i];
+        if (c == XUSART_SLIP_END) {
+            if (host_frame_len) {
+                uint16_t crc = 0xFFFF;
+                uint32_t n;
+                for (uint8_t j = 0; j < host_frame_len; j++)
+                    crc = _crc_ccitt_update(crc, host_frame_buf[j]);
+                memcpy(&n, &host_frame_buf[3], sizeof(n));
+                if (crc || host_frame_len != 3 + 32 + 2 || n < host_next) {
+                    host_bad++;
+                } else {
+                    host_gaps += n - host_next;
+                    host_next = n + 1;
+                    host_frames++;
+                }
+            }
+            host_frame_len = 0;
+        } else if (c == XUSART_SLIP_ESC) {
+            host_esc = true;
+        } else if (host_frame_len < sizeof(host_frame_buf)) {
+            host_frame_buf[host_frame_len++] = host_esc ? (c == XUSART_SLIP_ESC_END ? XUSART_SLIP_END : XUSART_SLIP_ESC) : c;
+            host_esc = false;
+        }
+    }
+    if (ctx)
+        sim_at(sim_now() + SIM_MS(5), host_collect, ctx);
+}
+
+/* pool_bridge_loop() on the bridge profile with the peer's payloads arriving at random */
+static void random_arrival(void) {
+    const xnrf_profile_t *bridge = &ee_profiles[0];
+
+    testbed_radio_a();
+    testbed_boot(0);
+    sim_nrf_t *peer = sim_nrf_peer();
+    sim_nrf_link(peer, bridge->rf_ch, 250, testbed_addr(bridge->rx0_addr), 32, false, false);
+    sim_nrf_ce(peer, true);
+    peer_until = sim_now() + SIM_MS(RUN_MS - 200);
+    sim_at(sim_now() + SIM_MS(10), peer_tick, peer);
+    sim_at(sim_now() + SIM_MS(5), host_collect, peer);
+
+    sim_run(pool_bridge_loop, SIM_MS(RUN_MS));
+    host_collect(NULL);
+    printf("    sent %u  framed %u  pool drops %u\n", peer_sent, host_frames, loop_ram.pool.drops);
+
+    CHECK(peer_sent > 250);
+    CHECK_EQ(host_bad, 0);
+    CHECK_EQ(host_frames + host_gaps, peer_sent);
+    CHECK_EQ(host_gaps, loop_ram.pool.drops);                 /* the air is clean, so only the pool loses payloads */
+    CHECK(loop_ram.pool.drops > 0);                           /* the bursts did overrun it */
+    CHECK(host_frames > peer_sent * 3 / 4);
+    // all buffers back on the free ring once the line has caught up
+    CHECK_EQ((uint8_t)(loop_ram.pool.free_head - loop_ram.pool.free_tail), XNRF_POOL_SIZE);
+    CHECK_EQ(loop_ram.pool.ready_head, loop_ram.pool.ready_tail);
+}
+
+int main(void) {
+    TEST_RUN(three_threads);
+    TEST_RUN(random_arrival);
+    return test_done();
+}
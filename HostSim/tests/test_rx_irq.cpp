@@ -0,0 +1,88 @@
+/*
+ * test_rx_irq.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  FIFO draining receive behind an edge sensed IRQ:  rx_int_loop()'s ISR
+ *  against a 2Mbps stream, with interrupts held off in bursts so the FIFO is
+ *  full when the ISR gets in and more payloads land while it drains.
+ */
+
+#include "testbed.h"
+
+#define STREAM_MS   200
+
+static sim_nrf_t *nrf;
+
+/* rx_int_loop() up to its empty while (1), then interrupts held off for 2ms every 5ms */
+static void rx_int_with_cli(void) {
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+    PORTC_PIN3CTRL = PORT_ISC_FALLING_gc;
+    PORTC.INTMASK = PIN3_bm;
+    PORTC.INTCTRL = PORT_INTLVL_LO_gc;
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+    sei();
+    xnrf_enable(&xnrf_config);
+
+    while (1) {
+        cli();
+        _delay_us(2000);
+        sei();
+        _delay_us(3000);
+    }
+}
+
+static void stream(sim_nrf_t *peer) {
+    const xnrf_profile_t *fast = &ee_profiles[1];
+
+    sim_nrf_link(peer, fast->rf_ch, 2000, testbed_addr(fast->rx0_addr), 32, false, false);
+    sim_nrf_on_event(peer, peer_stream, NULL);
+    peer_stream_left = UINT32_MAX;
+    peer_stream(peer, NULL);
+    sim_nrf_ce(peer, true);
+}
+
+/* The IRQ line has to keep coming back up, or reception stops for good after the first bad burst */
+static void no_stall_after_bursts(void) {
+    nrf = testbed_radio_a();
+    testbed_boot(1);
+    sim_nrf_t *peer = sim_nrf_peer();
+    stream(peer);
+
+    sim_run(rx_int_with_cli, SIM_MS(STREAM_MS));
+    uint32_t early = sim_nrf_stats(nrf)->rx_packets;
+    sim_run(rx_int_with_cli, SIM_MS(STREAM_MS));
+    uint32_t late = sim_nrf_stats(nrf)->rx_packets - early;
+
+    // around 2500 payloads a second get through at 2Mbps with interrupts off 40% of the time, none once stalled
+    CHECK(early > STREAM_MS * 2);
+    CHECK(late > STREAM_MS * 2);
+    CHECK(sim_nrf_stats(nrf)->rx_overflows > 0);   /* the bursts did fill the FIFO */
+
+    // peer stops, the last edge drains everything
+    peer_stream_left = 0;
+    sim_nrf_ce(peer, false);
+    PORTC.INTMASK = PIN3_bm;
+    sei();
+    _delay_ms(2);
+    CHECK_EQ(sim_nrf_rx_count(nrf), 0);
+    CHECK(PORTC.IN & PIN3_bm);
+}
+
+int main(void) {
+    TEST_RUN(no_stall_after_bursts);
+    return test_done();
+}
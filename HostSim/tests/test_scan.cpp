@@ -0,0 +1,103 @@
+/*
+ * test_scan.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Channel survey:  xnrf_scan_channel() against RPD driven per channel by
+ *  sim_air_noise(), its dwell against XNRF_SCAN_CHANNEL_US(), and the lines
+ *  scan_loop() streams.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "testbed.h"
+
+#define BUSY_CHANNEL    40          /* RPD set on every sample */
+#define HALF_CHANNEL    41          /* RPD set on half of them */
+
+static void scan_setup(void) {
+    testbed_radio_a();
+    testbed_boot(0);
+    sim_air_noise(BUSY_CHANNEL, 1000);
+    sim_air_noise(HALF_CHANNEL, 500);
+}
+
+/* Hits follow the RPD rate on the channel, and the radio is left tuned to it with CE low */
+static void scan_channel(void) {
+    scan_setup();
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+
+    CHECK_EQ(xnrf_scan_channel(&xnrf_config, BUSY_CHANNEL, SCAN_SAMPLES), SCAN_SAMPLES);
+    CHECK_EQ(xnrf_read_register(&xnrf_config, RF_CH), BUSY_CHANNEL);
+    CHECK(!(PORTC.OUT & PIN2_bm));
+
+    uint8_t hits = xnrf_scan_channel(&xnrf_config, HALF_CHANNEL, SCAN_SAMPLES);
+    CHECK(hits > SCAN_SAMPLES / 4 && hits < SCAN_SAMPLES * 3 / 4);
+    CHECK_EQ(xnrf_scan_channel(&xnrf_config, HALF_CHANNEL + 1, SCAN_SAMPLES), 0);
+
+    // straight after power up the radio is still in Tpd2stby for most of the samples, which miss the carrier
+    xnrf_powerdown(&xnrf_config);
+    xnrf_powerup_rx(&xnrf_config);
+    CHECK(xnrf_scan_channel(&xnrf_config, BUSY_CHANNEL, SCAN_SAMPLES) < SCAN_SAMPLES);
+}
+
+/* The dwell on a channel is what XNRF_SCAN_CHANNEL_US() estimates, retune and settling included */
+static void scan_dwell(void) {
+    scan_setup();
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+
+    for (uint8_t samples = 1; samples <= 121; samples += 60) {
+        uint64_t start = sim_now();
+        xnrf_scan_channel(&xnrf_config, 10, samples);
+        double took = (sim_now() - start) / (double)SIM_CYCLES_PER_US;
+        printf("    %3u samples  %6.1fus  estimate %luus\n", samples, took, (unsigned long)XNRF_SCAN_CHANNEL_US(samples));
+        CHECK(took >= XNRF_RPD_SETTLE_US);
+        CHECK(took > XNRF_SCAN_CHANNEL_US(samples) * 0.95 && took < XNRF_SCAN_CHANNEL_US(samples) * 1.05);
+    }
+}
+
+/* scan_loop() prints a digit per channel and the measured pass time next to the estimate */
+static void scan_loop_line(void) {
+    char text[256];
+    unsigned long elapsed, estimate;
+
+    scan_setup();
+    sim_run(scan_loop, SIM_MS(5) + SIM_US(XNRF_SCAN_PASS_US(SCAN_SAMPLES) * 1.2));
+    size_t len = sim_uart_take(&USARTD0, (uint8_t *)text, sizeof(text) - 1);
+    text[len] = 0;
+
+    CHECK(len > XNRF_CHANNELS);
+    CHECK_EQ(sscanf(text + XNRF_CHANNELS, " %lu %lu\r\n", &elapsed, &estimate), 2);
+    for (uint8_t channel = 0; channel < XNRF_CHANNELS; channel++) {
+        if (channel == BUSY_CHANNEL)
+            CHECK_EQ(text[channel], 'F');
+        else if (channel == HALF_CHANNEL)
+            CHECK(text[channel] >= '5' && text[channel] <= '9');
+        else
+            CHECK_EQ(text[channel], '0');
+    }
+    printf("    pass %luus  estimate %luus\n", elapsed, estimate);
+    CHECK_EQ(estimate, XNRF_SCAN_PASS_US(SCAN_SAMPLES));
+    CHECK(elapsed > estimate * 0.95 && elapsed < estimate * 1.05);
+}
+
+int main(void) {
+    TEST_RUN(scan_channel);
+    TEST_RUN(scan_dwell);
+    TEST_RUN(scan_loop_line);
+    return test_done();
+}
@@ -0,0 +1,159 @@
+/*
+ * test_shadow.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Write-through shadow of the nRF configuration registers:  SPI transactions
+ *  per setter against the old read-modify-write, and verify / resync after a
+ *  brown-out, and what a profile may put in CONFIG.
+ */
+
+#include <util/delay.h>
+#include "XNRF24L01.h"
+#include "test.h"
+
+static xnrf_config_t radio = {
+    .spi = &SPIC,
+    .usart = NULL,
+    .spi_port = &PORTC,
+    .ss_port = &PORTC,
+    .ss_pin = 4,
+    .ce_port = &PORTC,
+    .ce_pin = 2,
+    .addr_width = 5,
+    .payload_width = 32,
+    .confbits = (1 << EN_CRC) | (1 << CRCO),
+};
+
+static sim_nrf_t *setup(void) {
+    sim_nrf_wiring_t wiring = { &SPIC, &PORTC, 4, &PORTC, 2, &PORTC, 3 };
+    sim_nrf_t *nrf = sim_nrf_attach(&wiring);
+
+    xnrf_init(&radio);
+    return nrf;
+}
+
+/* Every shadowed register on the radio against the shadow */
+static void check_radio(sim_nrf_t *nrf) {
+    CHECK_EQ(sim_nrf_reg(nrf, CONFIG), radio.shadow.config);
+    CHECK_EQ(sim_nrf_reg(nrf, EN_AA), radio.shadow.en_aa);
+    CHECK_EQ(sim_nrf_reg(nrf, EN_RXADDR), radio.shadow.en_rxaddr);
+    CHECK_EQ(sim_nrf_reg(nrf, SETUP_RETR), radio.shadow.setup_retr);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_CH), radio.shadow.rf_ch);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_SETUP), radio.shadow.rf_setup);
+    CHECK_EQ(sim_nrf_reg(nrf, FEATURE), radio.shadow.feature);
+    CHECK_EQ(sim_nrf_reg(nrf, DYNPD), radio.shadow.dynpd);
+}
+
+/* Setting the datarate the way it was done before the shadow, read RF_SETUP then write it back */
+static void set_datarate_rmw(xnrf_datarate_t rate) {
+    uint8_t setup = xnrf_read_register(&radio, RF_SETUP) & ~((1 << RF_DR_LOW) | (1 << RF_DR_HIGH));
+
+    if (rate == XNRF_250KBPS)
+        setup |= (1 << RF_DR_LOW);
+    else if (rate == XNRF_2MBPS)
+        setup |= (1 << RF_DR_HIGH);
+    xnrf_write_register(&radio, RF_SETUP, setup);
+}
+
+/* One transaction per setter, half what the read-modify-write took */
+static void single_transaction_setters(void) {
+    sim_nrf_t *nrf = setup();
+    sim_nrf_stats_t *stats = sim_nrf_stats(nrf);
+
+    uint32_t before = stats->transactions, bytes = stats->spi_bytes;
+    set_datarate_rmw(XNRF_250KBPS);
+    CHECK_EQ(stats->transactions - before, 2);
+    CHECK_EQ(stats->spi_bytes - bytes, 4);
+
+    before = stats->transactions, bytes = stats->spi_bytes;
+    xnrf_set_datarate(&radio, XNRF_2MBPS);
+    CHECK_EQ(stats->transactions - before, 1);
+    CHECK_EQ(stats->spi_bytes - bytes, 2);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_SETUP) & ((1 << RF_DR_LOW) | (1 << RF_DR_HIGH)), (1 << RF_DR_HIGH));
+
+    before = stats->transactions;
+    xnrf_set_channel(&radio, 76);
+    xnrf_set_autoack(&radio, 0x03);
+    xnrf_set_rx_pipes(&radio, 0x03);
+    xnrf_powerup_rx(&radio);
+    xnrf_powerup_tx(&radio);
+    xnrf_powerdown(&radio);
+    CHECK_EQ(stats->transactions - before, 6);
+
+    // reading the config back is free
+    before = stats->transactions;
+    CHECK_EQ(radio.shadow.rf_ch, 76);
+    CHECK(!(radio.shadow.config & (1 << PWR_UP)));
+    CHECK_EQ(stats->transactions, before);
+    check_radio(nrf);
+}
+
+/* A brown-out puts the radio back to reset values, verify spots it and resync puts the shadow back */
+static void brownout_resync(void) {
+    sim_nrf_t *nrf = setup();
+
+    xnrf_set_channel(&radio, 76);
+    xnrf_set_datarate(&radio, XNRF_250KBPS);
+    xnrf_set_autoack(&radio, 0);
+    xnrf_powerup_rx(&radio);
+    CHECK(xnrf_verify(&radio));
+
+    sim_nrf_brownout(nrf);
+    _delay_us(XNRF_TPOR_US);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_CH), 2);
+    CHECK(!xnrf_verify(&radio));
+
+    uint32_t before = sim_nrf_stats(nrf)->transactions;
+    xnrf_resync(&radio);
+    CHECK_EQ(sim_nrf_stats(nrf)->transactions - before, sizeof(xnrf_shadow_t));
+    CHECK(xnrf_verify(&radio));
+    check_radio(nrf);
+}
+
+/* A profile's crc field only reaches the CRC bits of CONFIG, a stray bit makes the whole profile invalid */
+static void profile_crc_bits(void) {
+    xnrf_profile_t profile = {
+        .name = "crc", .crc = (1 << EN_CRC), .en_aa = 0, .en_rxaddr = (1 << ERX_P0), .setup_retr = 0x03, .rf_ch = 40,
+        .rf_setup = (1 << RF_DR_LOW), .feature = 0, .dynpd = 0, .addr_width = 5, .payload_width = 32,
+        .tx_addr = { 0xE1, 0xF0, 0xF0, 0xF0, 0xF0 }, .rx0_addr = { 0xE1, 0xF0, 0xF0, 0xF0, 0xF0 },
+        .rx1_addr = { 0xD2, 0xF0, 0xF0, 0xF0, 0xF0 }, .rx_lsb = { 0xC3, 0xC4, 0xC5, 0xC6 } };
+    sim_nrf_t *nrf = setup();
+    sim_nrf_stats_t *stats = sim_nrf_stats(nrf);
+
+    xnrf_powerup_rx(&radio);
+    uint8_t config = radio.shadow.config;
+
+    profile.crc = (1 << EN_CRC) | (1 << MASK_RX_DR);
+    uint32_t before = stats->transactions;
+    CHECK(!xnrf_apply_profile(&radio, &profile));
+    CHECK_EQ(stats->transactions, before);
+    profile.crc = (1 << EN_CRC) | (1 << PWR_UP);
+    CHECK(!xnrf_apply_profile(&radio, &profile));
+    CHECK_EQ(stats->transactions, before);
+
+    profile.crc = (1 << EN_CRC);
+    CHECK(xnrf_apply_profile(&radio, &profile));
+    CHECK_EQ(radio.shadow.config, (config & ~(1 << CRCO)) | (1 << EN_CRC));
+    CHECK_EQ(radio.shadow.rf_ch, 40);
+    check_radio(nrf);
+}
+
+int main(void) {
+    TEST_RUN(single_transaction_setters);
+    TEST_RUN(brownout_resync);
+    TEST_RUN(profile_crc_bits);
+    return test_done();
+}
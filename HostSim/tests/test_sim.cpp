@@ -0,0 +1,197 @@
+/*
+ * test_sim.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Sanity checks of the machine and radio models, driven through the plain
+ *  blocking driver calls.  Also built as test_sim_mspi with NRF_INTERFACE set
+ *  to XNRF_IF_USART, the radio on USARTC0 in master SPI mode.
+ */
+
+#include <string.h>
+#include <util/delay.h>
+#include "XNRF24L01.h"
+#include "test.h"
+
+#define LINK_ADDR   0xE7E7E7E7E7ULL
+
+#if NRF_INTERFACE == XNRF_IF_USART
+/* USARTC0 in master SPI mode takes PC1 - PC3 (XCK, MISO, MOSI), so CE and IRQ move to port A */
+#   define TEST_BUS         USARTC0
+#   define TEST_CE_PORT     PORTA
+#   define TEST_CE_PIN      5
+#   define TEST_IRQ_PORT    PORTA
+#   define TEST_IRQ_PIN     6
+#else
+#   define TEST_BUS         SPIC
+#   define TEST_CE_PORT     PORTC
+#   define TEST_CE_PIN      2
+#   define TEST_IRQ_PORT    PORTC
+#   define TEST_IRQ_PIN     3
+#endif
+
+static xnrf_config_t radio = {
+#if NRF_INTERFACE == XNRF_IF_USART
+    .spi = NULL,
+    .usart = &TEST_BUS,
+#else
+    .spi = &TEST_BUS,
+    .usart = NULL,
+#endif
+    .spi_port = &PORTC,
+    .ss_port = &PORTC,
+    .ss_pin = 4,
+    .ce_port = &TEST_CE_PORT,
+    .ce_pin = TEST_CE_PIN,
+    .addr_width = 5,
+    .payload_width = 32,
+    .confbits = (1 << EN_CRC) | (1 << CRCO),
+};
+
+static sim_nrf_t *attach_radio(void) {
+    sim_nrf_wiring_t wiring = { &TEST_BUS, &PORTC, 4, &TEST_CE_PORT, TEST_CE_PIN, &TEST_IRQ_PORT, TEST_IRQ_PIN };
+    return sim_nrf_attach(&wiring);
+}
+
+static bool irq_low(void) {
+    return !(TEST_IRQ_PORT.IN & (1 << TEST_IRQ_PIN));
+}
+
+/* SPI bytes take 8 SCK periods at F_CPU/8 on either interface, and SS is never raised mid byte */
+static void spi_timing(void) {
+    uint8_t data[16];
+
+    attach_radio();
+    xnrf_init(&radio);
+    uint64_t start = sim_now();
+    uint32_t bytes = sim_bus_stats(&TEST_BUS)->bytes;
+    xnrf_read_register_buffer(&radio, TX_ADDR, data, sizeof(data));
+    CHECK_EQ(sim_bus_stats(&TEST_BUS)->bytes - bytes, 17);
+    CHECK(sim_now() - start >= 17 * 64);
+    CHECK(sim_now() - start < 17 * 64 * 2);
+    CHECK_EQ(sim_bus_stats(&TEST_BUS)->conflicts, 0);
+    CHECK_EQ(sim_bus_stats(&TEST_BUS)->unselected, 0);
+    CHECK_EQ(sim_bus_stats(&TEST_BUS)->collisions, 0);
+}
+
+/* Register writes before Tpor are ignored, after it they stick */
+static void power_on_reset(void) {
+    sim_nrf_t *nrf = attach_radio();
+
+    PORTC.OUTSET = (1 << 4);
+    PORTC.DIRSET = (1 << 4);
+    TEST_CE_PORT.DIRSET = (1 << TEST_CE_PIN);
+#if NRF_INTERFACE == XNRF_IF_USART
+    xspi_usart_master_init(&PORTC, &TEST_BUS, SPI_MODE_0_gc, false, 4000000);
+#else
+    xspi_master_init(&PORTC, &TEST_BUS, SPI_MODE_0_gc, false, SPI_PRESCALER_DIV16_gc, true);
+#endif
+    xnrf_write_register(&radio, RF_CH, 40);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_CH), 2);
+    CHECK_EQ(sim_nrf_stats(nrf)->early_bytes, 2);
+
+    xnrf_init(&radio);
+    xnrf_set_channel(&radio, 40);
+    CHECK_EQ(sim_nrf_reg(nrf, RF_CH), 40);
+    CHECK(xnrf_verify(&radio));
+}
+
+/* Acked packets from the driver to a peer, IRQ pin following TX_DS */
+static void tx_to_peer(void) {
+    uint8_t payload[32], got[32];
+    sim_nrf_t *nrf = attach_radio();
+    sim_nrf_t *peer = sim_nrf_peer();
+
+    sim_nrf_link(peer, 2, 2000, LINK_ADDR, 32, true, true);
+    sim_nrf_ce(peer, true);
+    xnrf_init(&radio);
+    xnrf_powerup_tx(&radio);
+    _delay_us(XNRF_TPD2STBY_US);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        memset(payload, i + 1, sizeof(payload));
+        xnrf_write_payload(&radio, payload, sizeof(payload));
+        xnrf_enable(&radio);
+        _delay_us(15);
+        xnrf_disable(&radio);
+        while (!irq_low());
+        uint8_t status = xnrf_write_register(&radio, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+        CHECK(status & (1 << TX_DS));
+        CHECK(!irq_low());
+        CHECK_EQ(sim_nrf_recv(peer, got, NULL), 32);
+        CHECK(!memcmp(payload, got, 32));
+    }
+    CHECK_EQ(sim_nrf_stats(nrf)->tx_ds, 3);
+    CHECK_EQ(sim_nrf_stats(nrf)->max_rt, 0);
+}
+
+/* Nobody listening, MAX_RT after SETUP_RETR retransmits */
+static void max_rt(void) {
+    uint8_t payload[32] = { 0 };
+    sim_nrf_t *nrf = attach_radio();
+
+    xnrf_init(&radio);
+    xnrf_powerup_tx(&radio);
+    _delay_us(XNRF_TPD2STBY_US);
+    xnrf_write_payload(&radio, payload, sizeof(payload));
+    xnrf_enable(&radio);
+    _delay_us(15);
+    xnrf_disable(&radio);
+    while (!irq_low());
+    CHECK(xnrf_get_status(&radio) & (1 << MAX_RT));
+    CHECK_EQ(sim_nrf_stats(nrf)->tx_packets, 4);
+    CHECK_EQ(xnrf_read_register(&radio, OBSERVE_TX) & 0x0F, 3);
+}
+
+/* Packets from a peer, read back with the FIFO draining receive */
+static void rx_from_peer(void) {
+    uint8_t payload[32];
+    xnrf_packet_t batch[XNRF_RX_FIFO_DEPTH];
+    sim_nrf_t *peer = sim_nrf_peer();
+
+    attach_radio();
+    sim_nrf_link(peer, 2, 2000, LINK_ADDR, 32, true, false);
+    xnrf_init(&radio);
+    xnrf_powerup_rx(&radio);
+    _delay_us(XNRF_TPD2STBY_US);
+    xnrf_enable(&radio);
+    _delay_us(XNRF_TSTBY2A_US);
+
+    for (uint8_t i = 0; i < 2; i++) {
+        memset(payload, 0x10 + i, sizeof(payload));
+        sim_nrf_send(peer, payload, sizeof(payload), false);
+    }
+    sim_nrf_ce(peer, true);
+    while (sim_nrf_tx_count(peer))
+        _delay_us(10);
+    sim_nrf_ce(peer, false);
+    CHECK(irq_low());
+
+    CHECK_EQ(xnrf_receive_all(&radio, batch, XNRF_RX_FIFO_DEPTH), 2);
+    CHECK_EQ(batch[0].pipe, 0);
+    CHECK_EQ(batch[0].len, 32);
+    CHECK_EQ(batch[0].data[0], 0x10);
+    CHECK_EQ(batch[1].data[31], 0x11);
+    CHECK(!irq_low());
+}
+
+int main(void) {
+    TEST_RUN(spi_timing);
+    TEST_RUN(power_on_reset);
+    TEST_RUN(tx_to_peer);
+    TEST_RUN(max_rt);
+    TEST_RUN(rx_from_peer);
+    return test_done();
+}
@@ -0,0 +1,76 @@
+/*
+ * test_stream.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Streaming TX:  tx_stream_loop() on the "fast" profile into a peer PRX,
+ *  checking the running count stamped into each payload and the once a
+ *  second report on USARTD0.
+ */
+
+#include <stdio.h>
+#include "testbed.h"
+
+#define RUN_MS      1100
+
+static uint32_t peer_next;
+static uint32_t peer_got;
+static uint32_t peer_gaps;
+
+/* Peer PRX emptying its RX FIFO and following the stamped count */
+static void peer_check(sim_nrf_t *nrf, void *ctx) {
+    uint8_t payload[32];
+    uint32_t stamp;
+
+    while (sim_nrf_recv(nrf, payload, NULL) >= 0) {
+        memcpy(&stamp, payload, sizeof(stamp));
+        if (stamp != peer_next)
+            peer_gaps++;
+        peer_next = stamp + 1;
+        peer_got++;
+    }
+}
+
+/* Back to back payloads reach the peer in order, and the report matches what it saw */
+static void stream_to_peer(void) {
+    const xnrf_profile_t *fast = &ee_profiles[1];
+    char report[128];
+    unsigned long pps, bps, full, retries, lost;
+
+    testbed_radio_a();
+    testbed_boot(1);
+    sim_nrf_t *peer = sim_nrf_peer();
+    sim_nrf_link(peer, fast->rf_ch, 2000, testbed_addr(fast->tx_addr), 32, false, true);
+    sim_nrf_on_event(peer, peer_check, NULL);
+    sim_nrf_ce(peer, true);
+
+    sim_run(tx_stream_loop, SIM_MS(RUN_MS));
+    size_t len = sim_uart_take(&USARTD0, (uint8_t *)report, sizeof(report) - 1);
+    report[len] = 0;
+
+    CHECK_EQ(peer_gaps, 0);
+    CHECK(peer_got > 1000);
+    CHECK_EQ(sscanf(report, "pps %lu Bps %lu full %lu retries %lu lost %lu\r\n", &pps, &bps, &full, &retries, &lost), 5);
+    CHECK_EQ(bps, pps * 32);
+    CHECK(full > 0);   /* the FIFO was kept topped up */
+    CHECK_EQ(lost, 0);
+    // the first second has the 5ms power up in it, the rest runs at the same rate
+    CHECK(pps <= peer_got && pps * RUN_MS / 1000 >= peer_got - peer_got / 20);
+}
+
+int main(void) {
+    TEST_RUN(stream_to_peer);
+    return test_done();
+}
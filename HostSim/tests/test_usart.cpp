@@ -0,0 +1,261 @@
+/*
+ * test_usart.cpp
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Interrupt driven ring buffers in XUSART, on USARTD0 at 115200 8N1, and
+ *  the XSPI master SPI calls on USARTC0.
+ */
+
+#include <string.h>
+#include <util/delay.h>
+#include "XUSART.h"
+#include "XSPI.h"
+#include "test.h"
+
+static xusart_buffered_t serial;
+XUSART_BUFFERED_ISRS(USARTD0, serial)
+
+static void setup(void) {
+    xusart_set_format(&USARTD0, USART_CHSIZE_8BIT_gc, USART_PMODE_DISABLED_gc, false);
+    xusart_set_baudrate(&USARTD0, 115200, F_CPU);
+    xusart_enable_rx(&USARTD0);
+    xusart_enable_tx(&USARTD0);
+    xusart_buffered_init(&serial, &USARTD0);
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+    sei();
+}
+
+/* Writes go out in order across many trips around the ring, the main loop never waits on the USART */
+static void tx_wraps(void) {
+    uint8_t data[200], out[200];
+    uint16_t queued = 0;
+    size_t got = 0;
+
+    for (uint16_t i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+    setup();
+    while (queued < sizeof(data)) {
+        uint8_t chunk = sizeof(data) - queued > 23 ? 23 : sizeof(data) - queued;
+        uint8_t accepted = xusart_write(&serial, data + queued, chunk);
+        serial.tx_overflows = 0;
+        queued += accepted;
+        _delay_us(500);
+        got += sim_uart_take(&USARTD0, out + got, sizeof(out) - got);
+    }
+    _delay_ms(25);
+    got += sim_uart_take(&USARTD0, out + got, sizeof(out) - got);
+    CHECK_EQ(got, sizeof(data));
+    CHECK(!memcmp(data, out, sizeof(data)));
+}
+
+/* A full ring takes what fits and counts the rest */
+static void tx_overflow(void) {
+    uint8_t data[XUSART_TX_BUFFER_SIZE + 10];
+
+    memset(data, 0x55, sizeof(data));
+    setup();
+    uint8_t accepted = xusart_write(&serial, data, sizeof(data));
+    // the DRE interrupt can take one byte before the write returns, so the ring may have just one extra slot
+    CHECK(accepted >= XUSART_TX_BUFFER_SIZE - 1 && accepted <= XUSART_TX_BUFFER_SIZE);
+    CHECK_EQ(serial.tx_overflows, sizeof(data) - accepted);
+    _delay_ms(30);
+    CHECK_EQ(sim_uart_stats(&USARTD0)->tx_bytes, accepted);
+}
+
+/* Received bytes are buffered by the RXC interrupt until read.  Free running indexes, so all SIZE slots are used */
+static void rx_ring(void) {
+    uint8_t data[XUSART_RX_BUFFER_SIZE + 8], in[sizeof(data)];
+
+    for (uint8_t i = 0; i < sizeof(data); i++)
+        data[i] = 0x80 + i;
+    setup();
+    sim_uart_feed(&USARTD0, data, sizeof(data));
+    _delay_ms(5);
+    CHECK_EQ(xusart_rx_available(&serial), XUSART_RX_BUFFER_SIZE);
+    CHECK_EQ(serial.rx_overflows, sizeof(data) - (XUSART_RX_BUFFER_SIZE));
+    CHECK_EQ(xusart_read(&serial, in, sizeof(in)), XUSART_RX_BUFFER_SIZE);
+    CHECK(!memcmp(data, in, XUSART_RX_BUFFER_SIZE));
+    CHECK_EQ(xusart_read(&serial, in, sizeof(in)), 0);
+
+    // read as it comes and nothing is lost
+    serial.rx_overflows = 0;
+    sim_uart_feed(&USARTD0, data, sizeof(data));
+    uint8_t total = 0;
+    for (uint8_t i = 0; i < 20 && total < sizeof(data); i++) {
+        _delay_us(500);
+        total += xusart_read(&serial, in + total, sizeof(in) - total);
+    }
+    CHECK_EQ(total, sizeof(data));
+    CHECK(!memcmp(data, in, sizeof(data)));
+    CHECK_EQ(serial.rx_overflows, 0);
+}
+
+/* SLIP frames written to the TX ring decode back to the same bytes */
+static void slip_round_trip(void) {
+    uint8_t frame[] = { 1, XUSART_SLIP_END, 2, XUSART_SLIP_ESC, 3 };
+    uint8_t wire[32], decoded[16];
+    xusart_slip_writer_t writer;
+    xusart_slip_reader_t reader;
+
+    setup();
+    CHECK(xusart_slip_begin(&writer, &serial, sizeof(frame)));
+    xusart_slip_write(&writer, frame, sizeof(frame));
+    xusart_slip_end(&writer);
+    _delay_ms(2);
+    size_t len = sim_uart_take(&USARTD0, wire, sizeof(wire));
+    CHECK_EQ(len, sizeof(frame) + 2 + 2);
+
+    sim_uart_feed(&USARTD0, wire, len);
+    _delay_ms(2);
+    xusart_slip_reader_init(&reader, decoded, sizeof(decoded));
+    CHECK_EQ(xusart_slip_read(&reader, &serial), sizeof(frame));
+    CHECK(!memcmp(frame, decoded, sizeof(frame)));
+    CHECK_EQ(reader.errors, 0);
+}
+
+/* RS485:  DE is up for every byte and drops once the last stop bit is out */
+static void rs485_direction(void) {
+    uint8_t data[10] = { 0 };
+
+    setup();
+    xusart_set_rs485(&serial, &PORTD, PIN5_bm);
+    sim_uart_de(&USARTD0, &PORTD, 5);
+    xusart_write(&serial, data, sizeof(data));
+    CHECK(xusart_tx_busy(&serial));
+    _delay_us(sizeof(data) * 87 - 20);
+    CHECK(xusart_tx_busy(&serial));
+    _delay_us(150);
+    CHECK(!xusart_tx_busy(&serial));
+    CHECK_EQ(sim_uart_stats(&USARTD0)->tx_bytes, sizeof(data));
+    CHECK_EQ(sim_uart_stats(&USARTD0)->de_errors, 0);
+    // DE held no longer than the frame plus the TXC interrupt
+    CHECK(sim_uart_stats(&USARTD0)->de_high < sizeof(data) * sim_uart_char_cycles(&USARTD0) + SIM_US(10));
+}
+
+/* A slave on USARTC0 with SS on PC4 that keeps what it was sent and answers with the previous byte */
+typedef struct {
+    sim_spi_slave_t slave;
+    uint8_t         mosi[64];
+    uint8_t         count;
+    uint8_t         last;
+} echo_slave_t;
+
+static uint8_t echo_exchange(void *ctx, uint8_t mosi) {
+    echo_slave_t *echo = (echo_slave_t *)ctx;
+    uint8_t miso = echo->last;
+
+    if (echo->count < sizeof(echo->mosi))
+        echo->mosi[echo->count++] = mosi;
+    echo->last = mosi;
+    return miso;
+}
+
+/* Attaches the slave, so once per test */
+static void mspi_setup(echo_slave_t *echo, SPI_MODE_t mode, bool lsb) {
+    memset(echo, 0, sizeof(*echo));
+    echo->slave.ss_port = &PORTC;
+    echo->slave.ss_pin = 4;
+    echo->slave.exchange = echo_exchange;
+    echo->slave.ctx = echo;
+    sim_spi_attach(&USARTC0, &echo->slave);
+    PORTC.DIRSET = PIN4_bm;
+    PORTC.OUTCLR = PIN4_bm;
+    xspi_usart_master_init(&PORTC, &USARTC0, mode, lsb, 4000000);
+}
+
+/* CPOL goes on XCK's INVEN and CPHA on UCPHA, and going back to a lower mode clears them again */
+static void mspi_modes(void) {
+    static const SPI_MODE_t modes[] = { SPI_MODE_1_gc, SPI_MODE_2_gc, SPI_MODE_3_gc, SPI_MODE_0_gc };
+    echo_slave_t echo;
+
+    mspi_setup(&echo, SPI_MODE_0_gc, false);
+    for (uint8_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        xspi_usart_master_init(&PORTC, &USARTC0, modes[i], false, 4000000);
+        CHECK_EQ(USARTC0.CTRLC, USART_CMODE_MSPI_gc | ((modes[i] & SPI_MODE_1_gc) ? USART_UCPHA_bm : 0));
+        CHECK_EQ(!!(PORTC.PIN1CTRL & PORT_INVEN_bm), !!(modes[i] & SPI_MODE_2_gc));
+        CHECK_EQ(sim_spi_mode(&USARTC0), modes[i]);
+        CHECK(PORTC.DIR & PIN1_bm);
+        CHECK(PORTC.DIR & PIN3_bm);
+    }
+    // the rest of the pin's setup is left alone
+    PORTC.PIN1CTRL = PORT_ISC_INPUT_DISABLE_gc | PORT_INVEN_bm;
+    xspi_usart_master_init(&PORTC, &USARTC0, SPI_MODE_1_gc, false, 4000000);
+    CHECK_EQ(PORTC.PIN1CTRL, PORT_ISC_INPUT_DISABLE_gc);
+}
+
+/* UDORD puts the LSB on the wire first, both ways */
+static void mspi_lsb_first(void) {
+    echo_slave_t echo;
+
+    mspi_setup(&echo, SPI_MODE_0_gc, true);
+    CHECK_EQ(USARTC0.CTRLC, USART_CMODE_MSPI_gc | USART_UDORD_bm);
+    xspi_usart_transfer_byte(&USARTC0, 0x01);
+    CHECK_EQ(xspi_usart_transfer_byte(&USARTC0, 0x3A), 0x01);
+    CHECK_EQ(echo.mosi[0], 0x80);
+    CHECK_EQ(echo.mosi[1], 0x5C);
+
+    echo.count = 0;
+    xspi_usart_master_init(&PORTC, &USARTC0, SPI_MODE_0_gc, false, 4000000);
+    CHECK_EQ(USARTC0.CTRLC, USART_CMODE_MSPI_gc);
+    xspi_usart_transfer_byte(&USARTC0, 0x01);
+    CHECK_EQ(xspi_usart_transfer_byte(&USARTC0, 0x3A), 0x01);
+    CHECK_EQ(echo.mosi[0], 0x01);
+    CHECK_EQ(echo.mosi[1], 0x3A);
+}
+
+/* Packets go out back to back with no more than 2 bytes ever written and not read back, so RX never overruns */
+static void mspi_pipelined(void) {
+    uint8_t tx[32], rx[32];
+    echo_slave_t echo;
+
+    for (uint8_t i = 0; i < sizeof(tx); i++)
+        tx[i] = 0xA0 ^ (i * 3);
+    mspi_setup(&echo, SPI_MODE_0_gc, false);
+    uint64_t start = sim_now();
+    xspi_usart_transfer_packet(&USARTC0, tx, rx, sizeof(tx));
+    uint64_t took = sim_now() - start;
+    CHECK_EQ(echo.count, sizeof(tx));
+    CHECK(!memcmp(echo.mosi, tx, sizeof(tx)));
+    CHECK_EQ(rx[0], 0);
+    CHECK(!memcmp(rx + 1, tx, sizeof(tx) - 1));
+    CHECK(took >= sizeof(tx) * sim_uart_char_cycles(&USARTC0));
+    CHECK(took < (sizeof(tx) + 2) * sim_uart_char_cycles(&USARTC0));
+    CHECK_EQ(sim_bus_stats(&USARTC0)->in_flight, 2);
+    CHECK_EQ(sim_bus_stats(&USARTC0)->collisions, 0);
+    CHECK(!(USARTC0.STATUS & (USART_RXCIF_bm | USART_BUFOVF_bm)));
+
+    // send and get are the same pipeline with one side thrown away
+    xspi_usart_send_packet(&USARTC0, tx, 16);
+    xspi_usart_get_packet(&USARTC0, rx, 8);
+    CHECK_EQ(echo.count, sizeof(tx) + 24);
+    CHECK_EQ(rx[0], tx[15]);
+    CHECK_EQ(rx[1], 0xFF);
+    CHECK_EQ(echo.mosi[sizeof(tx) + 23], 0xFF);
+    CHECK_EQ(sim_bus_stats(&USARTC0)->in_flight, 2);
+    CHECK(!(USARTC0.STATUS & (USART_RXCIF_bm | USART_BUFOVF_bm)));
+}
+
+int main(void) {
+    TEST_RUN(tx_wraps);
+    TEST_RUN(tx_overflow);
+    TEST_RUN(rx_ring);
+    TEST_RUN(slip_round_trip);
+    TEST_RUN(rs485_direction);
+    TEST_RUN(mspi_modes);
+    TEST_RUN(mspi_lsb_first);
+    TEST_RUN(mspi_pipelined);
+    return test_done();
+}
@@ -0,0 +1,89 @@
+/*
+ * testbed.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Pulls xNRF_Testbed.c into a test, so its loops and ISRs run against the
+ *  simulator.  Its main() becomes testbed_main().  Loops that spin on plain
+ *  variables never let virtual time move, so tests run the ones that poll
+ *  registers or delay, and stand in for the empty while (1) ones.
+ */
+
+#ifndef HOSTSIM_TESTBED_H_
+#define HOSTSIM_TESTBED_H_
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#define main testbed_main
+#include "../../xNRF_Testbed/xNRF_Testbed.c"
+#undef main
+#pragma GCC diagnostic pop
+
+#include "test.h"
+
+/* Radio A on SPIC, SS PC4, CE PC2, IRQ PC3 */
+static inline sim_nrf_t *testbed_radio_a(void) {
+    sim_nrf_wiring_t wiring = { &SPIC, &PORTC, 4, &PORTC, 2, &PORTC, 3 };
+    return sim_nrf_attach(&wiring);
+}
+
+/* Radio B on SPIC, SS PA4, CE PA5, IRQ PA6 */
+static inline sim_nrf_t *testbed_radio_b(void) {
+    sim_nrf_wiring_t wiring = { &SPIC, &PORTA, 4, &PORTA, 5, &PORTA, 6 };
+    return sim_nrf_attach(&wiring);
+}
+
+/* What main() does before it picks a loop:  clocks, timebase, radio init and EEPROM profile n */
+static inline void testbed_boot(uint8_t profile) {
+    eeprom_update_byte(&ee_profile_boot, profile);
+    init();
+    bench_timer_init();
+#ifdef XSTATS_ENABLED
+    xstats_init();
+#endif
+    xnrf_init(&xnrf_config);
+    radio_setup();
+}
+
+/* Address from a profile's 5 byte LSB first array, for sim_nrf_link() */
+static inline uint64_t testbed_addr(const uint8_t *addr) {
+    uint64_t value = 0;
+    for (int8_t i = 4; i >= 0; i--)
+        value = (value << 8) | addr[i];
+    return value;
+}
+
+/* Peer PTX that keeps its TX FIFO topped up, for as long as peer_stream_left says */
+static uint32_t peer_stream_left;
+static uint8_t peer_stream_seq;
+
+static inline void peer_stream(sim_nrf_t *nrf, void *ctx) {
+    static bool busy;
+    uint8_t payload[32];
+
+    if (busy)
+        return;
+    busy = true;
+    if (sim_nrf_reg(nrf, NRF_STATUS) & ((1 << TX_DS) | (1 << MAX_RT)))
+        sim_nrf_clear_irq(nrf);
+    while (peer_stream_left && sim_nrf_tx_count(nrf) < 3) {
+        memset(payload, peer_stream_seq++, sizeof(payload));
+        sim_nrf_send(nrf, payload, sizeof(payload), false);
+        peer_stream_left--;
+    }
+    busy = false;
+}
+
+#endif /* HOSTSIM_TESTBED_H_ */
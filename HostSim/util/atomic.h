@@ -0,0 +1,36 @@
+/*
+ * util/atomic.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  ATOMIC_BLOCK on top of the simulated global interrupt flag.
+ */
+
+#ifndef HOSTSIM_UTIL_ATOMIC_H_
+#define HOSTSIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+uint8_t sim_atomic_enter(void);
+void sim_atomic_exit(uint8_t sreg);
+
+#define ATOMIC_RESTORESTATE     0
+#define ATOMIC_FORCEON          1
+
+#define ATOMIC_BLOCK(type) \
+    for (uint8_t sim_sreg_save = sim_atomic_enter() | ((type) << 1), sim_atomic_todo = 1; \
+         sim_atomic_todo; sim_atomic_todo = 0, sim_atomic_exit(sim_sreg_save))
+
+#endif /* HOSTSIM_UTIL_ATOMIC_H_ */
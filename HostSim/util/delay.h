@@ -0,0 +1,35 @@
+/*
+ * util/delay.h
+ *
+ * Project: HostSim
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ *  Busy waits advance virtual time; interrupts still run while waiting.
+ */
+
+#ifndef HOSTSIM_UTIL_DELAY_H_
+#define HOSTSIM_UTIL_DELAY_H_
+
+#include <avr/io.h>
+
+#ifndef F_CPU
+#   define F_CPU 32000000UL
+#endif
+
+void sim_delay_cycles(uint64_t cycles);
+
+#define _delay_us(us)   sim_delay_cycles((uint64_t)((double)(us) * (F_CPU / 1000000UL)))
+#define _delay_ms(ms)   sim_delay_cycles((uint64_t)((double)(ms) * (F_CPU / 1000UL)))
+
+#endif /* HOSTSIM_UTIL_DELAY_H_ */
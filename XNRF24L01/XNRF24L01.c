@@ -22,70 +22,956 @@
 #   define F_CPU 32000000UL
 #endif
 
+#include <stddef.h>
 #include <avr/io.h>
 #include <util/delay.h>
+#include <util/atomic.h>
 #include "XSPI.h"
 #include "XNRF24L01.h"
 
+/* Registers backing xnrf_shadow_t, in member order */
+static const uint8_t xnrf_shadow_regs[sizeof(xnrf_shadow_t)] = {
+    CONFIG, EN_AA, EN_RXADDR, SETUP_RETR, RF_CH, RF_SETUP, FEATURE, DYNPD
+};
+
 //TODO: Change xnrf_init so it doesn't assume a 32MHz clock, or change xspi_master_init to reference baud rates.
-//TODO: Change this to xnrf_init_spi and add xnrf_init_usart??
+/* Drives SS idle high and makes SS and CE outputs */
+static void xnrf_init_pins(xnrf_config_t *config) {
+    xnrf_deselect(config);
+#ifdef XNRF_FIXED_SS_PORT
+    XNRF_FIXED_SS_PORT.DIRSET = (1 << XNRF_FIXED_SS_PIN);
+#else
+    config->ss_port->DIRSET = (1 << config->ss_pin);
+#endif
+#ifdef XNRF_FIXED_CE_PORT
+    XNRF_FIXED_CE_PORT.DIRSET = (1 << XNRF_FIXED_CE_PIN);
+#else
+    config->ce_port->DIRSET = (1 << config->ce_pin);
+#endif
+}
+
 void xnrf_init(xnrf_config_t *config) {
     // Make sure our nRF powered and stabilized, per the datasheet for power-on state transition. 
     _delay_ms(100);
-    
-    // Initialize SPI to 4Mhz, assume a 32Mhz clock
-    config->ss_port->DIRSET = (1 << config->ss_pin);
-    config->ce_port->DIRSET = (1 << config->ce_pin);
-    xspi_master_init(config->spi_port, config->spi, SPI_MODE_0_gc, false, SPI_PRESCALER_DIV16_gc, true);
-    //xspi_usart_master_init(&PORTC, &USARTC0, SPI_MODE_0_gc, 4000000);
-    
-    // configure address width
-    xnrf_set_address_width(config, config->addr_width);
-    
+
+    xnrf_init_pins(config);
+    xnrf_configure(config);
+}
+
+/* Body of xnrf_write_batch(), left uninstrumented so xnrf_configure() can count its table on its own.  Adds the
+ * bytes put on the bus, a command byte and the data for each entry, to *bytes.
+ */
+static uint8_t xnrf_batch_apply(xnrf_config_t *config, const uint8_t *table, uint8_t *bytes) {
+    uint8_t *shadow = (uint8_t *)&config->shadow;
+    uint8_t status = 0;
+    uint8_t reg;
+
+    while ((reg = *table++) != XNRF_BATCH_END) {
+        uint8_t len = *table++;
+
+        xnrf_select(config);
+        status = xnrf_transfer_byte(config, (W_REGISTER | (REGISTER_MASK & reg)));
+        xnrf_send_bytes(config, (uint8_t *)table, len);
+        xnrf_deselect(config);
+
+        if (len == 1) {
+            for (uint8_t i = 0; i < sizeof(xnrf_shadow_t); i++) {
+                if (xnrf_shadow_regs[i] == reg)
+                    shadow[i] = *table;
+            }
+        }
+        table += len;
+        *bytes += len + 1;
+    }
+    return status;
+}
+
+void xnrf_configure(xnrf_config_t *config) {
+    // Initialize SPI (or USART in Master SPI mode) to 4Mhz, assume a 32Mhz clock
+#if NRF_INTERFACE == XNRF_IF_USART
+    xspi_usart_master_init(config->spi_port, XNRF_USART(config), SPI_MODE_0_gc, false, 4000000);
+#else
+    xspi_master_init(config->spi_port, XNRF_SPI(config), SPI_MODE_0_gc, false, SPI_PRESCALER_DIV16_gc, true);
+#endif
+
+    // CONFIG bits and the datasheet reset values for the shadowed registers, then address width and default
+    // payload widths for all pipes, applied as one batch which also seeds the shadow
+    static const uint8_t defaults[] = {
+        EN_AA, 1, 0x3F,
+        EN_RXADDR, 1, (1 << ERX_P1) | (1 << ERX_P0),
+        SETUP_RETR, 1, 0x03,
+        RF_CH, 1, 0x02,
+        RF_SETUP, 1, 0x0E,
+        FEATURE, 1, 0,
+        DYNPD, 1, 0,
+    };
+    uint8_t table[3 + sizeof(defaults) + 3 + 3 * 6 + 1];
+    uint8_t *p = table;
+
+    *p++ = CONFIG; *p++ = 1; *p++ = config->confbits;
+    for (uint8_t i = 0; i < sizeof(defaults); i++)
+        *p++ = defaults[i];
+    *p++ = SETUP_AW; *p++ = 1; *p++ = (config->addr_width >= 3 && config->addr_width <= 5) ? config->addr_width - 2 : 3;
     //TODO: change this to only set default width when pipe is enabled? Does it matter?
-    // configure default payload widths for all pipes
-    xnrf_write_register(config, RX_PW_P0, config->payload_width);
-    xnrf_write_register(config, RX_PW_P1, config->payload_width);
-    xnrf_write_register(config, RX_PW_P2, config->payload_width);
-    xnrf_write_register(config, RX_PW_P3, config->payload_width);
-    xnrf_write_register(config, RX_PW_P4, config->payload_width);
-    xnrf_write_register(config, RX_PW_P5, config->payload_width);
+    for (uint8_t reg = RX_PW_P0; reg <= RX_PW_P5; reg++) {
+        *p++ = reg; *p++ = 1; *p++ = config->payload_width;
+    }
+    *p = XNRF_BATCH_END;
+
+    XSTATS_BEGIN();
+    uint8_t bytes = 0;
+    xnrf_batch_apply(config, table, &bytes);
+    XSTATS_END(XSTATS_NRF_CONFIGURE, bytes);
+
+    config->link.sent = 0;
+    config->link.retries = 0;
+    config->link.lost = 0;
+}
+
+bool xnrf_verify(xnrf_config_t *config) {
+    uint8_t *shadow = (uint8_t *)&config->shadow;
+
+    for (uint8_t i = 0; i < sizeof(xnrf_shadow_t); i++) {
+        if (xnrf_read_register(config, xnrf_shadow_regs[i]) != shadow[i])
+            return false;
+    }
+    return true;
+}
+
+void xnrf_resync(xnrf_config_t *config) {
+    uint8_t *shadow = (uint8_t *)&config->shadow;
+
+    for (uint8_t i = 0; i < sizeof(xnrf_shadow_t); i++)
+        xnrf_write_register(config, xnrf_shadow_regs[i], shadow[i]);
+}
+
+void xnrf_sm_init(xnrf_config_t *config, xnrf_sm_t *sm, uint32_t now_us) {
+    xnrf_init_pins(config);
+    xnrf_disable(config);
+    sm->state = XNRF_STATE_RESET;
+    sm->target = XNRF_STATE_POWERDOWN;
+    sm->since = now_us;
+    sm->wait = XNRF_TPOR_US;
+}
+
+/* Moves to state, waiting wait microseconds before the next transition */
+static void xnrf_sm_enter(xnrf_sm_t *sm, xnrf_state_t state, uint32_t now_us, uint32_t wait) {
+    sm->state = state;
+    sm->since = now_us;
+    sm->wait = wait;
+}
+
+xnrf_event_t xnrf_poll(xnrf_config_t *config, xnrf_sm_t *sm, uint32_t now_us) {
+    if (sm->wait) {
+        if (now_us - sm->since < sm->wait)
+            return XNRF_EVENT_NONE;
+        sm->wait = 0;
+
+        // a wait just ran out, which completes the state we were heading for
+        switch (sm->state) {
+            case XNRF_STATE_RESET:
+                xnrf_configure(config);
+                xnrf_powerdown(config);
+                sm->state = XNRF_STATE_POWERDOWN;
+                return XNRF_EVENT_POWERDOWN;
+            case XNRF_STATE_STARTUP:
+                sm->state = XNRF_STATE_STANDBY;
+                return XNRF_EVENT_STANDBY;
+            case XNRF_STATE_RX_SETTLING:
+                sm->state = XNRF_STATE_RX;
+                return XNRF_EVENT_RX_ACTIVE;
+            case XNRF_STATE_TX_SETTLING:
+                sm->state = XNRF_STATE_TX;
+                return XNRF_EVENT_TX_ACTIVE;
+            default:
+                break;
+        }
+    }
+
+    if (sm->state == sm->target)
+        return XNRF_EVENT_NONE;
+
+    // start the next step toward the target
+    switch (sm->state) {
+        case XNRF_STATE_POWERDOWN:
+            xnrf_powerup_rx(config);
+            xnrf_sm_enter(sm, XNRF_STATE_STARTUP, now_us, XNRF_TPD2STBY_US);
+            break;
+        case XNRF_STATE_STANDBY:
+            if (sm->target == XNRF_STATE_POWERDOWN) {
+                xnrf_powerdown(config);
+                sm->state = XNRF_STATE_POWERDOWN;
+                return XNRF_EVENT_POWERDOWN;
+            }
+            if (sm->target == XNRF_STATE_RX) {
+                xnrf_powerup_rx(config);
+                xnrf_enable(config);
+                xnrf_sm_enter(sm, XNRF_STATE_RX_SETTLING, now_us, XNRF_TSTBY2A_US);
+            } else if (sm->target == XNRF_STATE_TX) {
+                xnrf_powerup_tx(config);
+                xnrf_enable(config);
+                xnrf_sm_enter(sm, XNRF_STATE_TX_SETTLING, now_us, XNRF_TSTBY2A_US);
+            }
+            break;
+        case XNRF_STATE_RX:
+        case XNRF_STATE_TX:
+            // dropping CE is immediate, PRIM_RX is only changed back in standby
+            xnrf_disable(config);
+            sm->state = XNRF_STATE_STANDBY;
+            return XNRF_EVENT_STANDBY;
+        default:
+            break;
+    }
+    return XNRF_EVENT_NONE;
+}
+
+void xnrf_duty_init(xnrf_duty_t *duty, uint32_t period_us, uint32_t listen_us, uint32_t hold_us, uint32_t now_us) {
+    duty->period_us = period_us;
+    duty->listen_us = listen_us;
+    duty->hold_us = hold_us;
+    duty->wake_at = now_us;
+    duty->close_at = now_us;
+    duty->listening = false;
+    duty->open = false;
+    duty->heard = false;
+    duty->wakes = 0;
+    duty->hits = 0;
+    duty->missed = 0;
 }
 
-void xnrf_read_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len) {
+xnrf_state_t xnrf_duty_schedule(xnrf_duty_t *duty, xnrf_sm_t *sm, uint32_t now_us) {
+    if (!duty->listening) {
+        if ((int32_t)(now_us - duty->wake_at) < 0)
+            return XNRF_STATE_POWERDOWN;
+
+        // wake.  Wakes are on a fixed grid so the schedule doesn't drift, ones we overslept are counted and skipped
+        duty->listening = true;
+        duty->open = false;
+        duty->heard = false;
+        duty->wakes++;
+        duty->wake_at += duty->period_us;
+        while ((int32_t)(now_us - duty->wake_at) >= 0) {
+            duty->wake_at += duty->period_us;
+            duty->missed++;
+        }
+        return XNRF_STATE_RX;
+    }
+
+    if (!duty->open) {
+        if (sm->state != XNRF_STATE_RX)
+            return XNRF_STATE_RX;       /* still waking */
+        duty->open = true;
+        duty->close_at = now_us + duty->listen_us;
+    }
+
+    if ((int32_t)(now_us - duty->close_at) < 0)
+        return XNRF_STATE_RX;
+
+    duty->listening = false;
+    if (duty->heard)
+        duty->hits++;
+    return XNRF_STATE_POWERDOWN;
+}
+
+void xnrf_duty_heard(xnrf_duty_t *duty, uint32_t now_us) {
+    duty->heard = true;
+    if (duty->open && (int32_t)(duty->close_at - now_us) < (int32_t)duty->hold_us)
+        duty->close_at = now_us + duty->hold_us;
+}
+
+uint32_t xnrf_duty_sleep_us(xnrf_duty_t *duty, xnrf_sm_t *sm, uint32_t now_us) {
+    int32_t left;
+
+    if (sm->wait)
+        left = (int32_t)(sm->since + sm->wait - now_us);
+    else if (sm->state != sm->target)
+        return 0;
+    else if (duty->open)
+        left = (int32_t)(duty->close_at - now_us);
+    else if (!duty->listening)
+        left = (int32_t)(duty->wake_at - now_us);
+    else
+        return 0;
+    return left > 0 ? (uint32_t)left : 0;
+}
+
+uint8_t xnrf_read_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len) {
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, (R_REGISTER | (REGISTER_MASK & reg)));
-    while (len--)
-        *data++ = xspi_transfer_byte(config->spi, NRF_NOP);
-    xnrf_deselect(config);	
+    uint8_t status = xnrf_transfer_byte(config, (R_REGISTER | (REGISTER_MASK & reg)));
+    xnrf_get_bytes(config, data, len);
+    xnrf_deselect(config);
+    return status;
 }
 
-void xnrf_write_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len) {
+uint8_t xnrf_write_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len) {
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, (W_REGISTER | (REGISTER_MASK & reg)));
+    uint8_t status = xnrf_transfer_byte(config, (W_REGISTER | (REGISTER_MASK & reg)));
+    xnrf_send_bytes(config, data, len);
+    xnrf_deselect(config);
+    return status;
+}
+
+uint8_t xnrf_write_batch(xnrf_config_t *config, const uint8_t *table) {
+    XSTATS_BEGIN();
+    uint8_t bytes = 0;
+    uint8_t status = xnrf_batch_apply(config, table, &bytes);
+    XSTATS_END(XSTATS_NRF_WRITE_BATCH, bytes);
+    return status;
+}
+
+/* Appends a batch entry to a table being built */
+static uint8_t *xnrf_batch_put(uint8_t *p, uint8_t reg, const uint8_t *data, uint8_t len) {
+    *p++ = reg;
+    *p++ = len;
     while (len--)
-        xspi_transfer_byte(config->spi, *data++);
-    xnrf_deselect(config);	
+        *p++ = *data++;
+    return p;
 }
 
-void xnrf_read_payload(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+bool xnrf_apply_profile(xnrf_config_t *config, const xnrf_profile_t *profile) {
+    uint8_t table[XNRF_PROFILE_TABLE_SIZE];
+    uint8_t *p = table;
+    uint8_t width = profile->addr_width;
+    uint8_t setup_aw = width - 2;
+    uint8_t crc_bits = (1 << EN_CRC) | (1 << CRCO);
+    uint8_t confbits = (config->shadow.config & ~crc_bits) | (profile->crc & crc_bits);
+
+    // anything but the CRC bits in crc would land in CONFIG and switch off IRQs or power the radio
+    if (width < 3 || width > 5 || profile->rf_ch >= 126 || profile->payload_width > XNRF_MAX_PAYLOAD ||
+            (profile->crc & ~crc_bits))
+        return false;
+
+    // same order as the shadow, FEATURE has to be on before DYNPD takes
+    p = xnrf_batch_put(p, CONFIG, &confbits, 1);
+    p = xnrf_batch_put(p, EN_AA, &profile->en_aa, 1);
+    p = xnrf_batch_put(p, EN_RXADDR, &profile->en_rxaddr, 1);
+    p = xnrf_batch_put(p, SETUP_RETR, &profile->setup_retr, 1);
+    p = xnrf_batch_put(p, RF_CH, &profile->rf_ch, 1);
+    p = xnrf_batch_put(p, RF_SETUP, &profile->rf_setup, 1);
+    p = xnrf_batch_put(p, FEATURE, &profile->feature, 1);
+    p = xnrf_batch_put(p, DYNPD, &profile->dynpd, 1);
+    p = xnrf_batch_put(p, SETUP_AW, &setup_aw, 1);
+    for (uint8_t reg = RX_PW_P0; reg <= RX_PW_P5; reg++)
+        p = xnrf_batch_put(p, reg, &profile->payload_width, 1);
+    p = xnrf_batch_put(p, TX_ADDR, profile->tx_addr, width);
+    p = xnrf_batch_put(p, RX_ADDR_P0, profile->rx0_addr, width);
+    p = xnrf_batch_put(p, RX_ADDR_P1, profile->rx1_addr, width);
+    for (uint8_t i = 0; i < 4; i++)
+        p = xnrf_batch_put(p, RX_ADDR_P2 + i, &profile->rx_lsb[i], 1);
+    *p = XNRF_BATCH_END;
+
+    config->addr_width = width;
+    config->payload_width = profile->payload_width;
+    xnrf_write_batch(config, table);
+    return true;
+}
+
+uint8_t xnrf_read_payload(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+    XSTATS_BEGIN();
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, R_RX_PAYLOAD);
-    while (len--)
-        *data++ = xspi_transfer_byte(config->spi, NRF_NOP);
-    xnrf_deselect(config);	
+    uint8_t status = xnrf_transfer_byte(config, R_RX_PAYLOAD);
+    xnrf_get_bytes(config, data, len);
+    xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_READ_PAYLOAD, len + 1);
+    return status;
+}
+
+uint8_t xnrf_read_dynamic_payload(xnrf_config_t *config, uint8_t *data) {
+    uint8_t len = xnrf_read_payload_width(config);
+
+    if (len > XNRF_MAX_PAYLOAD) {
+        xnrf_flush_rx(config);
+        return 0;
+    }
+    xnrf_read_payload(config, data, len);
+    return len;
 }
 
-void xnrf_write_payload(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+uint8_t xnrf_write_payload(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+    XSTATS_BEGIN();
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, W_TX_PAYLOAD);
-    while (len--)
-        xspi_transfer_byte(config->spi, *data++);
+    uint8_t status = xnrf_transfer_byte(config, W_TX_PAYLOAD);
+    xnrf_send_bytes(config, data, len);
+    xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_WRITE_PAYLOAD, len + 1);
+    return status;
+}
+
+/* Opens a read of the payload at the top of the RX FIFO, taking the pipe from the STATUS byte that comes back with
+ * the command byte rather than a separate STATUS transaction.  If the FIFO is empty SS is raised straight away,
+ * which aborts the command.  Otherwise SS is left low after R_RX_PAYLOAD with *len set, finish with xnrf_rx_close().
+ * A corrupt dynamic width, 0 or over 32 with a payload known to be there, flushes the RX FIFO, raises SS and sets *len
+ * to 0.
+ */
+static uint8_t xnrf_rx_open(xnrf_config_t *config, uint8_t *len) {
+    xnrf_select(config);
+
+    if (!config->shadow.dynpd) {
+        uint8_t status = xnrf_transfer_byte(config, R_RX_PAYLOAD);
+        if (xnrf_status_pipe(status) == XNRF_PIPE_EMPTY)
+            xnrf_deselect(config);
+        *len = config->payload_width;
+        return status;
+    }
+
+    // with dynamic payloads in play the width has to come first, which gets us STATUS just the same
+    uint8_t status = xnrf_transfer_byte(config, R_RX_PL_WID);
+    uint8_t pipe = xnrf_status_pipe(status);
+    if (pipe == XNRF_PIPE_EMPTY) {
+        xnrf_deselect(config);
+        return status;
+    }
+
+    if (config->shadow.dynpd & (1 << pipe)) {
+        *len = xnrf_transfer_byte(config, NRF_NOP);
+        xnrf_deselect(config);
+        if (!*len || *len > XNRF_MAX_PAYLOAD) {
+            xnrf_flush_rx(config);
+            *len = 0;
+            return status;
+        }
+    } else {
+        *len = config->payload_width;
+        xnrf_deselect(config);
+    }
+
+    xnrf_select(config);
+    xnrf_transfer_byte(config, R_RX_PAYLOAD);
+    return status;
+}
+
+/* Clocks out the payload opened by xnrf_rx_open() and raises SS */
+static void xnrf_rx_close(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+    XSTATS_BEGIN();
+    xnrf_get_bytes(config, data, len);
+    xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_READ_PAYLOAD, len + 1);
+}
+
+static uint8_t xnrf_drain_rx(xnrf_config_t *config, xnrf_packet_t *batch, uint8_t max) {
+    uint8_t count = 0;
+
+    for (;;) {
+        uint8_t status;
+        uint8_t len;
+
+        if (count == max) {
+            status = xnrf_get_status(config);
+            if (xnrf_status_pipe(status) != XNRF_PIPE_EMPTY)
+                return count;   /* out of room, leave RX_DR set so we get called again */
+        } else {
+            status = xnrf_rx_open(config, &len);
+            if (xnrf_status_pipe(status) != XNRF_PIPE_EMPTY) {
+                if (len) {      /* corrupt dynamic payloads get flushed, don't hand them back */
+                    xnrf_rx_close(config, batch->data, len);
+                    batch->pipe = xnrf_status_pipe(status);
+                    batch->len = len;
+                    batch++;
+                    count++;
+                }
+                continue;
+            }
+        }
+
+        if (!(status & (1 << RX_DR)))
+            return count;
+
+        // FIFO is empty, clear the IRQ and check again in case a payload landed while clearing it
+        xnrf_write_register(config, NRF_STATUS, (1 << RX_DR));
+    }
+}
+
+void xnrf_dispatch_init(xnrf_dispatch_t *dispatch) {
+    for (uint8_t i = 0; i < XNRF_PIPES; i++) {
+        xnrf_pipe_t *p = &dispatch->pipes[i];
+        p->handler = NULL;
+        p->queue = NULL;
+        p->mask = 0;
+        p->head = p->tail = 0;
+        p->received = p->dropped = 0;
+    }
+}
+
+void xnrf_dispatch_handler(xnrf_dispatch_t *dispatch, uint8_t pipe, xnrf_rx_handler_t handler) {
+    dispatch->pipes[pipe].handler = handler;
+}
+
+void xnrf_dispatch_queue(xnrf_dispatch_t *dispatch, uint8_t pipe, xnrf_packet_t *queue, uint8_t depth) {
+    xnrf_pipe_t *p = &dispatch->pipes[pipe];
+
+    p->queue = queue;
+    p->mask = depth - 1;
+    p->head = p->tail = 0;
+}
+
+uint8_t xnrf_dispatch(xnrf_config_t *config, xnrf_dispatch_t *dispatch) {
+    xnrf_packet_t scratch;      /* handlers and drops */
+    uint8_t count = 0;
+
+    for (;;) {
+        uint8_t len;
+        uint8_t status = xnrf_rx_open(config, &len);
+        uint8_t pipe = xnrf_status_pipe(status);
+
+        if (pipe == XNRF_PIPE_EMPTY) {
+            if (!(status & (1 << RX_DR)))
+                return count;
+            // FIFO is empty, clear the IRQ and check again in case a payload landed while clearing it
+            xnrf_write_register(config, NRF_STATUS, (1 << RX_DR));
+            continue;
+        }
+        if (!len)
+            continue;
+        if (pipe >= XNRF_PIPES) {
+            // the read is open with SS low, finish it so the payload is gone and the bus is free
+            xnrf_rx_close(config, scratch.data, len);
+            continue;
+        }
+
+        xnrf_pipe_t *p = &dispatch->pipes[pipe];
+        xnrf_packet_t *packet = &scratch;
+        uint8_t head = p->head;
+        bool queued = !p->handler && p->queue && (uint8_t)(head - p->tail) <= p->mask;
+
+        if (queued)
+            packet = &p->queue[head & p->mask];
+        xnrf_rx_close(config, packet->data, len);
+        packet->pipe = pipe;
+        packet->len = len;
+        count++;
+        p->received++;
+
+        if (p->handler)
+            p->handler(packet);
+        else if (queued)
+            p->head = head + 1;
+        else
+            p->dropped++;
+    }
+}
+
+void xnrf_pool_init(xnrf_pool_t *pool) {
+    for (uint8_t i = 0; i < XNRF_POOL_SIZE; i++)
+        pool->free_ring[i] = i;
+    pool->free_head = XNRF_POOL_SIZE;
+    pool->free_tail = 0;
+    pool->ready_head = pool->ready_tail = 0;
+    pool->drops = 0;
+}
+
+uint8_t xnrf_receive_pool(xnrf_config_t *config, xnrf_pool_t *pool) {
+    xnrf_packet_t scratch;      /* drops */
+    uint8_t count = 0;
+
+    for (;;) {
+        uint8_t len;
+        uint8_t status = xnrf_rx_open(config, &len);
+        uint8_t pipe = xnrf_status_pipe(status);
+
+        if (pipe == XNRF_PIPE_EMPTY) {
+            if (!(status & (1 << RX_DR)))
+                return count;
+            // FIFO is empty, clear the IRQ and check again in case a payload landed while clearing it
+            xnrf_write_register(config, NRF_STATUS, (1 << RX_DR));
+            continue;
+        }
+        if (!len)
+            continue;
+
+        xnrf_packet_t *packet = xnrf_pool_alloc(pool);
+        if (!packet) {
+            xnrf_rx_close(config, scratch.data, len);
+            pool->drops++;
+            continue;
+        }
+
+        xnrf_rx_close(config, packet->data, len);
+        packet->pipe = pipe;
+        packet->len = len;
+        xnrf_pool_post(pool, packet);
+        count++;
+    }
+}
+
+uint8_t xnrf_receive_all(xnrf_config_t *config, xnrf_packet_t *batch, uint8_t max) {
+    XSTATS_BEGIN();
+    uint8_t count = xnrf_drain_rx(config, batch, max);
+#ifdef XSTATS_ENABLED
+    // command and payload for each packet handed back, as xnrf_read_payload() counts it
+    uint16_t bytes = 0;
+    for (uint8_t i = 0; i < count; i++)
+        bytes += batch[i].len + 1;
+    XSTATS_END(XSTATS_NRF_RECEIVE_ALL, bytes);
+#endif
+    return count;
+}
+
+uint8_t xnrf_scan_channel(xnrf_config_t *config, uint8_t channel, uint8_t samples) {
+    uint8_t hits = 0;
+
+    xnrf_disable(config);
+    xnrf_set_channel(config, channel);
+    xnrf_enable(config);
+    _delay_us(XNRF_RPD_SETTLE_US);
+
+    // keep the loop down to the bare register read, RPD is bit 0 so it sums directly
+    while (samples--)
+        hits += xnrf_read_register(config, RPD) & 0x01;
+
+    xnrf_disable(config);
+    return hits;
+}
+
+/* Accounts for and clears any TX_DS / MAX_RT flags in status */
+static void xnrf_account_tx(xnrf_config_t *config, uint8_t status) {
+    uint8_t flags = status & ((1 << TX_DS) | (1 << MAX_RT));
+
+    if (!flags)
+        return;
+
+    // the transmitter takes its ACKs on pipe 0, no point asking for retries without auto-ack there
+    if (config->shadow.en_aa & (1 << ENAA_P0))
+        config->link.retries += (xnrf_read_register(config, OBSERVE_TX) >> ARC_CNT) & 0x0F;
+    if (flags & (1 << TX_DS))
+        config->link.sent++;
+    if (flags & (1 << MAX_RT))
+        config->link.lost++;
+    xnrf_write_register(config, NRF_STATUS, flags);
+}
+
+uint8_t xnrf_update_link_stats(xnrf_config_t *config) {
+    uint8_t status = xnrf_get_status(config);
+    xnrf_account_tx(config, status);
+    return status;
+}
+
+void xnrf_stream_start(xnrf_config_t *config, xnrf_stream_stats_t *stats) {
+    stats->packets = 0;
+    stats->full = 0;
+    stats->max_rt = 0;
+
+    xnrf_flush_tx(config);
+    xnrf_write_register(config, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+    xnrf_enable(config);
+}
+
+bool xnrf_stream_tx(xnrf_config_t *config, xnrf_stream_stats_t *stats, uint8_t *data, uint8_t len) {
+    XSTATS_BEGIN();
+    uint8_t status = xnrf_get_status(config);
+
+    // only spend SPI transactions on the link counters when there's a flag to clear
+    xnrf_account_tx(config, status);
+
+    // MAX_RT stalls the FIFO until cleared.  Drop what's in there so a dead link can't wedge the stream.
+    if (status & (1 << MAX_RT)) {
+        stats->max_rt++;
+        xnrf_flush_tx(config);
+        status &= ~(1 << TX_FULL);
+    }
+
+    if (status & (1 << TX_FULL)) {
+        stats->full++;
+        XSTATS_END(XSTATS_NRF_STREAM_TX, 0);
+        return false;
+    }
+
+    xnrf_write_payload(config, data, len);
+    stats->packets++;
+    XSTATS_END(XSTATS_NRF_STREAM_TX, len + 1);
+    return true;
+}
+
+void xnrf_stream_stop(xnrf_config_t *config) {
+    uint8_t fifo;
+
+    // FIFO_STATUS and STATUS come back in one transaction
+    for (;;) {
+        uint8_t status = xnrf_read_register_status(config, FIFO_STATUS, &fifo);
+        if (fifo & (1 << TX_EMPTY))
+            break;
+        if (status & (1 << MAX_RT))
+            xnrf_flush_tx(config);
+    }
+    xnrf_disable(config);
+    xnrf_write_register(config, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+}
+
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)
+void xnrf_bus_init(xnrf_bus_t *bus) {
+    bus->count = 0;
+    bus->head = bus->tail = 0;
+    bus->pending = 0;
+}
+
+uint8_t xnrf_bus_add(xnrf_bus_t *bus, xnrf_config_t *config) {
+    if (bus->count >= XNRF_BUS_MAX_RADIOS)
+        return XNRF_BUS_IDLE;
+
+    // idle high before it becomes an output, so it never glitches onto the bus
+    xnrf_deselect(config);
+    config->ss_port->DIRSET = (1 << config->ss_pin);
+
+    uint8_t radio = bus->count++;
+    bus->radios[radio] = config;
+    bus->stats[radio].irqs = 0;
+    bus->stats[radio].merged = 0;
+    bus->stats[radio].packets = 0;
+    return radio;
+}
+
+/* Puts a radio at the back of the queue unless it's already in there.  Callers outside the IRQ handlers hold off interrupts */
+static bool xnrf_bus_queue(xnrf_bus_t *bus, uint8_t radio) {
+    uint8_t mask = 1 << radio;
+
+    if (bus->pending & mask)
+        return false;
+    bus->pending |= mask;
+    bus->queue[bus->head++ & (XNRF_BUS_MAX_RADIOS - 1)] = radio;
+    return true;
+}
+
+void xnrf_bus_irq(xnrf_bus_t *bus, uint8_t radio) {
+    bus->stats[radio].irqs++;
+    if (!xnrf_bus_queue(bus, radio))
+        bus->stats[radio].merged++;
+}
+
+uint8_t xnrf_bus_service(xnrf_bus_t *bus, xnrf_packet_t *batch, uint8_t max, uint8_t *radio) {
+    uint8_t tail = bus->tail;
+
+    *radio = XNRF_BUS_IDLE;
+    if (tail == bus->head)
+        return 0;
+#ifdef XSPI_DMA_ENABLED
+    if (xspi_dma_busy())
+        return 0;
+#endif
+
+    uint8_t next = bus->queue[tail & (XNRF_BUS_MAX_RADIOS - 1)];
+    bus->tail = tail + 1;
+
+    // unmark before draining, an IRQ that lands from here on queues the radio again rather than getting lost
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        bus->pending &= ~(1 << next);
+    }
+
+    uint8_t count = xnrf_receive_all(bus->radios[next], batch, max);
+    bus->stats[next].packets += count;
+    *radio = next;
+
+    // A full batch can leave payloads behind with RX_DR still set.  IRQ stays low then and an edge sensed pin
+    // interrupt never fires again, so go round to this radio once more after the others have had a turn.
+    if (count == max) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            xnrf_bus_queue(bus, next);
+        }
+    }
+    return count;
+}
+#endif
+
+/* Hop list index for a slot.  Walks forward through the hop order past blacklisted entries */
+static uint8_t xnrf_hop_index(xnrf_hop_t *hop, uint8_t slot) {
+    uint8_t i = slot % hop->count;
+
+    for (uint8_t n = hop->count; n; n--) {
+        uint8_t index = hop->order[i];
+        if (!(hop->blacklist & (1U << index)))
+            return index;
+        if (++i == hop->count)
+            i = 0;
+    }
+    return hop->order[0];
+}
+
+static inline uint8_t xnrf_hop_channel(xnrf_hop_t *hop, uint8_t slot) {
+    return hop->channels[xnrf_hop_index(hop, slot)];
+}
+
+/* Retunes if needed.  RF_CH is only written with CE low, then CE goes back to what it was */
+static void xnrf_hop_tune(xnrf_config_t *config, uint8_t channel) {
+    if (channel == config->shadow.rf_ch)
+        return;
+
+#ifdef XNRF_FIXED_CE_PORT
+    bool ce = XNRF_FIXED_CE_PORT.OUT & (1 << XNRF_FIXED_CE_PIN);
+#else
+    bool ce = config->ce_port->OUT & (1 << config->ce_pin);
+#endif
+    xnrf_disable(config);
+    xnrf_set_channel(config, channel);
+    if (ce)
+        xnrf_enable(config);
+}
+
+bool xnrf_hop_init(xnrf_config_t *config, xnrf_hop_t *hop, const uint8_t *channels, uint8_t count, uint16_t seed,
+                   uint32_t slot_us, uint8_t loss_pct, bool tx, uint32_t now_us) {
+    uint16_t lfsr = seed ? seed : 1;
+
+    // the shuffle below counts down from count - 1, and there's no hopping with fewer anyway
+    if (count < XNRF_HOP_MIN_CHANNELS)
+        return false;
+    if (count > XNRF_HOP_MAX_CHANNELS)
+        count = XNRF_HOP_MAX_CHANNELS;
+    hop->count = count;
+    for (uint8_t i = 0; i < count; i++) {
+        hop->channels[i] = channels[i];
+        hop->order[i] = i;
+        hop->sent[i] = 0;
+        hop->lost[i] = 0;
+    }
+
+    // Fisher-Yates shuffle driven by a 16 bit Galois LFSR, so both ends get the same order from the same seed
+    for (uint8_t i = count - 1; i; i--) {
+        lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+        uint8_t j = lfsr % (i + 1);
+        uint8_t tmp = hop->order[i];
+        hop->order[i] = hop->order[j];
+        hop->order[j] = tmp;
+    }
+
+    hop->slot = 0;
+    hop->blacklist = 0;
+    hop->slot_us = slot_us;
+    hop->guard_us = 2 * XNRF_TSTBY2A_US + XNRF_HOP_AIRTIME_US;
+    hop->slot_start = now_us;
+    hop->tx = tx;
+    hop->synced = tx;
+    hop->idle = 0;
+    hop->loss_pct = loss_pct;
+    xnrf_hop_tune(config, xnrf_hop_channel(hop, 0));
+    return true;
+}
+
+bool xnrf_hop_poll(xnrf_config_t *config, xnrf_hop_t *hop, uint32_t now_us) {
+    // parked, step through the whole list regardless of blacklist in case the transmitter has dropped this channel
+    if (!hop->synced) {
+        if (now_us - hop->slot_start >= hop->slot_us * (hop->count + 1)) {
+            hop->slot_start = now_us;
+            hop->slot++;
+            xnrf_hop_tune(config, hop->channels[hop->order[hop->slot % hop->count]]);
+        }
+        return false;
+    }
+
+    if (now_us - hop->slot_start < hop->slot_us)
+        return false;
+
+    hop->slot_start += hop->slot_us;
+    hop->slot++;
+
+    // the receiver only follows while it keeps hearing the transmitter
+    if (!hop->tx && ++hop->idle >= XNRF_HOP_LOST_SLOTS) {
+        hop->synced = false;
+        hop->slot_start = now_us;
+        return false;
+    }
+
+    xnrf_hop_tune(config, xnrf_hop_channel(hop, hop->slot));
+    return true;
+}
+
+/* Hop list entries not on the blacklist */
+static uint8_t xnrf_hop_active(xnrf_hop_t *hop, uint16_t blacklist) {
+    uint8_t active = 0;
+
+    for (uint8_t c = 0; c < hop->count; c++) {
+        if (!(blacklist & (1U << c)))
+            active++;
+    }
+    return active;
+}
+
+void xnrf_hop_header(xnrf_hop_t *hop, uint8_t *header) {
+    header[0] = XNRF_HOP_MAGIC;
+    header[1] = hop->slot;
+    header[2] = (uint8_t)hop->blacklist;
+    header[3] = (uint8_t)(hop->blacklist >> 8);
+}
+
+void xnrf_hop_account(xnrf_hop_t *hop, uint8_t status) {
+    uint8_t index = xnrf_hop_index(hop, hop->slot);
+
+    if (!(status & ((1 << TX_DS) | (1 << MAX_RT))))
+        return;
+    hop->sent[index]++;
+    if (status & (1 << MAX_RT))
+        hop->lost[index]++;
+    if (hop->sent[index] < XNRF_HOP_WINDOW)
+        return;
+
+    // a window is done.  Blacklisted channels keep their countdown in lost[], and come back to be measured at 0
+    for (uint8_t c = 0; c < hop->count; c++) {
+        if ((hop->blacklist & (1U << c)) && !--hop->lost[c])
+            hop->blacklist &= ~(1U << c);
+    }
+
+    bool bad = (uint16_t)hop->lost[index] * 100 > (uint16_t)hop->loss_pct * XNRF_HOP_WINDOW;
+    hop->sent[index] = 0;
+    hop->lost[index] = 0;
+    if (bad && xnrf_hop_active(hop, hop->blacklist) > XNRF_HOP_MIN_CHANNELS) {
+        hop->blacklist |= (1U << index);
+        hop->lost[index] = XNRF_HOP_PAROLE;
+    }
+}
+
+bool xnrf_hop_sync(xnrf_config_t *config, xnrf_hop_t *hop, const uint8_t *header, uint32_t now_us) {
+    uint16_t blacklist = header[2] | ((uint16_t)header[3] << 8);
+
+    // the transmitter never blacklists past its list or below XNRF_HOP_MIN_CHANNELS
+    // a 16 channel list uses every bit, and shifting a 16 bit int by 16 is undefined
+    if (header[0] != XNRF_HOP_MAGIC || (hop->count < 16 && (blacklist >> hop->count)) ||
+            xnrf_hop_active(hop, blacklist) < XNRF_HOP_MIN_CHANNELS)
+        return false;
+
+    hop->slot = header[1];
+    hop->blacklist = blacklist;
+    hop->slot_start = now_us - hop->guard_us;
+    hop->synced = true;
+    hop->idle = 0;
+    xnrf_hop_tune(config, xnrf_hop_channel(hop, hop->slot));
+    return true;
+}
+
+void xnrf_set_dynamic_payloads(xnrf_config_t *config, uint8_t pipes) {
+    uint8_t feature = config->shadow.feature;
+
+    if (pipes)
+        feature |= (1 << EN_DPL);
+    else
+        feature &= ~(1 << EN_DPL);
+
+    if (feature != config->shadow.feature) {
+        config->shadow.feature = feature;
+        xnrf_write_register(config, FEATURE, feature);
+    }
+    config->shadow.dynpd = pipes;
+    xnrf_write_register(config, DYNPD, pipes);
+}
+
+void xnrf_set_retries(xnrf_config_t *config, uint8_t delay, uint8_t count) {
+    config->shadow.setup_retr = ((delay & 0x0F) << ARD) | ((count & 0x0F) << ARC);
+    xnrf_write_register(config, SETUP_RETR, config->shadow.setup_retr);
+}
+
+void xnrf_set_ack_payloads(xnrf_config_t *config, bool enable) {
+    if (enable)
+        config->shadow.feature |= (1 << EN_ACK_PAY);
+    else
+        config->shadow.feature &= ~(1 << EN_ACK_PAY);
+    xnrf_write_register(config, FEATURE, config->shadow.feature);
+}
+
+uint8_t xnrf_write_ack_payload(xnrf_config_t *config, uint8_t pipe, uint8_t *data, uint8_t len) {
+    xnrf_select(config);
+    uint8_t status = xnrf_transfer_byte(config, W_ACK_PAYLOAD | (pipe & 0x07));
+    xnrf_send_bytes(config, data, len);
     xnrf_deselect(config);
+    return status;
 }
 
 void xnrf_set_datarate(xnrf_config_t *config, xnrf_datarate_t rate) {
-    uint8_t setup = xnrf_read_register(config, RF_SETUP);
+    uint8_t setup = config->shadow.rf_setup;
 
     switch (rate) {
         case XNRF_250KBPS:
@@ -100,7 +986,8 @@ void xnrf_set_datarate(xnrf_config_t *config, xnrf_datarate_t rate) {
             setup |= (1 << RF_DR_HIGH);
             break;
     }
-    xnrf_write_register(config, RF_SETUP, setup);	
+    config->shadow.rf_setup = setup;
+    xnrf_write_register(config, RF_SETUP, setup);
 }
 
 void xnrf_set_address_width(xnrf_config_t *config, uint8_t width) {
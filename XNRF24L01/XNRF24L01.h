@@ -20,26 +20,88 @@
 #ifndef XNRF24L01_H_
 #define XNRF24L01_H_
 
+#include <stddef.h>
 #include "nRF24L01.h"
 #include "XSPI.h"
 
-#define NRF_INTERFACE SPI       /* uses hardware SPI */
-//#define NRF_INTERFACE USART   /* uses USART in Master SPI mode */
+#define XNRF_IF_SPI     0
+#define XNRF_IF_USART   1
+
+#ifndef NRF_INTERFACE
+#define NRF_INTERFACE XNRF_IF_SPI       /* uses hardware SPI */
+//#define NRF_INTERFACE XNRF_IF_USART   /* uses USART in Master SPI mode */
+#endif
+
+/* Compile-time pin configuration.  Uncomment (or define as symbols in both this library and the application project)
+ * to hard wire the SPI module, SS and CE pins.  Select/deselect and enable/disable then compile to a single
+ * OUTCLR/OUTSET store with a constant mask, and the matching xnrf_config_t members are ignored.
+ */
+//#define XNRF_FIXED_SPI        SPIC    /* SPI module */
+//#define XNRF_FIXED_USART      USARTC0 /* USART module, when using the USART interface */
+//#define XNRF_FIXED_SS_PORT    PORTC   /* Slave Select port */
+//#define XNRF_FIXED_SS_PIN     4       /* Slave Select pin number */
+//#define XNRF_FIXED_CE_PORT    PORTC   /* Chip Enable port */
+//#define XNRF_FIXED_CE_PIN     2       /* Chip Enable pin number */
+
+#ifdef XNRF_FIXED_SPI
+#   define XNRF_SPI(config)     (&XNRF_FIXED_SPI)
+#else
+#   define XNRF_SPI(config)     ((config)->spi)
+#endif
+#ifdef XNRF_FIXED_USART
+#   define XNRF_USART(config)   (&XNRF_FIXED_USART)
+#else
+#   define XNRF_USART(config)   ((config)->usart)
+#endif
+
+/*! \brief Write-through copy of the nRF configuration registers.
+ *
+ *  Every setter updates the shadow and issues a single register write, so nothing needs a read-modify-write
+ *  round trip and reads of the current config never touch the bus.  Member order must match xnrf_shadow_regs[] in XNRF24L01.c.
+ */
+typedef struct {
+    uint8_t config;
+    uint8_t en_aa;
+    uint8_t en_rxaddr;
+    uint8_t setup_retr;
+    uint8_t rf_ch;
+    uint8_t rf_setup;
+    uint8_t feature;
+    uint8_t dynpd;
+} xnrf_shadow_t;
+
+/*! \brief Enhanced ShockBurst link quality counters, accumulated from OBSERVE_TX on each TX_DS / MAX_RT.
+ *
+ *  ARC_CNT only covers the most recent packet, so when several packets complete between polls the
+ *  retry count is a lower bound.
+ *
+ *  \param sent     Packets acknowledged (TX_DS).
+ *  \param lost     Packets that hit the retry limit (MAX_RT).
+ *  \param retries  Retransmissions, summed from ARC_CNT.
+ */
+typedef struct {
+    uint32_t sent;
+    uint32_t retries;
+    uint16_t lost;
+} xnrf_link_stats_t;
 
-//TODO: Update this to support USART and move confbits elsewhere.
 /*! \brief Structure which defines some items needed for nRF and SPI control.
- *  \param spi              Pointer to the SPI module this nRF is connected to.
- *  \param spi_port         Pointer to the port which the SPI module resides.
+ *  \param spi              Pointer to the SPI module this nRF is connected to.  Used with the SPI interface.
+ *  \param usart            Pointer to the USART module this nRF is connected to.  Used with the USART interface, must be USARTx0.
+ *  \param spi_port         Pointer to the port which the SPI or USART module resides.
  *  \param ss_port          Pointer to the port containing the Slave Select pin.
  *  \param ss_pin           Slave Select pin number.
  *  \param ce_port          Pointer to the port containing the Chip Enable pin.
  *  \param ce_pin           Chip Enable pin number.
  *  \param addr_width       Address width to configure.  Valid values are 3-5.
- *  \param payload_width    Default payload width for all Pipes.  Valid values are 0-32.
- *  \param confbits         Configuration bits to be written to the CONFIG register. This shiznit needs to be moved elsewhere.
+ *  \param payload_width    Payload width for all Pipes without dynamic payloads.  Valid values are 0-32.
+ *  \param confbits         Initial value for the CONFIG register, loaded into the shadow by xnrf_init().
+ *  \param shadow           Shadow copy of the configuration registers.  Maintained by the driver.
+ *  \param link             Link quality counters.  Maintained by the driver.
  */
 typedef struct {
     SPI_t *spi;
+    USART_t *usart;
     PORT_t *spi_port;
     PORT_t *ss_port;
     uint8_t ss_pin;
@@ -48,8 +110,332 @@ typedef struct {
     uint8_t addr_width;
     uint8_t payload_width;
     uint8_t confbits;
+    xnrf_shadow_t shadow;
+    xnrf_link_stats_t link;
 } xnrf_config_t;
 
+#define XNRF_MAX_PAYLOAD    32  /* Maximum payload size */
+#define XNRF_RX_FIFO_DEPTH  3   /* Number of payloads the RX FIFO can hold */
+#define XNRF_PIPE_EMPTY     7   /* RX_P_NO value when the RX FIFO is empty */
+#define XNRF_CHANNELS       126 /* RF_CH 0-125, 2400-2525MHz */
+#define XNRF_RPD_SETTLE_US  170 /* RX mode to first valid RPD reading, Tstby2a plus the 40us RPD update */
+#define XNRF_RPD_RETUNE_US  5   /* CE low, the 2 byte RF_CH write and CE high before the settling wait */
+#define XNRF_RPD_SAMPLE_NS  4500 /* one 2 byte RPD read at SPI F_CPU/8, with select/deselect */
+
+/* Estimated time in microseconds for one xnrf_scan_channel() call.  The retune and sample times are as measured by
+ * test_scan in HostSim, which doesn't charge for the loop around the reads, so real parts run a little over.
+ */
+#define XNRF_SCAN_CHANNEL_US(samples)   (XNRF_RPD_SETTLE_US + XNRF_RPD_RETUNE_US + \
+                                         (uint32_t)(samples) * XNRF_RPD_SAMPLE_NS / 1000)
+/* Estimated time in microseconds to sweep every channel once */
+#define XNRF_SCAN_PASS_US(samples)      (XNRF_CHANNELS * XNRF_SCAN_CHANNEL_US(samples))
+
+/*! \brief Received payload and the pipe it arrived on.
+ *  \param pipe     Pipe number the payload was received on.
+ *  \param len      Payload length.  Fixed payload_width, or the R_RX_PL_WID value for dynamic payload pipes.
+ *  \param data     Payload data.
+ */
+typedef struct {
+    uint8_t pipe;
+    uint8_t len;
+    uint8_t data[XNRF_MAX_PAYLOAD];
+} xnrf_packet_t;
+
+#ifndef XNRF_POOL_SIZE
+#   define XNRF_POOL_SIZE   4   /* Packet buffers in a xnrf_pool_t.  Must be a power of 2, 128 max */
+#endif
+#if (XNRF_POOL_SIZE & (XNRF_POOL_SIZE - 1)) || (XNRF_POOL_SIZE > 128)
+#   error ** XNRF_POOL_SIZE must be a power of 2, 128 max **
+#endif
+#define XNRF_POOL_MASK      (XNRF_POOL_SIZE - 1)
+
+/* Keeps buffer accesses on the right side of the index store that hands the buffer over.  A compiler barrier is all
+ * an AVR needs, a host build running the pool across threads defines a real fence, e.g. __atomic_thread_fence().
+ */
+#ifndef XNRF_BARRIER
+#   define XNRF_BARRIER()   __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+/*! \brief Fixed pool of packet buffers handed between contexts by descriptor, so a payload is written once by the
+ *  radio and read once by whatever sends it on.
+ *
+ *  Buffers move free -> (alloc) -> filled -> (post) -> ready -> (peek/pop) -> in use -> (free) -> free.  Both rings are
+ *  single producer / single consumer with free running indexes, so no locking is needed as long as each end stays in
+ *  one context:  alloc and post from the radio side (e.g. the IRQ interrupt), peek and pop from the main loop, free
+ *  from wherever the consumer finishes (e.g. the USART DRE interrupt).
+ *
+ *  \param packets      Buffer storage.
+ *  \param free_ring    Indexes of free buffers.
+ *  \param free_head    Free ring write index.  Owned by xnrf_pool_free().
+ *  \param free_tail    Free ring read index.  Owned by xnrf_pool_alloc().
+ *  \param ready_ring   Indexes of filled buffers, oldest first.
+ *  \param ready_head   Ready ring write index.  Owned by xnrf_pool_post().
+ *  \param ready_tail   Ready ring read index.  Owned by xnrf_pool_pop().
+ *  \param drops        Payloads dropped by xnrf_receive_pool() with no buffer free.
+ */
+typedef struct {
+    xnrf_packet_t packets[XNRF_POOL_SIZE];
+    uint8_t free_ring[XNRF_POOL_SIZE];
+    volatile uint8_t free_head;
+    volatile uint8_t free_tail;
+    uint8_t ready_ring[XNRF_POOL_SIZE];
+    volatile uint8_t ready_head;
+    volatile uint8_t ready_tail;
+    uint16_t drops;
+} xnrf_pool_t;
+
+#define XNRF_PIPES  6   /* Number of RX pipes */
+
+/*! \brief Handler for packets on one pipe, called from xnrf_dispatch().  The packet is only valid during the call. */
+typedef void (*xnrf_rx_handler_t)(xnrf_packet_t *packet);
+
+/*! \brief Where packets for one pipe go, and what happened to them.
+ *
+ *  A handler wins over a queue.  Pipes with neither have their packets read out of the FIFO and dropped.
+ *  The queue is single producer / single consumer, so xnrf_dispatch() can run from the IRQ interrupt while the
+ *  main loop consumes with xnrf_pipe_peek() / xnrf_pipe_pop().
+ *
+ *  \param handler  Handler for this pipe, or NULL.
+ *  \param queue    Caller supplied queue storage, or NULL.
+ *  \param mask     Queue depth - 1.  Depth must be a power of 2, 128 max.
+ *  \param head     Queue write index.  Owned by xnrf_dispatch().
+ *  \param tail     Queue read index.  Owned by xnrf_pipe_pop().
+ *  \param received Packets received on this pipe.
+ *  \param dropped  Packets dropped on this pipe, queue full or nowhere to go.
+ */
+typedef struct {
+    xnrf_rx_handler_t handler;
+    xnrf_packet_t *queue;
+    uint8_t mask;
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    uint16_t received;
+    uint16_t dropped;
+} xnrf_pipe_t;
+
+/*! \brief Per pipe routing for xnrf_dispatch(). */
+typedef struct {
+    xnrf_pipe_t pipes[XNRF_PIPES];
+} xnrf_dispatch_t;
+
+/*! \brief Counters for a TX stream.
+ *  \param packets  Payloads queued into the TX FIFO.
+ *  \param full     Number of times the TX FIFO was found full.
+ *  \param max_rt   Number of MAX_RT events.  Only happens with auto-ack enabled, the TX FIFO is flushed on each.
+ */
+typedef struct {
+    uint32_t packets;
+    uint32_t full;
+    uint16_t max_rt;
+} xnrf_stream_stats_t;
+
+/* State machine timings in microseconds, per the nRF24L01+ datasheet */
+#define XNRF_TPOR_US        100000UL    /* power on reset */
+#ifndef XNRF_TPD2STBY_US
+#   define XNRF_TPD2STBY_US 1500UL      /* power down to standby, internal crystal.  Raise to 4500 for crystals with Ls > 30mH */
+#endif
+#define XNRF_TSTBY2A_US     130UL       /* standby to RX / TX settling */
+
+/*! \brief Radio states tracked by xnrf_poll().  Only the settled ones can be requested with xnrf_request(). */
+typedef enum {
+    XNRF_STATE_RESET,           /* waiting out Tpor before the first register access */
+    XNRF_STATE_POWERDOWN,
+    XNRF_STATE_STARTUP,         /* waiting out Tpd2stby */
+    XNRF_STATE_STANDBY,
+    XNRF_STATE_RX_SETTLING,     /* CE high, waiting out Tstby2a */
+    XNRF_STATE_RX,
+    XNRF_STATE_TX_SETTLING,     /* CE high, waiting out Tstby2a */
+    XNRF_STATE_TX               /* CE held high, sends whatever is in the TX FIFO */
+} xnrf_state_t;
+
+/*! \brief Completion events posted by xnrf_poll(), one per call. */
+typedef enum {
+    XNRF_EVENT_NONE,
+    XNRF_EVENT_POWERDOWN,       /* configured and powered down, either after reset or on request */
+    XNRF_EVENT_STANDBY,         /* reached standby-I */
+    XNRF_EVENT_RX_ACTIVE,       /* listening */
+    XNRF_EVENT_TX_ACTIVE        /* transmitter is up, payloads written now go straight out */
+} xnrf_event_t;
+
+/*! \brief Non-blocking radio state machine.
+ *  \param state    Current state.
+ *  \param target   State requested with xnrf_request().
+ *  \param since    Time the current wait started, in the caller's microseconds.
+ *  \param wait     Length of the current wait in microseconds.  0 when not waiting.
+ */
+typedef struct {
+    xnrf_state_t state;
+    xnrf_state_t target;
+    uint32_t since;
+    uint32_t wait;
+} xnrf_sm_t;
+
+#define XNRF_DUTY_WAKE_US   (XNRF_TPD2STBY_US + XNRF_TSTBY2A_US)    /* power down to listening */
+
+/*! \brief Duty cycled listen schedule, driven through xnrf_sm_t.  Only touches the radio via the state machine, so the
+ *         scheduling can be run against a simulated clock.
+ *  \param period_us        Wake to wake interval.
+ *  \param listen_us        Time spent in RX per wake, counted from when the receiver is up.
+ *  \param hold_us          The window is kept open this long after each packet heard.
+ *  \param wake_at          Time of the next wake.
+ *  \param close_at         Time the current window closes.  Only valid while open.
+ *  \param listening        Radio has been asked for RX this wake.
+ *  \param open             Receiver is up and close_at is running.
+ *  \param heard            A packet came in during this window.
+ *  \param wakes            Windows opened.
+ *  \param hits             Windows that caught at least one packet.
+ *  \param missed           Wakes skipped because the caller came around too late.
+ */
+typedef struct {
+    uint32_t period_us;
+    uint32_t listen_us;
+    uint32_t hold_us;
+    uint32_t wake_at;
+    uint32_t close_at;
+    bool listening;
+    bool open;
+    bool heard;
+    uint16_t wakes;
+    uint16_t hits;
+    uint16_t missed;
+} xnrf_duty_t;
+
+#ifndef XNRF_HOP_MAX_CHANNELS
+#   define XNRF_HOP_MAX_CHANNELS    16  /* Longest hop list.  16 max, the blacklist is a 16 bit mask */
+#endif
+#define XNRF_HOP_WINDOW             32  /* Packets sent on a channel between loss rate checks */
+#define XNRF_HOP_MIN_CHANNELS       2   /* Channels never blacklisted below this many */
+#define XNRF_HOP_LOST_SLOTS         8   /* Slots without a packet before the receiver drops sync and parks */
+#define XNRF_HOP_PAROLE             16  /* Windows, on any channel, a blacklisted channel sits out before it's tried again */
+#define XNRF_HOP_MAGIC              0xA7    /* First header byte, so a stray payload can't drag the receiver off */
+#define XNRF_HOP_HEADER_SIZE        4   /* magic, slot, blacklist lsb, blacklist msb */
+#define XNRF_HOP_AIRTIME_US         1500    /* default receiver guard on top of Tstby2a, a 32 byte payload at 250kbps */
+
+/*! \brief Frequency hopping state, shared by both ends of a link through the seed and channel list.
+ *
+ *  Slots are numbered 0-255.  The channel for a slot is order[slot % count], moving on through order[] past any
+ *  blacklisted entries, so both ends land on the same channel as long as they agree on slot and blacklist.
+ *  The transmitter owns both and puts them in front of every payload (xnrf_hop_header()), the receiver adopts them
+ *  from every packet it gets (xnrf_hop_sync()).
+ *
+ *  \param channels     Hop list, RF_CH values.
+ *  \param order        Hop list indexes, shuffled from the seed.
+ *  \param count        Number of channels in the list.
+ *  \param slot         Current slot number.
+ *  \param blacklist    Bitmask of hop list indexes being skipped.
+ *  \param slot_us      Slot length in microseconds.
+ *  \param guard_us     Receiver only.  Taken off a packet's pick up time to get the slot start.  Covers the transmitter's
+ *                      settling and air time plus a margin so the receiver is listening before the transmitter hops.
+ *                      Defaults to 2 * Tstby2a plus XNRF_HOP_AIRTIME_US.
+ *  \param slot_start   Time the current slot started.
+ *  \param tx           true on the transmitting end.
+ *  \param synced       Receiver only.  false while parked waiting to hear the transmitter.  A parked receiver moves to
+ *                      the next hop list entry every count + 1 slots, so it sits out a full transmitter cycle on each.
+ *  \param idle         Receiver only.  Slots since the last packet.
+ *  \param loss_pct     Loss rate above which the transmitter blacklists a channel.
+ *  \param sent         Transmitter only.  Packets sent per hop list index in the current window.
+ *  \param lost         Transmitter only.  Packets that hit MAX_RT per hop list index in the current window.  While the
+ *                      index is blacklisted, windows left until it comes off the blacklist.
+ */
+typedef struct {
+    uint8_t channels[XNRF_HOP_MAX_CHANNELS];
+    uint8_t order[XNRF_HOP_MAX_CHANNELS];
+    uint8_t count;
+    uint8_t slot;
+    uint16_t blacklist;
+    uint32_t slot_us;
+    uint32_t guard_us;
+    uint32_t slot_start;
+    bool tx;
+    bool synced;
+    uint8_t idle;
+    uint8_t loss_pct;
+    uint8_t sent[XNRF_HOP_MAX_CHANNELS];
+    uint8_t lost[XNRF_HOP_MAX_CHANNELS];
+} xnrf_hop_t;
+
+#ifndef XNRF_BUS_MAX_RADIOS
+#   define XNRF_BUS_MAX_RADIOS  4   /* Radios one xnrf_bus_t can arbitrate.  Must be a power of 2 */
+#endif
+#if (XNRF_BUS_MAX_RADIOS & (XNRF_BUS_MAX_RADIOS - 1)) || (XNRF_BUS_MAX_RADIOS > 8)
+#   error ** XNRF_BUS_MAX_RADIOS must be a power of 2, 8 max **
+#endif
+#define XNRF_BUS_IDLE           0xFF    /* xnrf_bus_service() radio index when nothing was pending */
+
+/*! \brief Per radio counters kept by the bus arbiter.
+ *  \param irqs     IRQs reported through xnrf_bus_irq().
+ *  \param merged   IRQs that arrived while the radio was already queued, and were folded into that entry.
+ *  \param packets  Payloads retrieved by xnrf_bus_service().
+ */
+typedef struct {
+    uint16_t irqs;
+    uint16_t merged;
+    uint32_t packets;
+} xnrf_bus_stats_t;
+
+/*! \brief Several radios sharing one SPI bus, each with its own SS / CE pins.
+ *
+ *  IRQ handlers only queue the radio with xnrf_bus_irq(), they never touch the bus.  The main loop services radios
+ *  one at a time in the order their IRQs fired with xnrf_bus_service(), so transactions can't interleave.
+ *  The queue holds each radio at most once, so it can't overflow.  Not available with XNRF_FIXED_SS_PORT / XNRF_FIXED_CE_PORT.
+ *
+ *  \param radios   Radio configs, in the order added.
+ *  \param stats    Per radio counters, same index as radios.
+ *  \param count    Number of radios added.
+ *  \param queue    Radio indexes waiting for service, oldest IRQ first.
+ *  \param head     Queue write index.  Moved by xnrf_bus_irq(), and by xnrf_bus_service() with interrupts held off.
+ *  \param tail     Queue read index.  Owned by xnrf_bus_service().
+ *  \param pending  Bitmask of radios currently in the queue.
+ */
+typedef struct {
+    xnrf_config_t *radios[XNRF_BUS_MAX_RADIOS];
+    xnrf_bus_stats_t stats[XNRF_BUS_MAX_RADIOS];
+    uint8_t count;
+    uint8_t queue[XNRF_BUS_MAX_RADIOS];
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    volatile uint8_t pending;
+} xnrf_bus_t;
+
+#define XNRF_PROFILE_NAME_SIZE  8
+#define XNRF_PROFILE_TABLE_SIZE (9 * 3 + 6 * 3 + 3 * (2 + 5) + 4 * 3 + 1)   /* xnrf_write_batch() table it expands to */
+
+/*! \brief Complete radio setup, in register form so it can be stored (i.e. in EEPROM) and applied as one batch.
+ *  \param name             NUL padded name, for listing profiles.
+ *  \param crc              EN_CRC / CRCO bits for CONFIG, any other bit makes the profile invalid.  The rest of
+ *                          CONFIG comes from the shadow.
+ *  \param en_aa            EN_AA register, auto ack per pipe.
+ *  \param en_rxaddr        EN_RXADDR register, enabled pipes.
+ *  \param setup_retr       SETUP_RETR register.
+ *  \param rf_ch            RF_CH register, channel.
+ *  \param rf_setup         RF_SETUP register, data rate and power.
+ *  \param feature          FEATURE register, dynamic payloads and ACK payloads.
+ *  \param dynpd            DYNPD register, dynamic payloads per pipe.
+ *  \param addr_width       Address width, 3-5.
+ *  \param payload_width    Static payload width for all pipes.
+ *  \param tx_addr          TX address, LSB first.
+ *  \param rx0_addr         Pipe 0 address, LSB first.
+ *  \param rx1_addr         Pipe 1 address, LSB first.
+ *  \param rx_lsb           Pipe 2-5 address LSBs.  The rest is shared with pipe 1.
+ */
+typedef struct {
+    char name[XNRF_PROFILE_NAME_SIZE];
+    uint8_t crc;
+    uint8_t en_aa;
+    uint8_t en_rxaddr;
+    uint8_t setup_retr;
+    uint8_t rf_ch;
+    uint8_t rf_setup;
+    uint8_t feature;
+    uint8_t dynpd;
+    uint8_t addr_width;
+    uint8_t payload_width;
+    uint8_t tx_addr[5];
+    uint8_t rx0_addr[5];
+    uint8_t rx1_addr[5];
+    uint8_t rx_lsb[4];
+} xnrf_profile_t;
+
 typedef enum {
     XNRF_250KBPS,
     XNRF_1MBPS,
@@ -65,35 +451,381 @@ typedef enum {
   */
 void xnrf_init(xnrf_config_t *config);
 
+/*! \brief Sets up the interface and pushes the initial configuration, leaving the radio powered down.
+ *
+ *  Same as xnrf_init() without the power on reset delay, for when Tpor is already known to have passed.
+ *
+ *  \param config  Pointer to a xnrf_config_t structure.
+ */
+void xnrf_configure(xnrf_config_t *config);
+
+/*! \brief Starts the non-blocking state machine in XNRF_STATE_RESET.  Replaces xnrf_init().
+ *
+ *  Only the pins are set up here.  The first xnrf_poll() after Tpor has passed runs xnrf_configure() and posts
+ *  XNRF_EVENT_POWERDOWN.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param sm       Pointer to a xnrf_sm_t structure.
+ *  \param now_us   Current time in microseconds, from any free running timer.
+ */
+void xnrf_sm_init(xnrf_config_t *config, xnrf_sm_t *sm, uint32_t now_us);
+
+/*! \brief Advances the state machine.  Never waits, call it as often as the main loop comes around.
+ *
+ *  Mode changes step through standby, so RX <-> TX costs one Tstby2a and powering up costs Tpd2stby on top.
+ *  Don't touch CONFIG or CE directly while the state machine is driving the radio.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param sm       Pointer to a xnrf_sm_t structure.
+ *  \param now_us   Current time in microseconds.  May wrap.
+ *  \return         Event for a state reached on this call, XNRF_EVENT_NONE otherwise.
+ */
+xnrf_event_t xnrf_poll(xnrf_config_t *config, xnrf_sm_t *sm, uint32_t now_us);
+
+/*! \brief Sets up a duty cycled listen schedule.  The first wake is now.
+ *  \param duty         Pointer to a xnrf_duty_t structure.
+ *  \param period_us    Wake to wake interval.  Senders repeat for xnrf_duty_repeat_us() to be heard.
+ *  \param listen_us    RX window per wake.  At least two packet spacings of the sender so one lands whole.
+ *  \param hold_us      Window extension after each packet.
+ *  \param now_us       Current time in microseconds.
+ */
+void xnrf_duty_init(xnrf_duty_t *duty, uint32_t period_us, uint32_t listen_us, uint32_t hold_us, uint32_t now_us);
+
+/*! \brief Runs the duty cycle schedule.  Call on every pass alongside xnrf_poll() and pass the result to xnrf_request().
+ *  \param duty     Pointer to a xnrf_duty_t structure.
+ *  \param sm       Pointer to the xnrf_sm_t driving the radio.
+ *  \param now_us   Current time in microseconds.  May wrap.
+ *  \return         State the radio should be heading for, XNRF_STATE_RX or XNRF_STATE_POWERDOWN.
+ */
+xnrf_state_t xnrf_duty_schedule(xnrf_duty_t *duty, xnrf_sm_t *sm, uint32_t now_us);
+
+/*! \brief Tells the schedule a packet came in, which holds the window open for hold_us from now.
+ *  \param duty     Pointer to a xnrf_duty_t structure.
+ *  \param now_us   Current time in microseconds.
+ */
+void xnrf_duty_heard(xnrf_duty_t *duty, uint32_t now_us);
+
+/*! \brief Returns how long the MCU can sleep before the schedule or the state machine needs another pass.
+ *
+ *  While the window is open that's the time to close_at, so the nRF IRQ has to be able to wake the MCU.
+ *
+ *  \param duty     Pointer to a xnrf_duty_t structure.
+ *  \param sm       Pointer to the xnrf_sm_t driving the radio.
+ *  \param now_us   Current time in microseconds.
+ *  \return         Microseconds to sleep, 0 if there's work to do now.
+ */
+uint32_t xnrf_duty_sleep_us(xnrf_duty_t *duty, xnrf_sm_t *sm, uint32_t now_us);
+
 /*! \brief Retrieves an array of bytes for the given register.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param reg      Register to trigger the query.
  *  \param data     Address of a buffer to hold the returned data.
  *  \param len      Length of the data you're retrieving.
+ *  \return         Contents of the STATUS register.
  */
-void xnrf_read_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len);
+uint8_t xnrf_read_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len);
 
 /*! \brief Writes an array of bytes for the given register.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param reg      Register to trigger the write.
  *  \param data     Pointer to the data we are sending.
  *  \param len      Size of the data we are sending.
+ *  \return         Contents of the STATUS register.
  */
-void xnrf_write_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len);
+uint8_t xnrf_write_register_buffer(xnrf_config_t *config, uint8_t reg, uint8_t *data, uint8_t len);
 
 /*! \brief Retrieves a payload.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param data     Address of a buffer to hold the returned payload
  *  \param len      Length of the payload you're retrieving.
+ *  \return         Contents of the STATUS register.  RX_P_NO is the pipe the payload came in on.
+ */
+uint8_t xnrf_read_payload(xnrf_config_t *config, uint8_t *data, uint8_t len);
+
+/*! \brief Retrieves a dynamic length payload.  Only clocks out as many bytes as R_RX_PL_WID reports.
+ *
+ *  A width over 32 means the payload is corrupt, in which case the RX FIFO is flushed per the datasheet.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param data     Address of a buffer to hold the returned payload.  Must hold XNRF_MAX_PAYLOAD bytes.
+ *  \return         Length of the payload, 0 if it was corrupt.
  */
-void xnrf_read_payload(xnrf_config_t *config, uint8_t *data, uint8_t len);
+uint8_t xnrf_read_dynamic_payload(xnrf_config_t *config, uint8_t *data);
 
 /*! \brief Writes a payload to be transmitted.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param data     Pointer to the payload we are sending.
  *  \param len      Size of the payload we are sending.
+ *  \return         Contents of the STATUS register from before the payload was queued.
+ */
+uint8_t xnrf_write_payload(xnrf_config_t *config, uint8_t *data, uint8_t len);
+
+#define XNRF_BATCH_END  0xFF    /* Terminates a xnrf_write_batch() table */
+
+/*! \brief Applies a table of register writes, e.g. a whole radio profile.
+ *
+ *  The table is a run of entries of register, length, then that many data bytes, ended by XNRF_BATCH_END.
+ *  Multi-byte entries are for the address registers.  Each entry is one SS cycle, which is the minimum since the
+ *  nRF ends every command on SS rising and doesn't auto-increment registers.  Shadowed registers update the shadow.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param table    Register write table.
+ *  \return         Contents of the STATUS register from the last write.
+ */
+uint8_t xnrf_write_batch(xnrf_config_t *config, const uint8_t *table);
+
+/*! \brief Applies a radio profile with a single xnrf_write_batch().  Leaves power and CE state alone.
+ *  \param config   Pointer to a xnrf_config_t structure.  Takes the profile's address and payload widths.
+ *  \param profile  Profile to apply.
+ *  \return         false if the profile is invalid (i.e. blank EEPROM), in which case nothing is written.
+ */
+bool xnrf_apply_profile(xnrf_config_t *config, const xnrf_profile_t *profile);
+
+/*! \brief Checks the shadowed configuration registers against the radio, i.e. after a brown-out.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \return         true if the radio matches the shadow.
+ */
+bool xnrf_verify(xnrf_config_t *config);
+
+/*! \brief Rewrites all shadowed configuration registers to the radio.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ */
+void xnrf_resync(xnrf_config_t *config);
+
+/*! \brief Drains the RX FIFO, retrieving up to max payloads and clearing RX_DR.
+ *
+ *  RX_DR is only cleared once the FIFO is seen empty, so if the batch fills up first the IRQ stays asserted
+ *  and the remaining payloads can be picked up on the next call.  That can happen even with XNRF_RX_FIFO_DEPTH entries,
+ *  as payloads keep landing while the FIFO is read.  With an edge sensed IRQ, call again while the return equals max,
+ *  or the IRQ line never goes high for the next edge.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param batch    Array of packets to hold the retrieved payloads and their pipe numbers.
+ *  \param max      Number of entries in batch.
+ *  \return         Number of payloads retrieved.
+ */
+uint8_t xnrf_receive_all(xnrf_config_t *config, xnrf_packet_t *batch, uint8_t max);
+
+/*! \brief Samples the Received Power Detector on one channel.  nRF24L01+ only.
+ *
+ *  Drops CE, retunes, raises CE, waits XNRF_RPD_SETTLE_US then reads RPD back to back, so the dwell on the channel is
+ *  XNRF_RPD_RETUNE_US plus the settling time plus samples * XNRF_RPD_SAMPLE_NS.  The radio must be powered up in RX mode.  Leaves CE low
+ *  and the radio tuned to channel.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param channel  Channel to sample, 0-125.
+ *  \param samples  Number of RPD reads.
+ *  \return         Number of reads that saw more than -64dBm.
+ */
+uint8_t xnrf_scan_channel(xnrf_config_t *config, uint8_t channel, uint8_t samples);
+
+/*! \brief Sets up frequency hopping.  Both ends need the same channel list and seed.
+ *
+ *  The transmitter starts synced, the receiver starts parked on the first channel in the sequence.  Tunes the radio
+ *  to the slot 0 channel.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param hop      Pointer to a xnrf_hop_t structure.
+ *  \param channels Hop list, RF_CH values.  Copied.
+ *  \param count    Number of channels, XNRF_HOP_MIN_CHANNELS to XNRF_HOP_MAX_CHANNELS.  Longer lists are cut short.
+ *  \param seed     Non-zero seed for the hop order.
+ *  \param slot_us  Slot length in microseconds.
+ *  \param loss_pct Loss rate in percent above which the transmitter blacklists a channel.
+ *  \param tx       true for the transmitting end.
+ *  \param now_us   Current time in microseconds.
+ *  \return         false, with hop and the radio left alone, if count is below XNRF_HOP_MIN_CHANNELS.
+ */
+bool xnrf_hop_init(xnrf_config_t *config, xnrf_hop_t *hop, const uint8_t *channels, uint8_t count, uint16_t seed,
+                   uint32_t slot_us, uint8_t loss_pct, bool tx, uint32_t now_us);
+
+/*! \brief Moves to the next slot when the current one has run out.  Never waits.
+ *
+ *  The channel change is a single RF_CH write, skipped if the channel didn't change.  CE is dropped around the
+ *  write and restored.  A receiver that has gone XNRF_HOP_LOST_SLOTS without a packet drops sync and parks.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param hop      Pointer to a xnrf_hop_t structure.
+ *  \param now_us   Current time in microseconds.
+ *  \return         true if a new slot started.
  */
-void xnrf_write_payload(xnrf_config_t *config, uint8_t *data, uint8_t len);
+bool xnrf_hop_poll(xnrf_config_t *config, xnrf_hop_t *hop, uint32_t now_us);
+
+/*! \brief Transmitter.  Writes the XNRF_HOP_HEADER_SIZE byte magic, slot and blacklist header for the current slot.
+ *  \param hop      Pointer to a xnrf_hop_t structure.
+ *  \param header   Buffer to put it in, usually the start of the payload.
+ */
+void xnrf_hop_header(xnrf_hop_t *hop, uint8_t *header);
+
+/*! \brief Transmitter.  Counts the outcome of a packet against the current channel and blacklists it if the loss
+ *  rate over the last XNRF_HOP_WINDOW packets is above loss_pct.  Every completed window counts down the blacklisted
+ *  channels, which come back after XNRF_HOP_PAROLE windows to be measured again.
+ *  \param hop      Pointer to a xnrf_hop_t structure.
+ *  \param status   STATUS with TX_DS or MAX_RT set, as returned by xnrf_update_link_stats().
+ */
+void xnrf_hop_account(xnrf_hop_t *hop, uint8_t status);
+
+/*! \brief Receiver.  Adopts slot and blacklist from a received header and lines the slot timer up with it.
+ *
+ *  Headers without XNRF_HOP_MAGIC, or with a blacklist the transmitter could never have sent, are ignored.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param hop      Pointer to a xnrf_hop_t structure.
+ *  \param header   XNRF_HOP_HEADER_SIZE byte header from the received payload.
+ *  \param now_us   Time the packet was picked up.
+ *  \return         true if the header was valid and adopted.
+ */
+bool xnrf_hop_sync(xnrf_config_t *config, xnrf_hop_t *hop, const uint8_t *header, uint32_t now_us);
+
+/*! \brief Clears all pipe routes and counters.
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ */
+void xnrf_dispatch_init(xnrf_dispatch_t *dispatch);
+
+/*! \brief Routes a pipe to a handler.
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ *  \param pipe     Pipe number, 0-5.
+ *  \param handler  Handler to call, NULL to remove.
+ */
+void xnrf_dispatch_handler(xnrf_dispatch_t *dispatch, uint8_t pipe, xnrf_rx_handler_t handler);
+
+/*! \brief Routes a pipe to a bounded queue.
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ *  \param pipe     Pipe number, 0-5.
+ *  \param queue    Queue storage, depth entries.
+ *  \param depth    Number of entries.  Must be a power of 2, 128 max.
+ */
+void xnrf_dispatch_queue(xnrf_dispatch_t *dispatch, uint8_t pipe, xnrf_packet_t *queue, uint8_t depth);
+
+/*! \brief Drains the RX FIFO, routing each payload by pipe.  Clears RX_DR like xnrf_receive_all().
+ *
+ *  The pipe comes from the STATUS byte returned with the read command, and queued payloads are read straight into
+ *  their queue entry.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ *  \return         Number of payloads taken out of the FIFO, dropped ones included.
+ */
+uint8_t xnrf_dispatch(xnrf_config_t *config, xnrf_dispatch_t *dispatch);
+
+/*! \brief Puts every buffer in a pool on the free ring.  Call before either side starts using it.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ */
+void xnrf_pool_init(xnrf_pool_t *pool);
+
+/*! \brief Drains the RX FIFO straight into pool buffers and posts them.  Clears RX_DR like xnrf_receive_all().
+ *
+ *  Payloads that arrive with no buffer free are read out and counted in pool->drops.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ *  \return         Number of payloads posted.
+ */
+uint8_t xnrf_receive_pool(xnrf_config_t *config, xnrf_pool_t *pool);
+
+/*! \brief Starts a TX stream.  Flushes the TX FIFO, clears the TX flags and raises CE for good.
+ *
+ *  The nRF must already be powered up in TX mode.  With CE held high the radio sends back to back as long as the
+ *  TX FIFO has data, so the 130us TX settling is only paid when the FIFO runs dry.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param stats    Pointer to a xnrf_stream_stats_t structure to reset.
+ */
+void xnrf_stream_start(xnrf_config_t *config, xnrf_stream_stats_t *stats);
+
+/*! \brief Non-blocking TX stream top up.  Queues the payload if the TX FIFO has room.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param stats    Pointer to the xnrf_stream_stats_t structure for this stream.
+ *  \param data     Pointer to the payload we are sending.
+ *  \param len      Size of the payload we are sending.
+ *  \return         true if the payload was queued, false if the TX FIFO is full.
+ */
+bool xnrf_stream_tx(xnrf_config_t *config, xnrf_stream_stats_t *stats, uint8_t *data, uint8_t len);
+
+/*! \brief Stops a TX stream.  Waits for the TX FIFO to empty, then drops CE.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ */
+void xnrf_stream_stop(xnrf_config_t *config);
+
+/*! \brief Enables Dynamic Payload Length on the given pipes, disables it on the rest.
+ *
+ *  DPL requires auto-ack on the same pipes, and the transmitter needs it enabled on pipe 0.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param pipes    Bitmask of pipes, (1 << DPL_Px).  0 turns off EN_DPL entirely.
+ */
+void xnrf_set_dynamic_payloads(xnrf_config_t *config, uint8_t pipes);
+
+/*! \brief Sets the auto retransmit delay and count.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param delay    Retransmit delay in 250us steps, 0-15 for 250-4000us.
+ *  \param count    Retransmit count, 0-15.  0 disables retransmits.
+ */
+void xnrf_set_retries(xnrf_config_t *config, uint8_t delay, uint8_t count);
+
+/*! \brief Enables or disables payloads on ACK packets.
+ *
+ *  ACK payloads ride on dynamic payloads, so xnrf_set_dynamic_payloads() needs to cover the pipes involved
+ *  (pipe 0 on the transmitter) along with auto-ack.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param enable   true to enable ACK payloads.
+ */
+void xnrf_set_ack_payloads(xnrf_config_t *config, bool enable);
+
+/*! \brief Pre-loads a payload to ride back on the next ACK sent from the given pipe.  Up to 3 can be queued.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param pipe     Pipe number the ACK will be sent on.
+ *  \param data     Pointer to the payload we are sending.
+ *  \param len      Size of the payload we are sending.
+ *  \return         Contents of the STATUS register.
+ */
+uint8_t xnrf_write_ack_payload(xnrf_config_t *config, uint8_t pipe, uint8_t *data, uint8_t len);
+
+/*! \brief Polls STATUS and folds any TX_DS / MAX_RT event into the link counters, clearing those flags.
+ *
+ *  The payload that hit MAX_RT is left in the TX FIFO, flush it or pulse CE to try again.
+ *
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \return         Contents of the STATUS register before the flags were cleared.
+ */
+uint8_t xnrf_update_link_stats(xnrf_config_t *config);
+
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)
+/*! \brief Clears a bus arbiter.
+ *  \param bus      Pointer to a xnrf_bus_t structure.
+ */
+void xnrf_bus_init(xnrf_bus_t *bus);
+
+/*! \brief Adds a radio to a bus.  Drives its SS high so it stays off the bus while the other radios are set up.
+ *
+ *  Add every radio before calling xnrf_init() on any of them.
+ *
+ *  \param bus      Pointer to a xnrf_bus_t structure.
+ *  \param config   Pointer to the radio's xnrf_config_t structure.
+ *  \return         Index of the radio on this bus, used with xnrf_bus_irq().  XNRF_BUS_IDLE if the bus is full.
+ */
+uint8_t xnrf_bus_add(xnrf_bus_t *bus, xnrf_config_t *config);
+
+/*! \brief Queues a radio for service.  Call from that radio's IRQ pin interrupt.  All radios on a bus need the same interrupt level.
+ *  \param bus      Pointer to a xnrf_bus_t structure.
+ *  \param radio    Index returned by xnrf_bus_add().
+ */
+void xnrf_bus_irq(xnrf_bus_t *bus, uint8_t radio);
+
+/*! \brief Services the radio whose IRQ fired first.  Drains its RX FIFO with xnrf_receive_all().
+ *
+ *  A radio that gives up max payloads goes to the back of the queue again, as payloads landing during the drain
+ *  can leave RX_DR set and its IRQ held low with no new edge to come.  Keep calling until it returns XNRF_BUS_IDLE.
+ *  Returns without touching the bus while an async XSPI DMA transfer is running.
+ *
+ *  \param bus      Pointer to a xnrf_bus_t structure.
+ *  \param batch    Array of packets to hold the retrieved payloads.
+ *  \param max      Number of entries in batch.
+ *  \param radio    Set to the index of the radio serviced, XNRF_BUS_IDLE if none was pending.
+ *  \return         Number of payloads retrieved.
+ */
+uint8_t xnrf_bus_service(xnrf_bus_t *bus, xnrf_packet_t *batch, uint8_t max, uint8_t *radio);
+#endif
 
 /*! \brief Sets the air datarate.
  *  \param config   Pointer to a xnrf_config_t structure.
@@ -112,32 +844,91 @@ void xnrf_set_address_width(xnrf_config_t *config, uint8_t width);
 /* INLINE FUCTIONS                                                      */
 /************************************************************************/
 
+/*! \brief Sends and returns a single byte over the configured interface.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param val      Byte to send.
+ *  \return         Byte returned by the nRF.
+ */
+static inline uint8_t xnrf_transfer_byte(xnrf_config_t *config, uint8_t val) {
+#if NRF_INTERFACE == XNRF_IF_USART
+    return xspi_usart_transfer_byte(XNRF_USART(config), val);
+#else
+    return xspi_transfer_byte(XNRF_SPI(config), val);
+#endif
+}
+
+/*! \brief Sends a block of bytes over the configured interface, ignoring what comes back.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param data     Pointer to the data being sent.
+ *  \param len      Length in bytes of the data being sent.
+ */
+static inline void xnrf_send_bytes(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+#if NRF_INTERFACE == XNRF_IF_USART
+    xspi_usart_send_packet(XNRF_USART(config), data, len);
+#else
+    xspi_send_packet(XNRF_SPI(config), data, len);
+#endif
+}
+
+/*! \brief Retrieves a block of bytes over the configured interface, clocking out NOPs.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param data     Pointer to a buffer to store the retrieved data.
+ *  \param len      Size of the buffer in bytes.
+ */
+static inline void xnrf_get_bytes(xnrf_config_t *config, uint8_t *data, uint8_t len) {
+#if NRF_INTERFACE == XNRF_IF_USART
+    xspi_usart_get_packet(XNRF_USART(config), data, len);
+#else
+    xspi_get_packet(XNRF_SPI(config), data, len);
+#endif
+}
+
 /*! \brief Pulls the Slave Select line low and selects our nRF.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
 static inline void xnrf_select(xnrf_config_t *config) {
+    XSTATS_BEGIN();
+#ifdef XNRF_FIXED_SS_PORT
+    XNRF_FIXED_SS_PORT.OUTCLR = (1 << XNRF_FIXED_SS_PIN);
+#else
     config->ss_port->OUTCLR = (1 << config->ss_pin);
+#endif
+    XSTATS_END(XSTATS_NRF_SELECT, 0);
 }
 
 /*! \brief Pulls the Slave Select line high and de-selects our nRF.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
 static inline void xnrf_deselect(xnrf_config_t *config) {
+    XSTATS_BEGIN();
+#ifdef XNRF_FIXED_SS_PORT
+    XNRF_FIXED_SS_PORT.OUTSET = (1 << XNRF_FIXED_SS_PIN);
+#else
     config->ss_port->OUTSET = (1 << config->ss_pin);
+#endif
+    XSTATS_END(XSTATS_NRF_DESELECT, 0);
 }
 
 /*! \brief Pulls the Chip Enable line high and enables our nRF.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
  static inline void xnrf_enable(xnrf_config_t *config) {
+#ifdef XNRF_FIXED_CE_PORT
+    XNRF_FIXED_CE_PORT.OUTSET = (1 << XNRF_FIXED_CE_PIN);
+#else
     config->ce_port->OUTSET = (1 << config->ce_pin);
+#endif
  }
 
 /*! \brief Pulls the Chip Enable line low and disables our nRF.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
  static inline void xnrf_disable(xnrf_config_t *config) {
+#ifdef XNRF_FIXED_CE_PORT
+    XNRF_FIXED_CE_PORT.OUTCLR = (1 << XNRF_FIXED_CE_PIN);
+#else
     config->ce_port->OUTCLR = (1 << config->ce_pin);
+#endif
  }
 
 /*! \brief Flushes the RX FIFO.
@@ -146,7 +937,7 @@ static inline void xnrf_deselect(xnrf_config_t *config) {
  */
 static inline uint8_t xnrf_flush_rx(xnrf_config_t *config) {
     xnrf_select(config);
-    uint8_t status = xspi_transfer_byte(config->spi, FLUSH_RX);
+    uint8_t status = xnrf_transfer_byte(config, FLUSH_RX);
     xnrf_deselect(config);
     return status;
 }
@@ -157,7 +948,7 @@ static inline uint8_t xnrf_flush_rx(xnrf_config_t *config) {
  */
 static inline uint8_t xnrf_flush_tx(xnrf_config_t *config) {
     xnrf_select(config);
-    uint8_t status = xspi_transfer_byte(config->spi, FLUSH_TX);
+    uint8_t status = xnrf_transfer_byte(config, FLUSH_TX);
     xnrf_deselect(config);
     return status;
 }
@@ -168,60 +959,202 @@ static inline uint8_t xnrf_flush_tx(xnrf_config_t *config) {
  */
 static inline uint8_t xnrf_get_status(xnrf_config_t *config) {
     xnrf_select(config);
-    uint8_t status = xspi_transfer_byte(config->spi, NRF_NOP);
+    uint8_t status = xnrf_transfer_byte(config, NRF_NOP);
     xnrf_deselect(config);
     return status;
 }
 
+/*! \brief Returns the width of the payload at the top of the RX FIFO.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \return         Payload width.  Anything over 32 means the payload is corrupt and the RX FIFO must be flushed.
+ */
+static inline uint8_t xnrf_read_payload_width(xnrf_config_t *config) {
+    xnrf_select(config);
+    xnrf_transfer_byte(config, R_RX_PL_WID);
+    uint8_t width = xnrf_transfer_byte(config, NRF_NOP);
+    xnrf_deselect(config);
+    return width;
+}
+
+/*! \brief Extracts the pipe number of the payload at the top of the RX FIFO from a STATUS value.
+ *  \param status   Contents of the STATUS register.
+ *  \return         Pipe number, or XNRF_PIPE_EMPTY if the RX FIFO is empty.
+ */
+static inline uint8_t xnrf_status_pipe(uint8_t status) {
+    return (status >> RX_P_NO) & 0x07;
+}
+
 /*! \brief Returns a single byte for the given register.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param reg      Register to query.
  *  \return         Contents of the register.
  */
 static inline uint8_t xnrf_read_register(xnrf_config_t *config, uint8_t reg) {
+    XSTATS_BEGIN();
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, (R_REGISTER | (REGISTER_MASK & reg)));
-    uint8_t result = xspi_transfer_byte(config->spi, NRF_NOP);
+    xnrf_transfer_byte(config, (R_REGISTER | (REGISTER_MASK & reg)));
+    uint8_t result = xnrf_transfer_byte(config, NRF_NOP);
     xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_READ_REGISTER, 2);
     return result;
 }
 
+/*! \brief Reads a single byte register and returns STATUS from the same transaction.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param reg      Register to query.
+ *  \param val      Set to the contents of the register.
+ *  \return         Contents of the STATUS register.
+ */
+static inline uint8_t xnrf_read_register_status(xnrf_config_t *config, uint8_t reg, uint8_t *val) {
+    XSTATS_BEGIN();
+    xnrf_select(config);
+    uint8_t status = xnrf_transfer_byte(config, (R_REGISTER | (REGISTER_MASK & reg)));
+    *val = xnrf_transfer_byte(config, NRF_NOP);
+    xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_READ_REGISTER, 2);
+    return status;
+}
+
 /*! \brief Writes a single byte to the given register.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param reg      Register to write.
  *  \param val      Value to write to the register.
+ *  \return         Contents of the STATUS register, clocked out with the command byte.
  */
-static inline void xnrf_write_register(xnrf_config_t *config, uint8_t reg, uint8_t val) {
+static inline uint8_t xnrf_write_register(xnrf_config_t *config, uint8_t reg, uint8_t val) {
+    XSTATS_BEGIN();
     xnrf_select(config);
-    xspi_transfer_byte(config->spi, (W_REGISTER | (REGISTER_MASK & reg)));
-    xspi_transfer_byte(config->spi, val);
+    uint8_t status = xnrf_transfer_byte(config, (W_REGISTER | (REGISTER_MASK & reg)));
+    xnrf_transfer_byte(config, val);
     xnrf_deselect(config);
+    XSTATS_END(XSTATS_NRF_WRITE_REGISTER, 2);
+    return status;
 }
 
-//TODO: need to move confbits elsewhere to they can change at runtime
 /*! \brief Powers up the nRF in TX mode.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
 static inline void xnrf_powerup_tx (xnrf_config_t *config) {
-    config->confbits |= (1 << PWR_UP);
-    config->confbits &= ~(1 << PRIM_RX);
-    xnrf_write_register(config, CONFIG, config->confbits);
+    config->shadow.config = (config->shadow.config | (1 << PWR_UP)) & ~(1 << PRIM_RX);
+    xnrf_write_register(config, CONFIG, config->shadow.config);
 }
 
-//TODO: need to move confbits elsewhere to they can change at runtime
 /*! \brief Powers up the nRF in RX mode.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
 static inline void xnrf_powerup_rx (xnrf_config_t *config) {
-    xnrf_write_register(config, CONFIG, (config->confbits | ((1 << PWR_UP) | (1 << PRIM_RX))));
+    config->shadow.config |= (1 << PWR_UP) | (1 << PRIM_RX);
+    xnrf_write_register(config, CONFIG, config->shadow.config);
 }
 
 /*! \brief Powers down the nRF.
  *  \param config   Pointer to a xnrf_config_t structure.
  */
-//TODO: need to move confbits elsewhere to they can change at runtime
 static inline void xnrf_powerdown (xnrf_config_t *config) {
-    xnrf_write_register(config, CONFIG, (config->confbits & ~(1 << PWR_UP)));
+    config->shadow.config &= ~(1 << PWR_UP);
+    xnrf_write_register(config, CONFIG, config->shadow.config);
+}
+
+/*! \brief Returns the oldest packet queued on a pipe, or NULL if there is none.  It stays queued until xnrf_pipe_pop().
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ *  \param pipe     Pipe number, 0-5.
+ */
+static inline xnrf_packet_t *xnrf_pipe_peek(xnrf_dispatch_t *dispatch, uint8_t pipe) {
+    xnrf_pipe_t *p = &dispatch->pipes[pipe];
+    uint8_t tail = p->tail;
+
+    if (tail == p->head)
+        return NULL;
+    return &p->queue[tail & p->mask];
+}
+
+/*! \brief Releases the packet returned by xnrf_pipe_peek().
+ *  \param dispatch Pointer to a xnrf_dispatch_t structure.
+ *  \param pipe     Pipe number, 0-5.
+ */
+static inline void xnrf_pipe_pop(xnrf_dispatch_t *dispatch, uint8_t pipe) {
+    dispatch->pipes[pipe].tail++;
+}
+
+/*! \brief Takes a buffer off the free ring.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ *  \return         Buffer to fill, NULL if all are in use.
+ */
+static inline xnrf_packet_t *xnrf_pool_alloc(xnrf_pool_t *pool) {
+    uint8_t tail = pool->free_tail;
+
+    if (tail == pool->free_head)
+        return NULL;
+    XNRF_BARRIER();
+    xnrf_packet_t *packet = &pool->packets[pool->free_ring[tail & XNRF_POOL_MASK]];
+    pool->free_tail = tail + 1;
+    return packet;
+}
+
+/*! \brief Hands a filled buffer to the consumer.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ *  \param packet   Buffer from xnrf_pool_alloc().
+ */
+static inline void xnrf_pool_post(xnrf_pool_t *pool, xnrf_packet_t *packet) {
+    uint8_t head = pool->ready_head;
+
+    pool->ready_ring[head & XNRF_POOL_MASK] = packet - pool->packets;
+    XNRF_BARRIER();
+    pool->ready_head = head + 1;
+}
+
+/*! \brief Returns the oldest posted buffer without taking it, NULL if there is none.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ */
+static inline xnrf_packet_t *xnrf_pool_peek(xnrf_pool_t *pool) {
+    uint8_t tail = pool->ready_tail;
+
+    if (tail == pool->ready_head)
+        return NULL;
+    XNRF_BARRIER();
+    return &pool->packets[pool->ready_ring[tail & XNRF_POOL_MASK]];
+}
+
+/*! \brief Takes the buffer returned by xnrf_pool_peek() off the ready ring.  It still needs xnrf_pool_free() when done.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ */
+static inline void xnrf_pool_pop(xnrf_pool_t *pool) {
+    XNRF_BARRIER();
+    pool->ready_tail++;
+}
+
+/*! \brief Returns a buffer to the free ring.
+ *  \param pool     Pointer to a xnrf_pool_t structure.
+ *  \param packet   Buffer to release.
+ */
+static inline void xnrf_pool_free(xnrf_pool_t *pool, xnrf_packet_t *packet) {
+    uint8_t head = pool->free_head;
+
+    pool->free_ring[head & XNRF_POOL_MASK] = packet - pool->packets;
+    XNRF_BARRIER();
+    pool->free_head = head + 1;
+}
+
+/*! \brief Asks the state machine to move to a new state.  Takes effect on the following xnrf_poll() calls.
+ *  \param sm       Pointer to a xnrf_sm_t structure.
+ *  \param target   XNRF_STATE_POWERDOWN, XNRF_STATE_STANDBY, XNRF_STATE_RX or XNRF_STATE_TX.
+ */
+static inline void xnrf_request(xnrf_sm_t *sm, xnrf_state_t target) {
+    sm->target = target;
+}
+
+/*! \brief Returns how long a sender has to keep repeating a packet to land in one of the receiver's windows.
+ *  \param duty     Pointer to the receiver's xnrf_duty_t settings.
+ */
+static inline uint32_t xnrf_duty_repeat_us(xnrf_duty_t *duty) {
+    return duty->period_us + duty->listen_us;
+}
+
+/*! \brief Returns true once the state machine has settled in the requested state.
+ *  \param sm       Pointer to a xnrf_sm_t structure.
+ */
+static inline bool xnrf_settled(xnrf_sm_t *sm) {
+    return sm->state == sm->target;
 }
 
 /*! \brief Sets the nRF channel.
@@ -229,9 +1162,28 @@ static inline void xnrf_powerdown (xnrf_config_t *config) {
  *  \param channel  Desired channel number (1-127).  We don't check so stay in range.  We're embedded FFS, don't be a tard.
  */
 static inline void xnrf_set_channel (xnrf_config_t *config, uint8_t channel) {
+    config->shadow.rf_ch = channel;
     xnrf_write_register(config, RF_CH, channel);
 }
 
+/*! \brief Sets which pipes have Enhanced ShockBurst auto-acknowledge enabled.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param pipes    Bitmask of pipes, (1 << ENAA_Px).
+ */
+static inline void xnrf_set_autoack (xnrf_config_t *config, uint8_t pipes) {
+    config->shadow.en_aa = pipes;
+    xnrf_write_register(config, EN_AA, pipes);
+}
+
+/*! \brief Sets which RX pipes are enabled.
+ *  \param config   Pointer to a xnrf_config_t structure.
+ *  \param pipes    Bitmask of pipes, (1 << ERX_Px).
+ */
+static inline void xnrf_set_rx_pipes (xnrf_config_t *config, uint8_t pipes) {
+    config->shadow.en_rxaddr = pipes;
+    xnrf_write_register(config, EN_RXADDR, pipes);
+}
+
 /*! \brief Sets the TX Address.
  *  \param config   Pointer to a xnrf_config_t structure.
  *  \param address  Pointer to the address to set.
@@ -17,30 +17,209 @@
  *
  */ 
 
+#include <stddef.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include "XSPI.h"
 
+#ifdef XSTATS_ENABLED
+xstats_entry_t xstats_table[XSTATS_COUNT];
+
+void xstats_init(void) {
+    for (uint8_t i = 0; i < XSTATS_COUNT; i++) {
+        xstats_table[i].calls = 0;
+        xstats_table[i].bytes = 0;
+        xstats_table[i].cycles = 0;
+    }
+    XSTATS_TC.CTRLA = XSTATS_TC_CLKSEL;
+}
+#endif
+
 void xspi_send_packet(SPI_t *spi, uint8_t *data, uint8_t len) {
-    while (len--) {
+    XSTATS_BEGIN();
+    for (uint8_t i = len; i; i--) {
         spi->DATA = *data++;
         while(!(spi->STATUS & SPI_IF_bm));
     }
+    XSTATS_END(XSTATS_SPI_SEND_PACKET, len);
 }
 
 void xspi_get_packet(SPI_t *spi, uint8_t *data, uint8_t len) {
-    while (len--) {
+    XSTATS_BEGIN();
+    for (uint8_t i = len; i; i--) {
         spi->DATA = 0xFF;
         while(!(spi->STATUS & SPI_IF_bm));
         *data++ = spi->DATA;
     }
+    XSTATS_END(XSTATS_SPI_GET_PACKET, len);
+}
+
+#ifdef XSPI_DMA_ENABLED
+/* State for the async transfer in flight.  Channel 0 always drains DATA and signals completion,
+ * channel 1 always feeds DATA. */
+static SPI_t * volatile xspi_dma_spi;
+static volatile xspi_callback_t xspi_dma_callback;
+static uint8_t xspi_dma_dummy;
+
+/* DMA address registers take the 16 bit data space address of a buffer or register */
+#ifndef XSPI_DMA_ADDR
+#   define XSPI_DMA_ADDR(p) ((uint16_t)(p))
+#endif
+
+bool xspi_dma_busy(void) {
+    return xspi_dma_spi != NULL;
+}
+
+#if defined(XSPI_HAS_EDMA)
+/* E series - SPI is put in buffered mode so the EDMA peripheral channels can use the RXC and DRE triggers.
+ * No need to prime the first byte, DRE fires as soon as the channel is enabled. */
+static void xspi_dma_start(SPI_t *spi, uint8_t *rxaddr, uint8_t rxdir, uint8_t *txaddr, uint8_t txdir, uint8_t len) {
+    EDMA.CTRL = EDMA_ENABLE_bm | EDMA_CHMODE_PER0123_gc;
+    spi->CTRLB = SPI_BUFMODE_BUFMODE1_gc | SPI_SSD_bm;
+
+    EDMA.CH0.CTRLA = EDMA_CH_SINGLE_bm;
+    EDMA.CH0.CTRLB = EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm | EDMA_CH_TRNINTLVL_LO_gc;
+    EDMA.CH0.ADDRCTRL = EDMA_CH_RELOAD_NONE_gc | (rxdir ? EDMA_CH_DIR_INC_gc : EDMA_CH_DIR_FIXED_gc);
+    EDMA.CH0.TRIGSRC = EDMA_CH_TRIGSRC_SPIC_RXC_gc;
+    EDMA.CH0.TRFCNT = len;
+    EDMA.CH0.ADDR = XSPI_DMA_ADDR(rxaddr);
+
+    EDMA.CH1.CTRLA = EDMA_CH_SINGLE_bm;
+    EDMA.CH1.CTRLB = EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm;
+    EDMA.CH1.ADDRCTRL = EDMA_CH_RELOAD_NONE_gc | (txdir ? EDMA_CH_DIR_INC_gc : EDMA_CH_DIR_FIXED_gc);
+    EDMA.CH1.TRIGSRC = EDMA_CH_TRIGSRC_SPIC_DRE_gc;
+    EDMA.CH1.TRFCNT = len;
+    EDMA.CH1.ADDR = XSPI_DMA_ADDR(txaddr);
+
+    EDMA.CH0.CTRLA |= EDMA_CH_ENABLE_bm;
+    EDMA.CH1.CTRLA |= EDMA_CH_ENABLE_bm;
+}
+
+ISR(EDMA_CH0_vect) {
+    SPI_t *spi = xspi_dma_spi;
+    xspi_callback_t callback = xspi_dma_callback;
+
+    EDMA.CH0.CTRLB |= EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm;
+    EDMA.CH0.CTRLA = 0;
+    EDMA.CH1.CTRLA = 0;
+    spi->CTRLB = 0;             /* back to unbuffered mode for the blocking calls */
+    xspi_dma_spi = NULL;
+
+    if (callback)
+        callback();
+}
+#elif defined(XSPI_HAS_DMA)
+/* A series - SPI only has a single transfer complete trigger.  The first byte is written by hand,
+ * then each trigger has channel 0 read DATA and channel 1 (lower fixed priority) write the next byte. */
+static void xspi_dma_start(SPI_t *spi, uint8_t *rxaddr, uint8_t rxdir, uint8_t *txaddr, uint8_t txdir, uint8_t len) {
+    uint8_t trigsrc = (spi == &SPIC) ? DMA_CH_TRIGSRC_SPIC_gc : DMA_CH_TRIGSRC_SPID_gc;
+    uint8_t first = txdir ? *txaddr : 0xFF;   /* before txaddr moves on to the second byte */
+
+    DMA.CTRL = DMA_ENABLE_bm | DMA_PRIMODE_CH0123_gc;
+
+    DMA.CH0.CTRLA = DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+    DMA.CH0.CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm | DMA_CH_TRNINTLVL_LO_gc;
+    DMA.CH0.ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_FIXED_gc |
+            DMA_CH_DESTRELOAD_NONE_gc | (rxdir ? DMA_CH_DESTDIR_INC_gc : DMA_CH_DESTDIR_FIXED_gc);
+    DMA.CH0.TRIGSRC = trigsrc;
+    DMA.CH0.TRFCNT = len;
+    DMA.CH0.SRCADDR0 = XSPI_DMA_ADDR(&spi->DATA) & 0xFF;
+    DMA.CH0.SRCADDR1 = XSPI_DMA_ADDR(&spi->DATA) >> 8;
+    DMA.CH0.SRCADDR2 = 0;
+    DMA.CH0.DESTADDR0 = XSPI_DMA_ADDR(rxaddr) & 0xFF;
+    DMA.CH0.DESTADDR1 = XSPI_DMA_ADDR(rxaddr) >> 8;
+    DMA.CH0.DESTADDR2 = 0;
+    DMA.CH0.CTRLA |= DMA_CH_ENABLE_bm;
+
+    // A TRFCNT of 0 means 64K on the XMega, so skip channel 1 entirely for single byte packets.
+    if (len > 1) {
+        if (txdir)
+            txaddr++;
+        DMA.CH1.CTRLA = DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+        DMA.CH1.CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm;
+        DMA.CH1.ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | (txdir ? DMA_CH_SRCDIR_INC_gc : DMA_CH_SRCDIR_FIXED_gc) |
+                DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_FIXED_gc;
+        DMA.CH1.TRIGSRC = trigsrc;
+        DMA.CH1.TRFCNT = len - 1;
+        DMA.CH1.SRCADDR0 = XSPI_DMA_ADDR(txaddr) & 0xFF;
+        DMA.CH1.SRCADDR1 = XSPI_DMA_ADDR(txaddr) >> 8;
+        DMA.CH1.SRCADDR2 = 0;
+        DMA.CH1.DESTADDR0 = XSPI_DMA_ADDR(&spi->DATA) & 0xFF;
+        DMA.CH1.DESTADDR1 = XSPI_DMA_ADDR(&spi->DATA) >> 8;
+        DMA.CH1.DESTADDR2 = 0;
+        DMA.CH1.CTRLA |= DMA_CH_ENABLE_bm;
+    }
+
+    // prime the pump
+    spi->DATA = first;
+}
+
+ISR(DMA_CH0_vect) {
+    xspi_callback_t callback = xspi_dma_callback;
+
+    DMA.CH0.CTRLB |= DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm;
+    DMA.CH0.CTRLA = 0;
+    DMA.CH1.CTRLA = 0;
+    xspi_dma_spi = NULL;
+
+    if (callback)
+        callback();
+}
+#endif
+
+bool xspi_send_packet_async(SPI_t *spi, uint8_t *data, uint8_t len, xspi_callback_t callback) {
+    if (xspi_dma_spi || !len)
+        return false;
+
+    xspi_dma_spi = spi;
+    xspi_dma_callback = callback;
+    xspi_dma_start(spi, &xspi_dma_dummy, 0, data, 1, len);
+    return true;
+}
+
+bool xspi_get_packet_async(SPI_t *spi, uint8_t *data, uint8_t len, xspi_callback_t callback) {
+    if (xspi_dma_spi || !len)
+        return false;
+
+    xspi_dma_spi = spi;
+    xspi_dma_callback = callback;
+    xspi_dma_dummy = 0xFF;
+    xspi_dma_start(spi, data, 1, &xspi_dma_dummy, 0, len);
+    return true;
+}
+#endif /* XSPI_DMA_ENABLED */
+
+void xspi_usart_transfer_packet(USART_t *usart, uint8_t *txdata, uint8_t *rxdata, uint8_t len) {
+    XSTATS_BEGIN();
+    uint8_t queued = 0;
+    uint8_t received = 0;
+
+    // toss anything stale
+    while (usart->STATUS & USART_RXCIF_bm)
+        (void)usart->DATA;
+
+    // Queue ahead while there's room in the TX buffer, but never let more than 2 bytes be in flight
+    // or the 2 level RX buffer would overrun and we'd lose count.
+    while (received < len) {
+        if (queued < len && (uint8_t)(queued - received) < 2 && (usart->STATUS & USART_DREIF_bm)) {
+            usart->DATA = txdata ? *txdata++ : 0xFF;
+            queued++;
+        }
+        if (usart->STATUS & USART_RXCIF_bm) {
+            uint8_t val = usart->DATA;
+            if (rxdata)
+                *rxdata++ = val;
+            received++;
+        }
+    }
+    usart->STATUS = USART_TXCIF_bm;
+    XSTATS_END(XSTATS_USART_TRANSFER_PACKET, len);
 }
 
 void xspi_usart_send_packet(USART_t *usart, uint8_t *data, uint8_t len) {
-    while (len--)
-        xspi_usart_send_byte(usart, *data++);
-}	
+    xspi_usart_transfer_packet(usart, data, NULL, len);
+}
 
 void xspi_usart_get_packet(USART_t *usart, uint8_t *data, uint8_t len) {
-    while (len--)
-        *data++ = xspi_usart_get_byte(usart);
-}
\ No newline at end of file
+    xspi_usart_transfer_packet(usart, NULL, data, len);
+}
@@ -23,6 +23,7 @@
 #define XSPI_H_
 
 #include <stdbool.h>
+#include "XSTATS.h"
 
 #ifndef F_CPU
 #   define F_CPU 32000000UL
@@ -44,6 +45,7 @@ defined (__AVR_ATxmega128A4U__)
 #   define XSPI_XCK1    PIN5_bm
 #   define XSPI_RXD1    PIN6_bm
 #   define XSPI_TXD1    PIN7_bm
+#   define XSPI_HAS_DMA             /* A series DMA controller */
 #elif defined (__AVR_ATxmega8E5__) || \
 defined (__AVR_ATxmega16E5__) || \
 defined (__AVR_ATxmega32E5__)
@@ -54,6 +56,7 @@ defined (__AVR_ATxmega32E5__)
 #   define XSPI_XCK0    PIN1_bm
 #   define XSPI_RXD0    PIN2_bm
 #   define XSPI_TXD0    PIN3_bm
+#   define XSPI_HAS_EDMA            /* E series EDMA controller */
 /* if remapped? 
 #   define XSPI_XCK1	PIN5_bm
 #   define XSPI_RXD1	PIN6_bm
@@ -63,6 +66,8 @@ defined (__AVR_ATxmega32E5__)
 #   error ** Device not supported by XSPI **
 #endif
 
+//#define XSPI_DMA_ENABLED  /* DMA backed async transfers on DMA channels 0 & 1.  Uncomment (or define as a symbol in every project) to enable */
+
 /************************************************************************/
 /* Normal hardware SPI stuff                                            */
 /************************************************************************/
@@ -98,8 +103,10 @@ static inline void xspi_slave_init(PORT_t *port, SPI_t *spi, SPI_MODE_t mode, bo
  *  \return     Single byte read from SPI.
  */
 static inline uint8_t xspi_transfer_byte(SPI_t *spi, uint8_t val) {
+    XSTATS_BEGIN();
     spi->DATA = val;
     while(!(spi->STATUS & SPI_IF_bm));
+    XSTATS_END(XSTATS_SPI_TRANSFER_BYTE, 1);
     return spi->DATA;
 }
 
@@ -117,6 +124,43 @@ void xspi_send_packet(SPI_t *spi, uint8_t *data, uint8_t len);
  */
 void xspi_get_packet(SPI_t *spi, uint8_t *data, uint8_t len);
 
+#ifdef XSPI_DMA_ENABLED
+/************************************************************************/
+/* DMA backed SPI stuff                                                 */
+/************************************************************************/
+
+/*! \brief Callback fired from the DMA interrupt once an async transfer has completed.
+ */
+typedef void (*xspi_callback_t)(void);
+
+/*! \brief Checks if an async transfer is in progress.
+ *  \return     true if the DMA channels are busy.
+ */
+bool xspi_dma_busy(void);
+
+/*! \brief Starts an async send of a packet, ignoring any returned SPI data.
+ *
+ *  Uses DMA channels 0 and 1 and their low level interrupt, so low level interrupts must be enabled.
+ *  The buffer must remain valid until the callback fires.
+ *
+ *  \param spi      Pointer to SPI_t module structure.
+ *  \param data     Pointer to the data being sent.
+ *  \param len      Length in bytes of the data being sent.
+ *  \param callback Function to call once the last byte has been clocked out.  Can be NULL.
+ *  \return         true if the transfer was started, false if busy or len is 0.
+ */
+bool xspi_send_packet_async(SPI_t *spi, uint8_t *data, uint8_t len, xspi_callback_t callback);
+
+/*! \brief Starts an async retrieval of a packet.
+ *  \param spi      Pointer to SPI_t module structure.
+ *  \param data     Pointer to a buffer to store the retrieved data.
+ *  \param len      Size of the buffer in bytes.
+ *  \param callback Function to call once the last byte has been retrieved.  Can be NULL.
+ *  \return         true if the transfer was started, false if busy or len is 0.
+ */
+bool xspi_get_packet_async(SPI_t *spi, uint8_t *data, uint8_t len, xspi_callback_t callback);
+#endif /* XSPI_DMA_ENABLED */
+
 
 /************************************************************************/
 /* USART specific SPI stuff                                             */
@@ -126,21 +170,35 @@ void xspi_get_packet(SPI_t *spi, uint8_t *data, uint8_t len);
 #define SERIAL_SPI_UBBRVAL(Baud)    ((Baud < (F_CPU / 2)) ? ((F_CPU / (2 * Baud)) - 1) : 0)
 
 /*! \brief SPI Master USART initialization function.
- *  \param port         Pointer to the port on which this SPI module resides.
+ *  \param port         Pointer to the port on which this USART module resides.
  *  \param usart        Pointer to USART_t module structure.
  *  \param mode         Clock and polarity mode for SPI.
  *  \param lsb          Set to true for LSB data, false for MSB.
- *  \param prescaler    SPI clock prescaler value.
- *  \param clk2x        Enables SPI clock double-speed.
+ *  \param baudrate     SPI clock rate.  F_CPU / 2 max.
  */
-static inline void xspi_usart_master_init(PORT_t *port, USART_t *usart, SPI_MODE_t mode, uint32_t baudrate) {
+static inline void xspi_usart_master_init(PORT_t *port, USART_t *usart, SPI_MODE_t mode, bool lsb, uint32_t baudrate) {
     uint16_t baudval = SERIAL_SPI_UBBRVAL(baudrate);
-	
+    uint8_t xck = 1;    /* XCK pin number */
+
+    // XCK and TXD are outputs.  USARTx1 sits 0x10 above USARTx0 in the A4U's IO map, the E5 only has USARTx0.
+#ifdef XSPI_TXD1
+    if ((uintptr_t)usart & 0x10) {
+        port->DIRSET = XSPI_XCK1 | XSPI_TXD1;
+        xck = 5;
+    } else
+#endif
+        port->DIRSET = XSPI_XCK0 | XSPI_TXD0;
+
+    // CPOL is handled by inverting the XCK pin, CPHA maps straight to UCPHA.
+    if (mode & SPI_MODE_2_gc)
+        (&port->PIN0CTRL)[xck] |= PORT_INVEN_bm;
+    else
+        (&port->PIN0CTRL)[xck] &= ~PORT_INVEN_bm;
+
     usart->BAUDCTRLB = (baudval >> 8);
     usart->BAUDCTRLA = (baudval & 0xFF);
-    // For now, only Mode 0 supported.
-    usart->CTRLC = USART_CMODE_MSPI_gc;
-    usart->CTRLB = (USART_RXEN_bm | USART_TXEN_bm); 	
+    usart->CTRLC = USART_CMODE_MSPI_gc | ((mode & SPI_MODE_1_gc) ? USART_UCPHA_bm : 0) | (lsb ? USART_UDORD_bm : 0);
+    usart->CTRLB = (USART_RXEN_bm | USART_TXEN_bm);
 }
 
 /*! \brief Blocking call that sends and returns a single byte.
@@ -149,9 +207,11 @@ static inline void xspi_usart_master_init(PORT_t *port, USART_t *usart, SPI_MODE
  *  \return         Single byte read from SPI.
  */
 static inline uint8_t xspi_usart_transfer_byte(USART_t *usart, uint8_t val) {
+    XSTATS_BEGIN();
     usart->DATA = val;
     while(!(usart->STATUS & USART_TXCIF_bm));
     usart->STATUS = USART_TXCIF_bm;
+    XSTATS_END(XSTATS_USART_TRANSFER_BYTE, 1);
     return usart->DATA;
 }
 
@@ -172,18 +232,34 @@ static inline uint8_t xspi_usart_get_byte(USART_t *usart) {
     return xspi_usart_transfer_byte(usart, 0xFF);
 }
 
-/*! \brief Sends a packet of data via UART in Master SPI mode.
+/*! \brief Sends a packet of data via UART in Master SPI mode, ignoring any returned data.
+ *
+ *  Keeps the TX buffer loaded so bytes go out back to back, and only returns once the last byte
+ *  has finished shifting and the returned bytes have been drained.
+ *
  *  \param usart    Pointer to USART_t module structure.
- *  \param data     Pointer to a buffer to store the retrieved data.
- *  \param len      Size of the buffer in bytes.
+ *  \param data     Pointer to the data being sent.
+ *  \param len      Length in bytes of the data being sent.
  */
 void xspi_usart_send_packet(USART_t *usart, uint8_t *data, uint8_t len);
 
-/*! \brief Retrieves a packet of data via UART in Master SPI mode.
+/*! \brief Retrieves a packet of data via UART in Master SPI mode.  Pipelined like xspi_usart_send_packet().
  *  \param usart    Pointer to USART_t module structure.
  *  \param data     Pointer to a buffer to store the retrieved data.
  *  \param len      Size of the buffer in bytes.
  */
 void xspi_usart_get_packet(USART_t *usart, uint8_t *data, uint8_t len);
 
+/*! \brief Full duplex packet transfer via UART in Master SPI mode.
+ *
+ *  Keeps one byte queued ahead in the TX buffer via DREIF and drains RX via RXCIF, holding no more than
+ *  2 bytes in flight so the RX buffer can't overrun.
+ *
+ *  \param usart    Pointer to USART_t module structure.
+ *  \param txdata   Pointer to the data being sent.  NULL sends 0xFF.
+ *  \param rxdata   Pointer to a buffer to store the retrieved data.  NULL discards it.
+ *  \param len      Length in bytes of the transfer.
+ */
+void xspi_usart_transfer_packet(USART_t *usart, uint8_t *txdata, uint8_t *rxdata, uint8_t len);
+
 #endif /* XSPI_H_ */
\ No newline at end of file
@@ -0,0 +1,102 @@
+/*
+ * XSTATS.h
+ *
+ * Project: XSPI
+ * Copyright (c) 2014 Shelby Merrick
+ * http://www.forkineye.com
+ *
+ *  This program is provided free for you to use in any way that you wish,
+ *  subject to the laws and regulations where you are using it.  Due diligence
+ *  is strongly suggested before using this code.  Please give credit where due.
+ *
+ *  The Author makes no warranty of any kind, express or implied, with regard
+ *  to this program or the documentation contained in this document.  The
+ *  Author shall not be liable in any event for incidental or consequential
+ *  damages in connection with, or arising out of, the furnishing, performance
+ *  or use of these programs.
+ *
+ */ 
+
+#ifndef XSTATS_H_
+#define XSTATS_H_
+
+/* Hot path instrumentation for the XSPI and XNRF24L01 entry points.  Uncomment (or define as a symbol in every
+ * project) to record call counts, bytes moved and CPU cycles per entry point.  When left undefined the
+ * XSTATS_BEGIN / XSTATS_END macros compile to nothing.
+ */
+//#define XSTATS_ENABLED
+
+#ifdef XSTATS_ENABLED
+
+/* Free running TC clocked at F_CPU for cycle counts.  16 bits, so a single call must finish within 65536 cycles. */
+#ifndef XSTATS_TC
+#   if defined (__AVR_ATxmega8E5__) || defined (__AVR_ATxmega16E5__) || defined (__AVR_ATxmega32E5__)
+#       define XSTATS_TC        TCC4
+#       define XSTATS_TC_CLKSEL TC45_CLKSEL_DIV1_gc
+#   else
+#       define XSTATS_TC        TCC0
+#       define XSTATS_TC_CLKSEL TC_CLKSEL_DIV1_gc
+#   endif
+#endif
+
+/*! \brief Instrumented entry points. */
+typedef enum {
+    XSTATS_SPI_SEND_PACKET,
+    XSTATS_SPI_GET_PACKET,
+    XSTATS_USART_TRANSFER_PACKET,
+    XSTATS_NRF_READ_REGISTER,
+    XSTATS_NRF_WRITE_REGISTER,
+    XSTATS_NRF_READ_PAYLOAD,
+    XSTATS_NRF_WRITE_PAYLOAD,
+    XSTATS_NRF_RECEIVE_ALL,
+    XSTATS_NRF_STREAM_TX,
+    XSTATS_NRF_WRITE_BATCH,
+    XSTATS_NRF_CONFIGURE,
+    XSTATS_SPI_TRANSFER_BYTE,
+    XSTATS_USART_TRANSFER_BYTE,
+    XSTATS_NRF_SELECT,
+    XSTATS_NRF_DESELECT,
+    XSTATS_COUNT
+} xstats_id_t;
+
+/*! \brief Counters for a single entry point.  Cycles are inclusive of any instrumented calls made within, and so are
+ *  bytes, except that xnrf_configure() and xnrf_write_batch() count a table once between them.
+ *  \param calls    Number of calls.
+ *  \param bytes    Bytes moved over the bus.
+ *  \param cycles   CPU cycles spent.
+ */
+typedef struct {
+    uint16_t calls;
+    uint32_t bytes;
+    uint32_t cycles;
+} xstats_entry_t;
+
+extern xstats_entry_t xstats_table[XSTATS_COUNT];
+
+/*! \brief Clears the stats table and starts the cycle counter.
+ */
+void xstats_init(void);
+
+/*! \brief Adds a call to the stats table.  Not atomic, counts can tear if an ISR hits the same entry mid-update.
+ *  \param id       Entry point.
+ *  \param bytes    Bytes moved.
+ *  \param cycles   Cycles spent.
+ */
+static inline void xstats_record(xstats_id_t id, uint16_t bytes, uint16_t cycles) {
+    xstats_entry_t *entry = &xstats_table[id];
+    entry->calls++;
+    entry->bytes += bytes;
+    entry->cycles += cycles;
+}
+
+#   define XSTATS_BEGIN()           uint16_t xstats_start = XSTATS_TC.CNT
+#   define XSTATS_END(id, bytes)    xstats_record(id, bytes, XSTATS_TC.CNT - xstats_start)
+
+#else
+
+#   define XSTATS_BEGIN()
+#   define XSTATS_END(id, bytes)
+
+#endif /* XSTATS_ENABLED */
+
+#endif /* XSTATS_H_ */
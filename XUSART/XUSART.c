@@ -17,6 +17,7 @@
  *
  */ 
 
+#include <stddef.h>
 #include <avr/io.h>
 #include "XUSART.h"
 
@@ -121,3 +122,234 @@ void xusart_get_packet(USART_t *usart, uint8_t *data, uint8_t len) {
         *data++ = xusart_getchar(usart);
     }
 }
+
+
+/* Publishes a new TX head, takes the bus in RS485 mode and kicks the DRE interrupt, which shuts itself off once the ring is drained */
+static void xusart_start_tx(xusart_buffered_t *buffered, uint8_t head) {
+    buffered->tx_head = head;
+    if (buffered->de_port)
+        buffered->de_port->OUTSET = buffered->de_pin_bm;
+    buffered->usart->CTRLA |= USART_DREINTLVL_LO_gc;
+}
+
+void xusart_buffered_init(xusart_buffered_t *buffered, USART_t *usart) {
+    buffered->usart = usart;
+    buffered->de_port = NULL;
+    buffered->block_pending = false;
+    buffered->rx_head = buffered->rx_tail = 0;
+    buffered->tx_head = buffered->tx_tail = 0;
+    buffered->rx_overflows = buffered->tx_overflows = 0;
+    usart->CTRLA = (usart->CTRLA & ~(USART_RXCINTLVL_gm | USART_DREINTLVL_gm)) | USART_RXCINTLVL_LO_gc;
+}
+
+uint8_t xusart_write(xusart_buffered_t *buffered, const uint8_t *data, uint8_t len) {
+    uint8_t head = buffered->tx_head;
+    uint8_t count = xusart_tx_free(buffered);
+
+    if (count > len)
+        count = len;
+    buffered->tx_overflows += len - count;
+    if (!count)
+        return 0;
+
+    for (uint8_t i = count; i; i--)
+        buffered->tx_buffer[head++ & XUSART_TX_MASK] = *data++;
+    xusart_start_tx(buffered, head);
+    return count;
+}
+
+bool xusart_slip_begin(xusart_slip_writer_t *writer, xusart_buffered_t *buffered, uint8_t len) {
+    uint16_t worst = 2 * (uint16_t)len + 2;
+
+    if (worst > xusart_tx_free(buffered)) {
+        buffered->tx_overflows += len;
+        return false;
+    }
+
+    writer->buffered = buffered;
+    writer->head = buffered->tx_head;
+    buffered->tx_buffer[writer->head++ & XUSART_TX_MASK] = XUSART_SLIP_END;
+    return true;
+}
+
+void xusart_slip_write(xusart_slip_writer_t *writer, const uint8_t *data, uint8_t len) {
+    while (len--)
+        xusart_slip_put(writer, *data++);
+}
+
+bool xusart_slip_block(xusart_slip_writer_t *writer, const uint8_t *data, uint8_t len, xusart_done_t done, void *ctx) {
+    xusart_buffered_t *buffered = writer->buffered;
+
+    if (buffered->block_pending)
+        return false;
+
+    if (!len) {
+        if (done)
+            done(ctx);
+        return true;
+    }
+
+    // the DRE interrupt can't get to block_at until xusart_slip_end() publishes past it
+    buffered->block = data;
+    buffered->block_len = len;
+    buffered->block_at = writer->head;
+    buffered->block_esc = 0;
+    buffered->block_done = done;
+    buffered->block_ctx = ctx;
+    buffered->block_pending = true;
+    return true;
+}
+
+void xusart_slip_end(xusart_slip_writer_t *writer) {
+    xusart_buffered_t *buffered = writer->buffered;
+
+    buffered->tx_buffer[writer->head++ & XUSART_TX_MASK] = XUSART_SLIP_END;
+    xusart_start_tx(buffered, writer->head);
+}
+
+void xusart_slip_reader_init(xusart_slip_reader_t *reader, uint8_t *buffer, uint8_t size) {
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->len = 0;
+    reader->escaped = false;
+    reader->discard = false;
+    reader->errors = 0;
+}
+
+uint8_t xusart_slip_read(xusart_slip_reader_t *reader, xusart_buffered_t *buffered) {
+    uint8_t tail = buffered->rx_tail;
+    uint8_t len = 0;
+
+    while (tail != buffered->rx_head) {
+        uint8_t data = buffered->rx_buffer[tail++ & XUSART_RX_MASK];
+
+        if (data == XUSART_SLIP_END) {
+            if (!reader->discard)
+                len = reader->len;
+            reader->len = 0;
+            reader->escaped = false;
+            reader->discard = false;
+            if (len)
+                break;
+            continue;
+        }
+
+        if (reader->discard)
+            continue;
+
+        if (reader->escaped) {
+            reader->escaped = false;
+            if (data == XUSART_SLIP_ESC_END) {
+                data = XUSART_SLIP_END;
+            } else if (data == XUSART_SLIP_ESC_ESC) {
+                data = XUSART_SLIP_ESC;
+            } else {
+                reader->discard = true;
+                reader->errors++;
+                continue;
+            }
+        } else if (data == XUSART_SLIP_ESC) {
+            reader->escaped = true;
+            continue;
+        }
+
+        if (reader->len < reader->size) {
+            reader->buffer[reader->len++] = data;
+        } else {
+            reader->discard = true;
+            reader->errors++;
+        }
+    }
+
+    buffered->rx_tail = tail;
+    return len;
+}
+
+uint8_t xusart_read(xusart_buffered_t *buffered, uint8_t *data, uint8_t len) {
+    uint8_t tail = buffered->rx_tail;
+    uint8_t count = xusart_rx_available(buffered);
+
+    if (count > len)
+        count = len;
+    for (uint8_t i = count; i; i--)
+        *data++ = buffered->rx_buffer[tail++ & XUSART_RX_MASK];
+    buffered->rx_tail = tail;
+    return count;
+}
+
+void xusart_rxc_handler(xusart_buffered_t *buffered) {
+    USART_t *usart = buffered->usart;
+    uint8_t head = buffered->rx_head;
+
+    if (usart->STATUS & USART_BUFOVF_bm)
+        buffered->rx_overflows++;
+
+    uint8_t data = usart->DATA;
+    if ((uint8_t)(head - buffered->rx_tail) < XUSART_RX_BUFFER_SIZE) {
+        buffered->rx_buffer[head & XUSART_RX_MASK] = data;
+        buffered->rx_head = head + 1;
+    } else {
+        buffered->rx_overflows++;
+    }
+}
+
+void xusart_set_rs485(xusart_buffered_t *buffered, PORT_t *port, uint8_t pin_bm) {
+    USART_t *usart = buffered->usart;
+
+    usart->CTRLA &= ~USART_TXCINTLVL_gm;
+    buffered->de_port = port;
+    buffered->de_pin_bm = pin_bm;
+    if (port) {
+        port->OUTCLR = pin_bm;
+        port->DIRSET = pin_bm;
+        usart->CTRLA |= USART_TXCINTLVL_LO_gc;
+    }
+}
+
+/* Sends the next byte of the external block from the DRE interrupt, escaping on the fly */
+static void xusart_block_next(xusart_buffered_t *buffered) {
+    uint8_t data = buffered->block_esc;
+
+    if (data) {
+        buffered->block_esc = 0;
+    } else {
+        data = *buffered->block++;
+        buffered->block_len--;
+        if (data == XUSART_SLIP_END) {
+            data = XUSART_SLIP_ESC;
+            buffered->block_esc = XUSART_SLIP_ESC_END;
+        } else if (data == XUSART_SLIP_ESC) {
+            buffered->block_esc = XUSART_SLIP_ESC_ESC;
+        }
+    }
+    buffered->usart->DATA = data;
+    buffered->usart->STATUS = USART_TXCIF_bm;
+
+    if (!buffered->block_len && !buffered->block_esc) {
+        buffered->block_pending = false;
+        if (buffered->block_done)
+            buffered->block_done(buffered->block_ctx);
+    }
+}
+
+void xusart_dre_handler(xusart_buffered_t *buffered) {
+    USART_t *usart = buffered->usart;
+    uint8_t tail = buffered->tx_tail;
+
+    if (buffered->block_pending && tail == buffered->block_at) {
+        xusart_block_next(buffered);
+    } else if (tail != buffered->tx_head) {
+        usart->DATA = buffered->tx_buffer[tail & XUSART_TX_MASK];
+        buffered->tx_tail = tail + 1;
+        // DATA is full again so any TXC flag still set is from an earlier burst, don't let it drop DE early
+        usart->STATUS = USART_TXCIF_bm;
+    } else {
+        usart->CTRLA &= ~USART_DREINTLVL_gm;
+    }
+}
+
+void xusart_txc_handler(xusart_buffered_t *buffered) {
+    // more data may have been queued since the last byte went out, DE stays up until that's gone too
+    if (buffered->de_port && buffered->tx_tail == buffered->tx_head && !buffered->block_pending)
+        buffered->de_port->OUTCLR = buffered->de_pin_bm;
+}
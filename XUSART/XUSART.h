@@ -22,6 +22,120 @@
 
 #include <stdbool.h>
 
+#ifndef XUSART_RX_BUFFER_SIZE
+#   define XUSART_RX_BUFFER_SIZE 32     /* RX ring buffer size.  Must be a power of 2, 128 max */
+#endif
+#ifndef XUSART_TX_BUFFER_SIZE
+#   define XUSART_TX_BUFFER_SIZE 64     /* TX ring buffer size.  Must be a power of 2, 128 max.  A fully escaped 37 byte SLIP frame needs 128 */
+#endif
+
+#if (XUSART_RX_BUFFER_SIZE & (XUSART_RX_BUFFER_SIZE - 1)) || (XUSART_RX_BUFFER_SIZE > 128)
+#   error ** XUSART_RX_BUFFER_SIZE must be a power of 2, 128 max **
+#endif
+#if (XUSART_TX_BUFFER_SIZE & (XUSART_TX_BUFFER_SIZE - 1)) || (XUSART_TX_BUFFER_SIZE > 128)
+#   error ** XUSART_TX_BUFFER_SIZE must be a power of 2, 128 max **
+#endif
+
+#define XUSART_RX_MASK (XUSART_RX_BUFFER_SIZE - 1)
+#define XUSART_TX_MASK (XUSART_TX_BUFFER_SIZE - 1)
+
+/* SLIP framing characters - RFC 1055 */
+#define XUSART_SLIP_END     0xC0        /* frame delimiter */
+#define XUSART_SLIP_ESC     0xDB        /* escape */
+#define XUSART_SLIP_ESC_END 0xDC        /* escaped END */
+#define XUSART_SLIP_ESC_ESC 0xDD        /* escaped ESC */
+
+/*! \brief Called from the DRE interrupt once the last byte of an external TX block has been handed to the USART.
+ *  \param ctx      Context pointer given with the block.
+ */
+typedef void (*xusart_done_t)(void *ctx);
+
+/*! \brief Interrupt driven, ring buffered state for a single USART.
+ *
+ *  Both rings are single producer / single consumer.  Head and tail indexes free-run and are masked on access,
+ *  so each is only ever written from one side - RX head and TX tail from the ISRs, the others from the main loop.
+ *
+ *  \param usart            Pointer to the USART module.
+ *  \param rx_head          RX ring write index.  Owned by the RXC interrupt.
+ *  \param rx_tail          RX ring read index.  Owned by xusart_read().
+ *  \param tx_head          TX ring write index.  Owned by xusart_write().
+ *  \param tx_tail          TX ring read index.  Owned by the DRE interrupt.
+ *  \param rx_overflows     Number of received bytes dropped due to a full ring or hardware buffer overflow.
+ *  \param tx_overflows     Number of bytes rejected by xusart_write() due to a full ring.
+ *  \param de_port          RS485 driver enable port, NULL when not in RS485 mode.  See xusart_set_rs485().
+ *  \param de_pin_bm        RS485 driver enable pin mask.
+ *  \param block            External TX block, sent in place without being copied into the ring.  See xusart_slip_block().
+ *  \param block_len        Bytes of the block still to send.
+ *  \param block_at         TX ring index the block is spliced in at.
+ *  \param block_esc        Second half of a SLIP escape still to send, 0 if none.
+ *  \param block_pending    A block is waiting or being sent.  Set from the main loop, cleared by the DRE interrupt.
+ *  \param block_done       Completion callback, or NULL.
+ *  \param block_ctx        Completion callback argument.
+ */
+typedef struct {
+    USART_t *usart;
+    PORT_t *de_port;
+    uint8_t de_pin_bm;
+    const uint8_t *block;
+    uint8_t block_len;
+    uint8_t block_at;
+    uint8_t block_esc;
+    volatile bool block_pending;
+    xusart_done_t block_done;
+    void *block_ctx;
+    volatile uint8_t rx_head;
+    volatile uint8_t rx_tail;
+    volatile uint8_t tx_head;
+    volatile uint8_t tx_tail;
+    volatile uint16_t rx_overflows;
+    volatile uint16_t tx_overflows;
+    uint8_t rx_buffer[XUSART_RX_BUFFER_SIZE];
+    uint8_t tx_buffer[XUSART_TX_BUFFER_SIZE];
+} xusart_buffered_t;
+
+/*! \brief Streaming SLIP frame writer.
+ *
+ *  Encodes straight into a buffered USART's TX ring.  Bytes are staged past tx_head and only published
+ *  by xusart_slip_end(), so the DRE interrupt never sees a partial frame.
+ *
+ *  \param buffered         Buffered USART being written to.
+ *  \param head             Private write index, published to tx_head when the frame ends.
+ */
+typedef struct {
+    xusart_buffered_t *buffered;
+    uint8_t head;
+} xusart_slip_writer_t;
+
+/*! \brief Streaming SLIP frame reader.
+ *
+ *  Decodes straight out of a buffered USART's RX ring into the caller's buffer.  The buffer may be pointed
+ *  somewhere new between calls to xusart_slip_read(), as long as it isn't changed mid frame.
+ *
+ *  \param buffer           Destination for the decoded frame.
+ *  \param size             Size of buffer in bytes.  Longer frames are discarded.
+ *  \param len              Number of bytes decoded so far into the current frame.
+ *  \param escaped          Last byte was an ESC.
+ *  \param discard          Current frame is bad and is being skipped up to the next END.
+ *  \param errors           Number of frames discarded for length or bad escapes.
+ */
+typedef struct {
+    uint8_t *buffer;
+    uint8_t size;
+    uint8_t len;
+    bool escaped;
+    bool discard;
+    uint16_t errors;
+} xusart_slip_reader_t;
+
+/*! \brief Declares the RXC, DRE and TXC interrupt handlers for a buffered USART.
+ *  \param name     USART module name, e.g. USARTD0.
+ *  \param buffered xusart_buffered_t instance serving this USART.
+ */
+#define XUSART_BUFFERED_ISRS(name, buffered) \
+    ISR(name##_RXC_vect) { xusart_rxc_handler(&(buffered)); } \
+    ISR(name##_DRE_vect) { xusart_dre_handler(&(buffered)); } \
+    ISR(name##_TXC_vect) { xusart_txc_handler(&(buffered)); }
+
 /*
  * \brief Set the baudrate value in the USART module
  *
@@ -56,6 +170,161 @@ void xusart_send_packet(USART_t *usart, uint8_t *data, uint8_t len);
  */
 void xusart_get_packet(USART_t *usart, uint8_t *data, uint8_t len);
 
+/*! \brief Initializes a buffered USART and enables its RX interrupt at low level.
+ *
+ *  Format, baud rate and RX/TX enables are still configured through the regular calls.
+ *  Low level interrupts need to be enabled in the PMIC and the ISRs declared with XUSART_BUFFERED_ISRS().
+ *
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \param usart    Pointer to the USART module.
+ */
+void xusart_buffered_init(xusart_buffered_t *buffered, USART_t *usart);
+
+/*! \brief Puts a buffered USART in RS485 half duplex mode.
+ *
+ *  The DE pin is made an output and held low (receive).  It is raised whenever data is queued and dropped from the
+ *  TXC interrupt once the last stop bit has left the shift register, so the turnaround tracks whatever baud rate is set.
+ *  Call after xusart_buffered_init().
+ *
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \param port     Port the DE pin is on.  NULL turns RS485 mode back off.
+ *  \param pin_bm   DE pin mask.
+ */
+void xusart_set_rs485(xusart_buffered_t *buffered, PORT_t *port, uint8_t pin_bm);
+
+/*! \brief Non-blocking write.  Queues as much data as will fit in the TX ring.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \param data     Pointer to the data being sent.
+ *  \param len      Length in bytes of the data being sent.
+ *  \return         Number of bytes accepted.
+ */
+uint8_t xusart_write(xusart_buffered_t *buffered, const uint8_t *data, uint8_t len);
+
+/*! \brief Non-blocking read.  Retrieves whatever is waiting in the RX ring.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \param data     Pointer to a buffer to store the retrieved data.
+ *  \param len      Size of the buffer in bytes.
+ *  \return         Number of bytes retrieved.
+ */
+uint8_t xusart_read(xusart_buffered_t *buffered, uint8_t *data, uint8_t len);
+
+/*! \brief Starts a SLIP frame.
+ *
+ *  Reserves ring space for the worst case encoding of len raw bytes (every byte escaped, plus both delimiters)
+ *  so the frame is written whole or not at all.  A leading END is sent to flush any line noise at the receiver.
+ *
+ *  \param writer   Pointer to a xusart_slip_writer_t structure.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \param len      Number of raw bytes that will be put in this frame.
+ *  \return         false if the frame won't fit.  The frame is dropped and counted in tx_overflows.
+ */
+bool xusart_slip_begin(xusart_slip_writer_t *writer, xusart_buffered_t *buffered, uint8_t len);
+
+/*! \brief Encodes a buffer into the current SLIP frame.
+ *  \param writer   Pointer to a xusart_slip_writer_t structure.
+ *  \param data     Pointer to the data being sent.
+ *  \param len      Length in bytes of the data being sent.
+ */
+void xusart_slip_write(xusart_slip_writer_t *writer, const uint8_t *data, uint8_t len);
+
+/*! \brief Splices an external buffer into the current SLIP frame without copying it.
+ *
+ *  The DRE interrupt sends the buffer in place, escaping as it goes, once it reaches this point in the frame, then
+ *  carries on with whatever is put in the frame afterwards.  The buffer must stay untouched until done is called,
+ *  from the DRE interrupt.  Only one block can be outstanding per USART, see xusart_block_busy().
+ *  Block bytes take no ring space, so don't count them in xusart_slip_begin().
+ *
+ *  \param writer   Pointer to a xusart_slip_writer_t structure.
+ *  \param data     Buffer to send.
+ *  \param len      Length of the buffer.
+ *  \param done     Called once the last byte has gone to the USART, or NULL.
+ *  \param ctx      Argument for done.
+ *  \return         false if a block is already outstanding.  Nothing is added to the frame.
+ */
+bool xusart_slip_block(xusart_slip_writer_t *writer, const uint8_t *data, uint8_t len, xusart_done_t done, void *ctx);
+
+/*! \brief Closes the current SLIP frame and hands it to the DRE interrupt.
+ *  \param writer   Pointer to a xusart_slip_writer_t structure.
+ */
+void xusart_slip_end(xusart_slip_writer_t *writer);
+
+/*! \brief Initializes a SLIP frame reader.
+ *  \param reader   Pointer to a xusart_slip_reader_t structure.
+ *  \param buffer   Destination for decoded frames.
+ *  \param size     Size of buffer in bytes.
+ */
+void xusart_slip_reader_init(xusart_slip_reader_t *reader, uint8_t *buffer, uint8_t size);
+
+/*! \brief Non-blocking SLIP decode.  Consumes the RX ring up to the end of the next complete frame.
+ *
+ *  Empty frames (back to back ENDs) are skipped.  Bytes left in the ring after a completed frame are
+ *  picked up on the next call.
+ *
+ *  \param reader   Pointer to a xusart_slip_reader_t structure.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ *  \return         Length of the frame now in reader->buffer, 0 if no frame has completed yet.
+ */
+uint8_t xusart_slip_read(xusart_slip_reader_t *reader, xusart_buffered_t *buffered);
+
+/*! \brief RXC interrupt handler.  Call from ISR(USARTxn_RXC_vect).
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+void xusart_rxc_handler(xusart_buffered_t *buffered);
+
+/*! \brief DRE interrupt handler.  Call from ISR(USARTxn_DRE_vect).
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+void xusart_dre_handler(xusart_buffered_t *buffered);
+
+/*! \brief TXC interrupt handler.  Call from ISR(USARTxn_TXC_vect).  Only enabled in RS485 mode.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+void xusart_txc_handler(xusart_buffered_t *buffered);
+
+/*! \brief Returns true while an external TX block is outstanding.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+static inline bool xusart_block_busy(xusart_buffered_t *buffered) {
+    return buffered->block_pending;
+}
+
+/*! \brief Returns true while a RS485 mode USART is driving the bus.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+static inline bool xusart_tx_busy(xusart_buffered_t *buffered) {
+    return buffered->de_port && (buffered->de_port->OUT & buffered->de_pin_bm);
+}
+
+/*! \brief Returns the number of bytes waiting in the RX ring.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+static inline uint8_t xusart_rx_available(xusart_buffered_t *buffered) {
+    return (uint8_t)(buffered->rx_head - buffered->rx_tail);
+}
+
+/*! \brief Returns the number of free bytes in the TX ring.
+ *  \param buffered Pointer to a xusart_buffered_t structure.
+ */
+static inline uint8_t xusart_tx_free(xusart_buffered_t *buffered) {
+    return XUSART_TX_BUFFER_SIZE - (uint8_t)(buffered->tx_head - buffered->tx_tail);
+}
+
+/*! \brief Encodes one byte into the current SLIP frame.
+ *  \param writer   Pointer to a xusart_slip_writer_t structure.
+ *  \param data     Byte to encode.
+ */
+static inline void xusart_slip_put(xusart_slip_writer_t *writer, uint8_t data) {
+    uint8_t *ring = writer->buffered->tx_buffer;
+
+    if (data == XUSART_SLIP_END) {
+        ring[writer->head++ & XUSART_TX_MASK] = XUSART_SLIP_ESC;
+        data = XUSART_SLIP_ESC_END;
+    } else if (data == XUSART_SLIP_ESC) {
+        ring[writer->head++ & XUSART_TX_MASK] = XUSART_SLIP_ESC;
+        data = XUSART_SLIP_ESC_ESC;
+    }
+    ring[writer->head++ & XUSART_TX_MASK] = data;
+}
 
 /*! \brief Function that sets the USART frame format.
  *  \param usart        Pointer to the USART module.
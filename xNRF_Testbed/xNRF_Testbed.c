@@ -17,8 +17,6 @@
  *
  */ 
 
-//TODO:  Add circular buffers
-
 #ifndef F_CPU
 #   define F_CPU 32000000UL
 #endif
@@ -27,12 +25,23 @@
 #include <avr/interrupt.h>
 #include <util/delay.h>
 #include <stdbool.h>
+#include <util/crc16.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+#include <string.h>
 #include "XNRF24L01.h"
 #include "XSPI.h"
 #include "XUSART.h"
 
+#if XUSART_TX_BUFFER_SIZE < 128
+#   warning ** bridge frames with a full payload need XUSART_TX_BUFFER_SIZE=128, as set in xNRF_Testbed.cproj **
+#endif
+
 static xnrf_config_t xnrf_config = {
     .spi = &SPIC,
+    //.usart = &USARTD0,    /* with NRF_INTERFACE set to XNRF_IF_USART */
     .spi_port = &PORTC,
     .ss_port = &PORTC,
     .ss_pin = 4,
@@ -44,10 +53,90 @@ static xnrf_config_t xnrf_config = {
     .confbits = 0b00111100    //  RX interrupt enabled
     //.confbits = 0b01111100  //  All interrupts disabled
     //.confbits = 0b00001100  //  All interrupts enabled
-    //.confbits = ((1 << EN_CRC) | (1 << CRCO)) //TODO: move confbits elsewhere for runtime config changes
+    //.confbits = ((1 << EN_CRC) | (1 << CRCO))
 };
 
-uint8_t rxbuff[32];    /* global RX buffer */
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)   /* the bus arbiter needs per radio SS / CE pins */
+/* Second radio on SPIC for multi_rx_loop(), IRQ on PA6.  Its CSN needs a pull-up, main() talks to radio A before PA4 is driven */
+static xnrf_config_t xnrf_config_b = {
+    .spi = &SPIC,
+    .spi_port = &PORTC,
+    .ss_port = &PORTA,
+    .ss_pin = 4,
+    .ce_port = &PORTA,
+    .ce_pin  = 5,
+    .addr_width = 5,
+    .payload_width = 32,
+    .confbits = 0b00111100    //  RX interrupt enabled
+};
+
+static bool xnrf_bus_active;        /* routes the PORTC IRQ to the bus arbiter instead of rx_int_loop() */
+#endif
+
+static bool rx_pool_active;         /* routes the PORTC IRQ to xnrf_receive_pool() */
+
+static bool duty_active;            /* routes the PORTC IRQ to duty_rx_loop() */
+static volatile bool duty_irq;      /* IRQ seen, PC3 masked until duty_rx_loop() drains the radio */
+
+xnrf_packet_t rxbatch[XNRF_RX_FIFO_DEPTH];    /* global RX buffer, room for a full RX FIFO */
+
+#define BRIDGE_TXQ_DEPTH    4                               /* power of 2 */
+#define BRIDGE_FRAME_SIZE   (3 + XNRF_MAX_PAYLOAD + 2)      /* pipe, len, seq, payload, crc16 */
+
+/* Buffers only one loop uses.  main() picks a single loop and never leaves it, so they share RAM, which the 8E5's
+ * 1KB hasn't got much of.  Each loop sets up its own member before it touches it.
+ */
+static union {
+    struct {
+        uint8_t txq[BRIDGE_TXQ_DEPTH][BRIDGE_FRAME_SIZE];   /* host to nRF queue */
+        xusart_slip_reader_t reader;
+    } bridge;                                               /* bridge_duplex_loop() */
+    xnrf_pool_t pool;                                       /* pool_bridge_loop() packet buffers */
+    xnrf_hop_t hop;                                         /* hop_tx_loop() / hop_rx_loop() */
+    struct {
+        xnrf_dispatch_t dispatch;
+        xnrf_packet_t pipe1_queue[2];
+    } gateway;                                              /* gateway_loop() pipe routing */
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)
+    xnrf_bus_t bus;                                         /* multi_rx_loop(), SPIC shared by both radios */
+#endif
+} loop_ram;
+
+static xusart_buffered_t usartd0_buffered;      /* ring buffers for USARTD0 */
+XUSART_BUFFERED_ISRS(USARTD0, usartd0_buffered)
+
+/* Benchmark timebase - free running TC at 2us per tick */
+#define BENCH_TC            TCC5                    /* E5 */
+#define BENCH_TC_CLKSEL     TC45_CLKSEL_DIV64_gc    /* E5 */
+#define BENCH_TC_OVFIF      TC5_OVFIF_bm            /* E5 */
+//#define BENCH_TC            TCC1                  /* A4U */
+//#define BENCH_TC_CLKSEL     TC_CLKSEL_DIV64_gc    /* A4U */
+//#define BENCH_TC_OVFIF      TC1_OVFIF_bm          /* A4U */
+#define BENCH_US(us)        ((us) / 2UL)            /* microseconds to ticks */
+#define BENCH_TO_US(ticks)  ((ticks) * 2UL)         /* ticks to microseconds */
+
+#define BENCH_PHASE_TICKS   BENCH_US(10000000UL)    /* TX time spent at each data rate */
+#define BENCH_REPORT_TICKS  BENCH_US(1000000UL)     /* RX summary interval */
+#define BENCH_SILENCE_TICKS BENCH_US(500000UL)      /* RX moves to the next data rate after this long without packets */
+#define BENCH_PDV_BUCKETS   8                       /* delay variation buckets, <16us, <32us ... >=1024us */
+
+/* Benchmark payload, padded out to a full 32 byte payload */
+typedef struct {
+    uint32_t seq;       /* sequence number */
+    uint32_t stamp;     /* BENCH_TC time it was queued */
+    uint8_t rate;       /* xnrf_datarate_t it was sent at */
+    uint8_t pad[XNRF_MAX_PAYLOAD - 9];
+} bench_frame_t;
+
+/* Benchmark RX counters for one report interval */
+typedef struct {
+    uint32_t received;
+    uint32_t lost;
+    uint32_t reordered;
+    uint16_t pdv[BENCH_PDV_BUCKETS];
+} bench_stats_t;
+
+static uint16_t bench_ovf;  /* BENCH_TC overflows, extends the count to 32 bits */
 
 void init() {
     // Configure clock to 32MHz
@@ -63,6 +152,68 @@ void init() {
     PORTA.DIRSET = PIN0_bm; /* E5 LED */
 }
 
+/* Sets up USARTD0 on the nRFbridge for interrupt driven TX/RX at 115200 */
+void usartd0_init() {
+    PORTD.DIRSET = PIN3_bm;                         /* set PD3 (TX) as output */
+    xusart_set_format(&USARTD0, USART_CHSIZE_8BIT_gc,
+            USART_PMODE_DISABLED_gc, false);        /* 8N1 on USARTD0 */
+    xusart_set_baudrate(&USARTD0, 115200, F_CPU);   /* set baud rate */
+    xusart_enable_rx(&USARTD0);                     /* Enable module RX */
+    xusart_enable_tx(&USARTD0);                     /* Enable module TX */
+    xusart_buffered_init(&usartd0_buffered, &USARTD0);  /* Interrupt driven ring buffers */
+    xusart_set_rs485(&usartd0_buffered, &PORTD, PIN1_bm);   /* RS485 direction control on nRFbridge, DE follows TX */
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;                   /* Enable low interrupts */
+    sei();                                          /* Enable global interrupt flag */
+}
+
+/* Queues an unsigned decimal number on USARTD0 */
+void usartd0_print_dec(uint32_t val) {
+    uint8_t digits[10];
+    uint8_t i = sizeof(digits);
+
+    do {
+        digits[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val);
+    xusart_write(&usartd0_buffered, &digits[i], sizeof(digits) - i);
+}
+
+/* Queues a string on USARTD0 */
+void usartd0_print(const char *str) {
+    xusart_write(&usartd0_buffered, (const uint8_t *)str, strlen(str));
+}
+
+/* Queues a PSTR() string on USARTD0, copied out of flash a chunk at a time so literals don't take up RAM */
+void usartd0_print_P(const char *str) {
+    uint8_t chunk[16];
+    uint8_t len = strlen_P(str);
+
+    while (len) {
+        uint8_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+        memcpy_P(chunk, str, n);
+        xusart_write(&usartd0_buffered, chunk, n);
+        str += n;
+        len -= n;
+    }
+}
+
+#ifdef XSTATS_ENABLED
+/* Dumps the XSTATS table as "id calls bytes cycles" lines on USARTD0 */
+void xstats_dump() {
+    for (uint8_t id = 0; id < XSTATS_COUNT; id++) {
+        while (xusart_tx_free(&usartd0_buffered) < 40);    /* let the ring drain a row's worth */
+        usartd0_print_dec(id);
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(xstats_table[id].calls);
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(xstats_table[id].bytes);
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(xstats_table[id].cycles);
+        usartd0_print_P(PSTR("\r\n"));
+    }
+}
+#endif
+
 /* Loop for TX testing */
 void tx_loop() {
     uint8_t	testdata[32] = {0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
@@ -84,7 +235,7 @@ void tx_loop() {
         xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << TX_DS));
         xnrf_write_payload(&xnrf_config, testdata, 32);
 
-        //TODO: If we were in a faster loop, the 130us state transition would need to be considered as to not overflow the TX FIFOs.
+        // One shot per second.  See tx_stream_loop() for keeping the TX FIFO full.
         xnrf_enable(&xnrf_config); /* send it off */
         _delay_us(15);
         xnrf_disable(&xnrf_config);
@@ -94,6 +245,230 @@ void tx_loop() {
     }    
 }
 
+/* Loop for streaming TX testing.  Keeps the TX FIFO topped up with CE held high and
+ * reports packets and payload bytes per second over USARTD0 once a second.
+ */
+void tx_stream_loop() {
+    xnrf_stream_stats_t stats;
+    uint32_t last = 0;
+    uint8_t testdata[32] = {0};
+
+    usartd0_init();
+
+    // RTC ticking at 1.024kHz from the internal 32kHz oscillator, overflowing once a second
+    CLK.RTCCTRL = CLK_RTCSRC_RCOSC_gc | CLK_RTCEN_bm;
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.PER = 1023;
+    RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+
+    // power-up transmitter and give 5ms to stabilize
+    xnrf_powerup_tx(&xnrf_config);
+    _delay_ms(5);
+
+    xnrf_stream_start(&xnrf_config, &stats);
+    while (1) {
+        // stamp a running count into the payload so the receiver can spot losses
+        memcpy(testdata, &stats.packets, sizeof(stats.packets));
+        xnrf_stream_tx(&xnrf_config, &stats, testdata, xnrf_config.payload_width);
+
+        if (RTC.INTFLAGS & RTC_OVFIF_bm) {
+            RTC.INTFLAGS = RTC_OVFIF_bm;
+            uint32_t sent = stats.packets - last;
+            last = stats.packets;
+
+            usartd0_print_P(PSTR("pps "));
+            usartd0_print_dec(sent);
+            usartd0_print_P(PSTR(" Bps "));
+            usartd0_print_dec(sent * xnrf_config.payload_width);
+            usartd0_print_P(PSTR(" full "));
+            usartd0_print_dec(stats.full);
+            usartd0_print_P(PSTR(" retries "));
+            usartd0_print_dec(xnrf_config.link.retries);
+            usartd0_print_P(PSTR(" lost "));
+            usartd0_print_dec(xnrf_config.link.lost);
+            usartd0_print_P(PSTR("\r\n"));
+
+            // Toggle status LED
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        }
+    }
+}
+
+/* Starts the benchmark timebase */
+void bench_timer_init() {
+    BENCH_TC.CTRLA = BENCH_TC_CLKSEL;
+}
+
+/* Returns the benchmark time in ticks.  Must be called at least once per TC overflow (131ms) to stay accurate. */
+uint32_t bench_now() {
+    uint16_t cnt = BENCH_TC.CNT;
+
+    if (BENCH_TC.INTFLAGS & BENCH_TC_OVFIF) {
+        BENCH_TC.INTFLAGS = BENCH_TC_OVFIF;
+        bench_ovf++;
+        cnt = BENCH_TC.CNT;     /* re-read, the overflow may have happened after the first read */
+    }
+    return ((uint32_t)bench_ovf << 16) | cnt;
+}
+
+/* Queues the speed of a data rate in kbps on USARTD0 */
+void bench_print_rate(xnrf_datarate_t rate) {
+    static const uint16_t kbps[] = { 250, 1000, 2000 };
+    usartd0_print_dec(kbps[rate]);
+}
+
+/* Benchmark transmitter.  Streams sequence numbered and time stamped payloads, spending BENCH_PHASE_TICKS at
+ * each data rate in turn, and reports packets sent per phase over USARTD0.
+ */
+void bench_tx_loop() {
+    bench_frame_t frame = {0};
+    xnrf_stream_stats_t stats;
+    uint32_t seq = 0;
+
+    usartd0_init();
+    bench_timer_init();
+
+    // power-up transmitter and give 5ms to stabilize
+    xnrf_powerup_tx(&xnrf_config);
+    _delay_ms(5);
+
+    while (1) {
+        for (xnrf_datarate_t rate = XNRF_250KBPS; rate <= XNRF_2MBPS; rate = (xnrf_datarate_t)(rate + 1)) {
+            xnrf_set_datarate(&xnrf_config, rate);
+            xnrf_stream_start(&xnrf_config, &stats);
+
+            uint32_t start = bench_now();
+            uint32_t now;
+            while (((now = bench_now()) - start) < BENCH_PHASE_TICKS) {
+                frame.seq = seq;
+                frame.stamp = now;
+                frame.rate = rate;
+                if (xnrf_stream_tx(&xnrf_config, &stats, (uint8_t *)&frame, sizeof(frame)))
+                    seq++;
+            }
+            xnrf_stream_stop(&xnrf_config);
+
+            usartd0_print_P(PSTR("TX kbps "));
+            bench_print_rate(rate);
+            usartd0_print_P(PSTR(" pkts "));
+            usartd0_print_dec(stats.packets);
+            usartd0_print_P(PSTR("\r\n"));
+
+            // Toggle status LED
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        }
+    }
+}
+
+/* Emits a benchmark summary line over USARTD0 */
+void bench_report(bench_stats_t *stats, xnrf_datarate_t rate, uint32_t ticks) {
+    usartd0_print_P(PSTR("RX kbps "));
+    bench_print_rate(rate);
+    usartd0_print_P(PSTR(" pkts "));
+    usartd0_print_dec(stats->received);
+    usartd0_print_P(PSTR(" lost "));
+    usartd0_print_dec(stats->lost);
+    usartd0_print_P(PSTR(" reord "));
+    usartd0_print_dec(stats->reordered);
+    usartd0_print_P(PSTR(" Bps "));
+    // scaled before dividing and in 64 bits, ticks is only ever a little over a second and would truncate to 1
+    usartd0_print_dec((uint64_t)stats->received * sizeof(bench_frame_t) * BENCH_US(1000000UL) / ticks);
+    usartd0_print_P(PSTR(" pdv"));
+    for (uint8_t i = 0; i < BENCH_PDV_BUCKETS; i++) {
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(stats->pdv[i]);
+    }
+    usartd0_print_P(PSTR("\r\n"));
+}
+
+/* Benchmark receiver.  Tracks loss, reordering, goodput and a packet delay variation (PDV) histogram from the
+ * bench_tx_loop() payloads, emitting a summary every BENCH_REPORT_TICKS.  Follows the transmitter through the data
+ * rates by moving to the next one after BENCH_SILENCE_TICKS without a packet.
+ *
+ * The two boards don't share a clock, so this is not one way latency.  Each packet's delay is taken relative to the
+ * fastest packet of the previous interval, which cancels the clock offset and re-bases any drift once per interval.
+ * The stamp is taken when the payload is offered to the TX FIFO, so time spent queued behind earlier payloads
+ * counts as delay too.
+ */
+void bench_rx_loop() {
+    bench_stats_t stats = {0};
+    xnrf_datarate_t rate = XNRF_250KBPS;
+    uint32_t next_seq = 0;
+    uint32_t base = 0, best = 0;    /* clock offset baseline, and best offset this interval */
+    bool synced = false;
+
+    usartd0_init();
+    bench_timer_init();
+
+    xnrf_set_datarate(&xnrf_config, rate);
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+
+    // start listening
+    xnrf_enable(&xnrf_config);
+
+    uint32_t last_rx = bench_now();
+    uint32_t report = last_rx;
+    while (1) {
+        uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);
+        uint32_t now = bench_now();
+
+        for (uint8_t i = 0; i < count; i++) {
+            bench_frame_t frame;
+            memcpy(&frame, rxbatch[i].data, sizeof(frame));     /* no alignment or aliasing assumptions on the batch */
+            uint32_t offset = now - frame.stamp;
+
+            if (!synced) {
+                next_seq = frame.seq;
+                base = best = offset;
+                synced = true;
+            }
+
+            stats.received++;
+            if (frame.seq >= next_seq) {
+                stats.lost += frame.seq - next_seq;
+                next_seq = frame.seq + 1;
+            } else {
+                stats.reordered++;
+            }
+
+            // delay beyond the baseline, bucketed by powers of 2 starting at 16us
+            int32_t delta = (int32_t)(offset - base);
+            if ((int32_t)(offset - best) < 0)
+                best = offset;
+            uint16_t pdv = (delta > 0) ? (uint16_t)(delta < 0xFFFF ? delta : 0xFFFF) : 0;
+            uint8_t bucket = 0;
+            for (pdv >>= 3; pdv && bucket < (BENCH_PDV_BUCKETS - 1); pdv >>= 1)
+                bucket++;
+            stats.pdv[bucket]++;
+        }
+
+        if (count) {
+            last_rx = now;
+        } else if ((now - last_rx) > BENCH_SILENCE_TICKS) {
+            // lost the transmitter, try the next data rate
+            rate = (rate == XNRF_2MBPS) ? XNRF_250KBPS : (xnrf_datarate_t)(rate + 1);
+            xnrf_disable(&xnrf_config);
+            xnrf_set_datarate(&xnrf_config, rate);
+            xnrf_enable(&xnrf_config);
+            synced = false;
+            last_rx = now;
+        }
+
+        if ((now - report) >= BENCH_REPORT_TICKS) {
+            bench_report(&stats, rate, now - report);
+            stats = (bench_stats_t){0};
+            base = best;
+            report = now;
+
+            // Toggle status LED
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        }
+    }
+}
+
 /* Loop for interrupt driven RX testing */
 void rx_int_loop() {
     // power-up receiver and give 5ms to stabilize
@@ -116,11 +491,30 @@ void rx_int_loop() {
     }
 }
 
-/* Interrupt handler for rx_int_loop() */
+/* Interrupt handler for rx_int_loop(), and radio A in multi_rx_loop() */
 ISR(PORTC_INT_vect) {
-    xnrf_read_payload(&xnrf_config, rxbuff, xnrf_config.payload_width);     /* retrieve the payload */
-    xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << RX_DR));            /* reset the RX_DR status */
-    //TODO: Check FIFO status to keep reading payloads if needed
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)
+    if (xnrf_bus_active) {
+        xnrf_bus_irq(&loop_ram.bus, 0);
+        PORTC.INTFLAGS = PIN3_bm;
+        return;
+    }
+#endif
+    if (rx_pool_active) {
+        xnrf_receive_pool(&xnrf_config, &loop_ram.pool);
+        PORTC.INTFLAGS = PIN3_bm;
+        return;
+    }
+    if (duty_active) {
+        PORTC.INTMASK = 0;          /* level sensed, so it would fire again until the radio is drained */
+        PORTC.INTFLAGS = PIN3_bm;
+        duty_irq = true;
+        return;
+    }
+
+    // Drain the RX FIFO and reset RX_DR.  A full batch can leave behind a payload that landed mid drain, with RX_DR
+    // still set holding IRQ low, and no new falling edge would ever come.  So go round until a batch comes up short.
+    while (xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH) == XNRF_RX_FIFO_DEPTH);
 
     // Toggle status LED
     PORTA.OUTTGL = PIN0_bm; /* E5 LED */
@@ -140,11 +534,35 @@ void rx_poll_loop() {
     //_delay_ms(130); /* do we need to delay for state transition? status should return RX_DR empty util radio is ready i would assume */
     
     while (1) {
-        if(xnrf_get_status(&xnrf_config) & (1 << RX_DR)) {                          /* check the RX_DR status to see if we have a packet */
-            xnrf_read_payload(&xnrf_config, rxbuff, xnrf_config.payload_width);     /* retrieve the payload */
-            xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << RX_DR));            /* reset the RX_DR status */
-            //TODO: Check FIFO status to keep reading payloads if needed
+        if(xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH)) {  /* drain any payloads and reset RX_DR */
+            // Toggle status LED
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        }
+    }
+}
+
+/* Loop for polled RX testing with auto-ack and ACK payloads.
+ * Each received payload's first byte is echoed back on the ACK of the next packet for that pipe,
+ * so the transmitter gets a reply without either side switching roles.
+ */
+void rx_ack_payload_loop() {
+    xnrf_set_autoack(&xnrf_config, (1 << ENAA_P1) | (1 << ENAA_P0));
+    xnrf_set_dynamic_payloads(&xnrf_config, (1 << DPL_P1) | (1 << DPL_P0));
+    xnrf_set_ack_payloads(&xnrf_config, true);
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
 
+    // start listening
+    xnrf_enable(&xnrf_config);
+
+    while (1) {
+        uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);
+        for (uint8_t i = 0; i < count; i++) {
+            xnrf_write_ack_payload(&xnrf_config, rxbatch[i].pipe, rxbatch[i].data, 1);
+        }
+        if (count) {
             // Toggle status LED
             PORTA.OUTTGL = PIN0_bm; /* E5 LED */
         }
@@ -158,42 +576,185 @@ void usart_echo_poll_loop() {
      *  PD2 - RX
      *  PD3 - TX
      */
-    uint8_t data;
+    uint8_t data[XUSART_RX_BUFFER_SIZE];
     
-    PORTD.DIRSET = PIN1_bm | PIN3_bm;               /* set PD1 and PD3 as outputs */
-    xusart_set_format(&USARTD0, USART_CHSIZE_8BIT_gc,
-            USART_PMODE_DISABLED_gc, false);        /* 8N1 on USARTD0 */
-    xusart_set_baudrate(&USARTD0, 115200, F_CPU);   /* set baud rate */
-    xusart_enable_rx(&USARTD0);                     /* Enable module RX */
-    xusart_enable_tx(&USARTD0);                     /* Enable module TX */
-    PORTD.OUTCLR = PIN1_bm;                         /* Initialize in RX mode -- RS485 direction control on nRFbridge */
+    usartd0_init();                                 /* DE on PD1 is raised on write and dropped by the TXC interrupt */
     
     while (1) {
-        data = xusart_getchar(&USARTD0);            /* get a character */
-        PORTD.OUTSET = PIN1_bm;                     /* switch to TX mode */
-        //_delay_us(1);                             /* may need for state transition in some driver chips */   
-        xusart_putchar(&USARTD0, data);             /* echo our character */
-
-        while (!(USARTD0.STATUS & USART_TXCIF_bm)); /* wait until TX is complete */
-        _delay_us(86);                              /* Give the RS485 chip time do its thing before switching back to RX mode ((1/baudrate)*10) */
-        PORTD.OUTCLR = PIN1_bm;                     /* switch back to RX mode */
-        //_delay_us(1);                             /* may need for state transition in some driver chips */   
-        
-        // Toggle LED
-        PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        uint8_t len = xusart_read(&usartd0_buffered, data, sizeof(data));
+        if (len) {
+            xusart_write(&usartd0_buffered, data, len); /* echo whatever came in */
+
+            // Toggle LED
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        }
+    }
+}
+
+/* Queues one received packet on USARTD0 as a SLIP frame:
+ *
+ *   pipe | len | seq | payload[len] | crc16 (lsb first)
+ *
+ * The CRC is _crc_ccitt_update(), CCITT with the reflected poly 0x8408, init 0xFFFF, over pipe through payload.  seq increments for every packet, sent or not,
+ * so the host can tell frames dropped here from ones it lost to corruption.  Everything is escaped on the way into
+ * the TX ring, so there is no intermediate frame buffer.
+ */
+bool bridge_send_frame(xnrf_packet_t *packet, uint8_t seq) {
+    xusart_slip_writer_t writer;
+    uint8_t header[3] = {packet->pipe, packet->len, seq};
+    uint16_t crc = 0xFFFF;
+
+    if (!xusart_slip_begin(&writer, &usartd0_buffered, sizeof(header) + packet->len + 2))
+        return false;
+
+    for (uint8_t i = 0; i < sizeof(header); i++)
+        crc = _crc_ccitt_update(crc, header[i]);
+    for (uint8_t i = 0; i < packet->len; i++)
+        crc = _crc_ccitt_update(crc, packet->data[i]);
+
+    xusart_slip_write(&writer, header, sizeof(header));
+    xusart_slip_write(&writer, packet->data, packet->len);
+    xusart_slip_put(&writer, (uint8_t)crc);
+    xusart_slip_put(&writer, (uint8_t)(crc >> 8));
+    xusart_slip_end(&writer);
+    return true;
+}
+
+/* Radio settings shared by all the test loops.  Profiles live in EEPROM, program the .eep along with the flash.  They
+ * can be edited there and switched from the host without a reflash, see profile_command().  profile_default, kept in
+ * flash, covers a blank EEPROM.
+ */
+#define PROFILE_COUNT       4
+#define PROFILE_CRC16       ((1 << EN_CRC) | (1 << CRCO))
+#define PROFILE_0DBM        ((1 << RF_PWR_HIGH) | (1 << RF_PWR_LOW))
+#define PROFILE_ADDR_E1     { 0xE1, 0xF0, 0xF0, 0xF0, 0xF0 }
+#define PROFILE_ADDR_D2     { 0xD2, 0xF0, 0xF0, 0xF0, 0xF0 }
+#define PROFILE_RX_LSB      { 0xC3, 0xC4, 0xC5, 0xC6 }      /* datasheet defaults */
+
+/* channel 100, 250kbps at 0dBm, no auto ack, pipes 0 & 1 */
+#define PROFILE_BRIDGE { \
+    .name = "bridge", .crc = PROFILE_CRC16, .en_aa = 0, .en_rxaddr = (1 << ERX_P1) | (1 << ERX_P0), \
+    .setup_retr = 0x03, .rf_ch = 100, .rf_setup = (1 << RF_DR_LOW) | PROFILE_0DBM, .feature = 0, .dynpd = 0, \
+    .addr_width = 5, .payload_width = 32, \
+    .tx_addr = PROFILE_ADDR_E1, .rx0_addr = PROFILE_ADDR_E1, .rx1_addr = PROFILE_ADDR_D2, .rx_lsb = PROFILE_RX_LSB }
+
+static const xnrf_profile_t profile_default PROGMEM = PROFILE_BRIDGE;
+
+static xnrf_profile_t EEMEM ee_profiles[PROFILE_COUNT] = {
+    PROFILE_BRIDGE,
+    /* 2Mbps at 0dBm on channel 110, above the WiFi channels */
+    { .name = "fast", .crc = PROFILE_CRC16, .en_aa = 0, .en_rxaddr = (1 << ERX_P1) | (1 << ERX_P0),
+      .setup_retr = 0x03, .rf_ch = 110, .rf_setup = (1 << RF_DR_HIGH) | PROFILE_0DBM, .feature = 0, .dynpd = 0,
+      .addr_width = 5, .payload_width = 32,
+      .tx_addr = PROFILE_ADDR_E1, .rx0_addr = PROFILE_ADDR_E1, .rx1_addr = PROFILE_ADDR_D2, .rx_lsb = PROFILE_RX_LSB },
+    /* rx_ack_payload_loop() setup: 1Mbps, auto ack, dynamic payloads and ACK payloads on pipes 0 & 1 */
+    { .name = "ackpay", .crc = PROFILE_CRC16, .en_aa = (1 << ENAA_P1) | (1 << ENAA_P0),
+      .en_rxaddr = (1 << ERX_P1) | (1 << ERX_P0), .setup_retr = (1 << ARD) | (15 << ARC), .rf_ch = 100,
+      .rf_setup = PROFILE_0DBM, .feature = (1 << EN_DPL) | (1 << EN_ACK_PAY), .dynpd = (1 << DPL_P1) | (1 << DPL_P0),
+      .addr_width = 5, .payload_width = 32,
+      .tx_addr = PROFILE_ADDR_E1, .rx0_addr = PROFILE_ADDR_E1, .rx1_addr = PROFILE_ADDR_D2, .rx_lsb = PROFILE_RX_LSB },
+    /* bridge at -18dBm for bench work with the boards next to each other */
+    { .name = "bench", .crc = PROFILE_CRC16, .en_aa = 0, .en_rxaddr = (1 << ERX_P1) | (1 << ERX_P0),
+      .setup_retr = 0x03, .rf_ch = 100, .rf_setup = (1 << RF_DR_LOW), .feature = 0, .dynpd = 0,
+      .addr_width = 5, .payload_width = 32,
+      .tx_addr = PROFILE_ADDR_E1, .rx0_addr = PROFILE_ADDR_E1, .rx1_addr = PROFILE_ADDR_D2, .rx_lsb = PROFILE_RX_LSB }
+};
+
+static uint8_t EEMEM ee_profile_boot = 0;   /* profile radio_setup() applies */
+
+static uint8_t profile_active;              /* PROFILE_COUNT when running on profile_default */
+static uint32_t profile_ticks;              /* time the last profile upload took, EEPROM read included */
+static bool profile_pending;                /* 'P' seen, waiting for the digit */
+
+/* Applies profile n from EEPROM, or profile_default if that one's blank */
+void profile_load(uint8_t n) {
+    xnrf_profile_t profile;
+    uint32_t start = bench_now();
+
+    profile_active = PROFILE_COUNT;
+    if (n < PROFILE_COUNT) {
+        eeprom_read_block(&profile, &ee_profiles[n], sizeof(profile));
+        if (xnrf_apply_profile(&xnrf_config, &profile))
+            profile_active = n;
+    }
+    if (profile_active == PROFILE_COUNT) {
+        memcpy_P(&profile, &profile_default, sizeof(profile));
+        xnrf_apply_profile(&xnrf_config, &profile);
     }
+    profile_ticks = bench_now() - start;
+}
+
+/* Queues the name of the active profile on USARTD0 */
+void profile_print_name() {
+    char name[XNRF_PROFILE_NAME_SIZE + 1] = { 0 };
+
+    if (profile_active == PROFILE_COUNT)
+        memcpy_P(name, profile_default.name, XNRF_PROFILE_NAME_SIZE);
+    else
+        eeprom_read_block(name, ee_profiles[profile_active].name, XNRF_PROFILE_NAME_SIZE);
+    usartd0_print(name);
+}
+
+/* Lists the stored profiles as "n name" lines, the active one marked with a '*' */
+void profile_list() {
+    char name[XNRF_PROFILE_NAME_SIZE + 1] = { 0 };
+
+    for (uint8_t i = 0; i < PROFILE_COUNT; i++) {
+        while (xusart_tx_free(&usartd0_buffered) < XNRF_PROFILE_NAME_SIZE + 6);
+        eeprom_read_block(name, ee_profiles[i].name, XNRF_PROFILE_NAME_SIZE);
+        usartd0_print_dec(i);
+        usartd0_print_P(i == profile_active ? PSTR("*") : PSTR(" "));
+        if (name[0] == (char)0xFF)
+            usartd0_print_P(PSTR("(blank)"));
+        else
+            usartd0_print(name);
+        usartd0_print_P(PSTR("\r\n"));
+    }
+}
+
+/* Switches a listening radio to profile n and makes it the boot profile.  Reports "Pn name us" */
+void profile_switch(uint8_t n) {
+    xnrf_disable(&xnrf_config);
+    profile_load(n);
+    xnrf_flush_rx(&xnrf_config);        /* anything still in there came in under the old profile */
+    xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << RX_DR) | (1 << TX_DS) | (1 << MAX_RT));
+    xnrf_enable(&xnrf_config);
+
+    if (profile_active == n)
+        eeprom_update_byte(&ee_profile_boot, n);
+    usartd0_print_P(PSTR("P"));
+    usartd0_print_dec(profile_active);
+    usartd0_print_P(PSTR(" "));
+    profile_print_name();
+    usartd0_print_P(PSTR(" "));
+    usartd0_print_dec(BENCH_TO_US(profile_ticks));
+    usartd0_print_P(PSTR("us\r\n"));
+}
+
+/* Host commands: 'L' lists the profiles, 'P' followed by a digit switches to that profile */
+void profile_command(uint8_t cmd) {
+    if (profile_pending) {
+        profile_pending = false;
+        if (cmd >= '0' && cmd < '0' + PROFILE_COUNT)
+            profile_switch(cmd - '0');
+    } else if (cmd == 'P') {
+        profile_pending = true;
+    } else if (cmd == 'L') {
+        profile_list();
+    }
+}
+
+void radio_setup() {
+    profile_load(eeprom_read_byte(&ee_profile_boot));
 }
 
 /* This is setup for my nRFbridge board.
- * Just a simple polling test that echos nRF received data via USART.
+ * Just a simple polling test that forwards nRF received data via USART as SLIP frames (see bridge_send_frame).
  */
 void nrf_to_usart_loop() {
-    PORTD.DIRSET = PIN1_bm | PIN3_bm;               /* set PD1 and PD3 as outputs */
-    xusart_set_format(&USARTD0, USART_CHSIZE_8BIT_gc,
-            USART_PMODE_DISABLED_gc, false);        /* 8N1 on USARTD0 */
-    xusart_set_baudrate(&USARTD0, 115200, F_CPU);   /* set baud rate */
-    xusart_enable_tx(&USARTD0);                     /* Enable module TX */
-    PORTD.OUTSET = PIN1_bm;                         /* Initialize in TX mode -- RS485 direction control on nRFbridge */
+    uint8_t seq = 0;
+
+    usartd0_init();
 
     // power-up receiver and give 5ms to stabilize
     xnrf_powerup_rx(&xnrf_config);
@@ -202,60 +763,839 @@ void nrf_to_usart_loop() {
     // start listening
     xnrf_enable(&xnrf_config);
     //_delay_ms(130); /* do we need to delay for state transition? status should return RX_DR empty util radio is ready i would assume */
-    
+
+    // boot to RX is timed from main(), Tpor and the 5ms above dominate it
+    uint32_t boot_ticks = bench_now();
+    usartd0_print_P(PSTR("profile "));
+    profile_print_name();
+    usartd0_print_P(PSTR(", upload "));
+    usartd0_print_dec(BENCH_TO_US(profile_ticks));
+    usartd0_print_P(PSTR("us, boot to RX "));
+    usartd0_print_dec(BENCH_TO_US(boot_ticks));
+    usartd0_print_P(PSTR("us\r\n"));
+
     while (1) {
-        if(xnrf_get_status(&xnrf_config) & (1 << RX_DR)) {                          /* check the RX_DR status to see if we have a packet */
-            xnrf_read_payload(&xnrf_config, rxbuff, xnrf_config.payload_width);     /* retrieve the payload */
-            xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << RX_DR));            /* reset the RX_DR status */
-            //TODO: Check FIFO status to keep reading payloads if needed
-
-            //TODO: Proper implementation with a ring buffer
-            for(uint8_t i=0; i < xnrf_config.payload_width; i++) {
-                xusart_putchar(&USARTD0, rxbuff[i]);
-            }
-            xusart_putchar(&USARTD0, 0x0D);
-            xusart_putchar(&USARTD0, 0x0A);
+        uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);    /* drain any payloads and reset RX_DR */
+        if (count) {
+            // frame them into the TX ring and get back to the radio, the DRE interrupt drains it.
+            // frames that don't fit are dropped whole and show up as seq gaps at the host.
+            for (uint8_t i = 0; i < count; i++)
+                bridge_send_frame(&rxbatch[i], seq++);
 
             // Toggle status LED
             PORTA.OUTTGL = PIN0_bm; /* E5 LED */
         }
+
+        // profile commands from the host, and 'S' dumps the instrumentation table
+        uint8_t cmd;
+        if (xusart_read(&usartd0_buffered, &cmd, 1)) {
+#ifdef XSTATS_ENABLED
+            if (cmd == 'S')
+                xstats_dump();
+#endif
+            profile_command(cmd);
+        }
     }
 
     
 }
 
+/* Host to nRF queue for bridge_duplex_loop().  Frames are decoded straight into the slot at the head and only
+ * committed once the CRC checks out, so the payload is never copied between the USART and the radio.
+ */
+#define BRIDGE_TX_BATCH     3                               /* frames that fill the nRF TX FIFO, flip as soon as we have them */
+#define BRIDGE_TX_HOLDOFF   BENCH_US(2000)                  /* or flip once the oldest frame has waited this long */
+
+typedef struct {
+    uint32_t received;      /* frames accepted from the host */
+    uint16_t crc_errors;    /* frames with a bad CRC or length */
+    uint16_t flips;         /* RX -> TX -> RX turnarounds */
+} bridge_stats_t;
+
+static uint8_t bridge_txq_head;
+static uint8_t bridge_txq_tail;
+static uint32_t bridge_txq_since;   /* when the queue last went from empty to not empty */
+static bridge_stats_t bridge_stats;
+
+/* Pulls host frames out of the USART RX ring into the TX queue.  Stops when the queue is full and leaves the
+ * rest in the ring, anything that overflows the ring shows up as a CRC error.
+ */
+void bridge_poll_host() {
+    while ((uint8_t)(bridge_txq_head - bridge_txq_tail) < BRIDGE_TXQ_DEPTH) {
+        uint8_t *frame = loop_ram.bridge.txq[bridge_txq_head & (BRIDGE_TXQ_DEPTH - 1)];
+        loop_ram.bridge.reader.buffer = frame;
+
+        uint8_t len = xusart_slip_read(&loop_ram.bridge.reader, &usartd0_buffered);
+        if (!len)
+            return;
+
+        uint16_t crc = 0xFFFF;
+        for (uint8_t i = 0; i < len; i++)
+            crc = _crc_ccitt_update(crc, frame[i]);     /* running the CRC over itself leaves 0 */
+
+        if (crc || len < 5 || frame[1] > XNRF_MAX_PAYLOAD || frame[1] != len - 5) {
+            bridge_stats.crc_errors++;
+            continue;
+        }
+
+        if (bridge_txq_head == bridge_txq_tail)
+            bridge_txq_since = bench_now();
+        bridge_txq_head++;
+        bridge_stats.received++;
+    }
+}
+
+/* Drains the radio and forwards everything to the host */
+void bridge_forward_rx(uint8_t *seq) {
+    uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);
+
+    for (uint8_t i = 0; i < count; i++)
+        bridge_send_frame(&rxbatch[i], (*seq)++);
+    if (count)
+        PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+}
+
+/* Flips to PRIM_TX, streams the whole TX queue out and flips back to PRIM_RX.  The host keeps being
+ * polled while we're in TX so a steady stream goes out in one turnaround instead of one per frame.
+ */
+void bridge_transmit(uint8_t *seq) {
+    xnrf_stream_stats_t stats;
+
+    // anything that landed before CE dropped still goes to the host
+    xnrf_disable(&xnrf_config);
+    bridge_forward_rx(seq);
+
+    xnrf_powerup_tx(&xnrf_config);
+    xnrf_stream_start(&xnrf_config, &stats);
+
+    while (bridge_txq_head != bridge_txq_tail) {
+        uint8_t *frame = loop_ram.bridge.txq[bridge_txq_tail & (BRIDGE_TXQ_DEPTH - 1)];
+        uint8_t len = frame[1];
+
+        // static payloads need the full width on air, pad over the CRC which has already been checked
+        if (!(xnrf_config.shadow.dynpd & (1 << DPL_P0))) {
+            while (len < xnrf_config.payload_width)
+                frame[3 + len++] = 0;
+        }
+
+        if (xnrf_stream_tx(&xnrf_config, &stats, &frame[3], len))
+            bridge_txq_tail++;
+        bridge_poll_host();
+    }
+
+    xnrf_stream_stop(&xnrf_config);
+    xnrf_powerup_rx(&xnrf_config);
+    xnrf_enable(&xnrf_config);
+    bridge_stats.flips++;
+}
+
+/* This is setup for my nRFbridge board.
+ * Bidirectional bridge.  Radio to host is the same as nrf_to_usart_loop().  Host to radio takes frames of the same
+ * layout (pipe is ignored, everything goes to the TX address) and transmits them in batches to keep the number of
+ * PRIM_RX / PRIM_TX turnarounds down.
+ */
+void bridge_duplex_loop() {
+    uint8_t seq = 0;
+
+    usartd0_init();
+    bench_timer_init();
+    xusart_slip_reader_init(&loop_ram.bridge.reader, loop_ram.bridge.txq[0], BRIDGE_FRAME_SIZE);
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+    xnrf_enable(&xnrf_config);
+
+    while (1) {
+        bridge_forward_rx(&seq);
+        bridge_poll_host();
+
+        uint8_t queued = bridge_txq_head - bridge_txq_tail;
+        if (queued >= BRIDGE_TX_BATCH || (queued && bench_now() - bridge_txq_since >= BRIDGE_TX_HOLDOFF))
+            bridge_transmit(&seq);
+    }
+}
+
+#if !defined(XNRF_FIXED_SS_PORT) && !defined(XNRF_FIXED_CE_PORT)   /* the bus arbiter needs per radio SS / CE pins */
+/* Radio B IRQ in multi_rx_loop() */
+ISR(PORTA_INT_vect) {
+    xnrf_bus_irq(&loop_ram.bus, 1);
+    PORTA.INTFLAGS = PIN6_bm;
+}
+
+/* Two radios on SPIC listening on different channels, forwarded as SLIP frames like nrf_to_usart_loop() with the
+ * radio index in the high nibble of the pipe byte.  Radio A's IRQ is PC3, radio B's is PA6.
+ */
+void multi_rx_loop() {
+    uint8_t seq = 0;
+    uint64_t tx_addr = 0xF0F0F0F0E1LL;
+    uint64_t rx_addr1 = 0xF0F0F0F0D2LL;
+
+    usartd0_init();
+
+    // get both SS lines high before talking to either radio.  radio A is already up from main()
+    xnrf_bus_init(&loop_ram.bus);
+    xnrf_bus_add(&loop_ram.bus, &xnrf_config);
+    xnrf_bus_add(&loop_ram.bus, &xnrf_config_b);
+
+    xnrf_init(&xnrf_config_b);
+    xnrf_set_channel(&xnrf_config_b, 110);
+    xnrf_set_datarate(&xnrf_config_b, XNRF_250KBPS);
+    xnrf_set_autoack(&xnrf_config_b, 0);
+    xnrf_set_rx_pipes(&xnrf_config_b, 3);
+    xnrf_set_rx0_address(&xnrf_config_b, (uint8_t*)&tx_addr);
+    xnrf_set_rx1_address(&xnrf_config_b, (uint8_t*)&rx_addr1);
+
+    // power-up receivers and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    xnrf_powerup_rx(&xnrf_config_b);
+    _delay_ms(5);
+
+    // IRQs are falling edge, both at low level so the arbiter queue is only ever pushed from one level
+    xnrf_bus_active = true;
+    PORTC_PIN3CTRL = PORT_ISC_FALLING_gc;
+    PORTC.INTMASK = PIN3_bm;
+    PORTC.INTCTRL = PORT_INTLVL_LO_gc;
+    PORTA_PIN6CTRL = PORT_ISC_FALLING_gc;
+    PORTA.INTMASK = PIN6_bm;
+    PORTA.INTCTRL = PORT_INTLVL_LO_gc;
+
+    xnrf_enable(&xnrf_config);
+    xnrf_enable(&xnrf_config_b);
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (1) {
+        uint8_t radio;
+        uint8_t count = xnrf_bus_service(&loop_ram.bus, rxbatch, XNRF_RX_FIFO_DEPTH, &radio);
+
+        // nothing queued, idle until an IRQ queues a radio.  The instruction after sei() always runs, so an IRQ
+        // between the check and sleep_cpu() still wakes us.
+        if (radio == XNRF_BUS_IDLE) {
+            cli();
+            if (loop_ram.bus.head == loop_ram.bus.tail) {
+                sleep_enable();
+                sei();
+                sleep_cpu();
+                sleep_disable();
+            }
+            sei();
+            continue;
+        }
+
+        for (uint8_t i = 0; i < count; i++) {
+            rxbatch[i].pipe |= radio << 4;
+            bridge_send_frame(&rxbatch[i], seq++);
+        }
+        if (count)
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+    }
+}
+#endif
+
+/* Non-blocking version of nrf_to_usart_loop() on the xnrf_poll() state machine, which also sends a beacon once a
+ * second.  The radio is booted from scratch with no delays, so the USART keeps echoing through Tpor, Tpd2stby and
+ * every RX <-> TX turnaround.
+ */
+void sm_loop() {
+    xnrf_sm_t sm;
+    uint8_t seq = 0;
+    uint8_t beacon[32] = {'b'};
+    uint32_t last = 0;
+    bool beacon_due = false;
+
+    usartd0_init();
+    bench_timer_init();
+    xnrf_sm_init(&xnrf_config, &sm, BENCH_TO_US(bench_now()));
+
+    while (1) {
+        uint32_t now = bench_now();
+
+        switch (xnrf_poll(&xnrf_config, &sm, BENCH_TO_US(now))) {
+            case XNRF_EVENT_POWERDOWN:
+                if (sm.target == XNRF_STATE_POWERDOWN) {    /* only after reset, xnrf_configure() just ran */
+                    radio_setup();
+                    xnrf_request(&sm, XNRF_STATE_RX);
+                }
+                break;
+            case XNRF_EVENT_TX_ACTIVE:
+                xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+                xnrf_write_payload(&xnrf_config, beacon, xnrf_config.payload_width);
+                break;
+            default:
+                break;
+        }
+
+        if (sm.state == XNRF_STATE_RX) {
+            bridge_forward_rx(&seq);
+            if (beacon_due) {
+                beacon_due = false;
+                xnrf_request(&sm, XNRF_STATE_TX);
+            }
+        } else if (sm.state == XNRF_STATE_TX) {
+            // with auto-ack on a beacon nobody hears ends in MAX_RT, which leaves it stalled in the FIFO
+            uint8_t status = xnrf_get_status(&xnrf_config);
+            if (status & (1 << MAX_RT))
+                xnrf_flush_tx(&xnrf_config);
+            if (status & ((1 << TX_DS) | (1 << MAX_RT)))
+                xnrf_request(&sm, XNRF_STATE_RX);
+        }
+
+        if (now - last >= BENCH_REPORT_TICKS) {
+            last = now;
+            beacon_due = true;
+        }
+
+        // whatever the radio is doing, the host side keeps moving
+        uint8_t data;
+        if (xusart_read(&usartd0_buffered, &data, 1))
+            xusart_write(&usartd0_buffered, &data, 1);
+    }
+}
+
+#define SCAN_SAMPLES        60      /* RPD reads per channel, 5 + 170 + 60 * 4.5us = ~0.45ms dwell */
+
+/* Channel survey.  Sweeps every channel with xnrf_scan_channel() and streams one line per pass over USARTD0:
+ * a hex digit per channel (0 = never above -64dBm, F = every sample), then the measured and estimated pass time in us.
+ * Each digit is queued as soon as its channel is done, a channel takes longer than a character at 115200 so the
+ * ring never backs up.
+ */
+void scan_loop() {
+    usartd0_init();
+    bench_timer_init();
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+
+    while (1) {
+        uint32_t start = bench_now();
+
+        for (uint8_t channel = 0; channel < XNRF_CHANNELS; channel++) {
+            uint8_t hits = xnrf_scan_channel(&xnrf_config, channel, SCAN_SAMPLES);
+            uint8_t level = (hits * 15 + SCAN_SAMPLES - 1) / SCAN_SAMPLES;  /* round up so a single hit shows */
+            uint8_t digit = level < 10 ? '0' + level : 'A' - 10 + level;
+
+            xusart_write(&usartd0_buffered, &digit, 1);
+        }
+
+        uint32_t elapsed = BENCH_TO_US(bench_now() - start);
+        while (xusart_tx_free(&usartd0_buffered) < 32);
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(elapsed);
+        usartd0_print_P(PSTR(" "));
+        usartd0_print_dec(XNRF_SCAN_PASS_US(SCAN_SAMPLES));
+        usartd0_print_P(PSTR("\r\n"));
+
+        PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+    }
+}
+
+/* Hopping links for hop_tx_loop() / hop_rx_loop() */
+#define HOP_SEED        0x5A17
+#define HOP_SLOT_US     8000UL      /* long enough for a 32 byte payload at 250kbps plus a few retries */
+#define HOP_LOSS_PCT    25
+
+static const uint8_t hop_channels[] = {2, 10, 18, 26, 34, 42, 50, 58, 66, 74, 82, 90, 98, 106, 114, 122};
+
+/* Sends one auto-acked hop payload */
+void hop_send(uint8_t *payload) {
+    xnrf_flush_tx(&xnrf_config);
+    xnrf_write_register(&xnrf_config, NRF_STATUS, (1 << TX_DS) | (1 << MAX_RT));
+    xnrf_hop_header(&loop_ram.hop, payload);
+    xnrf_write_payload(&xnrf_config, payload, xnrf_config.payload_width);
+    xnrf_enable(&xnrf_config);
+    _delay_us(15);
+    xnrf_disable(&xnrf_config);
+}
+
+/* Frequency hopping transmitter.  One auto-acked packet at the start of each slot with the hop header in front,
+ * channels that lose more than HOP_LOSS_PCT of their packets get blacklisted.  Reports once a second.
+ */
+void hop_tx_loop() {
+    uint8_t payload[32] = {0};
+    uint32_t last = 0;
+    bool pending;
+
+    usartd0_init();
+    bench_timer_init();
+
+    xnrf_set_autoack(&xnrf_config, (1 << ENAA_P0));     /* loss detection needs ACKs */
+    xnrf_set_retries(&xnrf_config, 1, 3);               /* 500us, 3 retries fits inside a slot */
+    xnrf_powerup_tx(&xnrf_config);
+    _delay_ms(5);
+    xnrf_hop_init(&xnrf_config, &loop_ram.hop, hop_channels, sizeof(hop_channels), HOP_SEED,
+                  HOP_SLOT_US, HOP_LOSS_PCT, true, BENCH_TO_US(bench_now()));
+    hop_send(payload);
+    pending = true;
+
+    while (1) {
+        uint32_t now = bench_now();
+        uint32_t now_us = BENCH_TO_US(now);
+
+        if (pending) {
+            uint8_t status = xnrf_update_link_stats(&xnrf_config);
+            if (status & ((1 << TX_DS) | (1 << MAX_RT))) {
+                xnrf_hop_account(&loop_ram.hop, status);
+                pending = false;
+            } else if (now_us - loop_ram.hop.slot_start >= loop_ram.hop.slot_us) {
+                // unfinished at the end of its slot, hop_send() is about to flush it.  Counted against the channel it
+                // went out on, before xnrf_hop_poll() moves the slot on.
+                xnrf_hop_account(&loop_ram.hop, (1 << MAX_RT));
+                pending = false;
+            }
+        }
+
+        if (xnrf_hop_poll(&xnrf_config, &loop_ram.hop, now_us)) {
+            hop_send(payload);
+            pending = true;
+        }
+
+        if (now - last >= BENCH_REPORT_TICKS) {
+            last = now;
+            usartd0_print_P(PSTR("sent "));
+            usartd0_print_dec(xnrf_config.link.sent);
+            usartd0_print_P(PSTR(" lost "));
+            usartd0_print_dec(xnrf_config.link.lost);
+            usartd0_print_P(PSTR(" blacklist "));
+            usartd0_print_dec(loop_ram.hop.blacklist);
+            usartd0_print_P(PSTR("\r\n"));
+        }
+    }
+}
+
+/* Frequency hopping receiver for hop_tx_loop().  Parks until it hears the transmitter, then follows the hop
+ * sequence and forwards packets as SLIP frames like nrf_to_usart_loop().
+ */
+void hop_rx_loop() {
+    uint8_t seq = 0;
+
+    usartd0_init();
+    bench_timer_init();
+
+    xnrf_set_autoack(&xnrf_config, (1 << ENAA_P0));
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+    xnrf_hop_init(&xnrf_config, &loop_ram.hop, hop_channels, sizeof(hop_channels), HOP_SEED,
+                  HOP_SLOT_US, HOP_LOSS_PCT, false, BENCH_TO_US(bench_now()));
+    xnrf_enable(&xnrf_config);
+
+    while (1) {
+        uint32_t now = BENCH_TO_US(bench_now());
+        uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);
+
+        for (uint8_t i = 0; i < count; i++) {
+            if (xnrf_hop_sync(&xnrf_config, &loop_ram.hop, rxbatch[i].data, now))
+                bridge_send_frame(&rxbatch[i], seq++);
+        }
+        if (count)
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+
+        xnrf_hop_poll(&xnrf_config, &loop_ram.hop, now);
+    }
+}
+
+/* Pipe routing for gateway_loop() */
+static uint8_t gateway_seq;
+
+/* Pipe 0 handler, forwards right away from inside xnrf_dispatch() */
+void gateway_pipe0(xnrf_packet_t *packet) {
+    bridge_send_frame(packet, gateway_seq++);
+}
+
+/* Gateway serving several classes of sensor by pipe.  Pipe 0 goes through a handler, pipe 1 into a 2 deep queue the
+ * main loop works through at its own pace.  Anything on another pipe is counted as dropped.
+ * Per pipe counts are in loop_ram.gateway.dispatch.pipes[].received / dropped.
+ */
+void gateway_loop() {
+    usartd0_init();
+
+    xnrf_dispatch_init(&loop_ram.gateway.dispatch);
+    xnrf_dispatch_handler(&loop_ram.gateway.dispatch, 0, gateway_pipe0);
+    xnrf_dispatch_queue(&loop_ram.gateway.dispatch, 1, loop_ram.gateway.pipe1_queue, 2);
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+    xnrf_enable(&xnrf_config);
+
+    while (1) {
+        if (xnrf_dispatch(&xnrf_config, &loop_ram.gateway.dispatch))
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+
+        // pipe 1 stays queued until the USART has room for it, a backed up queue shows up in its dropped count
+        xnrf_packet_t *packet = xnrf_pipe_peek(&loop_ram.gateway.dispatch, 1);
+        if (packet && bridge_send_frame(packet, gateway_seq)) {
+            gateway_seq++;
+            xnrf_pipe_pop(&loop_ram.gateway.dispatch, 1);
+        }
+    }
+}
+
+/* USART completion for pool_bridge_loop(), runs in the DRE interrupt */
+void pool_release(void *ctx) {
+    xnrf_pool_free(&loop_ram.pool, (xnrf_packet_t *)ctx);
+}
+
+/* Same frame as bridge_send_frame(), but the payload goes out of the pool buffer in place and the buffer is freed
+ * by the DRE interrupt once it's sent.  Only one payload can be in flight, so this fails while one still is.
+ */
+bool pool_send_frame(xnrf_packet_t *packet, uint8_t seq) {
+    xusart_slip_writer_t writer;
+    uint8_t header[3] = {packet->pipe, packet->len, seq};
+    uint16_t crc = 0xFFFF;
+
+    if (xusart_block_busy(&usartd0_buffered) ||
+            !xusart_slip_begin(&writer, &usartd0_buffered, sizeof(header) + 2))
+        return false;
+
+    for (uint8_t i = 0; i < sizeof(header); i++)
+        crc = _crc_ccitt_update(crc, header[i]);
+    for (uint8_t i = 0; i < packet->len; i++)
+        crc = _crc_ccitt_update(crc, packet->data[i]);
+
+    xusart_slip_write(&writer, header, sizeof(header));
+    xusart_slip_block(&writer, packet->data, packet->len, pool_release, packet);
+    xusart_slip_put(&writer, (uint8_t)crc);
+    xusart_slip_put(&writer, (uint8_t)(crc >> 8));
+    xusart_slip_end(&writer);
+    return true;
+}
+
+/* Interrupt driven version of nrf_to_usart_loop() with no payload copies.  The PC3 IRQ reads payloads straight into
+ * pool buffers, the main loop frames them and the USART sends them from the same buffer.  Payloads that find the pool
+ * empty are counted in loop_ram.pool.drops.
+ */
+void pool_bridge_loop() {
+    uint8_t seq = 0;
+
+    usartd0_init();
+    xnrf_pool_init(&loop_ram.pool);
+    rx_pool_active = true;
+
+    // power-up receiver and give 5ms to stabilize
+    xnrf_powerup_rx(&xnrf_config);
+    _delay_ms(5);
+
+    // setup interrupt listener, same as rx_int_loop()
+    PORTC_PIN3CTRL = PORT_ISC_FALLING_gc;
+    PORTC.INTMASK = PIN3_bm;
+    PORTC.INTCTRL = PORT_INTLVL_LO_gc;
+    xnrf_enable(&xnrf_config);
+
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (1) {
+        xnrf_packet_t *packet = xnrf_pool_peek(&loop_ram.pool);
+
+        if (packet && pool_send_frame(packet, seq)) {
+            xnrf_pool_pop(&loop_ram.pool);
+            seq++;
+            PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+            continue;
+        }
+
+        // nothing to frame, or the USART is still busy with the last one.  Idle until the IRQ or DRE interrupt
+        // changes that, same as multi_rx_loop()
+        cli();
+        if (!xnrf_pool_peek(&loop_ram.pool) || xusart_block_busy(&usartd0_buffered) ||
+                xusart_tx_free(&usartd0_buffered) < XUSART_TX_BUFFER_SIZE) {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+    }
+}
+
+/* Duty cycled listening for battery nodes.  The nRF is powered down between short RX windows and the MCU sleeps in
+ * power-save on the RTC, woken by RTC compare or the nRF IRQ.  Senders repeat each message for DUTY_PERIOD_US plus
+ * DUTY_LISTEN_US so it overlaps a window.  The DUTY_I_* figures are typical datasheet / assumed currents for the
+ * modeled average current in duty_report().
+ */
+#define DUTY_PERIOD_US      100000UL    /* wake to wake */
+#define DUTY_LISTEN_US      3500UL      /* two packet spacings of a 250kbps stream, so one lands whole */
+#define DUTY_HOLD_US        3500UL      /* stay up this long after each packet in case more follow */
+#define DUTY_TX_INTERVAL_MS 1000        /* duty_tx_loop() message interval */
+#define DUTY_REPORT_WAKES   64          /* duty_rx_loop() reports every this many wakes */
+
+#define DUTY_I_RX_UA        12600UL     /* nRF RX at 250kbps */
+#define DUTY_I_STARTUP_UA   400UL       /* nRF average during Tpd2stby */
+#define DUTY_I_PD_UA        1UL         /* nRF power down, 900nA */
+#define DUTY_I_MCU_UA       9000UL      /* E5 active at 32MHz, assumed */
+#define DUTY_I_SLEEP_UA     1UL         /* E5 power-save with RTC, assumed */
+#define DUTY_MCU_US         500UL       /* MCU awake time per wake, assumed */
+
+/* RTC at 32.768kHz from the internal RC, kept running in power-save.  512 ticks are exactly 15625us. */
+static volatile uint16_t rtc_ovf;   /* RTC overflows, extends the count to 32 bits */
+static uint32_t rtc_us_ticks;       /* RTC ticks at the last rtc_us() */
+static uint32_t rtc_us_total;       /* microseconds, wraps mod 2^32 like any other us clock */
+static uint32_t rtc_us_frac;        /* leftover, in 1/512ths of a microsecond */
+
+ISR(RTC_OVF_vect) {
+    rtc_ovf++;
+}
+
+ISR(RTC_COMP_vect) {
+    /* nothing to do, it's only here to wake duty_sleep() */
+}
+
+/* Starts the RTC timebase for the duty cycle loops */
+void rtc_init() {
+    CLK.RTCCTRL = CLK_RTCSRC_RCOSC32_gc | CLK_RTCEN_bm;
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.PER = 0xFFFF;
+    RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc;
+    PMIC.CTRL |= PMIC_LOLVLEN_bm;
+    sei();
+}
+
+/* Returns RTC ticks since rtc_init() */
+uint32_t rtc_now() {
+    uint16_t ovf, cnt;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ovf = rtc_ovf;
+        cnt = RTC.CNT;
+        if ((RTC.INTFLAGS & RTC_OVFIF_bm) && cnt < 0x8000)  /* overflowed, ISR hasn't run yet */
+            ovf++;
+    }
+    return ((uint32_t)ovf << 16) | cnt;
+}
+
+/* Returns microseconds on the RTC.  Converting the tick count as a whole would jump when the ticks wrap, 2^32 ticks
+ * isn't a whole number of 2^32us, so each call adds the ticks since the last one instead.  Call it at least every
+ * 36 hours.
+ */
+uint32_t rtc_us() {
+    uint32_t now = rtc_now();
+    uint32_t delta = now - rtc_us_ticks;
+
+    rtc_us_ticks = now;
+    rtc_us_total += (delta >> 9) * 15625UL;
+    rtc_us_frac += (delta & 511) * 15625UL;
+    rtc_us_total += rtc_us_frac >> 9;
+    rtc_us_frac &= 511;
+    return rtc_us_total;
+}
+
+/* Sleeps for up to us or until an interrupt.  Power-save, or idle while the USART still has something to send. */
+void duty_sleep(uint32_t us) {
+    if (us > 1000000UL)
+        us = 1000000UL;
+
+    uint16_t ticks = (us << 9) / 15625UL;   /* rounded down, never sleep past a deadline */
+    if (ticks < 2)
+        return;                             /* too close, COMP could be behind CNT by the time it's set */
+
+    while (RTC.STATUS & RTC_SYNCBUSY_bm);
+    RTC.COMP = RTC.CNT + ticks;
+    RTC.INTFLAGS = RTC_COMPIF_bm;
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc | RTC_COMPINTLVL_LO_gc;
+
+    set_sleep_mode(xusart_tx_busy(&usartd0_buffered) ? SLEEP_MODE_IDLE : SLEEP_MODE_PWR_SAVE);
+    cli();
+    if (!duty_irq) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+    RTC.INTCTRL = RTC_OVFINTLVL_LO_gc;
+}
+
+/* Queues "wakes hits missed rx_us uA" on USARTD0: the average RX time per wake and the modeled average current */
+void duty_report(xnrf_duty_t *duty, uint32_t rx_us) {
+    uint32_t per_wake = rx_us / DUTY_REPORT_WAKES;
+    uint32_t charge = DUTY_I_RX_UA * (per_wake + XNRF_TSTBY2A_US)          /* uA * us per period */
+                    + DUTY_I_STARTUP_UA * XNRF_TPD2STBY_US
+                    + DUTY_I_MCU_UA * DUTY_MCU_US
+                    + (DUTY_I_PD_UA + DUTY_I_SLEEP_UA) * DUTY_PERIOD_US;
+
+    usartd0_print_P(PSTR("wakes "));
+    usartd0_print_dec(duty->wakes);
+    usartd0_print_P(PSTR(" hits "));
+    usartd0_print_dec(duty->hits);
+    usartd0_print_P(PSTR(" missed "));
+    usartd0_print_dec(duty->missed);
+    usartd0_print_P(PSTR(" rx_us "));
+    usartd0_print_dec(per_wake);
+    usartd0_print_P(PSTR(" uA "));
+    usartd0_print_dec(charge / DUTY_PERIOD_US);
+    usartd0_print_P(PSTR("\r\n"));
+}
+
+/* Duty cycled receiver, forwards messages as SLIP frames like nrf_to_usart_loop().  Byte 0 of the payload is the
+ * sender's message id, repeats of one already forwarded are dropped.  Boots the radio through the state machine.
+ */
+void duty_rx_loop() {
+    xnrf_sm_t sm;
+    xnrf_duty_t duty = { 0 };
+    bool configured = false;
+    uint8_t seq = 0;
+    uint8_t last_id = 0;
+    uint32_t rx_since = 0;
+    uint32_t rx_us = 0;
+    uint16_t reported = 0;
+
+    usartd0_init();
+    rtc_init();
+
+    // nRF IRQ on PC3, level sensed so it can wake the MCU from power-save
+    duty_active = true;
+    PORTC_PIN3CTRL = PORT_ISC_LEVEL_gc;
+    PORTC.INTMASK = PIN3_bm;
+    PORTC.INTCTRL = PORT_INTLVL_LO_gc;
+
+    xnrf_sm_init(&xnrf_config, &sm, rtc_us());
+
+    while (1) {
+        uint32_t now = rtc_us();
+
+        switch (xnrf_poll(&xnrf_config, &sm, now)) {
+            case XNRF_EVENT_POWERDOWN:
+                if (!configured) {      /* only after reset, xnrf_configure() just ran.  First wake is now */
+                    radio_setup();
+                    xnrf_duty_init(&duty, DUTY_PERIOD_US, DUTY_LISTEN_US, DUTY_HOLD_US, now);
+                    configured = true;
+                }
+                break;
+            case XNRF_EVENT_RX_ACTIVE:
+                rx_since = now;
+                break;
+            case XNRF_EVENT_STANDBY:
+                if (sm.target == XNRF_STATE_POWERDOWN)
+                    rx_us += now - rx_since;
+                break;
+            default:
+                break;
+        }
+
+        if (duty_irq) {
+            uint8_t count = xnrf_receive_all(&xnrf_config, rxbatch, XNRF_RX_FIFO_DEPTH);
+            for (uint8_t i = 0; i < count; i++) {
+                if (rxbatch[i].data[0] != last_id) {
+                    last_id = rxbatch[i].data[0];
+                    bridge_send_frame(&rxbatch[i], seq++);
+                    PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+                }
+            }
+            if (count)
+                xnrf_duty_heard(&duty, now);
+            duty_irq = false;
+            PORTC.INTMASK = PIN3_bm;
+        }
+
+        xnrf_request(&sm, configured ? xnrf_duty_schedule(&duty, &sm, now) : XNRF_STATE_POWERDOWN);
+
+        if ((uint16_t)(duty.wakes - reported) >= DUTY_REPORT_WAKES && !duty.listening) {
+            duty_report(&duty, rx_us);
+            reported = duty.wakes;
+            rx_us = 0;
+        }
+
+        duty_sleep(xnrf_duty_sleep_us(&duty, &sm, now));
+    }
+}
+
+/* Sender for duty_rx_loop().  Repeats each message back to back for long enough to cover one receiver period and
+ * window, then powers down until the next one.
+ */
+void duty_tx_loop() {
+    xnrf_stream_stats_t stats;
+    xnrf_duty_t rx = { .period_us = DUTY_PERIOD_US, .listen_us = DUTY_LISTEN_US };
+    uint32_t repeat = BENCH_US(xnrf_duty_repeat_us(&rx));
+    uint8_t message[32] = {0};
+
+    bench_timer_init();
+
+    while (1) {
+        message[0]++;                   /* message id, 0 never goes out so the receiver's first message isn't a repeat */
+        if (!message[0])
+            message[0]++;
+
+        xnrf_powerup_tx(&xnrf_config);
+        _delay_ms(2);                   /* Tpd2stby */
+
+        xnrf_stream_start(&xnrf_config, &stats);
+        uint32_t start = bench_now();
+        while (bench_now() - start < repeat)
+            xnrf_stream_tx(&xnrf_config, &stats, message, xnrf_config.payload_width);
+        xnrf_stream_stop(&xnrf_config);
+        xnrf_powerdown(&xnrf_config);
+
+        // Toggle status LED
+        PORTA.OUTTGL = PIN0_bm; /* E5 LED */
+        _delay_ms(DUTY_TX_INTERVAL_MS);
+    }
+}
+
 int main(void) {
     init();
+    bench_timer_init();     /* boot timing for nrf_to_usart_loop() */
+
+#ifdef XSTATS_ENABLED
+    xstats_init();
+#endif
+
+    // These two boot the radio themselves on the xnrf_poll() state machine, so they go before the blocking
+    // xnrf_init() below, which would sit out Tpor first
+
+    // Non-blocking state machine
+    //sm_loop();
+
+    // Duty cycled low power listening, the battery node end.  Run duty_tx_loop() below on the other board
+    //duty_rx_loop();
 
     // Initialize XNRF driver
 	xnrf_init(&xnrf_config);
-	
-    // configure the radio
-    xnrf_set_channel(&xnrf_config, 100);                /* set our channel */
-    xnrf_set_datarate(&xnrf_config, XNRF_250KBPS);      /* set our data rate */
-    xnrf_write_register(&xnrf_config, EN_AA, 0);        /* disable auto ack's */
-    xnrf_write_register(&xnrf_config, EN_RXADDR, 3);    /* listen on pipes 0 & 1 */
-    
-    uint64_t tx_addr = 0xF0F0F0F0E1LL;
-    uint64_t rx_addr1 = 0xF0F0F0F0D2LL;
-    
-    // set addresses
-    xnrf_set_tx_address(&xnrf_config, (uint8_t*)&tx_addr);
-    xnrf_set_rx0_address(&xnrf_config, (uint8_t*)&tx_addr);
-    xnrf_set_rx1_address(&xnrf_config, (uint8_t*)&rx_addr1);
+    radio_setup();
 
     // TX test loop
     //tx_loop();
+
+    // TX test loop - streaming
+    //tx_stream_loop();
     
     // RX text loop - interrupt driven
     //rx_int_loop();
     
     // RX test loop - polled
     //rx_poll_loop();
+
+    // RX test loop - polled with auto-ack and ACK payloads
+    //rx_ack_payload_loop();
+
+    // Throughput and delay variation benchmark - run bench_tx_loop() on one board and bench_rx_loop() on the other
+    //bench_tx_loop();
+    //bench_rx_loop();
     
     // USART echo testing loop - polled
     //usart_echo_poll_loop();
     
     // Dump nRF data to serial
     nrf_to_usart_loop();
+
+    // Bidirectional nRF <-> serial bridge
+    //bridge_duplex_loop();
+
+    // Two radios on one SPI bus
+    //multi_rx_loop();
+
+    // 2.4GHz channel survey using RPD
+    //scan_loop();
+
+    // Per pipe routing
+    //gateway_loop();
+
+    // Interrupt driven bridge, payloads go radio -> pool buffer -> USART with no copies
+    //pool_bridge_loop();
+
+    // Frequency hopping link - run hop_tx_loop() on one board and hop_rx_loop() on the other
+    //hop_tx_loop();
+    //hop_rx_loop();
+
+    // Duty cycled low power listening - run duty_tx_loop() on one board and duty_rx_loop() (above) on the battery node
+    //duty_tx_loop();
 }
\ No newline at end of file